@@ -0,0 +1,137 @@
+#include <freertos/FreeRTOS.h>
+#include <driver/i2s.h>
+#include <esp_timer.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdio.h>
+
+#include "rg_host.h"
+
+// The i2s driver: writes take as long as the DMA would to play the samples, which is what
+// paces rg_audio's task. The samples can be saved to a 16bit stereo WAV file.
+
+static FILE *wavFile;
+static uint32_t wavBytes;
+static i2s_config_t i2sConfig;
+static bool i2sInstalled;
+static int64_t deadline;
+
+
+static void wav_write_header(FILE *fp, int sampleRate, uint32_t dataSize)
+{
+    uint32_t header[11] = {
+        0x46464952, 36 + dataSize, 0x45564157,    // "RIFF" size "WAVE"
+        0x20746d66, 16, 0x00020001, sampleRate,   // "fmt " 16 PCM/stereo rate
+        sampleRate * 4, 0x00100004,               // byte rate, align 4 / 16 bits
+        0x61746164, dataSize,                     // "data" size
+    };
+    fseek(fp, 0, SEEK_SET);
+    fwrite(header, sizeof(header), 1, fp);
+    fseek(fp, 0, SEEK_END);
+}
+
+bool rg_host_audio_open(const char *filename)
+{
+    rg_host_audio_close();
+
+    if (!filename)
+        return true;
+
+    if (!(wavFile = fopen(filename, "wb")))
+        return false;
+
+    wavBytes = 0;
+    wav_write_header(wavFile, i2sInstalled ? i2sConfig.sample_rate : 0, 0);
+    return true;
+}
+
+void rg_host_audio_close(void)
+{
+    if (!wavFile)
+        return;
+
+    wav_write_header(wavFile, i2sConfig.sample_rate, wavBytes);
+    fclose(wavFile);
+    wavFile = NULL;
+}
+
+static void wav_append(const short *samples, size_t count)
+{
+    short buffer[256];
+
+    // The built-in DAC gets the speaker's differential 8bit pair (see convert_speaker in
+    // rg_audio.c), turn it back into the mono signal it plays
+    if (i2sConfig.mode & I2S_MODE_DAC_BUILT_IN)
+    {
+        while (count > 0)
+        {
+            size_t chunk = RG_MIN(count, sizeof(buffer) / 2);
+            for (size_t i = 0; i < chunk; i += 2)
+            {
+                int dac1 = 0x80 - ((uint16_t)samples[i] >> 8);
+                int dac0 = ((uint16_t)samples[i + 1] >> 8) - 0x80;
+                buffer[i] = buffer[i + 1] = RG_MAX(RG_MIN((dac0 + dac1) * 128, 32767), -32768);
+            }
+            wavBytes += fwrite(buffer, 2, chunk, wavFile) * 2;
+            samples += chunk;
+            count -= chunk;
+        }
+    }
+    else
+    {
+        wavBytes += fwrite(samples, 2, count, wavFile) * 2;
+    }
+}
+
+esp_err_t i2s_driver_install(i2s_port_t port, const i2s_config_t *config, int queue_size, void *queue)
+{
+    i2sConfig = *config;
+    i2sInstalled = true;
+    deadline = 0;
+
+    if (wavFile && wavBytes == 0)
+        wav_write_header(wavFile, i2sConfig.sample_rate, 0);
+
+    return ESP_OK;
+}
+
+esp_err_t i2s_driver_uninstall(i2s_port_t port)
+{
+    i2sInstalled = false;
+    return ESP_OK;
+}
+
+esp_err_t i2s_set_pin(i2s_port_t port, const i2s_pin_config_t *pins)
+{
+    return ESP_OK;
+}
+
+esp_err_t i2s_zero_dma_buffer(i2s_port_t port)
+{
+    return ESP_OK;
+}
+
+esp_err_t i2s_write(i2s_port_t port, const void *src, size_t size, size_t *written, TickType_t ticks)
+{
+    if (!i2sInstalled || i2sConfig.sample_rate <= 0)
+        return ESP_ERR_INVALID_STATE;
+
+    if (wavFile)
+        wav_append(src, size / 2);
+
+    // Like a DMA with a few buffers in flight: block only once we're ahead of the playback
+    int64_t now = esp_timer_get_time();
+    int64_t duration = (int64_t)size / 4 * 1000000 / i2sConfig.sample_rate;
+    int64_t buffered = (int64_t)i2sConfig.dma_buf_count * i2sConfig.dma_buf_len * 1000000 / i2sConfig.sample_rate;
+
+    if (deadline < now)
+        deadline = now; // Underrun, the DMA has been playing silence
+    deadline += duration;
+
+    // Even unthrottled, a spinning audio task would only take CPU time from the emulator
+    if (deadline - now > buffered)
+        usleep(deadline - now - buffered);
+
+    *written = size;
+    return ESP_OK;
+}
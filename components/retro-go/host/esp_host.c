@@ -0,0 +1,538 @@
+#include <esp_heap_caps.h>
+#include <esp_partition.h>
+#include <esp_ota_ops.h>
+#include <esp_system.h>
+#include <esp_sleep.h>
+#include <esp_timer.h>
+#include <esp_vfs_fat.h>
+#include <esp_adc_cal.h>
+#include <driver/gpio.h>
+#include <driver/ledc.h>
+#include <driver/dac.h>
+#include <driver/adc.h>
+#include <driver/i2c.h>
+#include <driver/timer.h>
+#include <soc/timer_group_struct.h>
+#include <xtensa/hal.h>
+#include <esp32/clk.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+
+#include "rg_host.h"
+
+#ifndef RG_HOST_APP_VERSION
+#define RG_HOST_APP_VERSION "host"
+#endif
+
+// What the ODROID-GO reports, the host's heap is only limited by the machine
+#define HOST_INTERNAL_HEAP (160 * 1024)
+#define HOST_SPIRAM_HEAP (4 * 1024 * 1024)
+
+// Like CONFIG_SPIRAM_MALLOC_ALWAYSINTERNAL, larger blocks without placement caps go to PSRAM
+#define HOST_ALWAYS_INTERNAL (16 * 1024)
+#define HOST_SPIRAM_BLOCKS (256)
+
+// Pretend the cycle counter runs at the ESP32's clock
+#define HOST_CPU_FREQ (240 * 1000 * 1000)
+
+volatile timg_dev_t TIMERG0;
+volatile timg_dev_t TIMERG1;
+
+static int gpioLevels[GPIO_NUM_MAX];
+static int adcValues[ADC1_CHANNEL_MAX];
+static int64_t startTime;
+
+// Blocks that would be in PSRAM on the device, the DMA can't read them
+static struct { uintptr_t start, end; } spiramBlocks[HOST_SPIRAM_BLOCKS];
+static pthread_mutex_t spiramLock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/* esp_timer, esp_system, esp_sleep */
+
+int64_t esp_timer_get_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000 - startTime;
+}
+
+uint32_t xthal_get_ccount(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * HOST_CPU_FREQ + (uint64_t)ts.tv_nsec * (HOST_CPU_FREQ / 1000000) / 1000;
+}
+
+int esp_clk_cpu_freq(void)
+{
+    return HOST_CPU_FREQ;
+}
+
+uint32_t esp_random(void)
+{
+    return ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+}
+
+esp_reset_reason_t esp_reset_reason(void)
+{
+    return ESP_RST_POWERON;
+}
+
+void esp_restart(void)
+{
+    // The device would boot the next app, we have nothing else to run
+    fprintf(stderr, "[host] restart requested, exiting.\n");
+    exit(2);
+}
+
+void esp_deep_sleep_start(void)
+{
+    fprintf(stderr, "[host] deep sleep requested, exiting.\n");
+    exit(2);
+}
+
+int settimeofday(const struct timeval *tv, const struct timezone *tz)
+{
+    // Takes precedence over libc's: rg_system_time_init and the clock menu must not set the
+    // workstation's clock (which succeeds when running as root)
+    return 0;
+}
+
+const char *esp_get_idf_version(void)
+{
+    return "host";
+}
+
+const char *esp_err_to_name(esp_err_t code)
+{
+    return code == ESP_OK ? "ESP_OK" : "ESP_FAIL";
+}
+
+uint32_t crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len)
+{
+    // Same as the ROM's: reflected 0xEDB88320, with the inversion done here
+    crc = ~crc;
+    while (len--)
+    {
+        crc ^= *buf++;
+        for (int i = 0; i < 8; i++)
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+    }
+    return ~crc;
+}
+
+
+/* Heap */
+
+// Blocks may be freed with free(), where we can't see them go. A stale entry is dropped when
+// its memory is handed out again by heap_caps_*.
+static void *track_block(void *ptr, size_t size, uint32_t caps)
+{
+    bool spiram = (caps & MALLOC_CAP_SPIRAM)
+        || (!(caps & (MALLOC_CAP_INTERNAL|MALLOC_CAP_DMA)) && size > HOST_ALWAYS_INTERNAL);
+    uintptr_t start = (uintptr_t)ptr, end = start + size;
+
+    if (!ptr)
+        return NULL;
+
+    pthread_mutex_lock(&spiramLock);
+    for (int i = 0; i < HOST_SPIRAM_BLOCKS; i++)
+    {
+        if (spiramBlocks[i].start < end && start < spiramBlocks[i].end)
+            spiramBlocks[i].start = spiramBlocks[i].end = 0;
+    }
+    for (int i = 0; spiram && i < HOST_SPIRAM_BLOCKS; i++)
+    {
+        if (spiramBlocks[i].start == spiramBlocks[i].end)
+        {
+            spiramBlocks[i].start = start;
+            spiramBlocks[i].end = end;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&spiramLock);
+
+    return ptr;
+}
+
+bool esp_ptr_dma_capable(const void *p)
+{
+    bool capable = true;
+
+    pthread_mutex_lock(&spiramLock);
+    for (int i = 0; i < HOST_SPIRAM_BLOCKS; i++)
+    {
+        if ((uintptr_t)p >= spiramBlocks[i].start && (uintptr_t)p < spiramBlocks[i].end)
+            capable = false;
+    }
+    pthread_mutex_unlock(&spiramLock);
+
+    return capable;
+}
+
+void *heap_caps_malloc(size_t size, uint32_t caps)
+{
+    return track_block(malloc(size), size, caps);
+}
+
+void *heap_caps_calloc(size_t n, size_t size, uint32_t caps)
+{
+    return track_block(calloc(n, size), n * size, caps);
+}
+
+void *heap_caps_realloc(void *ptr, size_t size, uint32_t caps)
+{
+    return track_block(realloc(ptr, size), size, caps);
+}
+
+void heap_caps_free(void *ptr)
+{
+    track_block(ptr, 1, MALLOC_CAP_INTERNAL);
+    free(ptr);
+}
+
+size_t heap_caps_get_free_size(uint32_t caps)
+{
+    return (caps & MALLOC_CAP_SPIRAM) ? HOST_SPIRAM_HEAP : HOST_INTERNAL_HEAP;
+}
+
+size_t heap_caps_get_largest_free_block(uint32_t caps)
+{
+    return heap_caps_get_free_size(caps);
+}
+
+void heap_caps_get_info(multi_heap_info_t *info, uint32_t caps)
+{
+    memset(info, 0, sizeof(*info));
+    info->total_free_bytes = heap_caps_get_free_size(caps);
+    info->largest_free_block = heap_caps_get_largest_free_block(caps);
+}
+
+
+/* Partitions and OTA */
+
+const esp_app_desc_t *esp_ota_get_app_description(void)
+{
+    static esp_app_desc_t desc = {
+        .version = RG_HOST_APP_VERSION,
+        .date = __DATE__,
+        .time = __TIME__,
+        .idf_ver = "host",
+    };
+    if (!desc.project_name[0])
+        snprintf(desc.project_name, sizeof(desc.project_name), "%s", rg_host_app_name());
+    return &desc;
+}
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype,
+                                                const char *label)
+{
+    // Every app "exists", switching to one exits (see esp_restart)
+    static esp_partition_t partition;
+
+    partition = (esp_partition_t){.type = type, .subtype = ESP_PARTITION_SUBTYPE_APP_OTA_MIN};
+    snprintf(partition.label, sizeof(partition.label), "%s", label ? label : "factory");
+    return &partition;
+}
+
+esp_err_t esp_ota_set_boot_partition(const esp_partition_t *partition)
+{
+    return ESP_OK;
+}
+
+
+/* SD Card, it's a directory relative to the working directory */
+
+esp_err_t sdspi_host_init(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t sdspi_host_deinit(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t sdspi_host_do_transaction(int slot, sdmmc_command_t *cmdinfo)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_vfs_fat_sdmmc_mount(const char *base_path, const sdmmc_host_t *host_config, const void *slot_config,
+                                  const esp_vfs_fat_sdmmc_mount_config_t *mount_config, sdmmc_card_t **out_card)
+{
+    static sdmmc_card_t card;
+
+    if (mkdir(base_path, 0777) != 0 && errno != EEXIST)
+        return ESP_FAIL;
+
+    if (out_card)
+        *out_card = &card;
+
+    return ESP_OK;
+}
+
+esp_err_t esp_vfs_fat_sdmmc_unmount(void)
+{
+    return ESP_OK;
+}
+
+
+/* GPIO, ADC, DAC. Inputs read what rg_host_set_gamepad put there. */
+
+void rg_host_set_gamepad(uint32_t state)
+{
+    // Buttons pull their line low, the d-pad is a resistor ladder on two ADC channels
+    gpioLevels[RG_GPIO_GAMEPAD_MENU] = !(state & GAMEPAD_KEY_MENU);
+    gpioLevels[RG_GPIO_GAMEPAD_VOLUME] = !(state & GAMEPAD_KEY_VOLUME);
+    gpioLevels[RG_GPIO_GAMEPAD_SELECT] = !(state & GAMEPAD_KEY_SELECT);
+    gpioLevels[RG_GPIO_GAMEPAD_START] = !(state & GAMEPAD_KEY_START);
+    gpioLevels[RG_GPIO_GAMEPAD_A] = !(state & GAMEPAD_KEY_A);
+    gpioLevels[RG_GPIO_GAMEPAD_B] = !(state & GAMEPAD_KEY_B);
+
+    adcValues[RG_GPIO_GAMEPAD_Y] = (state & GAMEPAD_KEY_UP) ? 4095 : (state & GAMEPAD_KEY_DOWN) ? 2048 : 0;
+    adcValues[RG_GPIO_GAMEPAD_X] = (state & GAMEPAD_KEY_LEFT) ? 4095 : (state & GAMEPAD_KEY_RIGHT) ? 2048 : 0;
+}
+
+esp_err_t gpio_set_direction(gpio_num_t gpio, gpio_mode_t mode)
+{
+    return ESP_OK;
+}
+
+esp_err_t gpio_set_pull_mode(gpio_num_t gpio, gpio_pull_mode_t pull)
+{
+    return ESP_OK;
+}
+
+esp_err_t gpio_set_level(gpio_num_t gpio, uint32_t level)
+{
+    if (gpio < 0 || gpio >= GPIO_NUM_MAX)
+        return ESP_ERR_INVALID_ARG;
+    gpioLevels[gpio] = level;
+    return ESP_OK;
+}
+
+int gpio_get_level(gpio_num_t gpio)
+{
+    if (gpio < 0 || gpio >= GPIO_NUM_MAX)
+        return 0;
+    return gpioLevels[gpio];
+}
+
+esp_err_t gpio_reset_pin(gpio_num_t gpio)
+{
+    return ESP_OK;
+}
+
+esp_err_t gpio_set_intr_type(gpio_num_t gpio, gpio_int_type_t type)
+{
+    return ESP_OK;
+}
+
+esp_err_t gpio_install_isr_service(int flags)
+{
+    return ESP_OK;
+}
+
+esp_err_t gpio_isr_handler_add(gpio_num_t gpio, gpio_isr_t handler, void *arg)
+{
+    // Nothing would ever trigger it, callers fall back to polling or estimating
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_err_t gpio_isr_handler_remove(gpio_num_t gpio)
+{
+    return ESP_OK;
+}
+
+esp_err_t adc1_config_width(adc_bits_width_t width)
+{
+    return ESP_OK;
+}
+
+esp_err_t adc1_config_channel_atten(adc1_channel_t channel, adc_atten_t atten)
+{
+    return ESP_OK;
+}
+
+int adc1_get_raw(adc1_channel_t channel)
+{
+    if (channel < 0 || channel >= ADC1_CHANNEL_MAX)
+        return 0;
+    return adcValues[channel];
+}
+
+int esp_adc_cal_characterize(adc_unit_t unit, adc_atten_t atten, adc_bits_width_t width, uint32_t vref,
+                             esp_adc_cal_characteristics_t *chars)
+{
+    *chars = (esp_adc_cal_characteristics_t){unit, atten, width, 1, 0, vref};
+    return 0;
+}
+
+uint32_t esp_adc_cal_raw_to_voltage(uint32_t raw, const esp_adc_cal_characteristics_t *chars)
+{
+    // Raw values are millivolts
+    return raw;
+}
+
+esp_err_t dac_pad_get_io_num(dac_channel_t channel, gpio_num_t *gpio)
+{
+    *gpio = channel == DAC_CHANNEL_1 ? GPIO_NUM_25 : GPIO_NUM_26;
+    return ESP_OK;
+}
+
+
+/* LEDC (the backlight) */
+
+esp_err_t ledc_timer_config(const ledc_timer_config_t *config)
+{
+    return ESP_OK;
+}
+
+esp_err_t ledc_channel_config(const ledc_channel_config_t *config)
+{
+    return ESP_OK;
+}
+
+esp_err_t ledc_fade_func_install(int flags)
+{
+    return ESP_OK;
+}
+
+void ledc_fade_func_uninstall(void)
+{
+}
+
+esp_err_t ledc_set_fade_with_time(ledc_mode_t mode, ledc_channel_t channel, uint32_t duty, int time_ms)
+{
+    return ESP_OK;
+}
+
+esp_err_t ledc_fade_start(ledc_mode_t mode, ledc_channel_t channel, ledc_fade_mode_t wait)
+{
+    return ESP_OK;
+}
+
+
+/* I2C, there is nothing on the bus */
+
+esp_err_t i2c_param_config(i2c_port_t port, const i2c_config_t *config)
+{
+    return ESP_OK;
+}
+
+esp_err_t i2c_driver_install(i2c_port_t port, i2c_mode_t mode, size_t rx_len, size_t tx_len, int flags)
+{
+    return ESP_OK;
+}
+
+esp_err_t i2c_driver_delete(i2c_port_t port)
+{
+    return ESP_OK;
+}
+
+i2c_cmd_handle_t i2c_cmd_link_create(void)
+{
+    return (i2c_cmd_handle_t)1;
+}
+
+void i2c_cmd_link_delete(i2c_cmd_handle_t cmd)
+{
+}
+
+esp_err_t i2c_master_start(i2c_cmd_handle_t cmd)
+{
+    return ESP_OK;
+}
+
+esp_err_t i2c_master_stop(i2c_cmd_handle_t cmd)
+{
+    return ESP_OK;
+}
+
+esp_err_t i2c_master_write_byte(i2c_cmd_handle_t cmd, uint8_t data, bool ack)
+{
+    return ESP_OK;
+}
+
+esp_err_t i2c_master_write(i2c_cmd_handle_t cmd, uint8_t *data, size_t len, bool ack)
+{
+    return ESP_OK;
+}
+
+esp_err_t i2c_master_read(i2c_cmd_handle_t cmd, uint8_t *data, size_t len, i2c_ack_type_t ack)
+{
+    return ESP_OK;
+}
+
+esp_err_t i2c_master_cmd_begin(i2c_port_t port, i2c_cmd_handle_t cmd, TickType_t ticks)
+{
+    // No device acknowledges
+    return ESP_FAIL;
+}
+
+
+/* Timer groups, they never fire (rg_profiler samples with SIGPROF instead, see profiler.c) */
+
+esp_err_t timer_init(timer_group_t group, timer_idx_t timer, const timer_config_t *config)
+{
+    return ESP_OK;
+}
+
+esp_err_t timer_set_counter_value(timer_group_t group, timer_idx_t timer, uint64_t value)
+{
+    return ESP_OK;
+}
+
+esp_err_t timer_set_alarm_value(timer_group_t group, timer_idx_t timer, uint64_t value)
+{
+    return ESP_OK;
+}
+
+esp_err_t timer_enable_intr(timer_group_t group, timer_idx_t timer)
+{
+    return ESP_OK;
+}
+
+esp_err_t timer_disable_intr(timer_group_t group, timer_idx_t timer)
+{
+    return ESP_OK;
+}
+
+esp_err_t timer_isr_register(timer_group_t group, timer_idx_t timer, void (*fn)(void *), void *arg,
+                             int flags, intr_handle_t *handle)
+{
+    *handle = NULL;
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_err_t timer_start(timer_group_t group, timer_idx_t timer)
+{
+    return ESP_OK;
+}
+
+esp_err_t timer_pause(timer_group_t group, timer_idx_t timer)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_intr_free(intr_handle_t handle)
+{
+    return ESP_OK;
+}
+
+
+__attribute__((constructor)) static void esp_host_init(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    startTime = (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+
+    // Nothing pressed, a charged battery
+    rg_host_set_gamepad(0);
+    adcValues[RG_BATT_ADC_CHAN] = 2050;
+}
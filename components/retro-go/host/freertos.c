@@ -0,0 +1,356 @@
+#define _GNU_SOURCE
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "rg_host.h"
+
+struct host_task
+{
+    void *reserved;         // Where a TCB keeps pxTopOfStack, see rg_profiler's sample_isr
+    pthread_t thread;
+    TaskFunction_t func;
+    void *arg;
+    char name[16];
+    int core;
+    pthread_mutex_t lock;
+    pthread_cond_t notified;
+    uint32_t notifications;
+};
+
+struct host_queue
+{
+    pthread_mutex_t lock;
+    pthread_cond_t readable;
+    pthread_cond_t writable;
+    UBaseType_t length;
+    UBaseType_t itemSize;
+    UBaseType_t count;
+    UBaseType_t head;
+    uint8_t items[];
+};
+
+static __thread struct host_task *currentTask;
+static int64_t startTime;
+
+
+static void deadline_from_ticks(struct timespec *ts, TickType_t ticks)
+{
+    clock_gettime(CLOCK_MONOTONIC, ts);
+    uint64_t ns = (uint64_t)ticks * portTICK_PERIOD_MS * 1000000;
+    ts->tv_sec += ns / 1000000000;
+    ts->tv_nsec += ns % 1000000000;
+    if (ts->tv_nsec >= 1000000000)
+    {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000;
+    }
+}
+
+static void cond_init(pthread_cond_t *cond)
+{
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+// Waits on cond until pred is true or the ticks run out. The lock must be held.
+#define WAIT_UNTIL(pred, cond, lock, ticks, timedout)                           \
+    do {                                                                        \
+        struct timespec _deadline;                                              \
+        if ((ticks) != portMAX_DELAY)                                           \
+            deadline_from_ticks(&_deadline, ticks);                             \
+        while (!(pred) && !(timedout))                                          \
+        {                                                                       \
+            if ((ticks) == portMAX_DELAY)                                       \
+                pthread_cond_wait(cond, lock);                                  \
+            else if ((ticks) == 0 || pthread_cond_timedwait(cond, lock, &_deadline) == ETIMEDOUT) \
+                (timedout) = !(pred);                                           \
+        }                                                                       \
+    } while (0)
+
+static struct host_task *task_create(TaskFunction_t func, const char *name, void *arg, int core)
+{
+    struct host_task *task = calloc(1, sizeof(struct host_task));
+    task->func = func;
+    task->arg = arg;
+    task->core = core == tskNO_AFFINITY ? 0 : core;
+    snprintf(task->name, sizeof(task->name), "%s", name ? name : "");
+    pthread_mutex_init(&task->lock, NULL);
+    cond_init(&task->notified);
+    return task;
+}
+
+static void *task_entry(void *arg)
+{
+    currentTask = arg;
+    pthread_setname_np(pthread_self(), currentTask->name);
+    currentTask->func(currentTask->arg);
+    return NULL;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t func, const char *name, uint32_t stack, void *arg,
+                                   UBaseType_t priority, TaskHandle_t *handle, BaseType_t core)
+{
+    struct host_task *task = task_create(func, name, arg, core);
+    pthread_attr_t attr;
+
+    // The devices' stack sizes are tuned for the Xtensa ABI and newlib, the host needs more
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, RG_MAX(stack * 16, 256 * 1024u));
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    if (handle)
+        *handle = task;
+
+    if (pthread_create(&task->thread, &attr, &task_entry, task) != 0)
+    {
+        pthread_attr_destroy(&attr);
+        if (handle)
+            *handle = NULL;
+        free(task);
+        return pdFAIL;
+    }
+
+    pthread_attr_destroy(&attr);
+    return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+    // Tasks only ever delete themselves in retro-go. The handle is leaked on purpose, other
+    // tasks may still hold it (rg_audio and rg_synth poll theirs to see the task exit).
+    if (task == NULL || task == currentTask)
+        pthread_exit(NULL);
+
+    fprintf(stderr, "[host] vTaskDelete: can't delete another task (%s)\n", task->name);
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    if (ticks == 0)
+        sched_yield();
+    else
+        usleep(ticks * portTICK_PERIOD_MS * 1000);
+}
+
+void vTaskSuspendAll(void)
+{
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    return (esp_timer_get_time() - startTime) / 1000 / portTICK_PERIOD_MS;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    // Threads we didn't create (the process' main thread) get a handle the first time they ask
+    if (!currentTask)
+    {
+        currentTask = task_create(NULL, "host", NULL, 0);
+        currentTask->thread = pthread_self();
+    }
+    return currentTask;
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task)
+{
+    return 0;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    pthread_mutex_lock(&task->lock);
+    task->notifications++;
+    pthread_cond_signal(&task->notified);
+    pthread_mutex_unlock(&task->lock);
+    return pdPASS;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *woken)
+{
+    xTaskNotifyGive(task);
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks)
+{
+    struct host_task *task = xTaskGetCurrentTaskHandle();
+    bool timedout = false;
+    uint32_t value;
+
+    pthread_mutex_lock(&task->lock);
+    WAIT_UNTIL(task->notifications > 0, &task->notified, &task->lock, ticks, timedout);
+    value = task->notifications;
+    if (value)
+        task->notifications = clear ? 0 : value - 1;
+    pthread_mutex_unlock(&task->lock);
+
+    return value;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize)
+{
+    struct host_queue *queue = calloc(1, sizeof(struct host_queue) + length * itemSize);
+    queue->length = length;
+    queue->itemSize = itemSize;
+    pthread_mutex_init(&queue->lock, NULL);
+    cond_init(&queue->readable);
+    cond_init(&queue->writable);
+    return queue;
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max, UBaseType_t initial)
+{
+    struct host_queue *queue = xQueueCreate(max, 0);
+    queue->count = initial;
+    return queue;
+}
+
+void vQueueDelete(QueueHandle_t queue)
+{
+    pthread_mutex_destroy(&queue->lock);
+    pthread_cond_destroy(&queue->readable);
+    pthread_cond_destroy(&queue->writable);
+    free(queue);
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks)
+{
+    bool timedout = false;
+
+    pthread_mutex_lock(&queue->lock);
+    WAIT_UNTIL(queue->count < queue->length, &queue->writable, &queue->lock, ticks, timedout);
+    if (!timedout)
+    {
+        UBaseType_t index = (queue->head + queue->count) % queue->length;
+        if (queue->itemSize)
+            memcpy(&queue->items[index * queue->itemSize], item, queue->itemSize);
+        queue->count++;
+        pthread_cond_signal(&queue->readable);
+    }
+    pthread_mutex_unlock(&queue->lock);
+
+    return timedout ? pdFALSE : pdTRUE;
+}
+
+static BaseType_t queue_receive(QueueHandle_t queue, void *item, TickType_t ticks, bool peek)
+{
+    bool timedout = false;
+
+    pthread_mutex_lock(&queue->lock);
+    WAIT_UNTIL(queue->count > 0, &queue->readable, &queue->lock, ticks, timedout);
+    if (!timedout)
+    {
+        if (item && queue->itemSize)
+            memcpy(item, &queue->items[queue->head * queue->itemSize], queue->itemSize);
+        if (!peek)
+        {
+            queue->head = (queue->head + 1) % queue->length;
+            queue->count--;
+            pthread_cond_signal(&queue->writable);
+        }
+        else
+        {
+            // Let the other readers see it too
+            pthread_cond_signal(&queue->readable);
+        }
+    }
+    pthread_mutex_unlock(&queue->lock);
+
+    return timedout ? pdFALSE : pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks)
+{
+    return queue_receive(queue, item, ticks, false);
+}
+
+BaseType_t xQueuePeek(QueueHandle_t queue, void *item, TickType_t ticks)
+{
+    return queue_receive(queue, item, ticks, true);
+}
+
+BaseType_t xQueueReset(QueueHandle_t queue)
+{
+    pthread_mutex_lock(&queue->lock);
+    queue->count = queue->head = 0;
+    pthread_cond_broadcast(&queue->writable);
+    pthread_mutex_unlock(&queue->lock);
+    return pdPASS;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue)
+{
+    pthread_mutex_lock(&queue->lock);
+    UBaseType_t count = queue->count;
+    pthread_mutex_unlock(&queue->lock);
+    return count;
+}
+
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t queue)
+{
+    pthread_mutex_lock(&queue->lock);
+    UBaseType_t spaces = queue->length - queue->count;
+    pthread_mutex_unlock(&queue->lock);
+    return spaces;
+}
+
+void vPortEnterCritical(portMUX_TYPE *mux)
+{
+    intptr_t self = (intptr_t)xTaskGetCurrentTaskHandle();
+
+    if (__atomic_load_n(&mux->owner, __ATOMIC_ACQUIRE) != self)
+    {
+        intptr_t expected = 0;
+        while (!__atomic_compare_exchange_n(&mux->owner, &expected, self, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        {
+            expected = 0;
+            sched_yield();
+        }
+    }
+    mux->count++;
+}
+
+void vPortExitCritical(portMUX_TYPE *mux)
+{
+    if (--mux->count == 0)
+        __atomic_store_n(&mux->owner, 0, __ATOMIC_RELEASE);
+}
+
+BaseType_t xPortGetCoreID(void)
+{
+    return xTaskGetCurrentTaskHandle()->core;
+}
+
+int rg_host_task_core(void)
+{
+    // Unlike xTaskGetCurrentTaskHandle this never creates a handle, it's safe in a signal handler
+    return currentTask ? currentTask->core : 0;
+}
+
+// Signal handlers standing in for interrupts count themselves here, like _frxt_int_enter does
+unsigned port_interruptNesting[portNUM_PROCESSORS];
+
+BaseType_t xPortInIsrContext(void)
+{
+    return port_interruptNesting[rg_host_task_core()] != 0;
+}
+
+BaseType_t xPortInterruptedFromISRContext(void)
+{
+    return port_interruptNesting[rg_host_task_core()] != 0;
+}
+
+__attribute__((constructor)) static void freertos_init(void)
+{
+    startTime = esp_timer_get_time();
+}
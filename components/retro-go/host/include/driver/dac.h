@@ -0,0 +1,15 @@
+#pragma once
+
+#include "driver/gpio.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum { DAC_CHANNEL_1 = 1, DAC_CHANNEL_2 } dac_channel_t;
+
+esp_err_t dac_pad_get_io_num(dac_channel_t channel, gpio_num_t *gpio);
+
+#ifdef __cplusplus
+}
+#endif
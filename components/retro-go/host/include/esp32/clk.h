@@ -0,0 +1,12 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// xthal_get_ccount's emulated rate, the ESP32's 240MHz
+int esp_clk_cpu_freq(void);
+
+#ifdef __cplusplus
+}
+#endif
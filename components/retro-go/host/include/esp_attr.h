@@ -0,0 +1,9 @@
+#pragma once
+
+// There is only one kind of memory on the host
+#define IRAM_ATTR
+#define DRAM_ATTR
+#define DMA_ATTR
+#define RTC_NOINIT_ATTR
+#define RTC_DATA_ATTR
+#define EXT_RAM_ATTR
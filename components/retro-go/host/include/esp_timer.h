@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Microseconds since the process started, from CLOCK_MONOTONIC
+int64_t esp_timer_get_time(void);
+
+#ifdef __cplusplus
+}
+#endif
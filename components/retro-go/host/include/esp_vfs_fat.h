@@ -0,0 +1,118 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "driver/gpio.h"
+#include "driver/spi_master.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// The "SD card" is a directory, mounting makes sure it exists (see host/esp_host.c)
+
+typedef struct
+{
+    uint32_t opcode;
+    uint32_t arg;
+    uint32_t response[4];
+    void *data;
+    size_t datalen;
+    size_t blklen;
+    int flags;
+    esp_err_t error;
+    int timeout_ms;
+} sdmmc_command_t;
+
+typedef struct
+{
+    uint32_t flags;
+    int slot;
+    int max_freq_khz;
+    float io_voltage;
+    esp_err_t (*init)(void);
+    esp_err_t (*set_bus_width)(int slot, size_t width);
+    size_t (*get_bus_width)(int slot);
+    esp_err_t (*set_bus_ddr_mode)(int slot, bool ddr_enable);
+    esp_err_t (*set_card_clk)(int slot, uint32_t freq_khz);
+    esp_err_t (*do_transaction)(int slot, sdmmc_command_t *cmdinfo);
+    esp_err_t (*deinit)(void);
+    esp_err_t (*io_int_enable)(int slot);
+    esp_err_t (*io_int_wait)(int slot, uint32_t timeout_ticks);
+    int command_timeout_ms;
+} sdmmc_host_t;
+
+typedef struct
+{
+    int mfg_id;
+    int oem_id;
+    char name[8];
+    int revision;
+    int serial;
+    int date;
+} sdmmc_cid_t;
+
+typedef struct
+{
+    sdmmc_host_t host;
+    sdmmc_cid_t cid;
+} sdmmc_card_t;
+
+typedef struct
+{
+    gpio_num_t gpio_miso;
+    gpio_num_t gpio_mosi;
+    gpio_num_t gpio_sck;
+    gpio_num_t gpio_cs;
+    gpio_num_t gpio_cd;
+    gpio_num_t gpio_wp;
+    gpio_num_t gpio_int;
+    int dma_channel;
+} sdspi_slot_config_t;
+
+typedef struct
+{
+    uint8_t clk;
+    uint8_t cmd;
+    uint8_t d0;
+    uint8_t width;
+    uint32_t flags;
+} sdmmc_slot_config_t;
+
+typedef struct
+{
+    bool format_if_mount_failed;
+    int max_files;
+    size_t allocation_unit_size;
+} esp_vfs_fat_sdmmc_mount_config_t;
+
+#define SDMMC_HOST_FLAG_1BIT    (1 << 0)
+#define SDMMC_HOST_FLAG_SPI     (1 << 3)
+#define SDMMC_FREQ_DEFAULT      20000
+#define SDMMC_FREQ_HIGHSPEED    40000
+
+esp_err_t sdspi_host_init(void);
+esp_err_t sdspi_host_deinit(void);
+esp_err_t sdspi_host_do_transaction(int slot, sdmmc_command_t *cmdinfo);
+
+#define SDSPI_HOST_DEFAULT() { \
+    .flags = SDMMC_HOST_FLAG_SPI, .slot = HSPI_HOST, .max_freq_khz = SDMMC_FREQ_DEFAULT, \
+    .init = &sdspi_host_init, .do_transaction = &sdspi_host_do_transaction, .deinit = &sdspi_host_deinit, \
+}
+#define SDMMC_HOST_DEFAULT() { .slot = 1, .max_freq_khz = SDMMC_FREQ_DEFAULT }
+#define SDSPI_SLOT_CONFIG_DEFAULT() { \
+    .gpio_miso = GPIO_NUM_2, .gpio_mosi = GPIO_NUM_15, .gpio_sck = GPIO_NUM_14, .gpio_cs = GPIO_NUM_13, \
+    .gpio_cd = GPIO_NUM_NC, .gpio_wp = GPIO_NUM_NC, .gpio_int = GPIO_NUM_NC, .dma_channel = 1, \
+}
+#define SDMMC_SLOT_CONFIG_DEFAULT() { .width = 4 }
+
+esp_err_t esp_vfs_fat_sdmmc_mount(const char *base_path, const sdmmc_host_t *host_config, const void *slot_config,
+                                  const esp_vfs_fat_sdmmc_mount_config_t *mount_config, sdmmc_card_t **out_card);
+esp_err_t esp_vfs_fat_sdmmc_unmount(void);
+
+#ifdef __cplusplus
+}
+#endif
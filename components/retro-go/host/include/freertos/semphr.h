@@ -0,0 +1,24 @@
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Like in FreeRTOS, semaphores are queues of zero-sized items
+typedef QueueHandle_t SemaphoreHandle_t;
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max, UBaseType_t initial);
+#define xSemaphoreCreateBinary() xSemaphoreCreateCounting(1, 0)
+#define xSemaphoreCreateMutex() xSemaphoreCreateCounting(1, 1)
+#define vSemaphoreDelete(sem) vQueueDelete(sem)
+#define xSemaphoreTake(sem, ticks) xQueueReceive(sem, NULL, ticks)
+#define xSemaphoreGive(sem) xQueueSend(sem, NULL, 0)
+#define xSemaphoreGiveFromISR(sem, woken) xQueueSend(sem, NULL, 0)
+#define xSemaphoreTakeFromISR(sem, woken) xQueueReceive(sem, NULL, 0)
+#define uxSemaphoreGetCount(sem) uxQueueMessagesWaiting(sem)
+
+#ifdef __cplusplus
+}
+#endif
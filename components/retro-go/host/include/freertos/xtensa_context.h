@@ -0,0 +1,7 @@
+#pragma once
+
+// Only what rg_profiler's sampling interrupt reads, it never fires on the host
+typedef struct
+{
+    long exit, pc, ps, a0, a1;
+} XtExcFrame;
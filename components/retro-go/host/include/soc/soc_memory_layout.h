@@ -0,0 +1,14 @@
+#pragma once
+
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// esp_host.c: false for the blocks that the device would put in PSRAM
+bool esp_ptr_dma_capable(const void *p);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef BIT
+#define BIT(nr) (1UL << (nr))
+#endif
+
+// Just the registers rg_profiler's sampling interrupt touches
+typedef struct
+{
+    struct {
+        union {
+            struct {
+                uint32_t reserved0 : 10;
+                uint32_t alarm_en : 1;
+                uint32_t reserved11 : 21;
+            };
+            uint32_t val;
+        } config;
+        uint32_t reserved[8];
+    } hw_timer[2];
+    union {
+        uint32_t val;
+    } int_clr_timers;
+} timg_dev_t;
+
+extern volatile timg_dev_t TIMERG0;
+extern volatile timg_dev_t TIMERG1;
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// CPU cycles, emulated with the monotonic clock at esp_clk_cpu_freq()
+uint32_t xthal_get_ccount(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,473 @@
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_timer.h>
+#include <sys/resource.h>
+#include <malloc.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "rg_host.h"
+
+// The host's entry point: it prepares the "SD card" so the app boots straight into the ROM,
+// then runs app_main like the ESP-IDF would. rg_system_tick reports every frame here, which
+// is where the scripted input is applied, the frame times are added up, and where we decide
+// when to stop. The --report file is what tools/benchmark.py collects.
+
+#define MAX_INPUT_EVENTS 1024
+#define INPUT_SYNC_TIMEOUT 500000
+
+typedef struct
+{
+    int frame;
+    uint32_t state;
+} input_event_t;
+
+static struct
+{
+    const char *rom;
+    const char *root;
+    const char *input;
+    const char *audio;
+    const char *screenshot;
+    const char *report;
+    const char *record;
+    int frames;
+    int warmup;
+    int render;
+    int loadSlot;
+    int saveSlot;
+    int snapshots;
+    int rewind;
+    int rewindInterval;
+    bool realtime;
+} options = {.frames = 600, .loadSlot = -1, .saveSlot = -1, .rewindInterval = 10};
+
+static const char *renderModes[RG_DISPLAY_RENDER_COUNT] = {"auto", "all", "none"};
+
+static char appName[32];
+static char screenshotPath[PATH_MAX];
+static char reportPath[PATH_MAX];
+static FILE *recordFile;
+static input_event_t inputEvents[MAX_INPUT_EVENTS];
+static int inputCount, inputPos;
+static int frameCount, measuredFrames, skippedFrames;
+static int64_t startTime, excludedTime, busyTotal;
+static uint64_t stageTotals[RG_FRAME_STAGE_COUNT];
+static size_t heapPeak;
+static struct
+{
+    int count;
+    size_t bytes;
+    int64_t takeTime, restoreTime;
+} snapshotStats;
+
+extern void app_main(void);
+
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+        "usage: %s --rom <file> [options]\n"
+        "  --frames <n>        Exit after n measured frames (default: %d, 0 = never)\n"
+        "  --warmup <n>        Frames to run before measuring (default: 0)\n"
+        "  --render <mode>     auto: the emulator skips frames as usual, all: draw every frame,\n"
+        "                      none: draw nothing (default: auto)\n"
+        "  --report <file>     Write the measurements as JSON\n"
+        "  --root <dir>        Directory holding the sd/ card tree (default: current)\n"
+        "  --input <file>      Scripted input, lines of '<frame> <KEY+KEY...>' or '<frame> -'\n"
+        "  --audio <file.wav>  Save what the DAC plays\n"
+        "  --screenshot <file> Save the panel as a PPM on exit\n"
+        "  --record <file>     Save every frame sent to the display, for host/tests/diff_replay\n"
+        "  --load-state <n>    Load save slot n before the first frame\n"
+        "  --save-state <n>    Save to slot n after the last frame\n"
+        "  --snapshots <n>     Time n in-memory snapshots and restores after the last frame\n"
+        "  --rewind <kb>       Enable rewind with a buffer of that size (hotkey: SELECT+LEFT)\n"
+        "  --rewind-interval <n> Frames between rewind captures (default: %d)\n"
+        "  --realtime          Pace the emulation like the device instead of running flat out\n",
+        name, options.frames, options.rewindInterval);
+    exit(1);
+}
+
+static uint32_t parse_keys(char *keys)
+{
+    static const char *names[] = {"UP", "RIGHT", "DOWN", "LEFT", "SELECT", "START", "A", "B", "MENU", "VOLUME"};
+    static const uint32_t values[] = {
+        GAMEPAD_KEY_UP, GAMEPAD_KEY_RIGHT, GAMEPAD_KEY_DOWN, GAMEPAD_KEY_LEFT, GAMEPAD_KEY_SELECT,
+        GAMEPAD_KEY_START, GAMEPAD_KEY_A, GAMEPAD_KEY_B, GAMEPAD_KEY_MENU, GAMEPAD_KEY_VOLUME,
+    };
+    uint32_t state = 0;
+
+    for (char *key = strtok(keys, "+"); key; key = strtok(NULL, "+"))
+    {
+        size_t i = 0;
+        while (i < (sizeof(names) / sizeof(names[0])) && strcasecmp(key, names[i]) != 0)
+            i++;
+        if (i == (sizeof(names) / sizeof(names[0])))
+        {
+            if (strcmp(key, "-") != 0)
+                fprintf(stderr, "[host] unknown key '%s' in input script\n", key);
+            continue;
+        }
+        state |= values[i];
+    }
+
+    return state;
+}
+
+static void load_input_script(const char *filename)
+{
+    char line[128], keys[100];
+    int frame;
+
+    FILE *fp = fopen(filename, "r");
+    if (!fp)
+    {
+        fprintf(stderr, "[host] can't open input script '%s'\n", filename);
+        exit(1);
+    }
+
+    while (fgets(line, sizeof(line), fp) && inputCount < MAX_INPUT_EVENTS)
+    {
+        if (line[0] == '#' || sscanf(line, "%d %99s", &frame, keys) != 2)
+            continue;
+        inputEvents[inputCount++] = (input_event_t){frame, parse_keys(keys)};
+    }
+
+    fclose(fp);
+}
+
+static void absolute_path(char *out, const char *path)
+{
+    // The paths given on the command line are relative to where we started, not to --root
+    if (path[0] == '/' || !getcwd(out, PATH_MAX - 1))
+        out[0] = 0;
+    else
+        strcat(out, "/");
+    strncat(out, path, PATH_MAX - strlen(out) - 1);
+}
+
+static bool write_report(const char *filename, int64_t elapsed)
+{
+    static const char *stageNames[RG_FRAME_STAGE_COUNT] = {
+        "emulate", "diff", "display_wait", "convert", "spi_wait", "audio_wait",
+    };
+    rg_host_panel_counters_t panel = rg_host_panel_get_counters();
+    const uint16_t *pixels = rg_host_panel_pixels();
+    rg_rewind_stats_t rewind = rg_rewind_get_stats();
+    uint32_t deltas = rewind.captures - (rewind.captures > 0); // The first capture is a full state
+    float frames = RG_MAX(measuredFrames, 1);
+    struct rusage usage;
+
+    FILE *fp = fopen(filename, "w");
+    if (!fp)
+        return false;
+
+    getrusage(RUSAGE_SELF, &usage);
+
+    fprintf(fp, "{\n");
+    fprintf(fp, "  \"app\": \"%s\",\n", appName);
+    fprintf(fp, "  \"version\": \"%s\",\n", RG_HOST_APP_VERSION);
+    fprintf(fp, "  \"rom\": \"%s\",\n", rg_basename(options.rom));
+    fprintf(fp, "  \"render\": \"%s\",\n", renderModes[options.render]);
+    fprintf(fp, "  \"warmup\": %d,\n", options.warmup);
+    fprintf(fp, "  \"frames\": %d,\n", measuredFrames);
+    fprintf(fp, "  \"skipped_frames\": %d,\n", skippedFrames);
+    fprintf(fp, "  \"seconds\": %.6f,\n", elapsed / 1000000.0);
+    fprintf(fp, "  \"fps\": %.3f,\n", measuredFrames * 1000000.0 / RG_MAX(elapsed, 1));
+    fprintf(fp, "  \"frame_us\": %.3f,\n", elapsed / frames);
+    fprintf(fp, "  \"busy_us\": %.3f,\n", busyTotal / frames);
+    // The same grouping as the frame times graph: the emulator, the display path, the DAC
+    fprintf(fp, "  \"cpu_us\": %.3f,\n", stageTotals[RG_FRAME_EMULATE] / frames);
+    fprintf(fp, "  \"video_us\": %.3f,\n", (stageTotals[RG_FRAME_DIFF] + stageTotals[RG_FRAME_DISPLAY_WAIT] +
+                                           stageTotals[RG_FRAME_CONVERT] + stageTotals[RG_FRAME_SPI_WAIT]) / frames);
+    fprintf(fp, "  \"audio_us\": %.3f,\n", stageTotals[RG_FRAME_AUDIO_WAIT] / frames);
+    fprintf(fp, "  \"stages_us\": {");
+    for (int i = 0; i < RG_FRAME_STAGE_COUNT; i++)
+        fprintf(fp, "%s\"%s\": %.3f", i ? ", " : "", stageNames[i], stageTotals[i] / frames);
+    fprintf(fp, "},\n");
+    fprintf(fp, "  \"heap_peak\": %zu,\n", heapPeak);
+    fprintf(fp, "  \"rss_peak_kb\": %ld,\n", usage.ru_maxrss);
+    fprintf(fp, "  \"spi_transactions\": %u,\n", panel.transactions);
+    fprintf(fp, "  \"spi_bytes\": %u,\n", panel.bytes);
+    fprintf(fp, "  \"spi_direct_bytes\": %u,\n", rg_display_get_status()->counters.spiDirectBytes);
+    fprintf(fp, "  \"panel_pixels\": %u,\n", panel.pixels);
+    fprintf(fp, "  \"snapshot_bytes\": %zu,\n", snapshotStats.bytes);
+    fprintf(fp, "  \"snapshot_us\": %.3f,\n", snapshotStats.takeTime / (float)RG_MAX(snapshotStats.count, 1));
+    fprintf(fp, "  \"restore_us\": %.3f,\n", snapshotStats.restoreTime / (float)RG_MAX(snapshotStats.count, 1));
+    fprintf(fp, "  \"rewind_kb\": %d,\n", options.rewind);
+    fprintf(fp, "  \"rewind_interval\": %d,\n", options.rewindInterval);
+    fprintf(fp, "  \"rewind_captures\": %u,\n", rewind.captures);
+    fprintf(fp, "  \"rewind_entries\": %u,\n", rewind.entries);
+    fprintf(fp, "  \"rewind_state_bytes\": %u,\n", rewind.stateSize);
+    fprintf(fp, "  \"rewind_delta_bytes\": %.1f,\n", rewind.deltaBytes / (float)RG_MAX(deltas, 1));
+    fprintf(fp, "  \"rewind_capture_us\": %.3f,\n", rewind.captureTime / (float)RG_MAX(rewind.captures, 1));
+    fprintf(fp, "  \"rewind_capture_max_us\": %lld,\n", (long long)rewind.captureTimeMax);
+    fprintf(fp, "  \"panel_crc\": \"%08x\"\n", crc32_le(0, (const uint8_t *)pixels, RG_SCREEN_WIDTH * RG_SCREEN_HEIGHT * 2));
+    fprintf(fp, "}\n");
+
+    return fclose(fp) == 0;
+}
+
+static void report_and_exit(int code)
+{
+    int64_t elapsed = esp_timer_get_time() - startTime - excludedTime;
+    rg_host_panel_counters_t panel = rg_host_panel_get_counters();
+
+    printf("[host] frames: %d, time: %.3fs, fps: %.2f, busy: %.3fms/frame\n", measuredFrames,
+           elapsed / 1000000.f, measuredFrames * 1000000.f / RG_MAX(elapsed, 1),
+           busyTotal / 1000.f / RG_MAX(measuredFrames, 1));
+    printf("[host] panel: %u transactions, %u bytes, %u windows, %u pixels\n", panel.transactions,
+           panel.bytes, panel.windows, panel.pixels);
+
+    if (options.rewind > 0)
+    {
+        rg_rewind_stats_t rewind = rg_rewind_get_stats();
+        printf("[host] rewind: %u captures of %u bytes, %u in the ring (%u bytes), %.1fus/capture\n",
+               rewind.captures, rewind.stateSize, rewind.entries, rewind.used,
+               rewind.captureTime / (float)RG_MAX(rewind.captures, 1));
+    }
+
+    if (options.screenshot && !rg_host_panel_save(screenshotPath))
+        fprintf(stderr, "[host] can't save screenshot to '%s'\n", options.screenshot);
+
+    if (options.report && !write_report(reportPath, elapsed))
+        fprintf(stderr, "[host] can't save report to '%s'\n", options.report);
+
+    if (recordFile && fclose(recordFile) != 0)
+        fprintf(stderr, "[host] can't save the recording\n");
+
+    rg_host_audio_close();
+    fflush(stdout);
+    exit(code);
+}
+
+static bool measure_snapshots(int count)
+{
+    // Each restore puts back the state the snapshot was just taken of, the run isn't affected
+    for (int i = 0; i < count; i++)
+    {
+        int64_t start = esp_timer_get_time();
+        if (!rg_emu_snapshot_take())
+            return false;
+        int64_t taken = esp_timer_get_time();
+        if (!rg_emu_snapshot_restore())
+            return false;
+        snapshotStats.takeTime += taken - start;
+        snapshotStats.restoreTime += esp_timer_get_time() - taken;
+        snapshotStats.count++;
+    }
+
+    snapshotStats.bytes = rg_emu_snapshot_size();
+
+    printf("[host] snapshots: %zu bytes, take: %.1fus, restore: %.1fus\n", snapshotStats.bytes,
+           snapshotStats.takeTime / (float)RG_MAX(count, 1), snapshotStats.restoreTime / (float)RG_MAX(count, 1));
+    return true;
+}
+
+static void account_frame(int busyTime)
+{
+    rg_frame_time_t frame;
+    struct mallinfo2 heap = mallinfo2();
+
+    heapPeak = RG_MAX(heapPeak, heap.uordblks + heap.hblkhd);
+
+    if (frameCount <= options.warmup)
+    {
+        startTime = esp_timer_get_time();
+        excludedTime = 0;
+        return;
+    }
+
+    measuredFrames++;
+    busyTotal += busyTime;
+
+    if (rg_system_get_frame_times(&frame, 1) == 1)
+    {
+        skippedFrames += frame.skipped;
+        for (int i = 0; i < RG_FRAME_STAGE_COUNT; i++)
+            stageTotals[i] += frame.stages[i];
+    }
+}
+
+void rg_host_frame(int busyTime)
+{
+    frameCount++;
+    account_frame(busyTime);
+
+    if (options.frames > 0 && measuredFrames >= options.frames)
+    {
+        if (options.snapshots > 0 && !measure_snapshots(options.snapshots))
+            report_and_exit(3);
+        if (options.saveSlot >= 0 && !rg_emu_save_state(options.saveSlot))
+            report_and_exit(3);
+        report_and_exit(0);
+    }
+
+    if (frameCount == 1 && options.loadSlot >= 0)
+    {
+        int64_t loadStart = esp_timer_get_time();
+        if (!rg_emu_load_state(options.loadSlot))
+            report_and_exit(3);
+        excludedTime += esp_timer_get_time() - loadStart;
+    }
+
+    // The input task samples and debounces the buttons, wait until it sees the new state so
+    // that a script replays identically. The wait isn't emulation time.
+    while (inputPos < inputCount && inputEvents[inputPos].frame <= frameCount)
+    {
+        uint32_t state = inputEvents[inputPos++].state;
+        int64_t waitStart = esp_timer_get_time();
+
+        rg_host_set_gamepad(state);
+        while (rg_input_read_gamepad_raw() != state && esp_timer_get_time() - waitStart < INPUT_SYNC_TIMEOUT)
+            usleep(1000);
+
+        excludedTime += esp_timer_get_time() - waitStart;
+    }
+
+    if (frameCount == 1 && !options.realtime)
+        rg_audio_set_pacing(false);
+}
+
+void rg_host_frame_queued(const rg_video_frame_t *frame, const rg_video_frame_t *previousFrame)
+{
+    if (!recordFile)
+        return;
+
+    bool palette = (frame->flags & RG_PIXEL_PAL) && frame->palette;
+    rg_host_record_t record = {
+        .magic = RG_HOST_RECORD_MAGIC,
+        .width = frame->width,
+        .height = frame->height,
+        .stride = frame->stride,
+        .flags = palette ? frame->flags : (frame->flags & ~RG_PIXEL_PAL),
+        .pixel_mask = frame->pixel_mask,
+        .partial = previousFrame != NULL,
+    };
+
+    fwrite(&record, sizeof(record), 1, recordFile);
+    if (palette)
+        fwrite(frame->palette, 2, frame->pixel_mask + 1, recordFile);
+    fwrite(frame->buffer, frame->stride, frame->height, recordFile);
+}
+
+const char *rg_host_app_name(void)
+{
+    return appName;
+}
+
+bool rg_host_unthrottled(void)
+{
+    return !options.realtime;
+}
+
+static void main_task(void *arg)
+{
+    app_main();
+    fprintf(stderr, "[host] app_main returned\n");
+    report_and_exit(measuredFrames >= options.frames ? 0 : 2);
+}
+
+int main(int argc, char **argv)
+{
+    snprintf(appName, sizeof(appName), "%s", rg_basename(argv[0]));
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char *arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+
+        if (strcmp(arg, "--realtime") == 0)
+            options.realtime = true;
+        else if (!value)
+            usage(argv[0]);
+        else if (strcmp(arg, "--rom") == 0)
+            options.rom = value, i++;
+        else if (strcmp(arg, "--root") == 0)
+            options.root = value, i++;
+        else if (strcmp(arg, "--input") == 0)
+            options.input = value, i++;
+        else if (strcmp(arg, "--audio") == 0)
+            options.audio = value, i++;
+        else if (strcmp(arg, "--screenshot") == 0)
+            options.screenshot = value, i++;
+        else if (strcmp(arg, "--report") == 0)
+            options.report = value, i++;
+        else if (strcmp(arg, "--record") == 0)
+            options.record = value, i++;
+        else if (strcmp(arg, "--frames") == 0)
+            options.frames = atoi(value), i++;
+        else if (strcmp(arg, "--warmup") == 0)
+            options.warmup = atoi(value), i++;
+        else if (strcmp(arg, "--load-state") == 0)
+            options.loadSlot = atoi(value), i++;
+        else if (strcmp(arg, "--save-state") == 0)
+            options.saveSlot = atoi(value), i++;
+        else if (strcmp(arg, "--snapshots") == 0)
+            options.snapshots = atoi(value), i++;
+        else if (strcmp(arg, "--rewind") == 0)
+            options.rewind = atoi(value), i++;
+        else if (strcmp(arg, "--rewind-interval") == 0)
+            options.rewindInterval = atoi(value), i++;
+        else if (strcmp(arg, "--render") == 0)
+        {
+            while (options.render < RG_DISPLAY_RENDER_COUNT && strcmp(value, renderModes[options.render]))
+                options.render++;
+            if (options.render == RG_DISPLAY_RENDER_COUNT)
+                usage(argv[0]);
+            i++;
+        }
+        else
+            usage(argv[0]);
+    }
+
+    if (!options.rom)
+        usage(argv[0]);
+
+    char romPath[PATH_MAX];
+    if (!realpath(options.rom, romPath))
+    {
+        fprintf(stderr, "[host] can't find rom '%s'\n", options.rom);
+        return 1;
+    }
+    if (options.screenshot)
+        absolute_path(screenshotPath, options.screenshot);
+    if (options.report)
+        absolute_path(reportPath, options.report);
+    if (options.input)
+        load_input_script(options.input);
+    if (options.record && !(recordFile = fopen(options.record, "wb")))
+    {
+        fprintf(stderr, "[host] can't create '%s'\n", options.record);
+        return 1;
+    }
+    if (options.audio && !rg_host_audio_open(options.audio))
+    {
+        fprintf(stderr, "[host] can't create '%s'\n", options.audio);
+        return 1;
+    }
+    if (options.root && chdir(options.root) != 0)
+    {
+        fprintf(stderr, "[host] can't enter '%s'\n", options.root);
+        return 1;
+    }
+
+    // What the launcher would have done before switching to the app
+    rg_mkdir(RG_BASE_PATH_CONFIG);
+    rg_settings_init(appName);
+    rg_settings_set_string("RomFilePath", romPath);
+    rg_settings_set_int32("StartAction", RG_START_ACTION_NEWGAME);
+    rg_rewind_set_budget(options.rewind);
+    rg_rewind_set_interval(options.rewindInterval);
+    rg_settings_save();
+
+    rg_display_set_render_mode(options.render);
+
+    xTaskCreatePinnedToCore(&main_task, "main", 8192, NULL, 1, NULL, 0);
+
+    while (1)
+        pause();
+}
@@ -0,0 +1,198 @@
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <driver/spi_master.h>
+#include <driver/gpio.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "rg_host.h"
+
+// An ILI9341 as rg_display drives it: commands with DC low, their parameters and pixels with
+// DC high. Only the commands that affect the frame memory are decoded, the others (power,
+// gamma, rotation) are counted and ignored. The memory is kept in the screen's orientation.
+
+#define PANEL_WIDTH  RG_SCREEN_WIDTH
+#define PANEL_HEIGHT RG_SCREEN_HEIGHT
+
+struct host_spi_device
+{
+    spi_device_interface_config_t config;
+    QueueHandle_t results;
+};
+
+static struct host_spi_device spiDevice;
+static rg_host_panel_counters_t counters;
+static uint16_t framebuffer[PANEL_WIDTH * PANEL_HEIGHT];
+
+static struct
+{
+    uint8_t command;
+    uint8_t params[4];
+    size_t paramCount;
+    int left, right, top, bottom;
+    int x, y;
+    uint8_t pending;    // High byte of a pixel split across two transactions
+    bool hasPending;
+} panel;
+
+
+static void panel_command(uint8_t command)
+{
+    panel.command = command;
+    panel.paramCount = 0;
+    panel.hasPending = false;
+
+    if (command == 0x2C) // Memory write starts at the window's origin
+    {
+        panel.x = panel.left;
+        panel.y = panel.top;
+    }
+}
+
+static void panel_param(uint8_t value)
+{
+    if (panel.paramCount < 4)
+        panel.params[panel.paramCount] = value;
+
+    if (++panel.paramCount != 4)
+        return;
+
+    int start = (panel.params[0] << 8) | panel.params[1];
+    int end = (panel.params[2] << 8) | panel.params[3];
+
+    if (panel.command == 0x2A)
+    {
+        panel.left = RG_MIN(start, PANEL_WIDTH - 1);
+        panel.right = RG_MIN(RG_MAX(end, panel.left), PANEL_WIDTH - 1);
+    }
+    else if (panel.command == 0x2B)
+    {
+        panel.top = RG_MIN(start, PANEL_HEIGHT - 1);
+        panel.bottom = RG_MIN(RG_MAX(end, panel.top), PANEL_HEIGHT - 1);
+        counters.windows++;
+    }
+}
+
+static void panel_pixel(uint16_t pixel)
+{
+    if (panel.y > panel.bottom)
+        return; // Past the window, the real controller ignores it too
+
+    framebuffer[panel.y * PANEL_WIDTH + panel.x] = pixel;
+    counters.pixels++;
+
+    if (++panel.x > panel.right)
+    {
+        panel.x = panel.left;
+        panel.y++;
+    }
+}
+
+static void panel_data(const uint8_t *data, size_t length)
+{
+    if (panel.command != 0x2C && panel.command != 0x3C)
+    {
+        while (length--)
+            panel_param(*data++);
+        return;
+    }
+
+    // Pixels are big endian 565
+    if (panel.hasPending && length > 0)
+    {
+        panel_pixel((panel.pending << 8) | *data++);
+        panel.hasPending = false;
+        length--;
+    }
+    for (; length >= 2; data += 2, length -= 2)
+        panel_pixel((data[0] << 8) | data[1]);
+    if (length)
+    {
+        panel.pending = *data;
+        panel.hasPending = true;
+    }
+}
+
+const uint16_t *rg_host_panel_pixels(void)
+{
+    return framebuffer;
+}
+
+rg_host_panel_counters_t rg_host_panel_get_counters(void)
+{
+    return counters;
+}
+
+bool rg_host_panel_save(const char *filename)
+{
+    FILE *fp = fopen(filename, "wb");
+    if (!fp)
+        return false;
+
+    fprintf(fp, "P6\n%d %d\n255\n", PANEL_WIDTH, PANEL_HEIGHT);
+    for (size_t i = 0; i < PANEL_WIDTH * PANEL_HEIGHT; i++)
+    {
+        uint16_t pixel = framebuffer[i];
+        uint8_t rgb[3] = {
+            ((pixel >> 11) & 0x1F) * 255 / 31,
+            ((pixel >> 5) & 0x3F) * 255 / 63,
+            (pixel & 0x1F) * 255 / 31,
+        };
+        fwrite(rgb, 3, 1, fp);
+    }
+
+    return fclose(fp) == 0;
+}
+
+esp_err_t spi_bus_initialize(spi_host_device_t host, const spi_bus_config_t *config, int dma_chan)
+{
+    return ESP_OK;
+}
+
+esp_err_t spi_bus_add_device(spi_host_device_t host, const spi_device_interface_config_t *config,
+                             spi_device_handle_t *handle)
+{
+    spiDevice.config = *config;
+    spiDevice.results = xQueueCreate(RG_MAX(config->queue_size, 1), sizeof(spi_transaction_t *));
+    *handle = &spiDevice;
+    return ESP_OK;
+}
+
+esp_err_t spi_device_queue_trans(spi_device_handle_t handle, spi_transaction_t *trans, TickType_t ticks)
+{
+    // The transfer is instantaneous, it's done by the time the caller gets the result
+    size_t length = trans->length / 8;
+    const uint8_t *data = (trans->flags & SPI_TRANS_USE_TXDATA) ? trans->tx_data : trans->tx_buffer;
+
+    if (handle->config.pre_cb)
+        handle->config.pre_cb(trans);
+
+    counters.transactions++;
+    counters.bytes += length;
+
+    if (gpio_get_level(RG_GPIO_LCD_DC) == 0)
+    {
+        for (size_t i = 0; i < length; i++)
+            panel_command(data[i]);
+    }
+    else
+    {
+        panel_data(data, length);
+    }
+
+    if (handle->config.post_cb)
+        handle->config.post_cb(trans);
+
+    if (xQueueSend(handle->results, &trans, ticks) != pdTRUE)
+        return ESP_ERR_TIMEOUT;
+
+    return ESP_OK;
+}
+
+esp_err_t spi_device_get_trans_result(spi_device_handle_t handle, spi_transaction_t **trans, TickType_t ticks)
+{
+    if (xQueueReceive(handle->results, trans, ticks) != pdTRUE)
+        return ESP_ERR_TIMEOUT;
+
+    return ESP_OK;
+}
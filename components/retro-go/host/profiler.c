@@ -0,0 +1,95 @@
+#define _GNU_SOURCE
+#include <execinfo.h>
+#include <signal.h>
+#include <ucontext.h>
+#include <sys/time.h>
+#include <string.h>
+#include <stdio.h>
+#include <freertos/FreeRTOS.h>
+
+#include "rg_host.h"
+#include "rg_profiler.h"
+
+// rg_profiler's sampling source. The device interrupts each core with a timer, here ITIMER_PROF
+// sends SIGPROF to whichever thread is using the CPU. The interrupted PC comes from the signal's
+// context and its caller from unwinding through the signal frame. The timer runs on the kernel's
+// tick, rates above CONFIG_HZ (often 250Hz) get that instead.
+
+static void (*sampleFunc)(int core, uintptr_t pc, uintptr_t caller);
+static struct sigaction previousAction;
+static int busy;
+
+
+NO_PROFILE static uintptr_t context_pc(const ucontext_t *context)
+{
+#if defined(__x86_64__)
+    return context->uc_mcontext.gregs[REG_RIP];
+#elif defined(__aarch64__)
+    return context->uc_mcontext.pc;
+#else
+    return 0;
+#endif
+}
+
+NO_PROFILE static void sigprof_handler(int sig, siginfo_t *info, void *context)
+{
+    void *frames[16];
+    uintptr_t pc = context_pc(context);
+    uintptr_t caller = 0;
+
+    // The rings have one writer per core, two threads pinned to the same core may be running
+    if (!pc || !sampleFunc || __atomic_exchange_n(&busy, 1, __ATOMIC_ACQUIRE))
+        return;
+
+    // The handler's own frames and the signal trampoline come first
+    int count = backtrace(frames, 16);
+    for (int i = 0; i < count - 1; i++)
+    {
+        if ((uintptr_t)frames[i] == pc)
+        {
+            caller = (uintptr_t)frames[i + 1];
+            break;
+        }
+    }
+
+    // Like the device's interrupt entry, the handler counts itself in the nesting level
+    int core = rg_host_task_core();
+    port_interruptNesting[core]++;
+    sampleFunc(core, pc, caller);
+    port_interruptNesting[core]--;
+    __atomic_store_n(&busy, 0, __ATOMIC_RELEASE);
+}
+
+bool rg_host_sampler_start(int rate, void (*sample)(int core, uintptr_t pc, uintptr_t caller))
+{
+    struct sigaction action = {.sa_sigaction = &sigprof_handler, .sa_flags = SA_SIGINFO | SA_RESTART};
+    struct itimerval timer = {
+        .it_interval = {.tv_sec = 0, .tv_usec = 1000000 / rate},
+        .it_value = {.tv_sec = 0, .tv_usec = 1000000 / rate},
+    };
+    void *frames[1];
+
+    // The first call loads the unwinder, which isn't something to do in a signal handler
+    backtrace(frames, 1);
+
+    sampleFunc = sample;
+    sigemptyset(&action.sa_mask);
+
+    if (sigaction(SIGPROF, &action, &previousAction) != 0 || setitimer(ITIMER_PROF, &timer, NULL) != 0)
+    {
+        perror("[host] rg_host_sampler_start");
+        sampleFunc = NULL;
+        return false;
+    }
+
+    return true;
+}
+
+void rg_host_sampler_stop(void)
+{
+    struct itimerval timer = {0};
+
+    setitimer(ITIMER_PROF, &timer, NULL);
+    sigaction(SIGPROF, &previousAction, NULL);
+    sampleFunc = NULL;
+}
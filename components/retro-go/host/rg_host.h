@@ -0,0 +1,58 @@
+#pragma once
+
+// The Linux host platform: FreeRTOS and the esp-idf drivers retro-go uses, implemented on
+// POSIX so the emulators can run headless on a workstation (see README.md).
+
+#include "rg_system.h"
+
+typedef struct
+{
+    uint32_t transactions;  // SPI transactions received
+    uint32_t bytes;         // SPI bytes received, commands included
+    uint32_t windows;       // Times CASET/PASET opened a new window
+    uint32_t pixels;        // Pixels written to the panel
+} rg_host_panel_counters_t;
+
+// A frame in a --record file. It's followed by the palette (pixel_mask + 1 entries) if the frame
+// has one, then by height * stride bytes of pixels.
+typedef struct
+{
+    uint32_t magic;
+    uint32_t width;
+    uint32_t height;
+    uint32_t stride;
+    uint32_t flags;
+    uint32_t pixel_mask;
+    uint32_t partial;       // The emulator gave a previous frame to diff against
+} rg_host_record_t;
+
+#define RG_HOST_RECORD_MAGIC 0x46524752 // "RGRF"
+
+// main.c: called by rg_system_tick at the end of each emulated frame
+void rg_host_frame(int busyTime);
+// main.c: called by rg_display_queue_update with every frame the emulator sends
+void rg_host_frame_queued(const rg_video_frame_t *frame, const rg_video_frame_t *previousFrame);
+// main.c: the app's name, that's the executable's (gnuboy-go, ...)
+const char *rg_host_app_name(void);
+// main.c: the emulator should run as fast as it can rather than in real time
+bool rg_host_unthrottled(void);
+
+// freertos.c: the core the calling task is pinned to, 0 for threads that aren't tasks
+int rg_host_task_core(void);
+
+// profiler.c: call `sample` with the interrupted PC and its caller `rate` times per second of
+// CPU time, from a SIGPROF handler in whichever thread was running. rg_profiler's timer interrupt.
+bool rg_host_sampler_start(int rate, void (*sample)(int core, uintptr_t pc, uintptr_t caller));
+void rg_host_sampler_stop(void);
+
+// esp_host.c: drive the gamepad's GPIO and ADC lines as if keys were pressed (GAMEPAD_KEY_*)
+void rg_host_set_gamepad(uint32_t state);
+
+// panel.c: the emulated ILI9341's memory, 16bit 565 in native endianness
+const uint16_t *rg_host_panel_pixels(void);
+rg_host_panel_counters_t rg_host_panel_get_counters(void);
+bool rg_host_panel_save(const char *filename);
+
+// audio.c: where i2s_write sends the samples, NULL discards them
+bool rg_host_audio_open(const char *filename);
+void rg_host_audio_close(void);
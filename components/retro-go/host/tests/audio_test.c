@@ -0,0 +1,239 @@
+#include "rg_test.h"
+#include <math.h>
+#include "rg_audio.c"
+
+// rg_audio's sample paths. The integer DAC conversions against the float code they replaced,
+// which must match bit for bit at every volume, and what each costs. Then the filters' response
+// to a sine sweep, and full scale square waves to check that nothing wraps.
+// Usage: audio_test [iterations]
+
+#define SWEEP_RATE (32000)
+
+static short samples[65536 * 2];
+static short expected[65536 * 2];
+
+
+// The speaker path before the integer kernels
+static void convert_speaker_float(short *samples, size_t sampleCount, float volume)
+{
+    for (size_t i = 0; i < sampleCount; i += 2)
+    {
+        int32_t sample = (samples[i] + samples[i + 1]) >> 1;
+        const float sn = (float)sample / 0x8000;
+        const float range = (127 + 127) * sn * volume;
+        uint16_t dac0, dac1;
+
+        if (range > 127.f)
+        {
+            dac1 = (range - 127);
+            dac0 = 127;
+        }
+        else if (range < -127.f)
+        {
+            dac1 = (range + 127);
+            dac0 = -127;
+        }
+        else
+        {
+            dac1 = 0;
+            dac0 = range;
+        }
+
+        samples[i] = (short)((uint16_t)(0x80 - dac1) << 8);
+        samples[i + 1] = (short)((uint16_t)(dac0 + 0x80) << 8);
+    }
+}
+
+// The external DAC path before the integer kernels
+static void convert_ext_dac_float(short *samples, size_t sampleCount, float volume)
+{
+    for (size_t i = 0; i < sampleCount; ++i)
+    {
+        int32_t sample = samples[i] * volume;
+        samples[i] = sample > 32767 ? 32767 : sample < -32768 ? -32767 : sample;
+    }
+}
+
+static void fill_samples(bool stereo)
+{
+    // Every value on both channels, or every value on the left against noise on the right
+    for (int i = 0; i < 65536; i++)
+    {
+        samples[i * 2] = i - 32768;
+        samples[i * 2 + 1] = stereo ? (short)test_random() : i - 32768;
+    }
+    memcpy(expected, samples, sizeof(samples));
+}
+
+static void test_conversions(int iterations)
+{
+    int64_t time_int[2] = {0}, time_float[2] = {0};
+
+    printf("DAC conversions, ns per sample (integer vs float):\n");
+
+    for (int level = RG_AUDIO_VOL_MIN; level <= RG_AUDIO_VOL_MAX; level++)
+    {
+        float volume = volumeMap[level] * 0.01f;
+        uint32_t scale = volume * 2147483648.f; // As rg_audio_set_volume does
+        int errors = 0;
+
+        for (int pass = 0; pass < 2; pass++)
+        {
+            fill_samples(pass);
+            convert_speaker(samples, 65536 * 2, scale);
+            convert_speaker_float(expected, 65536 * 2, volume);
+            errors += memcmp(samples, expected, sizeof(samples)) != 0;
+        }
+        TEST_CHECK(errors == 0, "convert_speaker differs from the float code at volume %d%%", volumeMap[level]);
+
+        fill_samples(true);
+        convert_ext_dac(samples, 65536 * 2, scale);
+        convert_ext_dac_float(expected, 65536 * 2, volume);
+        TEST_CHECK(memcmp(samples, expected, sizeof(samples)) == 0,
+                   "convert_ext_dac differs from the float code at volume %d%%", volumeMap[level]);
+
+        for (int n = 0; n < iterations; n++)
+        {
+            int64_t start = test_time_ns();
+            convert_speaker(samples, 65536 * 2, scale);
+            time_int[0] += test_time_ns() - start;
+
+            start = test_time_ns();
+            convert_speaker_float(expected, 65536 * 2, volume);
+            time_float[0] += test_time_ns() - start;
+
+            start = test_time_ns();
+            convert_ext_dac(samples, 65536 * 2, scale);
+            time_int[1] += test_time_ns() - start;
+
+            start = test_time_ns();
+            convert_ext_dac_float(expected, 65536 * 2, volume);
+            time_float[1] += test_time_ns() - start;
+        }
+    }
+
+    double count = 65536.0 * 2 * iterations * (RG_AUDIO_VOL_MAX - RG_AUDIO_VOL_MIN + 1);
+    printf("  speaker %6.2f %6.2f\n", time_int[0] / count, time_float[0] / count);
+    printf("  ext_dac %6.2f %6.2f\n", time_int[1] / count, time_float[1] / count);
+}
+
+// Gain in dB of the current filter for a sine at `frequency`, once it has settled
+static float sweep_gain(int frequency)
+{
+    const int length = SWEEP_RATE / 4, settle = SWEEP_RATE / 8;
+    double in = 0, out = 0;
+
+    memset(lowpassState, 0, sizeof(lowpassState));
+    memset(highpassState, 0, sizeof(highpassState));
+
+    for (int i = 0; i < length; i++)
+    {
+        samples[i * 2] = samples[i * 2 + 1] = lrint(16000 * sin(2 * M_PI * frequency * i / SWEEP_RATE));
+        expected[i] = samples[i * 2];
+    }
+
+    filter_samples(samples, length * 2);
+
+    for (int i = settle; i < length; i++)
+    {
+        in += (double)expected[i] * expected[i];
+        out += (double)samples[i * 2] * samples[i * 2];
+        TEST_CHECK(samples[i * 2] == samples[i * 2 + 1], "the channels differ at %dHz", frequency);
+    }
+
+    return 10 * log10(out / in);
+}
+
+static void test_filters(void)
+{
+    const int frequencies[] = {50, 100, 200, 500, 1000, 2000, 5000, 8000, 12000};
+    const char *names[] = {"none", "low-pass", "high-pass", "weighted"};
+
+    audioSink = RG_AUDIO_SINK_SPEAKER;
+    audioSampleRate = SWEEP_RATE;
+    update_source_rate();
+
+    printf("Filter response at %dHz, speaker cutoffs %d/%dHz (dB):\n  %-9s", SWEEP_RATE,
+           filterCutoffs[audioSink].lowpass, filterCutoffs[audioSink].highpass, "");
+    for (int i = 0; i < sizeof(frequencies) / sizeof(frequencies[0]); i++)
+        printf(" %6d", frequencies[i]);
+    printf("\n");
+
+    for (audioFilter = RG_AUDIO_FILTER_LOW_PASS; audioFilter < RG_AUDIO_FILTER_COUNT; audioFilter++)
+    {
+        float gains[sizeof(frequencies) / sizeof(frequencies[0])];
+
+        printf("  %-9s", names[audioFilter]);
+        for (int i = 0; i < sizeof(frequencies) / sizeof(frequencies[0]); i++)
+            printf(" %6.1f", gains[i] = sweep_gain(frequencies[i]));
+        printf("\n");
+
+        bool lowpass = audioFilter != RG_AUDIO_FILTER_HIGH_PASS;
+        bool highpass = audioFilter != RG_AUDIO_FILTER_LOW_PASS;
+
+        // 50, 200, 1000, 5000 and 12000Hz
+        if (lowpass)
+        {
+            TEST_CHECK(fabsf(gains[6] + 3) < 1, "%s: %.1fdB at the cutoff", names[audioFilter], gains[6]);
+            TEST_CHECK(gains[8] < -20, "%s: only %.1fdB at 12kHz", names[audioFilter], gains[8]);
+        }
+        if (highpass)
+        {
+            TEST_CHECK(fabsf(gains[2] + 3) < 1, "%s: %.1fdB at the cutoff", names[audioFilter], gains[2]);
+            TEST_CHECK(gains[0] < -10, "%s: only %.1fdB at 50Hz", names[audioFilter], gains[0]);
+        }
+        TEST_CHECK(fabsf(gains[4]) < 0.5, "%s: %.1fdB in the passband", names[audioFilter], gains[4]);
+    }
+
+    // Full scale square waves overshoot, the result must be clamped rather than wrap around. The
+    // reference is the same filter in double precision, with the same (quantized) coefficients.
+    for (audioFilter = RG_AUDIO_FILTER_LOW_PASS; audioFilter < RG_AUDIO_FILTER_COUNT; audioFilter++)
+    {
+        bool lowpass = audioFilter != RG_AUDIO_FILTER_HIGH_PASS;
+        bool highpass = audioFilter != RG_AUDIO_FILTER_LOW_PASS;
+        double x1 = 0, x2 = 0, y1 = 0, y2 = 0, hp = 0;
+        int worst = 0;
+
+        memset(lowpassState, 0, sizeof(lowpassState));
+        memset(highpassState, 0, sizeof(highpassState));
+
+        for (int i = 0; i < 8192; i++)
+            samples[i] = (i / 64) & 1 ? 32767 : -32768;
+
+        filter_samples(samples, 8192);
+
+        for (int i = 0; i < 8192; i += 2)
+        {
+            double x = (i / 64) & 1 ? 32767 : -32768, y = x;
+            if (lowpass)
+            {
+                y = (lowpassCoefs[0] * x + lowpassCoefs[1] * x1 + lowpassCoefs[2] * x2
+                     - lowpassCoefs[3] * y1 - lowpassCoefs[4] * y2) / 4096;
+                x2 = x1, x1 = x, y2 = y1, y1 = y;
+            }
+            if (highpass)
+            {
+                hp += (y - hp) * highpassCoef / 65536;
+                y -= hp;
+            }
+            y = RG_MIN(RG_MAX(y, -32768), 32767);
+            worst = RG_MAX(worst, abs(samples[i] - (int)lrint(y)));
+        }
+
+        TEST_CHECK(worst < 256, "%s: a square wave is %d away from the reference", names[audioFilter], worst);
+    }
+
+    audioFilter = RG_AUDIO_FILTER_NONE;
+}
+
+int main(int argc, char **argv)
+{
+    int iterations = argc > 1 ? atoi(argv[1]) : 20;
+
+    rg_system_get_app()->logLevel = RG_LOG_WARN;
+
+    test_conversions(iterations);
+    test_filters();
+
+    return TEST_RESULT();
+}
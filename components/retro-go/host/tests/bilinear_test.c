@@ -0,0 +1,225 @@
+#include "rg_test.h"
+#include "rg_display.c"
+
+// The packed blends of the bilinear filter against the per-channel code they replaced, which is
+// the reference: pixel pairs, whole lines at every alignment, then the filter over random rects
+// of the viewport in every scaling and filter mode. Then a micro-benchmark of both.
+// Usage: bilinear_test [iterations]
+
+// Average of two big-endian RGB565 pixels, one channel at a time
+static uint blend_pixels_reference(uint a, uint b)
+{
+    a = ((a << 8) | (a >> 8)) & 0xFFFF;
+    b = ((b << 8) | (b >> 8)) & 0xFFFF;
+    int r0 = (a >> 11) & 0x1F;
+    int g0 = (a >> 5) & 0x3F;
+    int b0 = (a) & 0x1F;
+    int r1 = (b >> 11) & 0x1F;
+    int g1 = (b >> 5) & 0x3F;
+    int b1 = (b) & 0x1F;
+    int rv = (((r1 - r0) >> 1) + r0);
+    int gv = (((g1 - g0) >> 1) + g0);
+    int bv = (((b1 - b0) >> 1) + b0);
+    uint v = (rv << 11) | (gv << 5) | (bv);
+    return ((v << 8) | (v >> 8)) & 0xFFFF;
+}
+
+static void bilinear_filter_reference(uint16_t *line_buffer, int top, int left, int width, int height)
+{
+    const bool *column_is_empty = &screen_column_is_empty[left];
+    const int filter_y = display.config.filter == RG_DISPLAY_FILTER_VERT || display.config.filter == RG_DISPLAY_FILTER_BOTH;
+    const int filter_x = display.config.filter == RG_DISPLAY_FILTER_HORIZ || display.config.filter == RG_DISPLAY_FILTER_BOTH;
+    int fill_line = -1;
+
+    for (int y = 0; y < height; y++)
+    {
+        if (filter_y && y && screen_line_is_empty[top + y])
+        {
+            fill_line = y;
+            continue;
+        }
+
+        if (filter_x)
+        {
+            uint16_t *buffer = line_buffer + y * width;
+            for (int x = 1; x + 1 < width; ++x)
+                if (column_is_empty[x])
+                    buffer[x] = blend_pixels_reference(buffer[x - 1], buffer[x + 1]);
+        }
+
+        if (filter_y && fill_line > 0)
+        {
+            uint16_t *lineA = line_buffer + (fill_line - 1) * width;
+            uint16_t *lineB = line_buffer + (fill_line + 0) * width;
+            uint16_t *lineC = line_buffer + (fill_line + 1) * width;
+            for (int x = 0; x < width; ++x)
+                lineB[x] = blend_pixels_reference(lineA[x], lineC[x]);
+            fill_line = -1;
+        }
+    }
+}
+
+static uint16_t image[RG_SCREEN_WIDTH * RG_SCREEN_HEIGHT + 2];
+static uint16_t expected[RG_SCREEN_WIDTH * RG_SCREEN_HEIGHT + 2];
+
+
+static void test_pixels(void)
+{
+    int errors = 0;
+
+    // Every value of one pixel against random ones, then the extremes of each channel
+    for (uint a = 0; a < 0x10000; a++)
+    {
+        for (int n = 0; n < 64; n++)
+        {
+            uint b = test_random() & 0xFFFF;
+            errors += blend_pixels(a, b) != blend_pixels_reference(a, b);
+        }
+        errors += blend_pixels(a, 0xFFFF) != blend_pixels_reference(a, 0xFFFF);
+        errors += blend_pixels(a, 0) != blend_pixels_reference(a, 0);
+    }
+    TEST_CHECK(errors == 0, "blend_pixels differs from the reference for %d pairs", errors);
+
+    errors = 0;
+    for (int n = 0; n < 1 << 20; n++)
+    {
+        uint32_t a = test_random(), b = test_random();
+        uint32_t v = blend_pixels_x2(a, b);
+        errors += (v & 0xFFFF) != blend_pixels_reference(a & 0xFFFF, b & 0xFFFF);
+        errors += (v >> 16) != blend_pixels_reference(a >> 16, b >> 16);
+    }
+    TEST_CHECK(errors == 0, "blend_pixels_x2 differs from the reference for %d pairs", errors);
+}
+
+static void test_lines(void)
+{
+    uint16_t lines[3][64 + 2], out[64 + 2];
+    int errors = 0;
+
+    // Same alignment for all three like in the line buffers, then mixed ones
+    for (int align = 0; align < 8; align++)
+    {
+        for (int count = 0; count <= 64; count++)
+        {
+            int offset = align & 1, offsetB = (align >> 1) & 1, offsetC = (align >> 2) & 1;
+
+            for (int i = 0; i < 64 + 2; i++)
+            {
+                lines[0][i] = test_random();
+                lines[1][i] = test_random();
+                out[i] = lines[2][i] = test_random();
+            }
+
+            blend_lines(&out[offset], &lines[0][offsetB], &lines[1][offsetC], count);
+
+            for (int i = 0; i < count; i++)
+                errors += out[offset + i] != blend_pixels_reference(lines[0][offsetB + i], lines[1][offsetC + i]);
+            for (int i = 0; i < 64 + 2; i++)
+                errors += (i < offset || i >= offset + count) && out[i] != lines[2][i];
+        }
+    }
+    TEST_CHECK(errors == 0, "blend_lines differs from the reference for %d pixels", errors);
+}
+
+static void test_filter(void)
+{
+    const int sources[][2] = {{256, 240}, {160, 144}, {256, 192}, {256, 224}, {160, 102}};
+    const char *filter_names[] = {"none", "horiz", "vert", "both"};
+
+    display.screen.width = RG_SCREEN_WIDTH;
+    display.screen.height = RG_SCREEN_HEIGHT;
+
+    for (int i = 0; i < sizeof(sources) / sizeof(sources[0]); i++)
+    {
+        for (int scaling = RG_DISPLAY_SCALING_FIT; scaling < RG_DISPLAY_SCALING_COUNT; scaling++)
+        {
+            int width = sources[i][0], height = sources[i][1];
+            float ratio = scaling == RG_DISPLAY_SCALING_FILL ? RG_SCREEN_WIDTH / (float)RG_SCREEN_HEIGHT : width / (float)height;
+
+            display.config.scaling = scaling;
+            update_viewport_size(width, height, ratio);
+
+            for (int filter = RG_DISPLAY_FILTER_HORIZ; filter < RG_DISPLAY_FILTER_COUNT; filter++)
+            {
+                int errors = 0;
+
+                display.config.filter = filter;
+
+                // The whole viewport, then rects of any size and alignment
+                for (int n = 0; n < 200; n++)
+                {
+                    int left = n ? test_random() % display.viewport.width : 0;
+                    int top = n ? test_random() % display.viewport.height : 0;
+                    int w = n ? 1 + test_random() % (display.viewport.width - left) : display.viewport.width;
+                    int h = n ? 1 + test_random() % (display.viewport.height - top) : display.viewport.height;
+                    int offset = test_random() & 1;
+
+                    for (int p = 0; p < w * h + 1; p++)
+                        image[p] = expected[p] = test_random();
+
+                    bilinear_filter(image + offset, top, left, w, h);
+                    bilinear_filter_reference(expected + offset, top, left, w, h);
+
+                    errors += memcmp(image, expected, (w * h + 1) * 2) != 0;
+                }
+
+                TEST_CHECK(errors == 0, "%dx%d %s %s: the filter differs from the reference in %d rects", width,
+                           height, scaling == RG_DISPLAY_SCALING_FILL ? "fill" : "fit", filter_names[filter], errors);
+            }
+        }
+    }
+}
+
+static void bench_blend(int iterations)
+{
+    const int count = RG_SCREEN_WIDTH * RG_SCREEN_HEIGHT / 2;
+    uint16_t *a = image, *b = image + count, *out = expected;
+    volatile uint sink = 0;
+
+    for (int i = 0; i < count * 2; i++)
+        image[i] = test_random();
+
+    printf("Blend, ns per pixel (packed vs per channel):\n");
+
+    int64_t start = test_time_ns();
+    for (int n = 0; n < iterations; n++)
+        for (int i = 0; i < count; i++)
+            sink += blend_pixels(a[i], (b[i] ^ n) & 0xFFFF);
+    int64_t packed = test_time_ns() - start;
+
+    start = test_time_ns();
+    for (int n = 0; n < iterations; n++)
+        for (int i = 0; i < count; i++)
+            sink += blend_pixels_reference(a[i], (b[i] ^ n) & 0xFFFF);
+    int64_t reference = test_time_ns() - start;
+
+    printf("  pixels %9.2f %9.2f\n", packed / (double)(iterations * count), reference / (double)(iterations * count));
+
+    start = test_time_ns();
+    for (int n = 0; n < iterations; n++)
+        blend_lines(out, a, b, count);
+    packed = test_time_ns() - start;
+
+    start = test_time_ns();
+    for (int n = 0; n < iterations; n++)
+        for (int i = 0; i < count; i++)
+            out[i] = blend_pixels_reference(a[i], b[i]);
+    reference = test_time_ns() - start;
+
+    printf("  lines  %9.2f %9.2f\n", packed / (double)(iterations * count), reference / (double)(iterations * count));
+}
+
+int main(int argc, char **argv)
+{
+    int iterations = argc > 1 ? atoi(argv[1]) : 200;
+
+    // update_viewport_size is chatty
+    rg_system_get_app()->logLevel = RG_LOG_WARN;
+
+    test_pixels();
+    test_lines();
+    test_filter();
+    bench_blend(iterations);
+
+    return TEST_RESULT();
+}
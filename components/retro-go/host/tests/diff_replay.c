@@ -0,0 +1,257 @@
+#include "rg_test.h"
+
+// Swept below, see FULL_UPDATE_THRESHOLD
+static float diff_threshold = 0.6f;
+#define FULL_UPDATE_THRESHOLD diff_threshold
+#include "rg_display.c"
+
+// Replays frames through rg_display (frame_diff, write_rect, the SPI layer and the emulated
+// panel) and reports what went over the bus for each of them. After every partial update the
+// panel must be identical to what a full update of the same frame draws.
+//   diff_replay [-v] [recording]
+// The recording is made by the host runner's --record, without one a synthetic sequence is used:
+// a scrolling background, then sprites moving on both sides of a still screen, then a text box,
+// then the lower part of the screen scrolling under a still status bar. The synthetic sequence is
+// also replayed 320 pixels wide, as wide as pce-go's frames get.
+
+// DIFF_RECT_COST is what opening a window (six transactions) is worth in pixels
+#define TRANSACTION_COST (DIFF_RECT_COST * 2 / 6)
+
+typedef struct
+{
+    uint64_t bytes;
+    uint64_t transactions;
+    int full;
+    int mismatches;
+} replay_result_t;
+
+static test_frame_t *frames;
+static int frame_count;
+static rg_video_frame_t video[2];
+static uint16_t panel_copy[RG_SCREEN_WIDTH * RG_SCREEN_HEIGHT];
+static bool verbose;
+
+static const char *scaling_names[] = {"off", "fit", "fill"};
+static const char *filter_names[] = {"none", "horiz", "vert", "both"};
+
+
+static void make_synthetic(int width, int height)
+{
+    const rg_host_record_t header = {RG_HOST_RECORD_MAGIC, width, height, width, RG_PIXEL_PAL|RG_PIXEL_565|RG_PIXEL_BE, 0xFF, 1};
+
+    for (int i = 0; i < 160; i++)
+    {
+        test_frame_t *frame = test_add_frame(&frames, &frame_count, &header);
+        int scroll = i < 40 ? i * 2 : 80;
+        int status_bar = i < 120 ? 0 : 96;
+
+        if (i >= 120)
+            scroll = (i - 120) * 3;
+
+        for (int c = 0; c < 256; c++)
+            frame->palette[c] = c * 0x0101 + 0x1234;
+
+        for (int y = 0; y < height; y++)
+            for (int x = 0; x < width; x++)
+                frame->pixels[y * width + x] = ((((x + (y < status_bar ? 0 : scroll)) >> 3) ^ (y >> 3)) & 7) * 8 + ((x + y) & 3);
+
+        // Sprites on both sides of the screen
+        if (i >= 40 && i < 120)
+        {
+            int sprite_y = 16 + (i - 40) * 2;
+            for (int y = sprite_y; y < sprite_y + 16; y++)
+                for (int x = 0; x < 16; x++)
+                {
+                    frame->pixels[y * width + 8 + x] = 200 + (x ^ y);
+                    frame->pixels[y * width + width - 24 + x] = 220 + (x & y);
+                }
+        }
+
+        // A text box printing one character per frame, the last frames are still
+        if (i >= 80 && i < 120)
+        {
+            for (int y = height - 64; y < height - 16; y++)
+                memset(&frame->pixels[y * width + 24], 1, width - 48);
+            for (int c = 0; c < RG_MIN(i - 80, 30); c++)
+                for (int y = 0; y < 8; y++)
+                    for (int x = 0; x < 6; x++)
+                        frame->pixels[(height - 56 + (c / 15) * 16 + y) * width + 32 + (c % 15) * 12 + x] = (x * y + c) & 1 ? 255 : 1;
+        }
+    }
+}
+
+static void wait_display_idle(rg_video_frame_t *frame)
+{
+    rg_display_wait_frame_release(frame);
+}
+
+static void load_frame(rg_video_frame_t *frame, const test_frame_t *replay)
+{
+    frame->flags = replay->header.flags;
+    frame->width = replay->header.width;
+    frame->height = replay->header.height;
+    frame->stride = replay->header.stride;
+    frame->pixel_mask = replay->header.pixel_mask;
+    frame->palette = (void *)replay->palette;
+    memcpy(frame->buffer, replay->pixels, replay->header.stride * replay->header.height);
+}
+
+static replay_result_t replay(display_scaling_t scaling, display_filter_t filter, bool check)
+{
+    replay_result_t result = {0};
+    rg_video_frame_t *previous = NULL;
+
+    rg_display_set_scaling(scaling);
+    rg_display_set_filter(filter);
+
+    for (int i = 0; i < frame_count; i++)
+    {
+        const test_frame_t *replay = &frames[i];
+        rg_video_frame_t *frame = &video[i % 2];
+
+        wait_display_idle(frame);
+        load_frame(frame, replay);
+
+        rg_host_panel_counters_t before = rg_host_panel_get_counters();
+        rg_update_t update = rg_display_queue_update(frame, replay->header.partial ? previous : NULL);
+        wait_display_idle(frame);
+        rg_host_panel_counters_t after = rg_host_panel_get_counters();
+
+        result.bytes += after.bytes - before.bytes;
+        result.transactions += after.transactions - before.transactions;
+        result.full += update == RG_UPDATE_FULL;
+
+        if (verbose)
+            printf("  frame %4d: %6u bytes, %4u transactions, %2u rects%s\n", i, after.bytes - before.bytes,
+                   after.transactions - before.transactions, frame->diff_count,
+                   update == RG_UPDATE_FULL ? ", full" : update == RG_UPDATE_EMPTY ? ", empty" : "");
+
+        if (check && update != RG_UPDATE_FULL)
+        {
+            // The full update doesn't hash the lines but the frame's hashes are still good
+            bool hashes_valid = frame->line_hash_valid;
+
+            memcpy(panel_copy, rg_host_panel_pixels(), sizeof(panel_copy));
+            display.config.update = RG_DISPLAY_UPDATE_FULL;
+            rg_display_queue_update(frame, NULL);
+            wait_display_idle(frame);
+            display.config.update = RG_DISPLAY_UPDATE_PARTIAL;
+            frame->line_hash_valid = hashes_valid;
+
+            if (memcmp(panel_copy, rg_host_panel_pixels(), sizeof(panel_copy)) != 0)
+                result.mismatches++;
+        }
+
+        previous = frame;
+    }
+
+    return result;
+}
+
+static void check_partial_updates(void)
+{
+    for (int scaling = 0; scaling < RG_DISPLAY_SCALING_COUNT; scaling++)
+    {
+        for (int filter = 0; filter < RG_DISPLAY_FILTER_COUNT; filter++)
+        {
+            if (scaling == RG_DISPLAY_SCALING_OFF && filter != RG_DISPLAY_FILTER_OFF)
+                continue;
+            replay_result_t result = replay(scaling, filter, true);
+            printf("  scaling %-4s filter %-5s: %d mismatches\n", scaling_names[scaling], filter_names[filter],
+                   result.mismatches);
+            TEST_CHECK(result.mismatches == 0, "the panel differs after %d partial updates", result.mismatches);
+        }
+    }
+}
+
+static void free_frames(void)
+{
+    for (int i = 0; i < frame_count; i++)
+        free(frames[i].pixels);
+    free(frames);
+    frames = NULL;
+    frame_count = 0;
+}
+
+int main(int argc, char **argv)
+{
+    const float thresholds[] = {0.2f, 0.4f, 0.6f, 0.8f, 1.0f};
+    const char *recording = NULL;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-v") == 0)
+            verbose = true;
+        else
+            recording = argv[i];
+    }
+
+    if (recording && !test_load_recording(recording, &frames, &frame_count))
+    {
+        printf("Can't read recording '%s'\n", recording);
+        return 1;
+    }
+    else if (!recording)
+    {
+        make_synthetic(256, 240);
+    }
+
+    rg_system_get_app()->logLevel = RG_LOG_WARN;
+    rg_settings_init("diff_replay");
+    rg_display_init();
+    while (!display_task_queue)
+        usleep(1000);
+
+    for (int i = 0; i < 2; i++)
+        video[i].buffer = calloc(256, 1024);
+
+    printf("Partial updates against full updates, %d frames:\n", frame_count);
+    check_partial_updates();
+
+    printf("SPI traffic per frame by FULL_UPDATE_THRESHOLD (scaling fill, filter horiz):\n");
+    printf("  %9s %9s %12s %6s %11s\n", "threshold", "bytes", "transactions", "full", "cost");
+    for (int i = 0; i < sizeof(thresholds) / sizeof(thresholds[0]); i++)
+    {
+        diff_threshold = thresholds[i];
+        replay_result_t result = replay(RG_DISPLAY_SCALING_FILL, RG_DISPLAY_FILTER_HORIZ, false);
+        printf("  %9.1f %9.0f %12.1f %6d %11.0f\n", diff_threshold, result.bytes / (double)frame_count,
+               result.transactions / (double)frame_count, result.full,
+               (result.bytes + result.transactions * TRANSACTION_COST) / (double)frame_count);
+    }
+
+    printf("Interlaced updates (scaling fill, filter horiz):\n");
+    diff_threshold = 0.6f;
+    display.config.update = RG_DISPLAY_UPDATE_INTERLACE;
+    replay_result_t result = replay(RG_DISPLAY_SCALING_FILL, RG_DISPLAY_FILTER_HORIZ, false);
+    printf("  %9.0f bytes %6.1f transactions per frame\n", result.bytes / (double)frame_count,
+           result.transactions / (double)frame_count);
+
+    // Both fields of a frame draw what a full update does
+    int mismatches = 0;
+    for (int i = 0; i < frame_count; i += 8)
+    {
+        load_frame(&video[0], &frames[i]);
+        for (int field = 0; field < 2; field++)
+        {
+            rg_display_queue_update(&video[0], NULL);
+            wait_display_idle(&video[0]);
+        }
+        memcpy(panel_copy, rg_host_panel_pixels(), sizeof(panel_copy));
+        display.config.update = RG_DISPLAY_UPDATE_FULL;
+        rg_display_queue_update(&video[0], NULL);
+        wait_display_idle(&video[0]);
+        display.config.update = RG_DISPLAY_UPDATE_INTERLACE;
+        mismatches += memcmp(panel_copy, rg_host_panel_pixels(), sizeof(panel_copy)) != 0;
+    }
+    display.config.update = RG_DISPLAY_UPDATE_PARTIAL;
+    TEST_CHECK(mismatches == 0, "the two fields differ from a full update in %d frames", mismatches);
+
+    // Wider than the 256 columns the filter tables used to have
+    free_frames();
+    make_synthetic(320, 224);
+    printf("Partial updates against full updates, 320x224:\n");
+    check_partial_updates();
+
+    free_frames();
+    return TEST_RESULT();
+}
@@ -0,0 +1,362 @@
+#include "rg_test.h"
+#include "rg_display.c"
+
+// Micro-benchmarks of rg_display's pixel work, without the SPI bus. The scaler's frames are filled
+// with noise so that nothing can be skipped. The diff runs on sequences of frames: a still menu, a
+// text box, a scrolling screen and, if given, a recording from the host runner's --record.
+// Usage: display_bench [iterations] [recording]
+
+typedef struct
+{
+    const char *name;
+    int width, height, stride;
+    uint32_t flags;
+} bench_frame_t;
+
+static const bench_frame_t bench_frames[] = {
+    {"NES", 256, 240, 256, RG_PIXEL_PAL|RG_PIXEL_565|RG_PIXEL_BE},
+    {"GB", 160, 144, 320, RG_PIXEL_565|RG_PIXEL_BE},
+    {"SMS", 256, 192, 256, RG_PIXEL_PAL|RG_PIXEL_565|RG_PIXEL_BE},
+    {"SNES", 256, 224, 512, RG_PIXEL_565|RG_PIXEL_LE},
+};
+
+static const char *scaling_names[] = {"off", "fit", "fill"};
+static const char *filter_names[] = {"none", "horiz", "vert", "both"};
+
+static uint16_t palette[256];
+static uint16_t output[RG_SCREEN_WIDTH * (RG_SCREEN_HEIGHT + 1)];
+static uint16_t reference[RG_SCREEN_WIDTH * (RG_SCREEN_HEIGHT + 1)];
+
+
+static void alloc_frame(rg_video_frame_t *frame, const bench_frame_t *def)
+{
+    memset(frame, 0, sizeof(rg_video_frame_t));
+    frame->flags = def->flags;
+    frame->width = def->width;
+    frame->height = def->height;
+    frame->stride = def->stride;
+    frame->pixel_mask = 0xFF;
+    frame->palette = palette;
+    frame->buffer = malloc(def->stride * def->height);
+
+    for (int i = 0; i < def->stride * def->height; i += 4)
+        *(uint32_t *)(frame->buffer + i) = test_random();
+}
+
+static void set_viewport(const rg_video_frame_t *frame, display_scaling_t scaling, display_filter_t filter)
+{
+    display.screen.width = RG_SCREEN_WIDTH;
+    display.screen.height = RG_SCREEN_HEIGHT;
+    display.spi.bufferLength = SPI_BUFFER_LENGTH;
+    display.config.scaling = scaling;
+    display.config.filter = filter;
+
+    // Same as display_task
+    float ratio = 0.0;
+    if (scaling == RG_DISPLAY_SCALING_FILL)
+        ratio = display.screen.width / (float)display.screen.height;
+    else if (scaling == RG_DISPLAY_SCALING_FIT)
+        ratio = frame->width / (float)frame->height;
+    update_viewport_size(frame->width, frame->height, ratio);
+
+    if (frame->flags & RG_PIXEL_PAL)
+        update_palette_lut(frame);
+}
+
+// The scaler before the column tables: an accumulator stepped for every pixel, then a second
+// pass to swap little endian pixels.
+static void convert_line_stepping(uint16_t *dst, const uint8_t *buffer, const rg_video_frame_t *frame)
+{
+    const int screen_width = display.screen.width;
+    const int x_inc = screen_width / display.viewport.x_scale;
+    const uint16_t *palette = (frame->flags & RG_PIXEL_PAL) ? frame->palette : NULL;
+    int count = 0;
+
+    for (int x = 0, x_acc = 0; x < frame->width;)
+    {
+        dst[count++] = palette ? palette[buffer[x] & frame->pixel_mask] : ((uint16_t *)buffer)[x];
+
+        x_acc += x_inc;
+        while (x_acc >= screen_width)
+        {
+            ++x;
+            x_acc -= screen_width;
+        }
+    }
+
+    if (frame->flags & RG_PIXEL_LE)
+    {
+        while (count--)
+            dst[count] = (dst[count] >> 8) | (dst[count] << 8);
+    }
+}
+
+// write_rect's work for a full frame, into `out` instead of SPI buffers. Returns the lines.
+static int scale_frame(const rg_video_frame_t *frame, uint16_t *out, bool stepping)
+{
+    const int width = display.viewport.width;
+    const int top = display.viewport.y_pos;
+    const int bottom = RG_MIN(top + (int)display.viewport.height, RG_SCREEN_HEIGHT);
+    const uint8_t *buffer = frame->buffer;
+    int screen_y = top;
+
+    for (int y = 0; y < frame->height && screen_y < bottom;)
+    {
+        uint16_t *line = out + (screen_y - top) * width;
+
+        if (screen_y > top && screen_line_is_empty[screen_y])
+            memcpy(line, line - width, width * 2);
+        else if (stepping)
+            convert_line_stepping(line, buffer, frame);
+        else
+            convert_line(line, buffer, 0, width, frame->flags & RG_PIXEL_MASK);
+
+        if (!screen_line_is_empty[++screen_y])
+        {
+            buffer += frame->stride;
+            ++y;
+        }
+    }
+
+    if (display.config.scaling && display.config.filter)
+        bilinear_filter(out, top, 0, width, screen_y - top);
+
+    return screen_y - top;
+}
+
+// frame_diff before the line hashes: every line of both frames is compared
+static int frame_diff_compare(rg_video_frame_t *frame, rg_video_frame_t *prevFrame)
+{
+    int threshold_remaining = frame->width * frame->height * FULL_UPDATE_THRESHOLD;
+    int pixel_size = (frame->flags & RG_PIXEL_PAL) ? 1 : 2;
+    int lines_changed = 0;
+
+    uint32_t u32_blocks = (frame->width * pixel_size / 4);
+    uint32_t u32_pixels = 4 / pixel_size;
+
+    frame->diff_count = 0;
+
+    for (int y = 0, i = 0; y < frame->height; ++y, i += frame->stride)
+    {
+        uint32_t *buffer = frame->buffer + i;
+        uint32_t *prevBuffer = prevFrame->buffer + i;
+        int span_left = -1, span_right = -1;
+
+        for (int x = 0; x < u32_blocks; ++x)
+        {
+            if (buffer[x] == prevBuffer[x])
+                continue;
+
+            int left = x * u32_pixels;
+            while (x < u32_blocks && buffer[x] != prevBuffer[x])
+                ++x;
+            int right = x * u32_pixels;
+
+            if (span_left >= 0 && left - span_right > DIFF_RECT_COST)
+            {
+                add_diff_span(frame, span_left, span_right, y);
+                threshold_remaining -= span_right - span_left;
+                span_left = left;
+            }
+            else if (span_left < 0)
+            {
+                span_left = left;
+            }
+            span_right = right;
+        }
+
+        if (span_left >= 0)
+        {
+            add_diff_span(frame, span_left, span_right, y);
+            threshold_remaining -= span_right - span_left;
+            lines_changed++;
+        }
+
+        if (threshold_remaining <= 0)
+        {
+            set_full_diff(frame);
+            return frame->height;
+        }
+    }
+
+    merge_overlapping_rects(frame);
+
+    return lines_changed;
+}
+
+static test_frame_t *make_sequence(const char *name, int *count)
+{
+    const rg_host_record_t header = {RG_HOST_RECORD_MAGIC, 256, 240, 256, RG_PIXEL_PAL|RG_PIXEL_565|RG_PIXEL_BE, 0xFF, 1};
+    test_frame_t *frames = NULL;
+
+    *count = 0;
+
+    for (int i = 0; i < 60; i++)
+    {
+        test_frame_t *frame = test_add_frame(&frames, count, &header);
+        int scroll = strcmp(name, "scroll") == 0 ? i * 2 : 0;
+
+        for (int y = 0; y < 240; y++)
+            for (int x = 0; x < 256; x++)
+                frame->pixels[y * 256 + x] = ((((x + scroll) >> 3) ^ (y >> 3)) & 7) * 8 + ((x + y) & 3);
+
+        // A text box printing one character per frame
+        if (strcmp(name, "text") == 0)
+        {
+            for (int y = 176; y < 224; y++)
+                memset(&frame->pixels[y * 256 + 24], 1, 208);
+            for (int c = 0; c < RG_MIN(i, 30); c++)
+                for (int y = 0; y < 8; y++)
+                    for (int x = 0; x < 6; x++)
+                        frame->pixels[(184 + (c / 15) * 16 + y) * 256 + 32 + (c % 15) * 12 + x] = (x * y + c) & 1 ? 255 : 1;
+        }
+    }
+
+    return frames;
+}
+
+static void bench_diff_sequence(const char *name, test_frame_t *frames, int count, int iterations)
+{
+    rg_video_frame_t *video = calloc(count, sizeof(rg_video_frame_t));
+    int mismatches = 0;
+
+    if (count < 2)
+        return;
+
+    for (int i = 0; i < count; i++)
+    {
+        video[i].flags = frames[i].header.flags;
+        video[i].width = frames[i].header.width;
+        video[i].height = frames[i].header.height;
+        video[i].stride = frames[i].header.stride;
+        video[i].pixel_mask = frames[i].header.pixel_mask;
+        video[i].buffer = frames[i].pixels;
+    }
+
+    // Same rects both ways, and the counters of a single pass
+    memset(&display.counters, 0, sizeof(display.counters));
+    for (int i = 1; i < count; i++)
+    {
+        rg_video_frame_t expected = video[i];
+        int lines = frame_diff(&video[i], &video[i - 1]);
+        if (frame_diff_compare(&expected, &video[i - 1]) != lines || expected.diff_count != video[i].diff_count
+            || memcmp(expected.diff, video[i].diff, video[i].diff_count * sizeof(rg_diff_rect_t)) != 0)
+            mismatches++;
+    }
+    uint32_t skipped = display.counters.linesSkipped;
+    uint32_t compared = display.counters.linesCompared;
+    TEST_CHECK(mismatches == 0, "%s: the hashed diff differs from the comparison in %d frames", name, mismatches);
+
+    int64_t start = test_time_ns();
+    for (int n = 0; n < iterations; n++)
+        for (int i = 1; i < count; i++)
+            frame_diff(&video[i], &video[i - 1]);
+    int64_t hashed = test_time_ns() - start;
+
+    start = test_time_ns();
+    for (int n = 0; n < iterations; n++)
+        for (int i = 1; i < count; i++)
+            frame_diff_compare(&video[i], &video[i - 1]);
+    int64_t compare = test_time_ns() - start;
+
+    printf("%-10s %6d %9u %9u %9.1f %9.1f\n", name, count, skipped, compared,
+           hashed / (double)(iterations * (count - 1)) / 1000, compare / (double)(iterations * (count - 1)) / 1000);
+
+    free(video);
+}
+
+static void bench_diff(int iterations, const char *recording)
+{
+    const char *sequences[] = {"still", "text", "scroll"};
+    display_filter_t filter = display.config.filter;
+    test_frame_t *frames = NULL;
+    int count = 0;
+
+    // The filter's rect adjustments are left out, the old diff did the same ones
+    display.config.filter = RG_DISPLAY_FILTER_OFF;
+
+    printf("Diff, us per frame (line hashes vs comparing every line):\n");
+    printf("%-10s %6s %9s %9s %9s %9s\n", "sequence", "frames", "skipped", "compared", "hashes", "compare");
+
+    for (int i = 0; i < sizeof(sequences) / sizeof(sequences[0]); i++)
+    {
+        frames = make_sequence(sequences[i], &count);
+        bench_diff_sequence(sequences[i], frames, count, iterations);
+        for (int j = 0; j < count; j++)
+            free(frames[j].pixels);
+        free(frames);
+    }
+
+    frames = NULL, count = 0;
+    if (recording && test_load_recording(recording, &frames, &count))
+        bench_diff_sequence("recording", frames, count, RG_MAX(iterations / 10, 1));
+    else if (recording)
+        TEST_CHECK(false, "Can't read recording '%s'", recording);
+
+    display.config.filter = filter;
+}
+
+static void bench_scaler(int iterations)
+{
+    printf("Scaler, ns per screen line (column tables vs per-pixel stepping):\n");
+    printf("%-6s %-5s %-6s %5s %9s %9s\n", "frame", "scale", "filter", "lines", "tables", "stepping");
+
+    for (int i = 0; i < sizeof(bench_frames) / sizeof(bench_frames[0]); i++)
+    {
+        rg_video_frame_t frame;
+        alloc_frame(&frame, &bench_frames[i]);
+
+        for (int scaling = 0; scaling < RG_DISPLAY_SCALING_COUNT; scaling++)
+        {
+            for (int filter = 0; filter < RG_DISPLAY_FILTER_COUNT; filter++)
+            {
+                if (scaling == RG_DISPLAY_SCALING_OFF && filter != RG_DISPLAY_FILTER_OFF)
+                    continue; // Filters only apply when scaling
+
+                set_viewport(&frame, scaling, filter);
+
+                int lines = scale_frame(&frame, output, false);
+                if (filter == RG_DISPLAY_FILTER_OFF)
+                {
+                    scale_frame(&frame, reference, true);
+                    TEST_CHECK(memcmp(output, reference, lines * display.viewport.width * 2) == 0,
+                               "%s %s: the tables don't scale like the stepping", bench_frames[i].name,
+                               scaling_names[scaling]);
+                }
+
+                int64_t start = test_time_ns();
+                for (int n = 0; n < iterations; n++)
+                    scale_frame(&frame, output, false);
+                int64_t tables = test_time_ns() - start;
+
+                start = test_time_ns();
+                for (int n = 0; n < iterations; n++)
+                    scale_frame(&frame, output, true);
+                int64_t stepping = test_time_ns() - start;
+
+                printf("%-6s %-5s %-6s %5d %9.1f %9.1f\n", bench_frames[i].name, scaling_names[scaling],
+                       filter_names[filter], lines, tables / (double)(iterations * lines),
+                       stepping / (double)(iterations * lines));
+            }
+        }
+
+        free(frame.buffer);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int iterations = argc > 1 ? atoi(argv[1]) : 200;
+    const char *recording = argc > 2 ? argv[2] : NULL;
+
+    // update_viewport_size is chatty
+    rg_system_get_app()->logLevel = RG_LOG_WARN;
+
+    for (int i = 0; i < 256; i++)
+        palette[i] = test_random();
+
+    bench_scaler(iterations);
+    bench_diff(iterations, recording);
+
+    return TEST_RESULT();
+}
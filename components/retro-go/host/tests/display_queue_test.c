@@ -0,0 +1,101 @@
+#include "rg_test.h"
+#include "rg_display.c"
+
+// How fast the emulator side of the display queue wakes up. rg_display_queue_update must return
+// as soon as display_task takes a frame, even if the frame's transactions aren't done yet, and a
+// release must wake every task waiting for one, not only the first. Both used to fall back on
+// a 10ms timeout, the checks allow half of that.
+
+#define ROUNDS (20)
+#define SLOW_US (5000)
+
+static rg_video_frame_t frames[2];
+static int64_t woken[2];
+
+
+static void waiter_task(void *arg)
+{
+    int index = (intptr_t)arg;
+    rg_display_wait_frame_release(&frames[0]);
+    woken[index] = get_elapsed_time();
+    vTaskDelete(NULL);
+}
+
+static void test_release_waiters(void)
+{
+    int slow = 0;
+
+    for (int n = 0; n < ROUNDS; n++)
+    {
+        woken[0] = woken[1] = 0;
+        frame_retain(&frames[0]);
+
+        xTaskCreatePinnedToCore(&waiter_task, "waiter0", 2048, (void *)0, 5, NULL, 1);
+        xTaskCreatePinnedToCore(&waiter_task, "waiter1", 2048, (void *)1, 5, NULL, 1);
+        usleep(20 * 1000); // Both are blocked by now
+
+        int64_t released = get_elapsed_time();
+        frame_release(&frames[0]);
+
+        while (!woken[0] || !woken[1])
+            usleep(100);
+
+        slow += RG_MAX(woken[0], woken[1]) - released > SLOW_US;
+    }
+
+    TEST_CHECK(slow == 0, "a release took more than %dus to wake both waiters %d times", SLOW_US, slow);
+}
+
+static void test_queue_room(void)
+{
+    int64_t blocked = 0, worst = 0;
+
+    rg_display_set_queue_depth(1);
+
+    for (int n = 0; n < ROUNDS; n++)
+    {
+        rg_video_frame_t *frame = &frames[n % 2];
+
+        // Its transactions stay in flight, only display_task taking it may unblock the next one
+        frame_retain(frame);
+        rg_display_queue_update(frame, NULL);
+
+        int64_t start = get_elapsed_time();
+        rg_display_queue_update(&frames[(n + 1) % 2], NULL);
+        int64_t elapsed = get_elapsed_time_since(start);
+
+        blocked += elapsed;
+        worst = RG_MAX(worst, elapsed);
+
+        rg_display_wait_frame_release(&frames[(n + 1) % 2]);
+        frame_release(frame);
+    }
+
+    printf("  queue room: %.0fus on average, %lldus at worst\n", blocked / (double)ROUNDS, (long long)worst);
+    TEST_CHECK(worst < SLOW_US, "rg_display_queue_update blocked for %lldus after the display took the frame",
+               (long long)worst);
+}
+
+int main(int argc, char **argv)
+{
+    rg_system_get_app()->logLevel = RG_LOG_WARN;
+    rg_settings_init("display_queue_test");
+    rg_display_init();
+    while (!display_task_queue)
+        usleep(1000);
+
+    // Small frames, display_task is done with them long before the old timeout
+    for (int i = 0; i < 2; i++)
+    {
+        frames[i].flags = RG_PIXEL_565|RG_PIXEL_BE;
+        frames[i].width = frames[i].height = 32;
+        frames[i].stride = 64;
+        frames[i].buffer = calloc(32, 64);
+    }
+
+    printf("Display queue wake-ups:\n");
+    test_release_waiters();
+    test_queue_room();
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,71 @@
+#include "rg_test.h"
+
+// rg_system_frame_sync against a simulated clock. usleep moves the clock forward instead of
+// sleeping, the emulated frames take a random share of the frame time and now and then run
+// over. The long-run rate must stay within 0.1% of app->refreshRate, the late frames are paid
+// back by the next ones, and a pause must restart the clock rather than cause a burst.
+
+#include <unistd.h>
+
+#define FRAMES (20000)
+
+static int64_t fake_time;
+
+#undef get_elapsed_time
+#define get_elapsed_time() (fake_time)
+#define usleep(us) (fake_time += (us))
+// The test runs outside of the runner, which would pace nothing without --realtime
+#define rg_host_unthrottled() (false)
+
+#include "rg_system.c"
+
+static void test_rate(int rate)
+{
+    const int period = 1000000 / rate;
+    int overruns = 0, bursts = 0;
+
+    app.refreshRate = rate;
+    rg_system_frame_sync(); // Starts the clock
+
+    int64_t start = fake_time;
+
+    for (int n = 0; n < FRAMES; n++)
+    {
+        // Mostly 20% to 95% of the frame time, one frame in 50 takes up to three frames
+        int work = n % 50 ? period / 5 + test_random() % (period * 3 / 4) : period + test_random() % (period * 2);
+        overruns += work > period;
+        fake_time += work;
+        rg_system_frame_sync();
+    }
+
+    double measured = FRAMES / ((fake_time - start) / 1000000.0);
+    double error = (measured - rate) / rate;
+
+    // A pause, the frames that follow still come one period apart at most
+    fake_time += FRAME_CLOCK_MAX_LAG * 5;
+    rg_system_frame_sync();
+    for (int n = 0; n < 100; n++)
+    {
+        int64_t before = fake_time;
+        fake_time += period / 2;
+        rg_system_frame_sync();
+        bursts += fake_time - before < period - 1;
+    }
+
+    printf("  %3d Hz: %d frames, %d overruns, %.3f Hz measured (%+.4f%%)\n", rate, FRAMES, overruns,
+           measured, error * 100);
+    TEST_CHECK(error < 0.001 && error > -0.001, "%.3f Hz measured at %d Hz", measured, rate);
+    TEST_CHECK(bursts == 0, "%d frames ran early after a pause", bursts);
+}
+
+int main(int argc, char **argv)
+{
+    app.logLevel = RG_LOG_WARN;
+
+    printf("Frame pacing with jittered frame times:\n");
+    test_rate(50);
+    test_rate(60);
+    test_rate(75);
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,81 @@
+#include "rg_test.h"
+#include "sound.c"
+
+// CPU time gnuboy spends mixing one emulated second of sound, at the output rate it used to mix at
+// and at the rate main.c now hands to rg_audio_set_source_rate. It also checks that the channels
+// produce the rate main.c declares, (1 << 21) / snd.rate, and not the one pcm.hz asked for.
+// Usage: gnuboy_audio_bench [seconds]
+
+#define FRAMES_PER_SECOND (60)
+#define CYCLES_PER_SECOND (1 << 21)
+
+hw_t hw;
+struct ram ram;
+
+static n16 buffer[4096];
+
+
+// A bit of everything, the notes are retriggered every frame like a tune would
+static void play_notes(int frame)
+{
+    sound_write(RI_NR12, 0xF3);
+    sound_write(RI_NR13, frame * 7);
+    sound_write(RI_NR14, 0x80 | 5);
+    sound_write(RI_NR22, 0xA2);
+    sound_write(RI_NR23, 0x40);
+    sound_write(RI_NR24, 0x80 | 6);
+    sound_write(RI_NR30, 0x80);
+    sound_write(RI_NR32, 0x20);
+    sound_write(RI_NR33, frame * 3);
+    sound_write(RI_NR34, 0x80 | 4);
+    sound_write(RI_NR42, 0xF1);
+    sound_write(RI_NR43, 0x24 + (frame & 8));
+    sound_write(RI_NR44, 0x80);
+}
+
+static void bench_rate(int hz, int seconds)
+{
+    int64_t elapsed = 0;
+    size_t produced = 0;
+
+    pcm = (pcm_t){.hz = hz, .stereo = 1, .len = 4096, .buf = buffer};
+    sound_reset(true);
+    sound_write(RI_NR52, 0x80);
+    sound_write(RI_NR50, 0x77);
+    sound_write(RI_NR51, 0xFF);
+
+    for (int frame = 0; frame < seconds * FRAMES_PER_SECOND; frame++)
+    {
+        // Whole seconds have a whole number of cycles, the frames make up for the rounding
+        int cycles = CYCLES_PER_SECOND * (frame % FRAMES_PER_SECOND + 1) / FRAMES_PER_SECOND
+                   - CYCLES_PER_SECOND * (frame % FRAMES_PER_SECOND) / FRAMES_PER_SECOND;
+        int64_t start = test_time_ns();
+
+        play_notes(frame);
+        snd.cycles += cycles;
+        sound_mix();
+
+        elapsed += test_time_ns() - start;
+        produced += pcm.pos >> 1;
+        pcm.pos = 0;
+    }
+
+    int declared = CYCLES_PER_SECOND / snd.rate;
+    printf("  %5dHz: %3d cycles per sample, %5d samples per second, %.2fms per emulated second\n",
+           hz, snd.rate, (int)(produced / seconds), elapsed / 1e6 / seconds);
+    TEST_CHECK(abs((int)(produced / seconds) - declared) <= 1, "%dHz produced %d samples per second, not %d",
+               hz, (int)(produced / seconds), declared);
+}
+
+int main(int argc, char **argv)
+{
+    int seconds = argc > 1 ? atoi(argv[1]) : 60;
+
+    rg_system_get_app()->logLevel = RG_LOG_WARN;
+
+    printf("gnuboy sound mixing:\n");
+    bench_rate(32000, seconds);
+    bench_rate((1 << 21) / 96, seconds);
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,65 @@
+#include "rg_test.h"
+#include "rg_system.c"
+
+// rg_system_log's ring, with this test standing in for the system monitor. Queued messages must
+// keep their time and their 64bit arguments, and a writer must wake the monitor once per burst,
+// even when a flush couldn't get the ring back under half.
+
+static int wake_ups(void)
+{
+    return ulTaskNotifyTake(pdTRUE, 0);
+}
+
+static void test_format(void)
+{
+    unsigned sec, ms;
+    char text[64];
+
+    usleep(25 * 1000); // Something other than 0.000
+    rg_system_log(RG_LOG_INFO, "log_test", "%zu %zd %d %s\n", (size_t)SIZE_MAX, (ssize_t)-2, 42, "end");
+    uint32_t queued = logRing[(logHead - 1) & (LOG_RING_LENGTH - 1)].time;
+    log_flush(false);
+
+    const char *line = strstr(app.log.buffer, "[info ");
+    TEST_CHECK(line && sscanf(line, "[info %u.%u] log_test: %63[^\n]", &sec, &ms, text) == 3,
+               "unexpected line: %s", line ? line : app.log.buffer);
+    TEST_CHECK(sec * 1000 + ms == queued, "the line says %u.%03u, the message was queued at %u", sec, ms, queued);
+    TEST_CHECK(strcmp(text, "18446744073709551615 -2 42 end") == 0, "the arguments came out as '%s'", text);
+}
+
+static void test_wake_ups(void)
+{
+    wake_ups();
+
+    for (int i = 0; i < LOG_RING_LENGTH * 3 / 4; i++)
+        rg_system_log(RG_LOG_INFO, "log_test", "burst %d\n", i);
+    TEST_CHECK(wake_ups() == 1, "a burst must wake the monitor once");
+
+    // A writer is still filling in the oldest entry, the flush can't get past it
+    uint32_t seq = logRing[logTail & (LOG_RING_LENGTH - 1)].seq;
+    logRing[logTail & (LOG_RING_LENGTH - 1)].seq = 0;
+    log_flush(false);
+    logRing[logTail & (LOG_RING_LENGTH - 1)].seq = seq;
+
+    rg_system_log(RG_LOG_INFO, "log_test", "after the flush\n");
+    TEST_CHECK(wake_ups() == 1, "a message past half the ring must wake the monitor again after a flush");
+
+    log_flush(false);
+    TEST_CHECK(logTail == logHead, "the ring wasn't drained");
+
+    rg_system_log(RG_LOG_INFO, "log_test", "quiet\n");
+    TEST_CHECK(wake_ups() == 0, "a single message woke the monitor");
+}
+
+int main(int argc, char **argv)
+{
+    app.logLevel = RG_LOG_INFO;
+    logRing = calloc(LOG_RING_LENGTH, sizeof(log_entry_t));
+    logTask = xTaskGetCurrentTaskHandle();
+
+    test_format();
+    test_wake_ups();
+
+    logTask = NULL;
+    return TEST_RESULT();
+}
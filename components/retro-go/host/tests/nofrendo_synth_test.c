@@ -0,0 +1,179 @@
+#include "rg_test.h"
+
+// nofrendo's APU with the pulse, triangle and noise channels on rg_synth and the DMC on the CPU.
+// The log is replayed here rather than by the synth task, the way synth_task does it, so that
+// the runs are deterministic. With every write at the start of its frame the mix must match the
+// synchronous path sample for sample, DMC included. A write in the middle of a frame must only
+// be heard from the sample its cycle falls in.
+
+#define FRAMES (600)
+#define LOG_LENGTH (4096)
+
+typedef struct
+{
+    uint32_t cycle;
+    uint16_t reg;
+    uint8_t value;
+} test_write_t;
+
+static rg_synth_chip_t chip;
+static test_write_t synthLog[LOG_LENGTH];
+static int synthLogCount;
+static int16_t synthOutput[4096];
+static size_t synthOutputCount;
+
+static void test_synth_write(uint32_t cycle, uint16_t reg, uint8_t value)
+{
+    if (synthLogCount < LOG_LENGTH)
+        synthLog[synthLogCount++] = (test_write_t){cycle, reg, value};
+}
+
+static void test_synth_end_frame(uint32_t cycle, bool output)
+{
+    uint32_t lastCycle = 0;
+    short *buffer;
+
+    for (int i = 0; i < synthLogCount; i++)
+    {
+        if (synthLog[i].cycle > lastCycle)
+        {
+            chip.render(chip.arg, synthLog[i].cycle - lastCycle);
+            lastCycle = synthLog[i].cycle;
+        }
+        chip.write(chip.arg, synthLog[i].reg, synthLog[i].value);
+    }
+
+    if (cycle > lastCycle)
+        chip.render(chip.arg, cycle - lastCycle);
+
+    synthOutputCount = chip.flush(chip.arg, &buffer);
+    memcpy(synthOutput, buffer, synthOutputCount * 2 * sizeof(short));
+    synthLogCount = 0;
+}
+
+#define rg_synth_start(...) (chip = *(__VA_ARGS__))
+#define rg_synth_stop()
+#define rg_synth_sync()
+#define rg_synth_write test_synth_write
+#define rg_synth_end_frame test_synth_end_frame
+
+#include "apu.c"
+
+// What apu.c needs from the rest of the NES
+static nes_t nes = {.refresh_rate = NES_REFRESH_RATE_NTSC, .cpu_clock = NES_CPU_CLOCK_NTSC};
+static uint32 cycles;
+static int irqs, burns;
+
+nes_t *nes_getptr(void) { return &nes; }
+uint32 nes6502_getcycles(void) { return cycles; }
+void nes6502_irq(void) { irqs++; }
+void nes6502_burn(int count) { burns += count; }
+uint8 mem_getbyte(uint32 address) { return address * 0x9E3779B1 >> 24; }
+
+
+// A tune on every channel, the notes retriggered now and then, and a DMC sample raising IRQs
+static void play_notes(int frame)
+{
+    static const uint16 writes[][2] = {
+        {0x4015, 0x1F}, {0x4000, 0xBF}, {0x4001, 0x00}, {0x4002, 0x00}, {0x4003, 0x00},
+        {0x4004, 0x86}, {0x4005, 0xA9}, {0x4006, 0x00}, {0x4007, 0x00}, {0x4008, 0xFF},
+        {0x400A, 0x00}, {0x400B, 0x00}, {0x400C, 0x05}, {0x400E, 0x00}, {0x400F, 0x00},
+        {0x4010, 0x8F}, {0x4011, 0x20}, {0x4012, 0x10}, {0x4013, 0x08},
+    };
+    for (int i = 0; i < sizeof(writes) / sizeof(writes[0]); i++)
+    {
+        uint16 reg = writes[i][0];
+        uint8 value = writes[i][1];
+
+        // Retrigger the length counters every 8 frames, change the pitches every frame
+        if ((reg & 3) == 3 && reg < 0x4010 && frame % 8)
+            continue;
+        if (reg == 0x4002 || reg == 0x4006 || reg == 0x400A)
+            value = frame * (reg & 0xF) + 0x40;
+        if (reg == 0x400E)
+            value = frame & 0x8F;
+        if (reg >= 0x4010 && reg != 0x4011 && frame % 30)
+            continue;
+
+        apu_write(reg, value);
+    }
+}
+
+static void run(bool use_synth, int16 *out)
+{
+    const uint32 frame_cycles = NES_CPU_CLOCK_NTSC / NES_REFRESH_RATE_NTSC;
+
+    apu_init(32000, true);
+    apu_reset();
+    apu_synth(use_synth);
+    irqs = burns = 0;
+
+    for (int frame = 0; frame < FRAMES; frame++)
+    {
+        play_notes(frame);
+        cycles += frame_cycles;
+        apu_emulate();
+        apu_end_frame(false);
+
+        size_t count = apu.samples_per_frame * 2;
+        memcpy(out + frame * count, use_synth ? synthOutput : apu.buffer, count * sizeof(int16));
+    }
+
+    apu_synth(false);
+}
+
+int main(int argc, char **argv)
+{
+    rg_system_get_app()->logLevel = RG_LOG_WARN;
+
+    size_t frame_samples = 32000 / NES_REFRESH_RATE_NTSC * 2;
+    int16 *sync_out = calloc(FRAMES, frame_samples * sizeof(int16));
+    int16 *synth_out = calloc(FRAMES, frame_samples * sizeof(int16));
+
+    // Every write at the start of the frame, as the synchronous path hears them
+    run(false, sync_out);
+    int sync_irqs = irqs, sync_burns = burns;
+    run(true, synth_out);
+
+    int mismatches = 0, silent = 0;
+    for (size_t i = 0; i < FRAMES * frame_samples; i++)
+    {
+        mismatches += sync_out[i] != synth_out[i];
+        silent += sync_out[i] == 0;
+    }
+
+    printf("NES APU on rg_synth: %d frames, %d mismatches, %d DMC IRQs, %d cycles stolen\n",
+           FRAMES, mismatches, irqs, burns);
+    TEST_CHECK(silent < FRAMES * frame_samples / 2, "the tune is mostly silence");
+    TEST_CHECK(mismatches == 0, "%d samples differ from the synchronous path", mismatches);
+    TEST_CHECK(irqs == sync_irqs && burns == sync_burns, "the DMC behaved differently on the CPU side");
+    TEST_CHECK(synth_status == apu_status(), "$4015 doesn't reflect the last mixed frame");
+
+    // A note keyed in the middle of a silent frame
+    const uint32 frame_cycles = NES_CPU_CLOCK_NTSC / NES_REFRESH_RATE_NTSC;
+    apu_init(32000, true);
+    apu_reset();
+    apu_synth(true);
+    apu_write(APU_SMASK, 0x01);
+    cycles += frame_cycles / 2;
+    apu_write(APU_WRA0, 0xBF);
+    apu_write(APU_WRA2, 0x80);
+    apu_write(APU_WRA3, 0x08);
+    cycles += frame_cycles - frame_cycles / 2;
+    apu_emulate();
+    apu_end_frame(false);
+    apu_synth(false);
+
+    size_t first = 0;
+    while (first < synthOutputCount && synthOutput[first * 2] == 0)
+        first++;
+    size_t expected = (frame_cycles / 2) / apu.cycle_rate;
+
+    printf("A note keyed at cycle %u is heard from sample %u, its cycle falls in sample %u\n",
+           frame_cycles / 2, (unsigned)first, (unsigned)expected);
+    TEST_CHECK(first >= expected && first <= expected + 1, "heard from sample %u", (unsigned)first);
+
+    free(sync_out);
+    free(synth_out);
+    return TEST_RESULT();
+}
@@ -0,0 +1,85 @@
+#include "rg_test.h"
+#include "rg_profiler.c"
+
+// The sampling profiler on the host, where SIGPROF stands in for the timer interrupt. A loop
+// burns CPU time, most samples must land in it with the test's main as the caller, and
+// rg_profiler_sample_flush must fold them into the profile. The handler counts itself as an
+// interrupt the way the device does, only a sample that interrupted another one is skipped.
+
+#define SAMPLE_RATE (100) // ITIMER_PROF ticks with the kernel, often at 250Hz
+#define BURN_MS (500)
+#define CODE_SIZE (4096) // More than either function is long
+
+static volatile uint32_t sink;
+
+
+static int64_t cpu_time_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000000000ll + ts.tv_nsec;
+}
+
+// ITIMER_PROF counts CPU time, so does the loop or a busy machine would starve it of samples
+__attribute__((noinline)) static void burn(int ms)
+{
+    int64_t end = cpu_time_ns() + ms * 1000000ll;
+    uint32_t x = 1;
+
+    while (cpu_time_ns() < end)
+    {
+        for (int i = 0; i < 1000; i++)
+            x = x * 1664525 + 1013904223;
+    }
+
+    sink = x;
+}
+
+int main(int argc, char **argv)
+{
+    rg_system_get_app()->logLevel = RG_LOG_WARN;
+
+    rg_profiler_sample_start(SAMPLE_RATE);
+    burn(BURN_MS);
+    rg_profiler_sample_stop();
+
+    uint32_t count = sampler[0].head, in_burn = 0, from_main = 0;
+
+    for (uint32_t i = 0; i < count && i < SAMPLE_RING_LENGTH; i++)
+    {
+        uintptr_t pc = sampler[0].ring[i][0], caller = sampler[0].ring[i][1];
+        in_burn += pc - (uintptr_t)&burn < CODE_SIZE;
+        from_main += caller - (uintptr_t)&main < CODE_SIZE;
+    }
+
+    printf("SIGPROF sampling at %dHz: %u samples in %dms of CPU time, %u in the loop, %u of them called from main\n",
+           SAMPLE_RATE, count, BURN_MS, in_burn, from_main);
+    TEST_CHECK(count >= SAMPLE_RATE * BURN_MS / 1000 / 2, "only %u samples", count);
+    TEST_CHECK(in_burn >= count * 3 / 4, "only %u of %u samples are in the loop", in_burn, count);
+    TEST_CHECK(from_main >= in_burn * 9 / 10, "only %u of %u samples have main as their caller", from_main, in_burn);
+
+    // The samples become profile frames, each distinct PC is one
+    rg_profiler_sample_flush(false);
+
+    uint32_t calls = 0;
+    for (int i = 0; i < RG_PROFILER_FRAMES; i++)
+    {
+        profile_frame_t *frame = &profile->cores[0].frames[i];
+        if ((uintptr_t)frame->func_ptr - (uintptr_t)&burn < CODE_SIZE)
+            calls += frame->num_calls;
+    }
+
+    TEST_CHECK(calls == in_burn, "the profile has %u samples of the loop, not %u", calls, in_burn);
+    TEST_CHECK(sampler[0].tail == count, "the flush left %u samples", count - sampler[0].tail);
+
+    // As if the loop ran in an interrupt handler, its samples would have a stale context
+    port_interruptNesting[0] = 1;
+    rg_profiler_sample_start(SAMPLE_RATE);
+    burn(BURN_MS / 5);
+    rg_profiler_sample_stop();
+    port_interruptNesting[0] = 0;
+
+    TEST_CHECK(sampler[0].head == 0, "%u samples of a nested interrupt were kept", sampler[0].head);
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,97 @@
+#include "rg_test.h"
+#include "rg_rewind.c"
+
+#include <unistd.h>
+
+// Rewind from the host gamepad. The game mustn't see the hotkey while it rewinds, nor either key
+// of it until that key is let go, and the captures must go through the core's snapshot handlers
+// rather than the load/save state ones, which are free to show messages.
+
+#define KEYS_TIMEOUT (1000) // ms, the input task debounces over a few 10ms polls
+
+static uint32_t state[1024];
+static int stateCalls, snapshotCalls;
+
+static bool save_state_handler(FILE *fp)
+{
+    stateCalls++;
+    return fwrite(state, sizeof(state), 1, fp) == 1;
+}
+
+static bool load_state_handler(FILE *fp)
+{
+    stateCalls++;
+    return fread(state, sizeof(state), 1, fp) == 1;
+}
+
+static bool save_snapshot_handler(FILE *fp)
+{
+    snapshotCalls++;
+    return fwrite(state, sizeof(state), 1, fp) == 1;
+}
+
+static bool load_snapshot_handler(FILE *fp)
+{
+    snapshotCalls++;
+    return fread(state, sizeof(state), 1, fp) == 1;
+}
+
+static void set_keys(gamepad_state_t keys)
+{
+    int64_t start = test_time_ns();
+
+    rg_host_set_gamepad(keys);
+    while (rg_input_read_gamepad_raw() != keys && test_time_ns() - start < KEYS_TIMEOUT * 1000000ll)
+        usleep(1000);
+
+    TEST_CHECK(rg_input_read_gamepad_raw() == keys, "the input task didn't see %04X", (unsigned)keys);
+}
+
+int main(int argc, char **argv)
+{
+    rg_app_desc_t *app = rg_system_get_app();
+
+    app->logLevel = RG_LOG_WARN;
+    app->handlers.saveState = &save_state_handler;
+    app->handlers.loadState = &load_state_handler;
+    app->handlers.saveSnapshot = &save_snapshot_handler;
+    app->handlers.loadSnapshot = &load_snapshot_handler;
+
+    rg_settings_init("rewind_test");
+    rg_input_init();
+    rg_rewind_set_interval(1);
+    rg_rewind_set_budget(64);
+    TEST_CHECK(enabled, "rewind didn't start");
+
+    for (int frame = 1; frame <= 10; frame++)
+    {
+        state[0] = frame;
+        rg_rewind_tick();
+    }
+
+    // The hotkey goes back a capture per frame, A held alongside still reaches the game
+    set_keys(RG_REWIND_HOTKEY | GAMEPAD_KEY_A);
+    rg_rewind_tick();
+    rg_rewind_tick();
+    TEST_CHECK(state[0] == 8, "two steps back from frame 10 gave frame %u", (unsigned)state[0]);
+    TEST_CHECK(rg_input_read_gamepad() == GAMEPAD_KEY_A, "the game sees %04X while rewinding",
+               (unsigned)rg_input_read_gamepad());
+
+    // SELECT is still down, the game must not see it as pressed (or released and pressed again)
+    set_keys(GAMEPAD_KEY_SELECT);
+    rg_rewind_tick();
+    TEST_CHECK(rg_input_read_gamepad() == 0, "the game sees %04X after LEFT was let go",
+               (unsigned)rg_input_read_gamepad());
+
+    // Once released, the keys are the game's again
+    set_keys(0);
+    set_keys(GAMEPAD_KEY_LEFT);
+    TEST_CHECK(rg_input_read_gamepad() == GAMEPAD_KEY_LEFT, "LEFT pressed again isn't seen");
+
+    TEST_CHECK(snapshotCalls > 0, "the snapshot handlers weren't used");
+    TEST_CHECK(stateCalls == 0, "rewind called the load/save state handlers %d times", stateCalls);
+
+    set_keys(0);
+    rg_rewind_deinit();
+    return TEST_RESULT();
+}
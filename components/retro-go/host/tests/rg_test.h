@@ -0,0 +1,111 @@
+#pragma once
+
+// Shared by the host tests and micro-benchmarks. Each of them #includes the module it exercises
+// to reach its static functions, the rest of retro-go comes from the library as usual. They have
+// their own main, so they stand in for the runner's callbacks (main.c).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "rg_host.h"
+
+static int test_failures;
+
+#define TEST_CHECK(cond, ...)                                           \
+    do {                                                                \
+        if (!(cond))                                                    \
+        {                                                               \
+            printf("FAIL %s:%d: ", __FILE__, __LINE__);                 \
+            printf(__VA_ARGS__);                                        \
+            printf("\n");                                               \
+            test_failures++;                                            \
+        }                                                               \
+    } while (0)
+
+// Exit code for ctest
+#define TEST_RESULT() (printf("%s\n", test_failures ? "FAILED" : "OK"), test_failures ? 1 : 0)
+
+static inline int64_t test_time_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Same generator everywhere so that the inputs don't change from run to run
+static inline uint32_t test_random(void)
+{
+    static uint32_t state = 0x12345678;
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+// A frame of a --record file (host/main.c)
+typedef struct
+{
+    rg_host_record_t header;
+    uint16_t palette[256];
+    uint8_t *pixels;
+} test_frame_t;
+
+static inline test_frame_t *test_add_frame(test_frame_t **frames, int *count, const rg_host_record_t *header)
+{
+    *frames = realloc(*frames, (*count + 1) * sizeof(test_frame_t));
+    test_frame_t *frame = &(*frames)[(*count)++];
+    memset(frame, 0, sizeof(test_frame_t));
+    frame->header = *header;
+    frame->pixels = calloc(header->height, header->stride);
+    return frame;
+}
+
+// Appends the frames of a recording to `frames`, a truncated one stops at the last whole frame
+static inline bool test_load_recording(const char *filename, test_frame_t **frames, int *count)
+{
+    FILE *fp = fopen(filename, "rb");
+    rg_host_record_t header;
+    int loaded = 0;
+
+    if (!fp)
+        return false;
+
+    while (fread(&header, sizeof(header), 1, fp) == 1)
+    {
+        if (header.magic != RG_HOST_RECORD_MAGIC || header.height > 256 || header.stride > 1024
+            || header.pixel_mask > 255)
+            break;
+        test_frame_t *frame = test_add_frame(frames, count, &header);
+        if (((header.flags & RG_PIXEL_PAL) && fread(frame->palette, 2, header.pixel_mask + 1, fp) != header.pixel_mask + 1)
+            || fread(frame->pixels, header.stride, header.height, fp) != header.height)
+        {
+            free(frame->pixels);
+            (*count)--;
+            break;
+        }
+        loaded++;
+    }
+
+    fclose(fp);
+    return loaded > 0;
+}
+
+void rg_host_frame(int busyTime)
+{
+}
+
+void rg_host_frame_queued(const rg_video_frame_t *frame, const rg_video_frame_t *previousFrame)
+{
+}
+
+const char *rg_host_app_name(void)
+{
+    return "test";
+}
+
+bool rg_host_unthrottled(void)
+{
+    return true;
+}
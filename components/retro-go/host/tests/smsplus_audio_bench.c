@@ -0,0 +1,86 @@
+#include "rg_test.h"
+#include "sn76489.c"
+
+// CPU time smsplus spends in the PSG for one emulated second of sound, at the output rate it used
+// to mix at and at the rate main.c now asks for. Samples per frame are rounded up like sound_init
+// does, so the PSG must be clocked for the rounded rate, and a tone must then keep its pitch.
+// Usage: smsplus_audio_bench [seconds]
+
+#define FRAMES_PER_SECOND (FPS_NTSC)
+#define TONE_PERIOD (0x47) // Flips every 16 * 0x47 PSG clocks, about 1575Hz
+
+static INT16 buffer[2][2048];
+
+
+static void sn_write(int reg, int value)
+{
+    SN76489_Write(0, 0x80 | (reg << 4) | (value & 0xF));
+    if (reg < 6 && !(reg & 1))
+        SN76489_Write(0, value >> 4);
+}
+
+static void bench_rate(int sndrate, int seconds)
+{
+    const int sample_count = sndrate / FRAMES_PER_SECOND + 1;
+    const int sample_rate = sample_count * FRAMES_PER_SECOND;
+    INT16 *streams[2] = {buffer[0], buffer[1]};
+    int64_t elapsed = 0;
+    int flips = 0;
+    INT16 last = 0;
+
+    SN76489_Init(0, CLOCK_NTSC, sample_rate);
+    SN76489_Config(0, MUTE_ALLON, BOOST_OFF, VOL_FULL, FB_SEGAVDP);
+
+    // The first tone alone, to count its flips
+    sn_write(0, TONE_PERIOD);
+    sn_write(1, 0);
+    sn_write(3, 15);
+    sn_write(5, 15);
+    sn_write(7, 15);
+
+    for (int frame = 0; frame < seconds * FRAMES_PER_SECOND; frame++)
+    {
+        SN76489_Update(0, streams, sample_count);
+
+        for (int i = 0; i < sample_count; i++)
+        {
+            if (buffer[0][i] && (buffer[0][i] < 0) != (last < 0))
+                flips++;
+            if (buffer[0][i])
+                last = buffer[0][i];
+        }
+    }
+
+    // Everything, for the timing
+    sn_write(2, 0x123);
+    sn_write(3, 2);
+    sn_write(4, 0x2A0);
+    sn_write(5, 4);
+    sn_write(6, 0x5);
+    sn_write(7, 1);
+
+    for (int frame = 0; frame < seconds * FRAMES_PER_SECOND; frame++)
+    {
+        int64_t start = test_time_ns();
+        SN76489_Update(0, streams, sample_count);
+        elapsed += test_time_ns() - start;
+    }
+
+    double expected = (double)CLOCK_NTSC / 16 / TONE_PERIOD * seconds;
+    printf("  %5dHz: %3d samples per frame, %5d samples per second, %.2fms per emulated second\n",
+           sndrate, sample_count, sample_rate, elapsed / 1e6 / seconds);
+    TEST_CHECK(fabs(flips - expected) <= 2, "%dHz: the tone flipped %d times, not %.0f", sndrate, flips, expected);
+}
+
+int main(int argc, char **argv)
+{
+    int seconds = argc > 1 ? atoi(argv[1]) : 60;
+
+    rg_system_get_app()->logLevel = RG_LOG_WARN;
+
+    printf("smsplus PSG mixing:\n");
+    bench_rate(32000, seconds);
+    bench_rate(22050, seconds);
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,89 @@
+#include "rg_test.h"
+#include "rg_system.c"
+
+// Save & Continue: a snapshot taken in memory, then written to a slot by a background task. The
+// slot must hold what the core serialized, a second write can't start while one is pending, and
+// loading the slot must wait for the write rather than read a half written file.
+
+#define STATE_SIZE (256 * 1024)
+#define WRITE_TIMEOUT (5000) // ms
+
+static uint8_t *state;
+
+static bool save_state_handler(FILE *fp)
+{
+    return fwrite(state, STATE_SIZE, 1, fp) == 1;
+}
+
+static bool load_state_handler(FILE *fp)
+{
+    uint8_t *data = malloc(STATE_SIZE);
+    bool same = fread(data, STATE_SIZE, 1, fp) == 1 && fgetc(fp) == EOF && memcmp(data, state, STATE_SIZE) == 0;
+    free(data);
+    return same;
+}
+
+int main(int argc, char **argv)
+{
+    char root[] = "/tmp/snapshot_test.XXXXXX";
+
+    app.logLevel = RG_LOG_WARN;
+    app.name = "snapshot_test";
+    app.romPath = "/snapshot_test.rom";
+    app.handlers.saveState = &save_state_handler;
+    app.handlers.loadState = &load_state_handler;
+
+    // The saves go to sd/ under the current directory, the way the runner's --root does it
+    if (!mkdtemp(root) || chdir(root) != 0 || mkdir(RG_BASE_PATH, 0777) != 0)
+    {
+        printf("can't create %s\n", root);
+        return 1;
+    }
+
+    // Loading draws the hourglass
+    rg_settings_init(app.name);
+    rg_display_init();
+    rg_gui_init();
+
+    state = malloc(STATE_SIZE);
+    for (int i = 0; i < STATE_SIZE; i++)
+        state[i] = test_random() >> 29; // Compressible, but not to nothing
+
+    TEST_CHECK(!rg_emu_snapshot_persist(1), "persisted a snapshot that wasn't taken");
+    TEST_CHECK(rg_emu_snapshot_take(), "the snapshot failed");
+
+    snapshotWriting = true; // As if a write was still pending
+    TEST_CHECK(!rg_emu_snapshot_persist(1), "a write started while another one was pending");
+    snapshotWriting = false;
+
+    TEST_CHECK(rg_emu_snapshot_persist(1), "the write didn't start");
+
+    // The game goes on and changes its state while the first one is written out
+    uint8_t *saved = malloc(STATE_SIZE);
+    memcpy(saved, state, STATE_SIZE);
+    memset(state, 0xA5, STATE_SIZE / 2);
+    TEST_CHECK(rg_emu_snapshot_take(), "the snapshot after the write started failed");
+
+    int64_t start = test_time_ns();
+    while (snapshotWriting && test_time_ns() - start < WRITE_TIMEOUT * 1000000ll)
+        usleep(1000);
+    TEST_CHECK(!snapshotWriting, "the write took over %dms", WRITE_TIMEOUT);
+
+    // The slot has the state from the first snapshot, not the one taken since
+    memcpy(state, saved, STATE_SIZE);
+    TEST_CHECK(rg_emu_load_state(1), "the slot doesn't hold the snapshot");
+
+    // A pending write holds the load back until the file is complete
+    memset(state, 0x5A, STATE_SIZE);
+    TEST_CHECK(rg_emu_snapshot_take() && rg_emu_snapshot_persist(1), "the second write didn't start");
+    TEST_CHECK(rg_emu_load_state(1), "the load didn't wait for the write");
+    TEST_CHECK(!snapshotWriting, "the load returned before the write was done");
+
+    char command[64];
+    snprintf(command, sizeof(command), "rm -rf %s", root);
+    system(command);
+
+    free(saved);
+    free(state);
+    return TEST_RESULT();
+}
@@ -0,0 +1,100 @@
+#include "rg_test.h"
+
+// vsync_wait against a simulated scanout. The clock is ours: usleep moves it forward instead of
+// sleeping, so every case is exact. Each rect must then be written without the beam entering its
+// columns, unless it's counted as a tear, and the SPI queue must only be drained before a wait.
+
+// What rg_display.c includes, before the macros below
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <unistd.h>
+
+static int64_t fake_time;
+static int drains;
+
+#undef get_elapsed_time
+#define get_elapsed_time() (fake_time)
+#define usleep(us) (fake_time += (us))
+// spi_drain_queue starts with this check
+#define uxQueueSpacesAvailable(queue) ((queue) == spi_queue ? (drains++, 0) : uxQueueSpacesAvailable(queue))
+
+#include "rg_display.c"
+
+// Scanout line the beam is on at `time`, the same model as vsync_scanout_line
+static int beam_line(int64_t time)
+{
+    int64_t phase = (time - vsync_last_time) % display.vsync.period;
+    if (phase < 0)
+        phase += display.vsync.period;
+    return phase * display.screen.width / display.vsync.period;
+}
+
+static void test_scanout(int32_t period, int64_t anchor)
+{
+    const int lines = RG_SCREEN_WIDTH;
+    int tears = 0, waits = 0, crossed = 0, long_waits = 0, wrong_drains = 0;
+
+    display.vsync.period = period;
+    vsync_last_time = anchor;
+
+    for (int n = 0; n < 20000; n++)
+    {
+        int left = test_random() % lines;
+        int width = 1 + test_random() % (lines - left);
+        int height = 1 + test_random() % (n & 1 ? 16 : RG_SCREEN_HEIGHT); // Sprites, then large rects
+        int pixels = width * height;
+
+        uint32_t tears_before = display.counters.vsyncTears;
+        int64_t start = fake_time = anchor + test_random() % (period * 4);
+        int drains_before = drains;
+
+        vsync_wait(left, width, pixels);
+
+        if (display.counters.vsyncTears != tears_before)
+        {
+            tears++;
+            continue;
+        }
+
+        int64_t waited = fake_time - start;
+        waits += waited > 0;
+        long_waits += waited > period;
+        wrong_drains += (drains != drains_before) != (waited > 0);
+
+        // The write, one step per line of the panel's scanout
+        int64_t duration = (int64_t)pixels * VSYNC_PIXEL_TIME / 1000;
+        for (int64_t t = fake_time; t <= fake_time + duration; t += period / lines / 2)
+        {
+            int line = beam_line(t);
+            if (line >= left && line < left + width)
+            {
+                crossed++;
+                break;
+            }
+        }
+    }
+
+    printf("  period %5d us: %5d waits, %5d tears, %d crossed\n", period, waits, tears, crossed);
+    TEST_CHECK(crossed == 0, "the scanout crossed %d rects", crossed);
+    TEST_CHECK(long_waits == 0, "%d waits were longer than a refresh", long_waits);
+    TEST_CHECK(wrong_drains == 0, "the SPI queue was drained without a wait, or the reverse, %d times", wrong_drains);
+}
+
+int main(int argc, char **argv)
+{
+    rg_system_get_app()->logLevel = RG_LOG_WARN;
+
+    // spi_drain_queue's loops need a queue and transactions to go through
+    display.screen.width = RG_SCREEN_WIDTH;
+    display.screen.height = RG_SCREEN_HEIGHT;
+    display.spi.transactions = 1;
+    spi_trans = calloc(1, sizeof(spi_transaction_t));
+    spi_queue = xQueueCreate(1, sizeof(void *));
+
+    printf("Rects written behind the simulated scanout:\n");
+    test_scanout(VSYNC_PERIOD_DEFAULT, 0);
+    test_scanout(16666, 123456);
+    test_scanout(7000, -5000);
+
+    return TEST_RESULT();
+}
@@ -1,21 +1,90 @@
 #include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
 #include <driver/i2s.h>
 #include <driver/dac.h>
+#include <string.h>
 #include <unistd.h>
+#include <math.h>
 
 #include "rg_system.h"
 #include "rg_audio.h"
 
 static int audioSink = -1;
 static int audioSampleRate = 0;
+static int audioSourceRate = 0;    // Rate of the submitted samples, 0 means audioSampleRate
 static int audioFilter = 0;
 static bool audioMuted = false;
+static bool audioPacing = true;     // rg_audio_submit throttles the emulator
 static int volumeLevel = RG_AUDIO_VOL_DEFAULT;
 static int volumeMap[] = {0, 7, 15, 28, 39, 50, 61, 74, 88, 100};
+static uint32_t volumeScale = 0; // volumeMap[volumeLevel] as a float, times 2^31
+
+// Stereo frames handed from the emulator to audio_task. Only rg_audio_submit moves the head
+// and only audio_task moves the tail, so neither needs a lock.
+static uint32_t *ringBuffer;
+static uint32_t ringSize;           // Power of two, in frames
+static uint32_t ringTarget;         // Fill level the resampling ratio steers to
+static uint32_t ringStep;           // Source frames per output frame, 16.16
+static uint32_t ringHead;
+static uint32_t ringTail;
+static volatile bool ringClear;
+static SemaphoreHandle_t ringSpace;
+static TaskHandle_t audioTask;
+static volatile bool audioTaskRunning;
+static rg_audio_counters_t audioCounters;
+
+// Frames sent to the DAC per i2s_write
+#define AUDIO_CHUNK_LENGTH (256)
+// Maximum deviation from the nominal rate, in 1/1000, like snes9x's DynamicRateLimit
+#define AUDIO_DYNAMIC_RATE_LIMIT (5)
 
 static const char *SETTING_OUTPUT = "AudioSink";
 static const char *SETTING_VOLUME = "Volume";
-// static const char *SETTING_FILTER = "AudioFilter";
+static const char *SETTING_FILTER = "AudioFilter";
+
+// Cutoff frequencies (Hz) for each sink. The speaker can't reproduce much bass and the
+// built-in DAC aliases badly on square waves, a good headphone DAC needs much less help.
+static const struct {
+    int lowpass;
+    int highpass;
+} filterCutoffs[] = {
+    [RG_AUDIO_SINK_SPEAKER] = {5000, 200},
+    [RG_AUDIO_SINK_EXT_DAC] = {12000, 20},
+    [RG_AUDIO_SINK_DUMMY]   = {12000, 20},
+};
+
+// Butterworth biquad low-pass, coefficients are 4.12
+static int32_t lowpassCoefs[5];         // b0, b1, b2, a1, a2
+static int32_t lowpassState[2][4];      // x1, x2, y1, y2 for each channel
+// One-pole high-pass, coefficient is 0.16 and the state is the sample with 8 fraction bits
+static uint32_t highpassCoef;
+static int32_t highpassState[2];
+
+static void audio_task(void *arg);
+static void update_source_rate(void);
+
+static uint32_t filter_coefficient(int cutoff, int sample_rate)
+{
+    // a = 1 - e^(-2pi * fc / fs), computed once per init
+    cutoff = RG_MIN(cutoff, sample_rate / 2);
+    return (1.f - expf(-2.f * (float)M_PI * cutoff / sample_rate)) * 65535.f;
+}
+
+static void filter_biquad_lowpass(int32_t *coefs, int cutoff, int sample_rate)
+{
+    // RBJ cookbook low-pass with Q = 1/sqrt(2)
+    float w0 = 2.f * (float)M_PI * RG_MIN(cutoff, sample_rate * 0.45f) / sample_rate;
+    float alpha = sinf(w0) / (2.f * (float)M_SQRT1_2);
+    float cosw0 = cosf(w0);
+    float a0 = 1.f + alpha;
+
+    coefs[0] = lroundf((1.f - cosw0) / 2.f / a0 * 4096.f);
+    coefs[1] = lroundf((1.f - cosw0) / a0 * 4096.f);
+    coefs[2] = coefs[0];
+    coefs[3] = lroundf(-2.f * cosw0 / a0 * 4096.f);
+    coefs[4] = lroundf((1.f - alpha) / a0 * 4096.f);
+}
 
 
 void rg_audio_init(int sample_rate)
@@ -29,8 +98,8 @@ void rg_audio_init(int sample_rate)
         .bits_per_sample = 16,
         .channel_format = I2S_CHANNEL_FMT_RIGHT_LEFT,
         .communication_format = I2S_COMM_FORMAT_I2S | I2S_COMM_FORMAT_I2S_LSB,
-        .dma_buf_count = 2,
-        .dma_buf_len = RG_MIN(sample_rate / 50 + 1, 640), // The unit is stereo samples (4 bytes)
+        .dma_buf_count = 4,
+        .dma_buf_len = AUDIO_CHUNK_LENGTH,                // The unit is stereo samples (4 bytes)
         .intr_alloc_flags = ESP_INTR_FLAG_LEVEL1,         // Interrupt level 1
         .use_apll = 0
     };
@@ -80,14 +149,34 @@ void rg_audio_init(int sample_rate)
             rg_audio_get_sink_name(sink), sink, sample_rate, ret);
     }
 
+    // The ring buffer absorbs the emulators' frame time jitter, 50ms is about 3 frames
+    if (!ringBuffer)
+    {
+        for (ringSize = 1024; ringSize < sample_rate / 4; ringSize <<= 1);
+        ringBuffer = rg_alloc(ringSize * 4, MEM_FAST);
+        ringSpace = xSemaphoreCreateBinary();
+    }
+    ringHead = ringTail = 0;
+
+    update_source_rate();
+    audioFilter = rg_settings_get_app_int32(SETTING_FILTER, RG_AUDIO_FILTER_NONE);
+
     rg_audio_set_volume(volume);
     rg_audio_set_mute(false);
+
+    audioTaskRunning = true;
+    xTaskCreatePinnedToCore(&audio_task, "audio_task", 2048, NULL, 7, &audioTask, 1);
 }
 
 void rg_audio_deinit(void)
 {
     rg_audio_set_mute(true);
 
+    // audio_task is at most one chunk away from noticing
+    audioTaskRunning = false;
+    while (audioTask)
+        usleep(1000);
+
     if (audioSink == RG_AUDIO_SINK_SPEAKER)
     {
         gpio_num_t pin;
@@ -114,106 +203,225 @@ void rg_audio_deinit(void)
     audioSink = -1;
 }
 
-static inline void filter_samples(short *samples, size_t count)
+static inline int32_t filter_step(int32_t *state, int32_t sample, uint32_t coef)
 {
+    *state += ((int64_t)((sample << 8) - *state) * coef) >> 16;
+    return *state >> 8;
+}
 
+static inline int32_t filter_biquad_step(int32_t *state, int32_t sample, const int32_t *coefs)
+{
+    // With 4.12 coefficients and 16bit samples the sum stays within 32 bits
+    int32_t out = (coefs[0] * sample + coefs[1] * state[0] + coefs[2] * state[1]
+                 - coefs[3] * state[2] - coefs[4] * state[3]) >> 12;
+    state[1] = state[0];
+    state[0] = sample;
+    state[3] = state[2];
+    state[2] = out;
+    return out;
 }
 
-void rg_audio_submit(short *stereoAudioBuffer, size_t frameCount)
+static void filter_samples(short *samples, size_t count)
 {
-    size_t sampleCount = frameCount * 2;
-    size_t bufferSize = sampleCount * sizeof(short);
-    size_t written = 0;
-    float volume = volumeMap[volumeLevel] * 0.01f;
+    const bool lowpass = audioFilter == RG_AUDIO_FILTER_LOW_PASS || audioFilter == RG_AUDIO_FILTER_WEIGHTED;
+    const bool highpass = audioFilter == RG_AUDIO_FILTER_HIGH_PASS || audioFilter == RG_AUDIO_FILTER_WEIGHTED;
 
-    if (bufferSize == 0)
+    for (size_t i = 0; i < count; i += 2)
     {
-        RG_LOGW("Empty buffer?\n");
-        return;
+        for (size_t c = 0; c < 2; ++c)
+        {
+            int32_t sample = samples[i + c];
+
+            if (lowpass)
+                sample = filter_biquad_step(lowpassState[c], sample, lowpassCoefs);
+
+            // The high-pass is whatever its low-pass twin doesn't keep
+            if (highpass)
+                sample -= filter_step(&highpassState[c], sample, highpassCoef);
+
+            samples[i + c] = RG_MIN(RG_MAX(sample, -32768), 32767);
+        }
     }
+}
 
-    if (audioFilter)
+// Returns x * volume truncated toward zero, exactly as it used to be computed with floats:
+// the product is first rounded to the 24 significant bits of a float. `shift` accounts for
+// the 2^31 of volumeScale and whatever scale x was already at.
+static inline int32_t apply_volume(int32_t x, uint32_t scale, int shift)
+{
+    int32_t sign = x >> 31;
+    uint64_t product = (uint64_t)(uint32_t)((x ^ sign) - sign) * scale;
+    int bits = 64 - __builtin_clzll(product | 1);
+
+    // Adding half of the float's ulp before truncating reproduces its rounding
+    product += (uint64_t)1 << RG_MAX(bits - 25, 0);
+
+    int32_t result = product >> shift;
+    return (result ^ sign) - sign;
+}
+
+static void convert_speaker(short *samples, size_t sampleCount, uint32_t scale)
+{
+    // In speaker mode we use dac left and right as a single channel to increase resolution
+    for (size_t i = 0; i < sampleCount; i += 2)
     {
-        filter_samples(stereoAudioBuffer, bufferSize);
+        // Down mix stereo to mono
+        int32_t sample = (samples[i] + samples[i + 1]) >> 1;
+
+        // Scale to +/-254, the 2^15 of the sample adds to the volume's 2^31
+        int32_t range = apply_volume(sample * 254, scale, 46);
+
+        // Convert to differential output: dac0 takes up to 127 and dac1 the rest
+        int32_t dac0 = RG_MIN(RG_MAX(range, -127), 127);
+        int32_t dac1 = range - dac0;
+
+        samples[i] = (0x80 - dac1) << 8;
+        samples[i + 1] = (dac0 + 0x80) << 8;
     }
+}
 
-    if (audioMuted || audioSink == RG_AUDIO_SINK_DUMMY)
+static void convert_ext_dac(short *samples, size_t sampleCount, uint32_t scale)
+{
+    // Volume is at most 1.0 so the result can't clip
+    for (size_t i = 0; i < sampleCount; ++i)
     {
-        // Simulate i2s_write_bytes delay
-        usleep((audioSampleRate * 1000) / sampleCount);
+        samples[i] = apply_volume(samples[i], scale, 31);
     }
-    else if (audioSink == RG_AUDIO_SINK_SPEAKER)
+}
+
+static inline uint32_t ring_fill(void)
+{
+    return __atomic_load_n(&ringHead, __ATOMIC_ACQUIRE) - __atomic_load_n(&ringTail, __ATOMIC_ACQUIRE);
+}
+
+// Linear interpolation of two packed stereo frames, frac is 16 bits
+static inline void mix_frames(short *out, uint32_t a, uint32_t b, uint32_t frac)
+{
+    int32_t al = (int16_t)a, ar = (int16_t)(a >> 16);
+    int32_t bl = (int16_t)b, br = (int16_t)(b >> 16);
+    frac >>= 1; // Keeps the product within 32 bits
+    out[0] = al + (((bl - al) * (int32_t)frac) >> 15);
+    out[1] = ar + (((br - ar) * (int32_t)frac) >> 15);
+}
+
+static void audio_task(void *arg)
+{
+    static short buffer[AUDIO_CHUNK_LENGTH * 2];
+    size_t lastCount = 0;
+    uint32_t frac = 0;
+
+    while (audioTaskRunning)
     {
-        // In speaker mode we use dac left and right as a single channel
-        // to increase resolution.
-        for (size_t i = 0; i < sampleCount; i += 2)
+        uint32_t fill = ring_fill();
+        uint32_t tail = ringTail;
+
+        if (ringClear)
         {
-            // Down mix stereo to mono
-            int32_t sample = (stereoAudioBuffer[i] + stereoAudioBuffer[i + 1]) >> 1;
-
-            // Normalize
-            const float sn = (float)sample / 0x8000;
-
-            // Scale
-            const int magnitude = 127 + 127;
-            const float range = magnitude * sn * volume;
-
-            uint16_t dac0, dac1;
-
-            // Convert to differential output
-            if (range > 127.f)
-            {
-                dac1 = (range - 127);
-                dac0 = 127;
-            }
-            else if (range < -127.f)
-            {
-                dac1 = (range + 127);
-                dac0 = -127;
-            }
-            else
-            {
-                dac1 = 0;
-                dac0 = range;
-            }
+            tail = ringTail + fill;
+            fill = 0;
+            ringClear = false;
+        }
 
-            dac0 += 0x80;
-            dac1 = 0x80 - dac1;
+        // Consume slightly faster when above target and slower when below (16.16 input frames per output frame)
+        int32_t error = RG_MIN(RG_MAX((int32_t)fill - (int32_t)ringTarget, -(int32_t)ringTarget), (int32_t)ringTarget);
+        uint32_t step = ringStep + (int64_t)ringStep * AUDIO_DYNAMIC_RATE_LIMIT * error / (1000 * (int32_t)ringTarget);
+        audioCounters.rate = step;
 
-            dac0 <<= 8;
-            dac1 <<= 8;
+        size_t count = 0;
+        // Interpolation needs the next frame too
+        while (count < AUDIO_CHUNK_LENGTH && fill >= 2)
+        {
+            mix_frames(&buffer[count * 2], ringBuffer[tail & (ringSize - 1)], ringBuffer[(tail + 1) & (ringSize - 1)], frac);
+            frac += step;
+            tail += frac >> 16;
+            fill -= frac >> 16;
+            frac &= 0xFFFF;
+            count++;
+        }
 
-            stereoAudioBuffer[i] = (short)dac1;
-            stereoAudioBuffer[i + 1] = (short)dac0;
+        __atomic_store_n(&ringTail, tail, __ATOMIC_RELEASE);
+        xSemaphoreGive(ringSpace);
+
+        if (count < AUDIO_CHUNK_LENGTH)
+        {
+            // The emulator is late, pad with silence rather than stall the DAC
+            memset(&buffer[count * 2], 0, (AUDIO_CHUNK_LENGTH - count) * 4);
+            // Only count it once per dry spell, nothing is playing before the first submit
+            if (lastCount == AUDIO_CHUNK_LENGTH)
+                audioCounters.underruns++;
+        }
+        lastCount = count;
+
+        if (audioMuted || audioSink == RG_AUDIO_SINK_DUMMY)
+        {
+            // Simulate i2s_write delay
+            usleep(AUDIO_CHUNK_LENGTH * 1000000LL / audioSampleRate);
+        }
+        else
+        {
+            size_t written = 0;
+            if (audioSink == RG_AUDIO_SINK_SPEAKER)
+                convert_speaker(buffer, AUDIO_CHUNK_LENGTH * 2, volumeScale);
+            else
+                convert_ext_dac(buffer, AUDIO_CHUNK_LENGTH * 2, volumeScale);
+            i2s_write(I2S_NUM_0, buffer, sizeof(buffer), &written, portMAX_DELAY);
         }
-        i2s_write(I2S_NUM_0, (const void *)stereoAudioBuffer, bufferSize, &written, 1000);
-        RG_ASSERT(written > 0, "i2s_write failed.");
     }
-    else if (audioSink == RG_AUDIO_SINK_EXT_DAC)
+
+    audioTask = NULL;
+    vTaskDelete(NULL);
+}
+
+void rg_audio_submit(short *stereoAudioBuffer, size_t frameCount)
+{
+    size_t sampleCount = frameCount * 2;
+    size_t bufferSize = sampleCount * sizeof(short);
+
+    if (bufferSize == 0)
     {
-        for (size_t i = 0; i < sampleCount; ++i)
-        {
-            int32_t sample = stereoAudioBuffer[i] * volume;
+        RG_LOGW("Empty buffer?\n");
+        return;
+    }
 
-            // Clip
-            if (sample > 32767)
-                sample = 32767;
-            else if (sample < -32768)
-                sample = -32767;
+    if (audioFilter)
+    {
+        filter_samples(stereoAudioBuffer, sampleCount);
+    }
 
-            stereoAudioBuffer[i] = (short)sample;
+    // Unless they use rg_system_frame_sync, emulators pace themselves on audio: wait until the
+    // DAC is down to the target level. A late frame then eats into the buffer instead of
+    // causing an underrun.
+    if (audioPacing && ring_fill() > ringTarget && audioTask)
+    {
+        int64_t startTime = get_elapsed_time();
+        while (audioPacing && ring_fill() > ringTarget && audioTask)
+        {
+            xSemaphoreTake(ringSpace, pdMS_TO_TICKS(10));
         }
-        i2s_write(I2S_NUM_0, (const void *)stereoAudioBuffer, bufferSize, &written, 1000);
-        RG_ASSERT(written > 0, "i2s_write failed.");
+        rg_system_frame_stage(RG_FRAME_AUDIO_WAIT, get_elapsed_time_since(startTime));
     }
-    else
+
+    uint32_t head = ringHead;
+    uint32_t space = ringSize - ring_fill();
+
+    if (frameCount > space)
     {
-        RG_PANIC("Audio Sink Unknown");
+        audioCounters.overruns++;
+        frameCount = space;
     }
+
+    for (size_t i = 0; i < frameCount; ++i)
+    {
+        ringBuffer[(head + i) & (ringSize - 1)] = ((uint16_t)stereoAudioBuffer[i * 2]) | (stereoAudioBuffer[i * 2 + 1] << 16);
+    }
+
+    __atomic_store_n(&ringHead, head + frameCount, __ATOMIC_RELEASE);
 }
 
 void rg_audio_clear_buffer()
 {
+    ringClear = true;
+
     if (audioSink == RG_AUDIO_SINK_SPEAKER || audioSink == RG_AUDIO_SINK_EXT_DAC)
     {
         i2s_zero_dma_buffer(I2S_NUM_0);
@@ -232,6 +440,51 @@ const char *rg_audio_get_sink_name(audio_sink_t sink)
     return "Unknown";
 }
 
+rg_audio_counters_t rg_audio_get_counters(void)
+{
+    rg_audio_counters_t counters = audioCounters;
+    counters.latency = audioSampleRate ? ring_fill() * 1000 / (audioSourceRate ?: audioSampleRate) : 0;
+    return counters;
+}
+
+int rg_audio_get_sample_rate(void)
+{
+    return audioSampleRate;
+}
+
+static void update_source_rate(void)
+{
+    int rate = audioSourceRate ?: audioSampleRate;
+
+    ringTarget = RG_MIN(rate / 20, ringSize / 2);
+    ringStep = ((uint64_t)rate << 16) / audioSampleRate;
+
+    // Filters run in rg_audio_submit, on the source samples
+    filter_biquad_lowpass(lowpassCoefs, filterCutoffs[audioSink].lowpass, rate);
+    highpassCoef = filter_coefficient(filterCutoffs[audioSink].highpass, rate);
+    memset(lowpassState, 0, sizeof(lowpassState));
+    memset(highpassState, 0, sizeof(highpassState));
+}
+
+void rg_audio_set_source_rate(int sample_rate)
+{
+    // audio_task resamples to the DAC's rate, so cores can mix at whatever rate suits them
+    audioSourceRate = sample_rate;
+    update_source_rate();
+    rg_audio_clear_buffer();
+    RG_LOGI("Source rate set to %d (output %d)\n", audioSourceRate ?: audioSampleRate, audioSampleRate);
+}
+
+void rg_audio_set_pacing(bool enable)
+{
+    audioPacing = enable;
+}
+
+int rg_audio_get_source_rate(void)
+{
+    return audioSourceRate ?: audioSampleRate;
+}
+
 audio_sink_t rg_audio_get_sink(void)
 {
     return audioSink;
@@ -244,6 +497,17 @@ void rg_audio_set_sink(audio_sink_t sink)
     rg_audio_init(audioSampleRate);
 }
 
+void rg_audio_set_filter(audio_filter_t filter)
+{
+    audioFilter = RG_MIN(RG_MAX(0, filter), RG_AUDIO_FILTER_COUNT - 1);
+    rg_settings_set_app_int32(SETTING_FILTER, audioFilter);
+}
+
+audio_filter_t rg_audio_get_filter(void)
+{
+    return audioFilter;
+}
+
 audio_volume_t rg_audio_get_volume(void)
 {
     return volumeLevel;
@@ -252,6 +516,7 @@ audio_volume_t rg_audio_get_volume(void)
 void rg_audio_set_volume(audio_volume_t level)
 {
     volumeLevel = RG_MIN(RG_AUDIO_VOL_MAX, RG_MAX(RG_AUDIO_VOL_MIN, level));
+    volumeScale = volumeMap[volumeLevel] * 0.01f * 2147483648.f; // Exact, the float is just rescaled
     rg_settings_set_int32(SETTING_VOLUME, volumeLevel);
     RG_LOGI("Volume set to %d%%\n", volumeMap[volumeLevel]);
 }
@@ -30,17 +30,32 @@ typedef enum
     RG_AUDIO_FILTER_NONE = 0,
     RG_AUDIO_FILTER_LOW_PASS,
     RG_AUDIO_FILTER_HIGH_PASS,
-    RG_AUDIO_FILTER_WEIGHTED,
+    RG_AUDIO_FILTER_WEIGHTED,   // Low-pass and high-pass
+    RG_AUDIO_FILTER_COUNT,
 } audio_filter_t;
 
+typedef struct
+{
+    uint32_t underruns;     // Chunks padded with silence because the emulator was late
+    uint32_t overruns;      // Submits that didn't fit in the ring buffer
+    uint32_t latency;       // Audio queued ahead of the DAC, in ms
+    uint32_t rate;          // Current resampling ratio, 16.16
+} rg_audio_counters_t;
+
 void rg_audio_init(int sample_rate);
 void rg_audio_deinit(void);
 const char *rg_audio_get_sink_name(audio_sink_t sink);
 void rg_audio_set_sink(audio_sink_t sink);
 audio_sink_t rg_audio_get_sink(void);
+void rg_audio_set_filter(audio_filter_t filter);
+audio_filter_t rg_audio_get_filter(void);
 void rg_audio_set_volume(audio_volume_t level);
 audio_volume_t rg_audio_get_volume(void);
 void rg_audio_set_mute(bool mute);
 void rg_audio_submit(short *stereoAudioBuffer, size_t frameCount);
 int  rg_audio_get_sample_rate(void);
+void rg_audio_set_source_rate(int sample_rate);
+int  rg_audio_get_source_rate(void);
+void rg_audio_set_pacing(bool enable);
+rg_audio_counters_t rg_audio_get_counters(void);
 void rg_audio_clear_buffer();
@@ -5,29 +5,60 @@
 #include <driver/spi_master.h>
 #include <driver/gpio.h>
 #include <driver/ledc.h>
+#include <soc/soc_memory_layout.h>
 #include <string.h>
 #include <unistd.h>
 
 #include "rg_system.h"
 #include "rg_display.h"
 
+#ifdef RG_TARGET_HOST
+#include "host/rg_host.h"
+#endif
+
+// Default SPI pool, apps can override it in their settings (see spi_init)
 #define SPI_TRANSACTION_COUNT (8)
 #define SPI_BUFFER_COUNT (6)
 #define SPI_BUFFER_LENGTH (4 * 320) // In pixels (uint16)
 
-#define PTR_IS_SPI_BUFFER(ptr) ((((intptr_t)(ptr) - (intptr_t)&spi_buffers) % sizeof(spi_buffers[0])) == 0)
+#define SPI_BUFFER_SIZE (display.spi.bufferLength * 2)
+// Anywhere in a buffer of the pool, several transactions may share one (see spi_buffer_retain)
+#define PTR_IS_SPI_BUFFER(ptr) ((void*)(ptr) >= (void*)spi_buffers && (void*)(ptr) < (void*)spi_buffers + SPI_BUFFER_SIZE * display.spi.buffers)
+#define SPI_BUFFER_INDEX(ptr) (((uint16_t*)(ptr) - spi_buffers) / display.spi.bufferLength)
 
 // Maximum amount of change (percent) in a frame before we trigger a full transfer
 // instead of a partial update (faster). This also allows us to stop the diff early!
+// host/tests/diff_replay.c measures it against recorded frames.
+#ifndef FULL_UPDATE_THRESHOLD
 #define FULL_UPDATE_THRESHOLD (0.6f) // 0.4f
-
-static DMA_ATTR uint16_t spi_buffers[SPI_BUFFER_COUNT][SPI_BUFFER_LENGTH];
-static spi_transaction_t spi_trans[SPI_TRANSACTION_COUNT];
+#endif
+
+// Approximate cost, in pixels, of opening a new window on the panel (six small SPI
+// transactions for CASET/PASET/RAMWR). Dirty spans closer than this are merged.
+#define DIFF_RECT_COST (64)
+
+// Panel refresh period as configured by 0xB1 in ili9341_init, used until TE pulses tell us better
+#define VSYNC_PERIOD_DEFAULT (1000000 / 119)
+// Time to clock one pixel out at 40MHz, in 1/1000 us
+#define VSYNC_PIXEL_TIME (400)
+
+static uint16_t *spi_buffers;
+static uint8_t *spi_buffers_users; // Transactions (and display_task) still using each buffer
+static spi_transaction_t *spi_trans;
+static rg_video_frame_t **spi_trans_frame; // Frame the transaction belongs to
+static rg_video_frame_t *spi_current_frame; // Frame being sent by display_task
+static portMUX_TYPE frame_lock = portMUX_INITIALIZER_UNLOCKED;
+static portMUX_TYPE spi_buffers_lock = portMUX_INITIALIZER_UNLOCKED;
+static SemaphoreHandle_t frame_release_semaphore; // Given once per waiter, see frame_release
+static SemaphoreHandle_t frame_dequeued_semaphore; // display_task is done with a frame
+static int frame_release_waiters;
 static spi_device_handle_t spi_dev;
 static SemaphoreHandle_t spi_count_semaphore;
 static QueueHandle_t spi_buffers_queue;
 static QueueHandle_t spi_queue;
 static QueueHandle_t display_task_queue;
+static portMUX_TYPE vsync_lock = portMUX_INITIALIZER_UNLOCKED;
+static int64_t vsync_last_time;
 
 static rg_display_t display;
 
@@ -36,8 +67,22 @@ static const char *SETTING_SCALING   = "DispScaling";
 static const char *SETTING_FILTER    = "DispFilter";
 static const char *SETTING_ROTATION  = "DispRotation";
 static const char *SETTING_UPDATE    = "DispUpdate";
+static const char *SETTING_VSYNC     = "DispVSync";
+static const char *SETTING_SPI_TRANS = "DispSPITransactions";
+static const char *SETTING_SPI_BUFS  = "DispSPIBuffers";
+static const char *SETTING_SPI_LEN   = "DispSPIBufferLength";
+
+// Not part of display, it's set by the benchmark runner before rg_display_init
+static display_render_t render_mode = RG_DISPLAY_RENDER_AUTO;
+
+static bool screen_line_is_empty[RG_SCREEN_HEIGHT + 1]; // The block loops peek one line past the end
+static bool screen_column_is_empty[RG_SCREEN_WIDTH];
+static int16_t screen_column_source[RG_SCREEN_WIDTH]; // Viewport column => frame column
+static bool screen_columns_unscaled;
+static bool screen_lines_unscaled;
 
-static bool screen_line_is_empty[RG_SCREEN_HEIGHT];
+// Frame palette expanded to 256 entries, masked and swapped to big endian
+static uint16_t palette_lut[256];
 
 typedef struct {
     uint8_t start  : 1; // Indicates this line or column is safe to start an update on
@@ -46,6 +91,7 @@ typedef struct {
 } frame_filter_cap_t;
 
 static frame_filter_cap_t frame_filter_lines[256];
+static frame_filter_cap_t frame_filter_columns[RG_SCREEN_WIDTH]; // Indexed by frame column
 
 typedef struct {
     uint8_t cmd;
@@ -63,22 +109,112 @@ typedef struct {
 #define lcd_init() ili9341_init()
 #define lcd_deinit() ili9341_deinit()
 #define lcd_set_window(left, top, width, height) ili9341_set_window(left, top, width, height)
+#define lcd_set_window_rows(top, height) ili9341_set_window_rows(top, height)
 #define lcd_send_data(buffer, length) ili9341_send_data(buffer, length)
 #define lcd_set_backlight(percent) ili9341_set_backlight(percent)
 
+static inline void frame_retain(rg_video_frame_t *frame)
+{
+    portENTER_CRITICAL(&frame_lock);
+    frame->pending++;
+    portEXIT_CRITICAL(&frame_lock);
+}
+
+static void frame_release(rg_video_frame_t *frame)
+{
+    portENTER_CRITICAL(&frame_lock);
+    int pending = --frame->pending;
+    portEXIT_CRITICAL(&frame_lock);
+
+    if (pending == 0)
+    {
+        // Last byte of the frame is out, this is as close to photons as we can measure
+        uint32_t latency = get_elapsed_time_since(frame->queued_time);
+        display.counters.latency[RG_MIN(latency / RG_DISPLAY_LATENCY_STEP, RG_DISPLAY_LATENCY_BUCKETS - 1)]++;
+        display.counters.latencyLast = latency;
+
+        // Everyone waiting on a release wakes up to check their frame
+        portENTER_CRITICAL(&frame_lock);
+        int waiters = frame_release_waiters;
+        portEXIT_CRITICAL(&frame_lock);
+
+        while (waiters-- > 0)
+            xSemaphoreGive(frame_release_semaphore);
+    }
+}
+
+// Waiters register before checking their frames, so that a release can't slip in between
+static inline void frame_release_waiters_add(int count)
+{
+    portENTER_CRITICAL(&frame_lock);
+    frame_release_waiters += count;
+    portEXIT_CRITICAL(&frame_lock);
+}
+
+static inline void spi_buffer_retain(const void *ptr)
+{
+    portENTER_CRITICAL(&spi_buffers_lock);
+    spi_buffers_users[SPI_BUFFER_INDEX(ptr)]++;
+    portEXIT_CRITICAL(&spi_buffers_lock);
+}
+
+// The buffer goes back to the pool with its last user
+static void spi_buffer_release(const void *ptr)
+{
+    int index = SPI_BUFFER_INDEX(ptr);
+
+    portENTER_CRITICAL(&spi_buffers_lock);
+    int users = --spi_buffers_users[index];
+    portEXIT_CRITICAL(&spi_buffers_lock);
+
+    if (users == 0)
+    {
+        void *buffer = &spi_buffers[index * display.spi.bufferLength];
+        xQueueSend(spi_buffers_queue, &buffer, 0);
+    }
+}
 
 static inline uint16_t *spi_get_buffer()
 {
     uint16_t *buffer;
 
-    if (xQueueReceive(spi_buffers_queue, &buffer, pdMS_TO_TICKS(2500)) != pdTRUE)
+    if (xQueueReceive(spi_buffers_queue, &buffer, 0) != pdTRUE)
     {
-        RG_PANIC("display");
+        // The pool is exhausted, the SPI bus can't keep up with us
+        int64_t start = get_elapsed_time();
+
+        if (xQueueReceive(spi_buffers_queue, &buffer, pdMS_TO_TICKS(2500)) != pdTRUE)
+        {
+            RG_PANIC("display");
+        }
+
+        display.counters.spiBlockedTime += get_elapsed_time_since(start);
     }
 
     return buffer;
 }
 
+static inline spi_transaction_t *spi_get_transaction(size_t length)
+{
+    spi_transaction_t *t;
+
+    if (xQueueReceive(spi_queue, &t, 0) != pdTRUE)
+    {
+        int64_t start = get_elapsed_time();
+        xQueueReceive(spi_queue, &t, portMAX_DELAY);
+        display.counters.spiBlockedTime += get_elapsed_time_since(start);
+    }
+
+    uint32_t queued = display.spi.transactions - uxQueueMessagesWaiting(spi_queue);
+    if (queued > display.counters.spiQueueHighWater)
+        display.counters.spiQueueHighWater = queued;
+
+    display.counters.spiTransactions++;
+    display.counters.spiBytes += length;
+
+    return t;
+}
+
 static inline void spi_queue_transaction(const void *data, size_t length, uint32_t dc_line)
 {
     spi_transaction_t *t;
@@ -86,7 +222,11 @@ static inline void spi_queue_transaction(const void *data, size_t length, uint32
     if (!data || length < 1)
         return;
 
-    xQueueReceive(spi_queue, &t, portMAX_DELAY);
+    t = spi_get_transaction(length);
+    spi_trans_frame[t - spi_trans] = spi_current_frame;
+
+    if (spi_current_frame)
+        frame_retain(spi_current_frame);
 
     *t = (spi_transaction_t) {
         .tx_buffer = NULL,
@@ -98,6 +238,7 @@ static inline void spi_queue_transaction(const void *data, size_t length, uint32
     if (PTR_IS_SPI_BUFFER(data))
     {
         t->tx_buffer = data;
+        spi_buffer_retain(data);
     }
     else if (length < 5)
     {
@@ -107,6 +248,7 @@ static inline void spi_queue_transaction(const void *data, size_t length, uint32
     else
     {
         t->tx_buffer = memcpy(spi_get_buffer(), data, length);
+        spi_buffer_retain(t->tx_buffer);
     }
 
     rg_spi_lock_acquire(SPI_LOCK_DISPLAY);
@@ -119,6 +261,34 @@ static inline void spi_queue_transaction(const void *data, size_t length, uint32
     xSemaphoreGive(spi_count_semaphore);
 }
 
+// Same as spi_queue_transaction but data is sent straight from the frame's buffer, without
+// copying. Like every transaction of the frame, it keeps it busy until spi_task sees it complete.
+static inline void spi_queue_frame_data(rg_video_frame_t *frame, const void *data, size_t length)
+{
+    spi_transaction_t *t = spi_get_transaction(length);
+
+    display.counters.spiDirectBytes += length;
+
+    *t = (spi_transaction_t) {
+        .tx_buffer = data,
+        .length = length * 8, // In bits
+        .user = (void*)1,
+        .flags = 0,
+    };
+
+    frame_retain(frame);
+    spi_trans_frame[t - spi_trans] = frame;
+
+    rg_spi_lock_acquire(SPI_LOCK_DISPLAY);
+
+    if (spi_device_queue_trans(spi_dev, t, pdMS_TO_TICKS(2500)) != ESP_OK)
+    {
+        RG_PANIC("display");
+    }
+
+    xSemaphoreGive(spi_count_semaphore);
+}
+
 IRAM_ATTR
 static void spi_pre_transfer_cb(spi_transaction_t *t)
 {
@@ -138,9 +308,16 @@ static void spi_task(void *arg)
 
         if (spi_device_get_trans_result(spi_dev, &t, 100) == ESP_OK)
         {
+            rg_video_frame_t *frame = spi_trans_frame[t - spi_trans];
+
             if (PTR_IS_SPI_BUFFER(t->tx_buffer) && !(t->flags & SPI_TRANS_USE_TXDATA))
             {
-                xQueueSend(spi_buffers_queue, &t->tx_buffer, 0);
+                spi_buffer_release(t->tx_buffer);
+            }
+            if (frame)
+            {
+                spi_trans_frame[t - spi_trans] = NULL;
+                frame_release(frame);
             }
             if (xQueueSend(spi_queue, &t, 0) != pdTRUE)
             {
@@ -160,35 +337,51 @@ static void spi_task(void *arg)
 
 static void spi_init()
 {
-    spi_queue = xQueueCreate(SPI_TRANSACTION_COUNT, sizeof(void*));
-    spi_buffers_queue = xQueueCreate(SPI_BUFFER_COUNT, sizeof(void*));
-    spi_count_semaphore = xSemaphoreCreateCounting(SPI_TRANSACTION_COUNT, 0);
-
-    for (size_t x = 0; x < SPI_BUFFER_COUNT; x++)
+    // The pool's size is a tradeoff between memory and how far ahead of the SPI bus the display
+    // task can run. An emulator short on internal RAM might want less, one with bursty updates more.
+    display.spi.transactions = RG_MIN(RG_MAX(rg_settings_get_app_int32(SETTING_SPI_TRANS, SPI_TRANSACTION_COUNT), 4), 32);
+    display.spi.buffers = RG_MIN(RG_MAX(rg_settings_get_app_int32(SETTING_SPI_BUFS, SPI_BUFFER_COUNT), 2), 16);
+    display.spi.bufferLength = RG_MIN(RG_MAX(rg_settings_get_app_int32(SETTING_SPI_LEN, SPI_BUFFER_LENGTH),
+                                             RG_SCREEN_WIDTH), RG_SCREEN_WIDTH * 16);
+
+    spi_buffers = rg_alloc(display.spi.buffers * SPI_BUFFER_SIZE, MEM_FAST|MEM_DMA);
+    spi_buffers_users = rg_alloc(display.spi.buffers, MEM_FAST);
+    spi_trans = rg_alloc(display.spi.transactions * sizeof(spi_transaction_t), MEM_FAST);
+    spi_trans_frame = rg_alloc(display.spi.transactions * sizeof(rg_video_frame_t *), MEM_FAST);
+
+    spi_queue = xQueueCreate(display.spi.transactions, sizeof(void*));
+    spi_buffers_queue = xQueueCreate(display.spi.buffers, sizeof(void*));
+    spi_count_semaphore = xSemaphoreCreateCounting(display.spi.transactions, 0);
+
+    for (size_t x = 0; x < display.spi.buffers; x++)
     {
-        void *buffer = &spi_buffers[x];
+        void *buffer = &spi_buffers[x * display.spi.bufferLength];
         xQueueSend(spi_buffers_queue, &buffer, portMAX_DELAY);
     }
 
-    for (size_t x = 0; x < SPI_TRANSACTION_COUNT; x++)
+    for (size_t x = 0; x < display.spi.transactions; x++)
     {
         void *trans = &spi_trans[x];
         xQueueSend(spi_queue, &trans, portMAX_DELAY);
     }
 
+    RG_LOGI("SPI pool: %d transactions, %d buffers of %d pixels\n",
+        display.spi.transactions, display.spi.buffers, display.spi.bufferLength);
+
     spi_bus_config_t buscfg = {
         .miso_io_num = RG_GPIO_LCD_MISO,
         .mosi_io_num = RG_GPIO_LCD_MOSI,
         .sclk_io_num = RG_GPIO_LCD_CLK,
         .quadwp_io_num = -1,
         .quadhd_io_num = -1,
+        .max_transfer_sz = SPI_BUFFER_SIZE,
     };
 
     spi_device_interface_config_t devcfg = {
         .clock_speed_hz = SPI_MASTER_FREQ_40M,  // 80Mhz causes glitches unfortunately
         .mode = 0,                              // SPI mode 0
         .spics_io_num = RG_GPIO_LCD_CS,         // CS pin
-        .queue_size = SPI_TRANSACTION_COUNT,    // We want to be able to queue 5 transactions at a time
+        .queue_size = display.spi.transactions, // How many transactions we can queue at a time
         .pre_cb = &spi_pre_transfer_cb,         // Specify pre-transfer callback to handle D/C line and SPI lock
         .flags = SPI_DEVICE_NO_DUMMY,           // SPI_DEVICE_HALFDUPLEX;
     };
@@ -208,12 +401,12 @@ static void spi_init()
 static void spi_drain_queue()
 {
     if (uxQueueSpacesAvailable(spi_queue)) {
-        for (size_t i = 0; i < SPI_TRANSACTION_COUNT; ++i) {
+        for (size_t i = 0; i < display.spi.transactions; ++i) {
             spi_transaction_t *t;
             xQueueReceive(spi_queue, &t, portMAX_DELAY);
         }
 
-        for (size_t i = 0; i < SPI_TRANSACTION_COUNT; ++i) {
+        for (size_t i = 0; i < display.spi.transactions; ++i) {
             spi_transaction_t *t = &spi_trans[i];
             xQueueSend(spi_queue, &t, portMAX_DELAY);
         }
@@ -254,6 +447,7 @@ static void ili9341_init()
         {0x36, {(MADCTL_MV|MADCTL_MY|TFT_RGB_BGR)}, 1},     // Memory Access Control
         {0x3A, {0x55}, 1},
         {0xB1, {0x00, 0x10}, 2},                            // Frame Rate Control (1B=70, 1F=61, 10=119)
+        {0x35, {0x00}, 1},                                  // Tearing Effect Line ON (V-blanking only)
         {0xB6, {0x0A, 0xA2}, 2},                            // Display Function Control
         {0xF6, {0x01, 0x30}, 2},
         {0xF2, {0x00}, 1},                                  // 3Gamma Function Disable
@@ -323,7 +517,7 @@ static void ili9341_set_window(int left, int top, int width, int height)
     int bottom = top + height - 1;
     // int bottom = display.screen.height - 1;
 
-    if (right > 0 && bottom > 0)
+    if (width > 0 && height > 0 && left >= 0 && top >= 0)
     {
         ili9341_cmd(0x2A, (uint8_t[]){left >> 8, left & 0xff, right >> 8, right & 0xff}, 4); // Horiz
         ili9341_cmd(0x2B, (uint8_t[]){top >> 8, top & 0xff, bottom >> 8, bottom & 0xff}, 4); // Vert
@@ -338,46 +532,254 @@ static void ili9341_set_window(int left, int top, int width, int height)
     }
 }
 
+// Moves the window to other rows, its columns stay. Four transactions instead of six.
+static void ili9341_set_window_rows(int top, int height)
+{
+    int bottom = top + height - 1;
+
+    ili9341_cmd(0x2B, (uint8_t[]){top >> 8, top & 0xff, bottom >> 8, bottom & 0xff}, 4); // Vert
+    ili9341_cmd(0x2C, NULL, 0); // Memory write
+}
+
 static void ili9341_send_data(void *buffer, size_t length)
 {
     spi_queue_transaction(buffer, length, 1);
 }
 
+IRAM_ATTR
+static void vsync_isr(void *arg)
+{
+    int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL_ISR(&vsync_lock);
+    int64_t elapsed = now - vsync_last_time;
+    // Ignore glitches and missed pulses, the period should only drift slowly with temperature
+    if (elapsed > VSYNC_PERIOD_DEFAULT / 2 && elapsed < VSYNC_PERIOD_DEFAULT * 2)
+        display.vsync.period = (display.vsync.period * 7 + elapsed) / 8;
+    vsync_last_time = now;
+    display.vsync.pulses++;
+    portEXIT_CRITICAL_ISR(&vsync_lock);
+}
+
+static void vsync_init(void)
+{
+    display.vsync.period = VSYNC_PERIOD_DEFAULT;
+    display.vsync.estimated = true;
+    // Without a TE line the phase is anchored to the moment the panel came up. It drifts
+    // but it still keeps our writes at a steady distance from the scanout.
+    vsync_last_time = get_elapsed_time();
+
+    if (RG_GPIO_LCD_TE != GPIO_NUM_NC)
+    {
+        gpio_set_direction(RG_GPIO_LCD_TE, GPIO_MODE_INPUT);
+        gpio_set_intr_type(RG_GPIO_LCD_TE, GPIO_INTR_POSEDGE);
+        gpio_install_isr_service(0); // Might already be installed, that's fine
+        if (gpio_isr_handler_add(RG_GPIO_LCD_TE, &vsync_isr, NULL) == ESP_OK)
+            display.vsync.estimated = false;
+    }
+}
+
+// Returns the panel line being scanned out at time `now`. The panel's gate lines run along
+// our x axis because of MADCTL_MV. This only depends on its arguments and the last TE pulse,
+// so it can be driven by a simulated clock.
+static inline int vsync_scanout_line(int64_t now)
+{
+    portENTER_CRITICAL(&vsync_lock);
+    int64_t last = vsync_last_time;
+    int32_t period = display.vsync.period;
+    portEXIT_CRITICAL(&vsync_lock);
+
+    int64_t phase = (now - last) % period;
+    if (phase < 0)
+        phase += period;
+
+    return phase * display.screen.width / period;
+}
+
+// Delays until the columns [left, left + width) can be written, `pixels` long, without
+// the panel's scanout crossing them. We can't do anything about rects that take longer
+// to send than the beam needs to come back around, those are counted as tears.
+static void vsync_wait(int left, int width, int pixels)
+{
+    const int lines = display.screen.width;
+    const int period = display.vsync.period;
+
+    // Rounded up, being a line late is a tear
+    int write_lines = ((int64_t)pixels * VSYNC_PIXEL_TIME / 1000 * lines + period - 1) / period;
+    int slack = lines - width - write_lines;
+
+    if (slack <= 0)
+    {
+        display.counters.vsyncTears++;
+        return;
+    }
+
+    // Lines the beam has travelled since it left the rect, it must stay under slack
+    int distance = (vsync_scanout_line(get_elapsed_time()) - (left + width) + lines) % lines;
+
+    if (distance >= slack)
+    {
+        // The rect must go out when we're done waiting, not whenever the SPI queue gets to it
+        spi_drain_queue();
+        distance = (vsync_scanout_line(get_elapsed_time()) - (left + width) + lines) % lines;
+    }
+
+    if (distance >= slack)
+    {
+        int delay = ((lines - distance) * period + lines - 1) / lines;
+        usleep(delay);
+        display.counters.vsyncWaitTime += delay;
+    }
+}
+
+// Average of two big-endian RGB565 pixels, rounding each channel down
 static inline uint blend_pixels(uint a, uint b)
 {
-    // Input in Big-Endian, swap to Little Endian
-    a = (a << 8) | (a >> 8);
-    b = (b << 8) | (b >> 8);
+    // Mirroring the pixels puts them in native order in bits 8-23, no swap needed
+    a *= 0x10001;
+    b *= 0x10001;
+
+    // Clearing each channel's lowest bit before the shift keeps them from bleeding into each other
+    uint v = (a & b) + (((a ^ b) & 0x00F7DE00) >> 1);
+
+    return (v & 0xFF00) | ((v >> 16) & 0xFF);
+}
+
+// Same as blend_pixels but for two pairs of pixels packed in words
+static inline uint32_t blend_pixels_x2(uint32_t a, uint32_t b)
+{
+    // Green straddles both bytes in big-endian, its carry would have to go from bit 15 back down to
+    // bit 0. Redirecting it costs more than these swaps (about 22 ops against 20), so we swap.
+    a = ((a & 0x00FF00FF) << 8) | ((a >> 8) & 0x00FF00FF);
+    b = ((b & 0x00FF00FF) << 8) | ((b >> 8) & 0x00FF00FF);
 
-    // Signed arithmetic is deliberate here
-    int r0 = (a >> 11) & 0x1F;
-    int g0 = (a >> 5) & 0x3F;
-    int b0 = (a) & 0x1F;
+    uint32_t v = (a & b) + (((a ^ b) & 0xF7DEF7DE) >> 1);
 
-    int r1 = (b >> 11) & 0x1F;
-    int g1 = (b >> 5) & 0x3F;
-    int b1 = (b) & 0x1F;
+    return ((v & 0x00FF00FF) << 8) | ((v >> 8) & 0x00FF00FF);
+}
 
-    int rv = (((r1 - r0) >> 1) + r0);
-    int gv = (((g1 - g0) >> 1) + g0);
-    int bv = (((b1 - b0) >> 1) + b0);
+static inline void blend_lines(uint16_t *dst, const uint16_t *lineA, const uint16_t *lineB, int count)
+{
+    // Lines are consecutive in the buffer so they all share the same alignment, or none do
+    if (((intptr_t)dst & 3) == ((intptr_t)lineA & 3) && ((intptr_t)dst & 3) == ((intptr_t)lineB & 3))
+    {
+        if (count > 0 && ((intptr_t)dst & 3))
+        {
+            *dst++ = blend_pixels(*lineA++, *lineB++);
+            count--;
+        }
+
+        uint32_t *dst32 = (uint32_t *)dst;
+        const uint32_t *lineA32 = (const uint32_t *)lineA;
+        const uint32_t *lineB32 = (const uint32_t *)lineB;
+        for (; count >= 2; count -= 2)
+        {
+            *dst32++ = blend_pixels_x2(*lineA32++, *lineB32++);
+        }
+        dst = (uint16_t *)dst32;
+        lineA = (const uint16_t *)lineA32;
+        lineB = (const uint16_t *)lineB32;
+    }
 
-    uint v = (rv << 11) | (gv << 5) | (bv);
+    for (; count > 0; --count)
+    {
+        *dst++ = blend_pixels(*lineA++, *lineB++);
+    }
+}
 
-    // Back to Big-Endian
-    v = (v << 8) | (v >> 8);
+static inline void update_palette_lut(const rg_video_frame_t *frame)
+{
+    const uint16_t *palette = frame->palette;
+    const uint32_t palette_mask = frame->pixel_mask ? frame->pixel_mask : 0xFF;
 
-    return v;
+    if (frame->flags & RG_PIXEL_LE)
+    {
+        for (int i = 0; i < 256; ++i)
+        {
+            uint32_t pixel = palette[i & palette_mask];
+            palette_lut[i] = (pixel >> 8) | (pixel << 8);
+        }
+    }
+    else
+    {
+        for (int i = 0; i < 256; ++i)
+        {
+            palette_lut[i] = palette[i & palette_mask];
+        }
+    }
+}
+
+static inline void convert_line_pal8(uint16_t *dst, const uint8_t *src, int count)
+{
+    // Get the source on a word boundary so we can read 4 pixels per load
+    for (; count > 0 && ((intptr_t)src & 3); --count)
+    {
+        *dst++ = palette_lut[*src++];
+    }
+
+    const uint32_t *src32 = (const uint32_t *)src;
+
+    if (((intptr_t)dst & 3) == 0)
+    {
+        uint32_t *dst32 = (uint32_t *)dst;
+        for (; count >= 4; count -= 4)
+        {
+            uint32_t pixels = *src32++;
+            *dst32++ = palette_lut[pixels & 0xFF] | ((uint32_t)palette_lut[(pixels >> 8) & 0xFF] << 16);
+            *dst32++ = palette_lut[(pixels >> 16) & 0xFF] | ((uint32_t)palette_lut[pixels >> 24] << 16);
+        }
+        dst = (uint16_t *)dst32;
+    }
+    else
+    {
+        for (; count >= 4; count -= 4)
+        {
+            uint32_t pixels = *src32++;
+            dst[0] = palette_lut[pixels & 0xFF];
+            dst[1] = palette_lut[(pixels >> 8) & 0xFF];
+            dst[2] = palette_lut[(pixels >> 16) & 0xFF];
+            dst[3] = palette_lut[pixels >> 24];
+            dst += 4;
+        }
+    }
+
+    for (src = (const uint8_t *)src32; count > 0; --count)
+    {
+        *dst++ = palette_lut[*src++];
+    }
+}
+
+static inline void convert_line_swap16(uint16_t *dst, const uint16_t *src, int count)
+{
+    // Two pixels per word when both buffers share the same alignment
+    if (((intptr_t)dst & 3) == ((intptr_t)src & 3))
+    {
+        if (count > 0 && ((intptr_t)src & 3))
+        {
+            *dst++ = (*src >> 8) | (*src << 8);
+            src++, count--;
+        }
+
+        const uint32_t *src32 = (const uint32_t *)src;
+        uint32_t *dst32 = (uint32_t *)dst;
+        for (; count >= 2; count -= 2)
+        {
+            uint32_t pixels = *src32++;
+            *dst32++ = ((pixels & 0x00FF00FF) << 8) | ((pixels >> 8) & 0x00FF00FF);
+        }
+        src = (const uint16_t *)src32;
+        dst = (uint16_t *)dst32;
+    }
+
+    for (; count > 0; --count, ++src)
+    {
+        *dst++ = (*src >> 8) | (*src << 8);
+    }
 }
 
 static inline void bilinear_filter(uint16_t *line_buffer, int top, int left, int width, int height)
 {
-    // It crashes when we use display.screen.width
-    // I don't fully understand why because assert(display.screen.width == RG_SCREEN_WIDTH) is always good
-    // A memory access race between the cores maybe? A conflicting optimization?
-    const int screen_width = RG_SCREEN_WIDTH; // display.screen.width;
-    const int x_inc = screen_width / display.viewport.x_scale;
-    const int ix_acc = (x_inc * left) % screen_width;
+    const bool *column_is_empty = &screen_column_is_empty[left];
     const int filter_y = display.config.filter == RG_DISPLAY_FILTER_VERT || display.config.filter == RG_DISPLAY_FILTER_BOTH;
     const int filter_x = display.config.filter == RG_DISPLAY_FILTER_HORIZ || display.config.filter == RG_DISPLAY_FILTER_BOTH;
     int fill_line = -1;
@@ -394,19 +796,12 @@ static inline void bilinear_filter(uint16_t *line_buffer, int top, int left, int
         if (filter_x)
         {
             uint16_t *buffer = line_buffer + y * width;
-            for (int x = 0, frame_x = 0, prev_frame_x = -1, x_acc = ix_acc; x < width; ++x)
+            for (int x = 1; x + 1 < width; ++x)
             {
-                if (frame_x == prev_frame_x && x > 0 && x + 1 < width)
+                if (column_is_empty[x])
                 {
                     buffer[x] = blend_pixels(buffer[x - 1], buffer[x + 1]);
                 }
-                prev_frame_x = frame_x;
-
-                x_acc += x_inc;
-                while (x_acc >= screen_width) {
-                    ++frame_x;
-                    x_acc -= screen_width;
-                }
             }
         }
 
@@ -416,16 +811,83 @@ static inline void bilinear_filter(uint16_t *line_buffer, int top, int left, int
             uint16_t *lineA = line_buffer + (fill_line - 1) * width;
             uint16_t *lineB = line_buffer + (fill_line + 0) * width;
             uint16_t *lineC = line_buffer + (fill_line + 1) * width;
-            for (size_t x = 0; x < width; ++x)
-            {
-                lineB[x] = blend_pixels(lineA[x], lineC[x]);
-            }
+            blend_lines(lineB, lineA, lineC, width);
             fill_line = -1;
         }
     }
 }
 
-static inline void write_rect(rg_video_frame_t *frame, int left, int top, int width, int height)
+static inline void convert_line(uint16_t *dst, const uint8_t *buffer, int left, int width, int flags)
+{
+    const int16_t *columns = &screen_column_source[left];
+    const bool swap_pixels = (flags & RG_PIXEL_LE);
+
+    if (screen_columns_unscaled)
+    {
+        // When unscaled, screen_column_source[left] == left
+        if (flags & RG_PIXEL_PAL)
+            convert_line_pal8(dst, buffer + left, width);
+        else if (swap_pixels)
+            convert_line_swap16(dst, (uint16_t*)buffer + left, width);
+        else
+            memcpy(dst, (uint16_t*)buffer + left, width * 2);
+    }
+    else if (flags & RG_PIXEL_PAL)
+    {
+        for (int x = 0; x < width; ++x)
+            dst[x] = palette_lut[buffer[columns[x]]];
+    }
+    else if (swap_pixels)
+    {
+        for (int x = 0; x < width; ++x)
+        {
+            uint32_t pixel = ((uint16_t*)buffer)[columns[x]];
+            dst[x] = (pixel >> 8) | (pixel << 8);
+        }
+    }
+    else
+    {
+        for (int x = 0; x < width; ++x)
+            dst[x] = ((uint16_t*)buffer)[columns[x]];
+    }
+}
+
+static inline bool can_send_rect_directly(const rg_video_frame_t *frame, int left, int width)
+{
+    // The DMA engine needs word aligned buffers and lengths in internal memory. There's no
+    // filtering to worry about, it's a no-op when unscaled.
+    return (frame->flags & RG_PIXEL_DMA) && (frame->flags & (RG_PIXEL_PAL|RG_PIXEL_LE)) == 0
+        && screen_columns_unscaled && screen_lines_unscaled
+        && esp_ptr_dma_capable(frame->buffer) && ((intptr_t)frame->buffer & 3) == 0
+        && (frame->stride & 3) == 0 && (left & 1) == 0 && (width & 1) == 0;
+}
+
+static inline void write_rect_direct(rg_video_frame_t *frame, int left, int top, int width, int height)
+{
+    uint8_t *buffer = frame->buffer + (top * frame->stride) + (left * 2);
+
+    if (width * 2 == frame->stride)
+    {
+        // Consecutive lines are contiguous, send them in as few transactions as possible
+        for (size_t remaining = width * height * 2; remaining > 0;)
+        {
+            size_t length = RG_MIN(remaining, SPI_BUFFER_SIZE);
+            spi_queue_frame_data(frame, buffer, length);
+            buffer += length;
+            remaining -= length;
+        }
+    }
+    else
+    {
+        for (int y = 0; y < height; ++y)
+        {
+            spi_queue_frame_data(frame, buffer, width * 2);
+            buffer += frame->stride;
+        }
+    }
+}
+
+static inline void write_rect(rg_video_frame_t *frame, int left, int top, int width, int height, int field)
 {
     const int screen_width = display.screen.width;
     const int screen_height = display.screen.height;
@@ -433,15 +895,14 @@ static inline void write_rect(rg_video_frame_t *frame, int left, int top, int wi
     const int y_inc = screen_height / display.viewport.y_scale;
     const int scaled_left = ((screen_width * left) + (x_inc - 1)) / x_inc;
     const int scaled_top = ((screen_height * top) + (y_inc - 1)) / y_inc;
-    const int scaled_right = ((screen_width * (left + width)) + (x_inc - 1)) / x_inc;
+    const int scaled_right = RG_MIN(((screen_width * (left + width)) + (x_inc - 1)) / x_inc, (int)display.viewport.width);
     const int scaled_bottom = ((screen_height * (top + height)) + (y_inc - 1)) / y_inc;
     const int scaled_width = scaled_right - scaled_left;
     const int scaled_height = scaled_bottom - scaled_top;
     const int screen_top = display.viewport.y_pos + scaled_top;
     const int screen_left = display.viewport.x_pos + scaled_left;
     const int screen_bottom = RG_MIN(screen_top + scaled_height, screen_height);
-    const int ix_acc = (x_inc * scaled_left) % screen_width;
-    const int lines_per_buffer = SPI_BUFFER_LENGTH / scaled_width;
+    const int lines_per_buffer = display.spi.bufferLength / scaled_width;
     const int filter_mode = display.config.scaling ? display.config.filter : 0;
 
     if (scaled_width < 1 || scaled_height < 1)
@@ -449,14 +910,77 @@ static inline void write_rect(rg_video_frame_t *frame, int left, int top, int wi
         return;
     }
 
+    if (display.config.vsync)
+    {
+        int lines = RG_MIN(scaled_height, screen_bottom - screen_top);
+        vsync_wait(screen_left, scaled_width, scaled_width * (field < 0 ? lines : lines / 2));
+    }
+
     uint32_t pixel_format = frame->flags & RG_PIXEL_MASK;
     uint32_t stride = frame->stride;
-    uint32_t palette_mask = frame->pixel_mask ? frame->pixel_mask : 0xFF;
-    uint16_t *palette = (pixel_format & RG_PIXEL_PAL) ? frame->palette : NULL;
-    uint8_t *buffer = frame->buffer + (top * stride) + (left * (palette ? 1 : 2));
+    uint8_t *buffer = frame->buffer + (top * stride);
+
+    // Interlaced updates send every other screen line, each in its own window. Only the first one
+    // sets the columns, and the lines share the SPI buffers. They start on a word boundary for the
+    // DMA. The vertical filter needs both neighbours of a line so only the horizontal filter applies.
+    if (field >= 0)
+    {
+        const int line_pitch = (scaled_width + 1) & ~1;
+        const int lines_per_field_buffer = display.spi.bufferLength / line_pitch;
+        uint16_t *field_buffer = NULL;
+        int field_lines = 0;
+        bool columns_set = false;
+
+        for (int y = 0, screen_y = screen_top; y < height && screen_y < screen_bottom;)
+        {
+            if ((screen_y & 1) == field)
+            {
+                if (!field_buffer || field_lines == lines_per_field_buffer)
+                {
+                    if (field_buffer)
+                        spi_buffer_release(field_buffer);
+                    field_buffer = spi_get_buffer();
+                    spi_buffer_retain(field_buffer); // Until we're done filling it
+                    field_lines = 0;
+                }
+
+                uint16_t *line_buffer = &field_buffer[field_lines++ * line_pitch];
+
+                convert_line(line_buffer, buffer, scaled_left, scaled_width, pixel_format);
+
+                if (filter_mode == RG_DISPLAY_FILTER_HORIZ || filter_mode == RG_DISPLAY_FILTER_BOTH)
+                {
+                    bilinear_filter(line_buffer, screen_y, scaled_left, scaled_width, 1);
+                }
+
+                if (columns_set)
+                    lcd_set_window_rows(screen_y, 1);
+                else
+                    lcd_set_window(screen_left, screen_y, scaled_width, 1);
+                columns_set = true;
+                lcd_send_data(line_buffer, scaled_width * 2);
+            }
+
+            if (!screen_line_is_empty[++screen_y])
+            {
+                buffer += stride;
+                ++y;
+            }
+        }
+
+        if (field_buffer)
+            spi_buffer_release(field_buffer);
+        return;
+    }
 
     lcd_set_window(screen_left, screen_top, scaled_width, scaled_height);
 
+    if (can_send_rect_directly(frame, left, width))
+    {
+        write_rect_direct(frame, left, top, width, RG_MIN(height, screen_bottom - screen_top));
+        return;
+    }
+
     for (int y = 0, screen_y = screen_top; y < height;)
     {
         int lines_to_copy = lines_per_buffer;
@@ -488,29 +1012,14 @@ static inline void write_rect(rg_video_frame_t *frame, int left, int top, int wi
             {
                 uint16_t *buffer = &line_buffer[line_buffer_index];
                 memcpy(buffer, buffer - scaled_width, scaled_width * 2);
-                line_buffer_index += scaled_width;
             }
             else
             {
-                for (int x = 0, x_acc = ix_acc; x < width;)
-                {
-                    uint32_t pixel;
-
-                    if (palette)
-                        pixel = palette[buffer[x] & palette_mask];
-                    else
-                        pixel = ((uint16_t*)buffer)[x];
-
-                    line_buffer[line_buffer_index++] = pixel;
-
-                    x_acc += x_inc;
-                    while (x_acc >= screen_width) {
-                        ++x;
-                        x_acc -= screen_width;
-                    }
-                }
+                convert_line(&line_buffer[line_buffer_index], buffer, scaled_left, scaled_width, pixel_format);
             }
 
+            line_buffer_index += scaled_width;
+
             if (!screen_line_is_empty[++screen_y])
             {
                 buffer += stride;
@@ -518,16 +1027,6 @@ static inline void write_rect(rg_video_frame_t *frame, int left, int top, int wi
             }
         }
 
-        // Swap endianness (looping over a second time is slower, but it should be unusual)
-        if (pixel_format & RG_PIXEL_LE)
-        {
-            while (line_buffer_index--)
-            {
-                uint32_t pixel = line_buffer[line_buffer_index];
-                line_buffer[line_buffer_index] = (pixel >> 8) | (pixel << 8);
-            }
-        }
-
         if (filter_mode)
         {
             bilinear_filter(line_buffer, screen_y - lines_to_copy, scaled_left, scaled_width, lines_to_copy);
@@ -537,14 +1036,109 @@ static inline void write_rect(rg_video_frame_t *frame, int left, int top, int wi
     }
 }
 
+static inline void set_full_diff(rg_video_frame_t *frame)
+{
+    frame->diff[0] = (rg_diff_rect_t){0, 0, frame->width, frame->height};
+    frame->diff_count = 1;
+}
+
+// Whether sending the diff costs about as much as sending the whole frame. A few pixels changed on
+// every line is still a small update.
+static inline bool diff_is_full(const rg_video_frame_t *frame)
+{
+    int area = 0;
+    for (int i = 0; i < frame->diff_count; ++i)
+        area += frame->diff[i].width * frame->diff[i].height;
+    return area >= frame->width * frame->height * FULL_UPDATE_THRESHOLD;
+}
+
+static inline bool rects_overlap(const rg_diff_rect_t *a, const rg_diff_rect_t *b)
+{
+    return a->left < b->left + b->width && b->left < a->left + a->width
+        && a->top < b->top + b->height && b->top < a->top + a->height;
+}
+
+static inline void rect_union(rg_diff_rect_t *a, int left, int top, int right, int bottom)
+{
+    right = RG_MAX(right, a->left + a->width);
+    bottom = RG_MAX(bottom, a->top + a->height);
+    a->left = RG_MIN(left, a->left);
+    a->top = RG_MIN(top, a->top);
+    a->width = right - a->left;
+    a->height = bottom - a->top;
+}
+
+// Pixels wasted (sent without having changed) if the span is folded into rect
+static inline int rect_merge_waste(const rg_diff_rect_t *rect, int left, int right, int y)
+{
+    int width = RG_MAX(right, rect->left + rect->width) - RG_MIN(left, (int)rect->left);
+    int height = RG_MAX(y + 1, rect->top + rect->height) - RG_MIN(y, (int)rect->top);
+    return (width * height) - (rect->width * rect->height) - (right - left);
+}
+
+static inline void add_diff_span(rg_video_frame_t *frame, int left, int right, int y)
+{
+    rg_diff_rect_t *rects = frame->diff;
+    rg_diff_rect_t *best = NULL;
+    int best_waste = INT32_MAX;
+
+    for (int i = frame->diff_count - 1; i >= 0; --i)
+    {
+        // Only rects touching the previous line can grow cheaply, unless we're out of rects
+        if (rects[i].top + rects[i].height < y && frame->diff_count < RG_DISPLAY_DIFF_RECTS)
+            continue;
+
+        int waste = rect_merge_waste(&rects[i], left, right, y);
+        if (waste < best_waste)
+        {
+            best_waste = waste;
+            best = &rects[i];
+        }
+    }
+
+    if (best && (best_waste <= DIFF_RECT_COST || frame->diff_count == RG_DISPLAY_DIFF_RECTS))
+        rect_union(best, left, y, right, y + 1);
+    else
+        rects[frame->diff_count++] = (rg_diff_rect_t){left, y, right - left, 1};
+}
+
+static inline void merge_overlapping_rects(rg_video_frame_t *frame)
+{
+    rg_diff_rect_t *rects = frame->diff;
+
+    for (int i = 0; i < frame->diff_count; ++i)
+    {
+        for (int j = i + 1; j < frame->diff_count; ++j)
+        {
+            if (rects_overlap(&rects[i], &rects[j]))
+            {
+                rect_union(&rects[i], rects[j].left, rects[j].top,
+                    rects[j].left + rects[j].width, rects[j].top + rects[j].height);
+                rects[j] = rects[--frame->diff_count];
+                i = -1; // rects[i] grew, it may now overlap rects we already checked
+                break;
+            }
+        }
+    }
+}
+
+static inline uint32_t hash_line(const uint32_t *buffer, size_t count)
+{
+    // FNV-1a over words instead of bytes, good enough to detect any realistic change
+    uint32_t hash = 0x811C9DC5;
+    for (size_t x = 0; x < count; ++x)
+    {
+        hash = (hash ^ buffer[x]) * 0x01000193;
+    }
+    return hash;
+}
+
 static inline int frame_diff(rg_video_frame_t *frame, rg_video_frame_t *prevFrame)
 {
     // NOTE: We no longer use the palette when comparing pixels. It is now the emulator's
     // responsibility to force a full redraw when its palette changes.
     // In most games a palette change is unusual so we get a performance increase by not checking.
 
-    rg_line_diff_t *out_diff = frame->diff;
-
     int threshold_remaining = frame->width * frame->height * FULL_UPDATE_THRESHOLD;
     int pixel_size = (frame->flags & RG_PIXEL_PAL) ? 1 : 2;
     int lines_changed = 0;
@@ -552,100 +1146,96 @@ static inline int frame_diff(rg_video_frame_t *frame, rg_video_frame_t *prevFram
     uint32_t u32_blocks = (frame->width * pixel_size / 4);
     uint32_t u32_pixels = 4 / pixel_size;
 
+    // The previous frame's hashes describe its buffer as it was diffed, which is still
+    // valid because the emulator doesn't draw in a frame it just queued.
+    bool use_hashes = prevFrame->line_hash_valid && prevFrame->width == frame->width;
+
+    frame->diff_count = 0;
+    frame->line_hash_valid = true;
+
     for (int y = 0, i = 0; y < frame->height; ++y, i += frame->stride)
     {
         uint32_t *buffer = frame->buffer + i;
         uint32_t *prevBuffer = prevFrame->buffer + i;
-        int left = 0, width = 0;
+        int span_left = -1, span_right = -1;
+
+        // Unchanged lines are skipped without ever reading the previous frame
+        frame->line_hash[y] = hash_line(buffer, u32_blocks);
 
+        if (use_hashes && frame->line_hash[y] == prevFrame->line_hash[y])
+        {
+            display.counters.linesSkipped++;
+            continue;
+        }
+
+        display.counters.linesCompared++;
+
+        // Collect the changed spans of the line, merging those separated by small gaps
         for (int x = 0; x < u32_blocks; ++x)
         {
-            if (buffer[x] != prevBuffer[x])
+            if (buffer[x] == prevBuffer[x])
+                continue;
+
+            int left = x * u32_pixels;
+            while (x < u32_blocks && buffer[x] != prevBuffer[x])
+                ++x;
+            int right = x * u32_pixels;
+
+            if (span_left >= 0 && left - span_right > DIFF_RECT_COST)
             {
-                for (int xl = u32_blocks - 1; xl >= x; --xl)
-                {
-                    if (buffer[xl] != prevBuffer[xl]) {
-                        left = x * u32_pixels;
-                        width = ((xl + 1) - x) * u32_pixels;
-                        lines_changed++;
-                        break;
-                    }
-                }
-                break;
+                add_diff_span(frame, span_left, span_right, y);
+                threshold_remaining -= span_right - span_left;
+                span_left = left;
             }
+            else if (span_left < 0)
+            {
+                span_left = left;
+            }
+            span_right = right;
         }
 
-        threshold_remaining -= width;
+        if (span_left >= 0)
+        {
+            add_diff_span(frame, span_left, span_right, y);
+            threshold_remaining -= span_right - span_left;
+            lines_changed++;
+        }
 
         if (threshold_remaining <= 0)
         {
-            out_diff[0].left = 0;
-            out_diff[0].width = frame->width;
-            out_diff[0].repeat = frame->height;
+            set_full_diff(frame);
+            frame->line_hash_valid = false; // The remaining lines weren't hashed
             return frame->height; // Stop scan and do full update
         }
-
-        out_diff[y].left = left;
-        out_diff[y].width = width;
-        out_diff[y].repeat = 1;
     }
 
     // If filtering is enabled we must adjust our diff blocks to be on appropriate boundaries
     if (display.config.filter && display.config.scaling)
     {
-        for (int y = 0; y < frame->height; ++y)
+        for (int i = 0; i < frame->diff_count; ++i)
         {
-            if (out_diff[y].width > 0)
-            {
-                int block_start = y;
-                int block_end = y;
-                int left = out_diff[y].left;
-                int right = left + out_diff[y].width;
+            rg_diff_rect_t *rect = &frame->diff[i];
+            int top = rect->top;
+            int bottom = rect->top + rect->height - 1;
+            int left = RG_MAX(rect->left - 1, 0);
+            int right = RG_MIN(rect->left + rect->width + 1, (int)frame->width);
 
-                while (block_start > 0 && (out_diff[block_start].width > 0 || !frame_filter_lines[block_start].start))
-                    block_start--;
-
-                while (block_end < frame->height - 1 && (out_diff[block_end].width > 0 || !frame_filter_lines[block_end].stop))
-                    block_end++;
-
-                for (int i = block_start; i <= block_end; i++)
-                {
-                    if (out_diff[i].width > 0) {
-                        if (out_diff[i].left + out_diff[i].width > right) right = out_diff[i].left + out_diff[i].width;
-                        if (out_diff[i].left < left) left = out_diff[i].left;
-                    }
-                }
+            // A repeated column is blended with the next one, the rect can't end on one
+            while (right < RG_MIN((int)frame->width, RG_SCREEN_WIDTH) && !frame_filter_columns[right - 1].stop)
+                right++;
 
-                if (--left < 0) left = 0;
-                if (++right > frame->width) right = frame->width;
+            while (top > 0 && !frame_filter_lines[top].start)
+                top--;
 
-                for (int i = block_start; i <= block_end; i++)
-                {
-                    out_diff[i].left = left;
-                    out_diff[i].width = right - left;
-                }
+            while (bottom < frame->height - 1 && !frame_filter_lines[bottom].stop)
+                bottom++;
 
-                y = block_end;
-            }
+            *rect = (rg_diff_rect_t){left, top, right - left, bottom - top + 1};
         }
     }
 
-    // Combine consecutive lines with similar changes location to optimize the SPI transfer
-    rg_line_diff_t *line = &out_diff[frame->height - 1];
-    rg_line_diff_t *prev_line = line - 1;
-
-    for (; line > out_diff; --line, --prev_line)
-    {
-        int right = line->left + line->width;
-        int right_prev = prev_line->left + prev_line->width;
-
-        if (abs(line->left - prev_line->left) <= 8 && abs(right - right_prev) <= 8)
-        {
-            if (line->left < prev_line->left) prev_line->left = line->left;
-            prev_line->width = RG_MAX(right, right_prev) - prev_line->left;
-            prev_line->repeat = line->repeat + 1;
-        }
-    }
+    // Growing rects may have made them overlap, sending the same pixels twice
+    merge_overlapping_rects(frame);
 
     return lines_changed;
 }
@@ -677,19 +1267,39 @@ static void update_viewport_size(int src_width, int src_height, float new_ratio)
     display.source.width = src_width;
     display.source.height = src_height;
 
-    // Build boundary tables used by filtering
+    // Build the scaler and boundary tables used by write_rect and filtering
 
     memset(frame_filter_lines, 1, sizeof(frame_filter_lines));
+    memset(frame_filter_columns, 0, sizeof(frame_filter_columns));
     memset(screen_line_is_empty, 0, sizeof(screen_line_is_empty));
+    memset(screen_column_is_empty, 0, sizeof(screen_column_is_empty));
+    memset(screen_column_source, 0, sizeof(screen_column_source));
+
+    int x_inc = display.screen.width / display.viewport.x_scale;
+
+    for (int x = 0, x_acc = 0; x < new_width && x < RG_SCREEN_WIDTH; ++x, x_acc += x_inc)
+    {
+        screen_column_source[x] = RG_MIN(x_acc / (int)display.screen.width, src_width - 1);
+        screen_column_is_empty[x] = x > 0 && screen_column_source[x] == screen_column_source[x - 1];
+        // A frame wider than the screen is only ever scaled down, its columns past the table don't repeat
+        if (screen_column_source[x] < RG_SCREEN_WIDTH)
+            frame_filter_columns[screen_column_source[x]].repeat++;
+    }
+
+    for (int x = 0; x < src_width && x < RG_SCREEN_WIDTH; ++x)
+        frame_filter_columns[x].stop = frame_filter_columns[x].repeat <= 1;
+
+    screen_columns_unscaled = (x_inc == display.screen.width);
 
     int y_inc = display.screen.height / display.viewport.y_scale;
     int y_acc = (y_inc * display.viewport.y_pos) % display.screen.height;
 
+    screen_lines_unscaled = (y_inc == display.screen.height);
+
     for (int y = 0, screen_y = display.viewport.y_pos; y < src_height && screen_y < display.screen.height; ++screen_y)
     {
         int repeat = ++frame_filter_lines[y].repeat;
 
-        frame_filter_lines[y].start = repeat == 1 || repeat == 2;
         frame_filter_lines[y].stop  = repeat == 1;
 
         screen_line_is_empty[screen_y] = repeat > 1;
@@ -701,6 +1311,10 @@ static void update_viewport_size(int src_width, int src_height, float new_ratio)
         }
     }
 
+    // A repeated line is blended with the next one, the rect can't start on that next one
+    for (int y = 1; y < src_height && y < 256; ++y)
+        frame_filter_lines[y].start = frame_filter_lines[y - 1].repeat <= 1;
+
     RG_LOGI("%dx%d@%.3f => %dx%d@%.3f x_pos:%d y_pos:%d x_scale:%.3f y_scale:%.3f\n",
            src_width, src_height, src_width/(float)src_height, new_width, new_height, new_ratio,
            display.viewport.x_pos, display.viewport.y_pos, display.viewport.x_scale, display.viewport.y_scale);
@@ -709,7 +1323,7 @@ static void update_viewport_size(int src_width, int src_height, float new_ratio)
 IRAM_ATTR
 static void display_task(void *arg)
 {
-    display_task_queue = xQueueCreate(1, sizeof(void*));
+    display_task_queue = xQueueCreate(RG_DISPLAY_QUEUE_MAX, sizeof(void*));
 
     while (1)
     {
@@ -722,8 +1336,12 @@ static void display_task(void *arg)
 
         RG_ASSERT((update->flags & RG_PIXEL_PAL) == 0 || update->palette, "Palette not defined");
 
+        uint32_t spiTransactions = display.counters.spiTransactions;
+        uint32_t spiBytes = display.counters.spiBytes;
+
         // It's better to update the counters before we start the transfer, in case someone needs it
-        if (update->diff[0].width == update->width && update->diff[0].repeat == update->height)
+        if (update->diff_count == 1 && update->diff[0].width == update->width
+            && update->diff[0].height == update->height && update->field < 0)
             display.counters.fullFrames++;
         display.counters.totalFrames++;
 
@@ -744,18 +1362,46 @@ static void display_task(void *arg)
             display.changed = false;
         }
 
-        for (int y = 0; y < update->height;)
+        // The palette is small enough that rebuilding the LUT every frame is cheaper than
+        // tracking changes, and it means emulators can keep editing it in place
+        if (update->flags & RG_PIXEL_PAL)
         {
-            rg_line_diff_t *diff = &update->diff[y];
+            update_palette_lut(update);
+        }
 
-            if (diff->width > 0)
+        spi_current_frame = update;
+
+        int64_t startTime = get_elapsed_time();
+        uint32_t spiBlockedTime = display.counters.spiBlockedTime;
+        uint32_t vsyncWaitTime = display.counters.vsyncWaitTime;
+
+        for (int i = 0; i < update->diff_count; ++i)
+        {
+            rg_diff_rect_t *diff = &update->diff[i];
+
+            if (diff->width > 0 && diff->height > 0)
             {
-                write_rect(update, diff->left, y, diff->width, diff->repeat);
+                write_rect(update, diff->left, diff->top, diff->width, diff->height, update->field);
             }
-            y += diff->repeat;
         }
 
+        spi_current_frame = NULL;
+
+        // Whatever wasn't spent waiting for the bus or the scanout was spent converting pixels
+        uint32_t spiWait = display.counters.spiBlockedTime - spiBlockedTime;
+        uint32_t vsyncWait = display.counters.vsyncWaitTime - vsyncWaitTime;
+        uint32_t elapsed = get_elapsed_time_since(startTime);
+        rg_system_frame_stage(RG_FRAME_CONVERT, elapsed - RG_MIN(spiWait + vsyncWait, elapsed));
+        rg_system_frame_stage(RG_FRAME_SPI_WAIT, spiWait);
+
+        display.counters.frameTransactions = display.counters.spiTransactions - spiTransactions;
+        display.counters.frameBytes = display.counters.spiBytes - spiBytes;
+
         xQueueReceive(display_task_queue, &update, portMAX_DELAY);
+        xSemaphoreGive(frame_dequeued_semaphore);
+
+        // Drop the queue's reference, the frame is released once its last transaction is done
+        frame_release(update);
     }
 
     display_task_queue = NULL;
@@ -771,6 +1417,7 @@ void rg_display_load_config(void)
     display.config.filter = rg_settings_get_app_int32(SETTING_FILTER, RG_DISPLAY_FILTER_HORIZ);
     display.config.rotation = rg_settings_get_app_int32(SETTING_ROTATION, RG_DISPLAY_ROTATION_AUTO);
     display.config.update = rg_settings_get_app_int32(SETTING_UPDATE, RG_DISPLAY_UPDATE_PARTIAL);
+    display.config.vsync = rg_settings_get_app_int32(SETTING_VSYNC, 0);
     display.changed = true;
 }
 
@@ -791,6 +1438,48 @@ display_update_t rg_display_get_update_mode(void)
     return display.config.update;
 }
 
+void rg_display_set_queue_depth(int depth)
+{
+    // This isn't a user setting, it depends on how many buffers the emulator has
+    display.config.queue_depth = RG_MIN(RG_MAX(1, depth), RG_DISPLAY_QUEUE_MAX);
+}
+
+int rg_display_get_queue_depth(void)
+{
+    return display.config.queue_depth;
+}
+
+void rg_display_set_vsync(bool enable)
+{
+    display.config.vsync = enable;
+    rg_settings_set_app_int32(SETTING_VSYNC, display.config.vsync);
+}
+
+bool rg_display_get_vsync(void)
+{
+    return display.config.vsync;
+}
+
+void rg_display_set_render_mode(display_render_t mode)
+{
+    render_mode = RG_MIN(RG_MAX(0, mode), RG_DISPLAY_RENDER_COUNT - 1);
+}
+
+display_render_t rg_display_get_render_mode(void)
+{
+    return render_mode;
+}
+
+bool rg_display_should_render(bool wanted)
+{
+    // Emulators pass their frame skipping decision, which isn't repeatable from run to run
+    if (render_mode == RG_DISPLAY_RENDER_ALL)
+        return true;
+    if (render_mode == RG_DISPLAY_RENDER_NONE)
+        return false;
+    return wanted;
+}
+
 void rg_display_set_scaling(display_scaling_t scaling)
 {
     display.config.scaling = RG_MIN(RG_MAX(0, scaling), RG_DISPLAY_SCALING_COUNT - 1);
@@ -898,31 +1587,97 @@ bool rg_display_save_frame(const char *filename, rg_video_frame_t *frame, int wi
 IRAM_ATTR
 rg_update_t rg_display_queue_update(rg_video_frame_t *frame, rg_video_frame_t *previousFrame)
 {
+    static bool last_update_interlaced = false;
+    static bool last_diff_full = false;
+    static int next_field = 0;
+    bool interlace = false;
     int linesChanged = 0;
 
     if (!frame)
         return RG_UPDATE_ERROR;
 
+    #ifdef RG_TARGET_HOST
+        rg_host_frame_queued(frame, previousFrame);
+    #endif
+
     if (frame->width != display.source.width || frame->height != display.source.height)
     {
         display.changed = true;
     }
 
-    if (previousFrame && !display.changed && display.config.update != RG_DISPLAY_UPDATE_FULL)
+    if (display.changed || display.config.update == RG_DISPLAY_UPDATE_FULL)
     {
+        set_full_diff(frame);
+        frame->line_hash_valid = false;
+        linesChanged = frame->height;
+    }
+    else if (display.config.update == RG_DISPLAY_UPDATE_INTERLACE)
+    {
+        set_full_diff(frame);
+        frame->line_hash_valid = false;
+        linesChanged = frame->height;
+        interlace = true;
+    }
+    else if (previousFrame)
+    {
+        int64_t startTime = get_elapsed_time();
         linesChanged = frame_diff(frame, previousFrame);
+        rg_system_frame_stage(RG_FRAME_DIFF, get_elapsed_time_since(startTime));
+
+        if (display.config.update == RG_DISPLAY_UPDATE_SMART)
+        {
+            // A single full frame (scene change) is sent as is. But if the screen keeps changing
+            // entirely (scrolling) or the display task is still busy with the previous frame,
+            // full updates would stall us further so we send half of it instead.
+            bool backlogged = uxQueueMessagesWaiting(display_task_queue) > 0;
+            bool diff_full = diff_is_full(frame);
+
+            if (diff_full && (backlogged || last_diff_full || last_update_interlaced))
+            {
+                interlace = true;
+            }
+            else if (last_update_interlaced)
+            {
+                // The other field is a frame behind and the diff can't know about it
+                set_full_diff(frame);
+                linesChanged = frame->height;
+            }
+
+            last_diff_full = diff_full;
+        }
     }
     else
     {
-        frame->diff[0].left = 0;
-        frame->diff[0].width = frame->width;
-        frame->diff[0].repeat = frame->height;
+        set_full_diff(frame);
+        frame->line_hash_valid = false;
         linesChanged = frame->height;
     }
 
+    frame->field = interlace ? next_field : -1;
+    next_field ^= interlace;
+    last_update_interlaced = interlace;
+
+    frame->queued_time = get_elapsed_time();
+    frame_retain(frame);
+
+    // Only queue_depth frames may be in flight. With a depth of 1 we return once the display
+    // is done with the previous frame, which is what double buffered emulators rely on.
+    if (uxQueueMessagesWaiting(display_task_queue) >= display.config.queue_depth)
+    {
+        int64_t startTime = get_elapsed_time();
+        while (uxQueueMessagesWaiting(display_task_queue) >= display.config.queue_depth)
+        {
+            xSemaphoreTake(frame_dequeued_semaphore, pdMS_TO_TICKS(10));
+        }
+        rg_system_frame_stage(RG_FRAME_DISPLAY_WAIT, get_elapsed_time_since(startTime));
+    }
+
     xQueueSend(display_task_queue, &frame, portMAX_DELAY);
 
-    if (linesChanged == frame->height)
+    if (interlace)
+        return RG_UPDATE_PARTIAL;
+
+    if (diff_is_full(frame))
         return RG_UPDATE_FULL;
 
     if (linesChanged == 0)
@@ -931,6 +1686,60 @@ rg_update_t rg_display_queue_update(rg_video_frame_t *frame, rg_video_frame_t *p
     return RG_UPDATE_PARTIAL;
 }
 
+bool rg_display_frame_released(const rg_video_frame_t *frame)
+{
+    return frame->pending == 0;
+}
+
+void rg_display_wait_frame_release(const rg_video_frame_t *frame)
+{
+    frame_release_waiters_add(1);
+    while (frame->pending > 0)
+    {
+        xSemaphoreTake(frame_release_semaphore, pdMS_TO_TICKS(10));
+    }
+    frame_release_waiters_add(-1);
+}
+
+rg_video_frame_t *rg_display_acquire_frame(rg_video_frame_t *frames, size_t count, int timeout_ms)
+{
+    int64_t start = get_elapsed_time();
+    rg_video_frame_t *acquired = NULL;
+
+    frame_release_waiters_add(1);
+
+    while (!acquired)
+    {
+        rg_video_frame_t *newest = NULL, *oldest = NULL;
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (!newest || frames[i].queued_time > newest->queued_time)
+                newest = &frames[i];
+        }
+
+        // The newest frame is the reference for the next diff, it must stay untouched
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (&frames[i] != newest && frames[i].pending == 0
+                && (!oldest || frames[i].queued_time < oldest->queued_time))
+                oldest = &frames[i];
+        }
+
+        if ((acquired = oldest))
+            break;
+
+        if (timeout_ms >= 0 && get_elapsed_time_since(start) >= timeout_ms * 1000)
+            break;
+
+        xSemaphoreTake(frame_release_semaphore, pdMS_TO_TICKS(10));
+    }
+
+    frame_release_waiters_add(-1);
+
+    return acquired;
+}
+
 void rg_display_show_info(const char *text, int timeout_ms)
 {
     // Overlay a line of text at the bottom of the screen for approximately timeout_ms
@@ -941,7 +1750,7 @@ void rg_display_write(int left, int top, int width, int height, int stride, cons
 {
     lcd_set_window(left, top, width, height);
 
-    size_t lines_per_buffer = SPI_BUFFER_LENGTH / width;
+    size_t lines_per_buffer = display.spi.bufferLength / width;
 
     if (stride < width * 2) {
         stride = width * 2;
@@ -981,7 +1790,7 @@ void rg_display_clear(uint16_t color)
     size_t remaining = display.screen.width * display.screen.height;
     while (remaining > 0)
     {
-        size_t count = RG_MIN(SPI_BUFFER_LENGTH, remaining);
+        size_t count = RG_MIN(display.spi.bufferLength, remaining);
         uint16_t *buffer = spi_get_buffer();
 
         for (size_t j = 0; j < count; ++j)
@@ -1016,12 +1825,16 @@ void rg_display_init()
     display = (rg_display_t) {
         .screen.width = RG_SCREEN_WIDTH,
         .screen.height = RG_SCREEN_HEIGHT,
+        .config.queue_depth = 1,
         .changed = true,
     };
 
+    frame_release_semaphore = xSemaphoreCreateCounting(16, 0);
+    frame_dequeued_semaphore = xSemaphoreCreateBinary();
     rg_display_load_config();
     spi_init();
     lcd_init();
+    vsync_init();
     xTaskCreatePinnedToCore(&display_task, "display_task", 2048, NULL, 5, NULL, 1);
 
     RG_LOGI("Display ready.\n");
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 typedef enum
@@ -15,8 +16,8 @@ typedef enum
 {
     RG_DISPLAY_UPDATE_PARTIAL = 0,
     RG_DISPLAY_UPDATE_FULL,
-    // RG_DISPLAY_UPDATE_INTERLACE,
-    // RG_DISPLAY_UPDATE_SMART,
+    RG_DISPLAY_UPDATE_INTERLACE,    // Send odd and even lines on alternate frames
+    RG_DISPLAY_UPDATE_SMART,        // Pick partial, full, or interlace for each frame
     RG_DISPLAY_UPDATE_COUNT,
 } display_update_t;
 
@@ -48,6 +49,14 @@ typedef enum
     RG_DISPLAY_FILTER_COUNT,
 } display_filter_t;
 
+typedef enum
+{
+    RG_DISPLAY_RENDER_AUTO = 0,     // The emulator decides which frames to skip
+    RG_DISPLAY_RENDER_ALL,          // Every frame is drawn, for repeatable measurements
+    RG_DISPLAY_RENDER_NONE,         // No frame is drawn, to measure the emulation alone
+    RG_DISPLAY_RENDER_COUNT,
+} display_render_t;
+
 typedef enum
 {
    RG_DISPLAY_ROTATION_OFF = 0,
@@ -65,8 +74,16 @@ enum
     RG_PIXEL_BE  = 0b0000, // big endian
     RG_PIXEL_LE  = 0b0100, // little endian
     RG_PIXEL_MASK = 0b1111,
+    RG_PIXEL_DMA = 0b10000, // Buffer may be sent by DMA without copy, see rg_display_frame_released()
 };
 
+// Maximum number of frames in flight in the display queue
+#define RG_DISPLAY_QUEUE_MAX 3
+
+// Frame latency histogram, buckets are RG_DISPLAY_LATENCY_STEP us wide, the last one is open-ended
+#define RG_DISPLAY_LATENCY_BUCKETS 16
+#define RG_DISPLAY_LATENCY_STEP 4000
+
 typedef struct {
     struct {
         display_backlight_t backlight;
@@ -74,6 +91,8 @@ typedef struct {
         display_scaling_t scaling;
         display_filter_t filter;
         display_update_t update;
+        bool vsync;                 // Pace writes behind the panel's scanout to avoid tearing
+        int queue_depth;            // Frames allowed in flight, emulators need queue_depth + 1 buffers
     } config;
     struct {
         uint32_t width;
@@ -96,20 +115,46 @@ typedef struct {
         } crop;
         uint32_t format;
     } source;
+    struct {
+        uint32_t transactions;      // Size of the SPI transaction pool
+        uint32_t buffers;           // Size of the SPI buffer pool
+        uint32_t bufferLength;      // In pixels
+    } spi;
+    struct {
+        uint32_t period;            // Panel refresh period (us)
+        uint32_t pulses;            // TE pulses received
+        bool estimated;             // No TE line, scanout position is extrapolated from the period
+    } vsync;
     struct {
         uint32_t totalFrames;
         uint32_t fullFrames;
         uint32_t spiTransactions;
+        uint32_t spiBytes;
+        uint32_t spiDirectBytes;    // Sent straight from the frames' buffers (RG_PIXEL_DMA)
+        uint32_t spiBlockedTime;    // Time spent waiting for a free SPI buffer or transaction (us)
+        uint32_t spiQueueHighWater; // Most transactions in flight at once
+        uint32_t frameTransactions; // SPI transactions used by the last frame
+        uint32_t frameBytes;        // SPI bytes sent for the last frame
+        uint32_t linesCompared;     // Lines that had to be compared word by word
+        uint32_t linesSkipped;      // Lines skipped because their hash didn't change
+        uint32_t vsyncWaitTime;     // Time spent waiting for the scanout to move past a rect (us)
+        uint32_t vsyncTears;        // Rects too large to be written without the scanout crossing them
+        uint32_t latencyLast;       // From rg_display_queue_update to the last SPI byte of the frame (us)
+        uint32_t latency[RG_DISPLAY_LATENCY_BUCKETS]; // Histogram of latencyLast
     } counters;
     bool lastUpdateType;
     bool changed;
 } rg_display_t;
 
+// Maximum number of dirty rectangles frame_diff() can emit for one frame
+#define RG_DISPLAY_DIFF_RECTS 32
+
 typedef struct {
-    short left;     // int32_t left:10;
-    short width;    // int32_t width:10;
-    short repeat;   // int32_t repeat:10;
-} rg_line_diff_t;
+    short left;
+    short top;
+    short width;
+    short height;
+} rg_diff_rect_t;
 
 typedef struct {
     uint32_t flags;         // bitwise of RG_PIXEL_*
@@ -120,7 +165,13 @@ typedef struct {
     void *buffer;           // Should be at least height*stride bytes. expects uint8_t * | uint16_t *
     void *palette;          // rg_video_palette_t expects uint16_t * of size pixel_mask
     void *my_arg;           // Reserved for user usage
-    rg_line_diff_t diff[256];
+    rg_diff_rect_t diff[RG_DISPLAY_DIFF_RECTS];
+    uint32_t diff_count;    // Number of valid entries in diff
+    uint32_t line_hash[256]; // Filled by frame_diff, reused when this frame becomes the previous frame
+    bool line_hash_valid;
+    int field;              // Set by rg_display_queue_update: -1 progressive, 0/1 screen lines sent if interlaced
+    volatile int pending;   // Queue entries and SPI transfers using the frame, see rg_display_frame_released()
+    int64_t queued_time;    // Set by rg_display_queue_update
 } rg_video_frame_t;
 
 void rg_display_init(void);
@@ -131,6 +182,9 @@ void rg_display_load_config(void);
 void rg_display_show_info(const char *text, int timeout_ms);
 bool rg_display_save_frame(const char *filename, rg_video_frame_t *frame, int width, int height);
 rg_update_t rg_display_queue_update(rg_video_frame_t *frame, rg_video_frame_t *previousFrame);
+bool rg_display_frame_released(const rg_video_frame_t *frame);
+void rg_display_wait_frame_release(const rg_video_frame_t *frame);
+rg_video_frame_t *rg_display_acquire_frame(rg_video_frame_t *frames, size_t count, int timeout_ms);
 const rg_display_t *rg_display_get_status(void);
 
 void rg_display_set_scaling(display_scaling_t scaling);
@@ -143,3 +197,10 @@ void rg_display_set_backlight(display_backlight_t backlight);
 display_backlight_t rg_display_get_backlight(void);
 void rg_display_set_update_mode(display_update_t update);
 display_update_t rg_display_get_update_mode(void);
+void rg_display_set_queue_depth(int depth);
+int rg_display_get_queue_depth(void);
+void rg_display_set_vsync(bool enable);
+bool rg_display_get_vsync(void);
+void rg_display_set_render_mode(display_render_t mode);
+display_render_t rg_display_get_render_mode(void);
+bool rg_display_should_render(bool wanted);
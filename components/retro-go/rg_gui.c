@@ -716,6 +716,27 @@ static dialog_return_t audio_update_cb(dialog_option_t *option, dialog_event_t e
     return RG_DIALOG_IGNORE;
 }
 
+static dialog_return_t audio_filter_update_cb(dialog_option_t *option, dialog_event_t event)
+{
+    int8_t max = RG_AUDIO_FILTER_COUNT - 1;
+    int8_t mode = rg_audio_get_filter();
+    int8_t prev = mode;
+
+    if (event == RG_DIALOG_PREV && --mode < 0) mode = max;
+    if (event == RG_DIALOG_NEXT && ++mode > max) mode = 0;
+
+    if (mode != prev) {
+        rg_audio_set_filter(mode);
+    }
+
+    if (mode == RG_AUDIO_FILTER_NONE)      strcpy(option->value, "Off  ");
+    if (mode == RG_AUDIO_FILTER_LOW_PASS)  strcpy(option->value, "Low  ");
+    if (mode == RG_AUDIO_FILTER_HIGH_PASS) strcpy(option->value, "High ");
+    if (mode == RG_AUDIO_FILTER_WEIGHTED)  strcpy(option->value, "Both ");
+
+    return RG_DIALOG_IGNORE;
+}
+
 static dialog_return_t filter_update_cb(dialog_option_t *option, dialog_event_t event)
 {
     int8_t max = RG_DISPLAY_FILTER_COUNT - 1;
@@ -771,9 +792,21 @@ static dialog_return_t update_mode_update_cb(dialog_option_t *option, dialog_eve
         rg_display_set_update_mode(mode);
     }
 
-    if (mode == RG_DISPLAY_UPDATE_PARTIAL)   strcpy(option->value, "Partial");
-    if (mode == RG_DISPLAY_UPDATE_FULL)      strcpy(option->value, "Full   ");
-    // if (mode == RG_DISPLAY_UPDATE_INTERLACE) strcpy(option->value, "Interlace");
+    if (mode == RG_DISPLAY_UPDATE_PARTIAL)   strcpy(option->value, "Partial  ");
+    if (mode == RG_DISPLAY_UPDATE_FULL)      strcpy(option->value, "Full     ");
+    if (mode == RG_DISPLAY_UPDATE_INTERLACE) strcpy(option->value, "Interlace");
+    if (mode == RG_DISPLAY_UPDATE_SMART)     strcpy(option->value, "Smart    ");
+
+    return RG_DIALOG_IGNORE;
+}
+
+static dialog_return_t vsync_update_cb(dialog_option_t *option, dialog_event_t event)
+{
+    if (event == RG_DIALOG_PREV || event == RG_DIALOG_NEXT) {
+        rg_display_set_vsync(!rg_display_get_vsync());
+    }
+
+    strcpy(option->value, rg_display_get_vsync() ? "On " : "Off");
 
     return RG_DIALOG_IGNORE;
 }
@@ -789,6 +822,29 @@ static dialog_return_t speedup_update_cb(dialog_option_t *option, dialog_event_t
     return RG_DIALOG_IGNORE;
 }
 
+static dialog_return_t rewind_update_cb(dialog_option_t *option, dialog_event_t event)
+{
+    static const int sizes[] = {0, 256, 512, 1024, 2048};
+    int count = sizeof(sizes) / sizeof(sizes[0]);
+    int sel = 0;
+
+    while (sel < count - 1 && sizes[sel] < rg_rewind_get_budget())
+        sel++;
+
+    if (event == RG_DIALOG_PREV && --sel < 0) sel = count - 1;
+    if (event == RG_DIALOG_NEXT && ++sel >= count) sel = 0;
+
+    if (event == RG_DIALOG_PREV || event == RG_DIALOG_NEXT)
+        rg_rewind_set_budget(sizes[sel]);
+
+    if (sizes[sel] == 0)
+        strcpy(option->value, "Off ");
+    else
+        sprintf(option->value, "%dK", sizes[sel]);
+
+    return RG_DIALOG_IGNORE;
+}
+
 int rg_gui_settings_menu(const dialog_option_t *extra_options)
 {
     dialog_option_t options[16 + get_dialog_items_count(extra_options)];
@@ -797,13 +853,16 @@ int rg_gui_settings_menu(const dialog_option_t *extra_options)
     *opt++ = (dialog_option_t){0, "Brightness", "50%",  1, &brightness_update_cb};
     *opt++ = (dialog_option_t){0, "Volume    ", "50%",  1, &volume_update_cb};
     *opt++ = (dialog_option_t){0, "Audio out ", "Speaker", 1, &audio_update_cb};
+    *opt++ = (dialog_option_t){0, "Audio filt", "Off", 1, &audio_filter_update_cb};
 
     if (!rg_system_get_app()->isLauncher)
     {
         *opt++ = (dialog_option_t){0, "Scaling", "Full", 1, &scaling_update_cb};
         *opt++ = (dialog_option_t){0, "Filter", "None", 1, &filter_update_cb};
         *opt++ = (dialog_option_t){0, "Update", "Partial", 1, &update_mode_update_cb};
+        *opt++ = (dialog_option_t){0, "VSync", "Off", 1, &vsync_update_cb};
         *opt++ = (dialog_option_t){0, "Speed", "1x", 1, &speedup_update_cb};
+        *opt++ = (dialog_option_t){0, "Rewind", "Off", 1, &rewind_update_cb};
     }
 
     while (extra_options && (*extra_options).flags != RG_DIALOG_FLAG_LAST)
@@ -873,11 +932,75 @@ int rg_gui_about_menu(const dialog_option_t *extra_options)
     return sel;
 }
 
+static void draw_frame_times(void)
+{
+    static const struct {const char *name; uint16_t color;} stages[RG_FRAME_STAGE_COUNT] = {
+        [RG_FRAME_EMULATE] = {"emu", C_ROYAL_BLUE},
+        [RG_FRAME_DIFF] = {"diff", C_GREEN},
+        [RG_FRAME_DISPLAY_WAIT] = {"disp", C_GRAY},
+        [RG_FRAME_CONVERT] = {"conv", C_YELLOW},
+        [RG_FRAME_SPI_WAIT] = {"spi", C_RED},
+        [RG_FRAME_AUDIO_WAIT] = {"audio", C_MAGENTA},
+    };
+    rg_frame_time_t times[RG_FRAME_HISTORY];
+    size_t count = rg_system_get_frame_times(times, RG_FRAME_HISTORY);
+
+    // The graph's top is two frames worth of time, the frame budget is the middle line
+    const int bar_width = RG_MAX(screen_width / RG_FRAME_HISTORY, 1);
+    const int height = 96;
+    const int top = screen_height - height;
+    const int budget = 1000000 / RG_MAX(rg_system_get_app()->refreshRate, 1);
+    const int us_per_line = budget * 2 / height;
+
+    int x = 0;
+    rg_gui_draw_fill_rect(0, top - font_info.height, screen_width, font_info.height, C_BLACK);
+    for (int i = 0; i < RG_FRAME_STAGE_COUNT; i++)
+        x += rg_gui_draw_text(x, top - font_info.height, 0, stages[i].name, stages[i].color, C_BLACK, 0).width + 4;
+
+    // overlay_buffer holds 32 lines, the stacked bars are drawn in bands of that height
+    for (int band = 0; band < height; band += 32)
+    {
+        for (int line = 0; line < 32; line++)
+        {
+            int level = (height - 1 - band - line) * us_per_line;
+            uint16_t *dst = overlay_buffer + line * screen_width;
+
+            for (int px = 0; px < screen_width; px++)
+            {
+                size_t frame = px / bar_width;
+                uint16_t color = (level == budget / us_per_line * us_per_line) ? C_DIM_GRAY : C_BLACK;
+
+                if (frame < count)
+                {
+                    const rg_frame_time_t *t = &times[frame];
+                    int sum = 0;
+
+                    for (int i = 0; i < RG_FRAME_STAGE_COUNT; i++)
+                    {
+                        sum += t->stages[i];
+                        if (sum > level)
+                        {
+                            color = stages[i].color;
+                            break;
+                        }
+                    }
+
+                    if (t->period / us_per_line == level / us_per_line)
+                        color = C_WHITE;
+                }
+
+                dst[px] = color;
+            }
+        }
+        rg_display_write(0, top + band, screen_width, 32, 0, overlay_buffer);
+    }
+}
+
 int rg_gui_debug_menu(const dialog_option_t *extra_options)
 {
     char screen_res[20], game_res[20], scaled_res[20];
     char stack_hwm[20], heap_free[20], block_free[20];
-    char system_rtc[20], uptime[20];
+    char system_rtc[20], uptime[20], spi_pool[20], spi_stall[20], latency[20];
 
     const dialog_option_t options[] = {
         {0, "Screen Res", screen_res, 1, NULL},
@@ -888,12 +1011,17 @@ int rg_gui_debug_menu(const dialog_option_t *extra_options)
         {0, "Block free", block_free, 1, NULL},
         {0, "System RTC", system_rtc, 1, NULL},
         {0, "Uptime    ", uptime, 1, NULL},
+        {0, "SPI pool  ", spi_pool, 1, NULL},
+        {0, "SPI stall ", spi_stall, 1, NULL},
+        {0, "Latency   ", latency, 1, NULL},
         RG_DIALOG_SEPARATOR,
         {1000, "Save screenshot", NULL, 1, NULL},
         {2000, "Save trace", NULL, 1, NULL},
         {3000, "Cheats", NULL, 1, NULL},
         {4000, "Crash", NULL, 1, NULL},
         {5000, "Random time", NULL, 1, NULL},
+        {6000, rg_profiler_sample_running() ? "Stop profiler" : "Start profiler", NULL, 1, NULL},
+        {7000, "Frame times", NULL, 1, NULL},
         RG_DIALOG_CHOICE_LAST
     };
 
@@ -909,6 +1037,20 @@ int rg_gui_debug_menu(const dialog_option_t *extra_options)
     sprintf(heap_free, "%d+%d", stats.freeMemoryInt, stats.freeMemoryExt);
     sprintf(block_free, "%d+%d", stats.freeBlockInt, stats.freeBlockExt);
     sprintf(uptime, "%ds", (int)(get_elapsed_time() / 1000 / 1000));
+    sprintf(spi_pool, "%d/%dx%d", display->counters.spiQueueHighWater, display->spi.transactions, display->spi.buffers);
+    sprintf(spi_stall, "%dms", display->counters.spiBlockedTime / 1000);
+
+    // Median and 95th percentile, rounded up to the histogram's bucket
+    uint32_t frames = 0, count = 0, p50 = 0, p95 = 0;
+    for (int i = 0; i < RG_DISPLAY_LATENCY_BUCKETS; i++)
+        frames += display->counters.latency[i];
+    for (int i = 0; i < RG_DISPLAY_LATENCY_BUCKETS; i++)
+    {
+        count += display->counters.latency[i];
+        if (!p50 && count * 2 >= frames) p50 = (i + 1) * RG_DISPLAY_LATENCY_STEP / 1000;
+        if (!p95 && count * 20 >= frames * 19) p95 = (i + 1) * RG_DISPLAY_LATENCY_STEP / 1000;
+    }
+    sprintf(latency, "%d/%dms", p50, p95);
 
     int sel = rg_gui_dialog("Debugging", options, 0);
 
@@ -929,6 +1071,20 @@ int rg_gui_debug_menu(const dialog_option_t *extra_options)
         struct timeval tv = {rand() % 1893474000, 0};
         settimeofday(&tv, NULL);
     }
+    else if (sel == 6000)
+    {
+        if (rg_profiler_sample_running())
+            rg_profiler_sample_stop();
+        else
+            rg_profiler_sample_start(RG_PROFILER_SAMPLE_RATE);
+    }
+    else if (sel == 7000)
+    {
+        rg_system_dump_frame_times();
+        draw_frame_times();
+        rg_input_wait_for_key(GAMEPAD_KEY_ALL, true);
+        rg_input_wait_for_key(GAMEPAD_KEY_ALL, false);
+    }
 
     return sel;
 }
@@ -970,6 +1126,26 @@ int rg_gui_game_settings_menu(const dialog_option_t *extra_options)
     return sel;
 }
 
+static int slot_dialog(const char *title, bool loading)
+{
+    dialog_option_t choices[RG_PATH_SAVE_STATE_3 - RG_PATH_SAVE_STATE + 2];
+    char labels[RG_PATH_SAVE_STATE_3 - RG_PATH_SAVE_STATE + 1][8];
+    int count = RG_PATH_SAVE_STATE_3 - RG_PATH_SAVE_STATE + 1;
+
+    for (int i = 0; i < count; i++)
+    {
+        char *path = rg_emu_get_path(RG_PATH_SAVE_STATE + i, NULL);
+        bool exists = access(path, F_OK) == 0;
+        free(path);
+
+        sprintf(labels[i], "Slot %d", i);
+        choices[i] = (dialog_option_t){i, labels[i], exists ? "Saved" : "Empty", !loading || exists, NULL};
+    }
+    choices[count] = (dialog_option_t)RG_DIALOG_CHOICE_LAST;
+
+    return rg_gui_dialog(title, choices, 0);
+}
+
 int rg_gui_game_menu(void)
 {
     const dialog_option_t choices[] = {
@@ -1001,11 +1177,22 @@ int rg_gui_game_menu(void)
         sel = rg_gui_dialog("Restart", choices_restart, 0);
     }
 
+    int slot = 0;
+
+    if (sel == 1000 && (slot = slot_dialog("Save to", false)) < 0)
+        sel = -1;
+    else if (sel == 3001 && (slot = slot_dialog("Load from", true)) < 0)
+        sel = -1;
+
     switch (sel)
     {
-        case 1000: rg_emu_save_state(0); break;
+        case 1000:
+            // The game goes on while the snapshot is written, the blocking save is the fallback
+            if (!rg_emu_snapshot_take() || !rg_emu_snapshot_persist(slot))
+                rg_emu_save_state(slot);
+            break;
         case 2000: rg_emu_save_state(0); rg_system_switch_app(RG_APP_LAUNCHER); break;
-        case 3001: rg_emu_load_state(0); break; // rg_system_restart();
+        case 3001: rg_emu_load_state(slot); break; // rg_system_restart();
         case 3002: rg_emu_reset(false); break;
         case 3003: rg_emu_reset(true); break;
     #ifdef ENABLE_NETPLAY
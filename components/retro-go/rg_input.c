@@ -12,6 +12,7 @@
 static bool input_initialized = false;
 static int64_t last_gamepad_read = 0;
 static gamepad_state_t gamepad_state;
+static gamepad_state_t gamepad_mask;
 
 
 static inline uint32_t gamepad_read(void)
@@ -79,6 +80,7 @@ static void input_task(void *arg)
         }
 
         gamepad_state = input_state;
+        gamepad_mask &= input_state; // Released keys are seen again
 
         vTaskDelay(pdMS_TO_TICKS(10));
     }
@@ -124,10 +126,9 @@ void rg_input_init(void)
 
 #endif
 
-    // Start background polling
-    xTaskCreatePinnedToCore(&input_task, "input_task", 1024, NULL, 5, NULL, 1);
-
+    // Start background polling, the task stops as soon as it sees input_initialized false
     input_initialized = true;
+    xTaskCreatePinnedToCore(&input_task, "input_task", 1024, NULL, 5, NULL, 1);
 
     RG_LOGI("Input ready.\n");
 }
@@ -149,9 +150,20 @@ long rg_input_gamepad_last_read(void)
 gamepad_state_t rg_input_read_gamepad(void)
 {
     last_gamepad_read = get_elapsed_time();
+    return gamepad_state & ~gamepad_mask;
+}
+
+gamepad_state_t rg_input_read_gamepad_raw(void)
+{
     return gamepad_state;
 }
 
+void rg_input_mask_keys(gamepad_state_t keys)
+{
+    // Only keys that are down, the input task unmasks them as they're released
+    gamepad_mask |= keys & gamepad_state;
+}
+
 bool rg_input_key_is_pressed(gamepad_key_t key)
 {
     return (rg_input_read_gamepad() & key) ? true : false;
@@ -35,4 +35,6 @@ long rg_input_gamepad_last_read(void);
 bool rg_input_key_is_pressed(gamepad_key_t key);
 void rg_input_wait_for_key(gamepad_key_t key, bool pressed);
 gamepad_state_t rg_input_read_gamepad(void);
+gamepad_state_t rg_input_read_gamepad_raw(void);
+void rg_input_mask_keys(gamepad_state_t keys);
 battery_state_t rg_input_read_battery(void);
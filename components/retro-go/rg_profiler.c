@@ -1,67 +1,169 @@
 #include <freertos/FreeRTOS.h>
 #include <freertos/semphr.h>
+#include <freertos/task.h>
+#include <freertos/xtensa_context.h>
+#include <driver/timer.h>
+#include <soc/timer_group_struct.h>
+#include <xtensa/hal.h>
+#include <esp32/clk.h>
 #include <string.h>
 #include <stdio.h>
 
 #include "rg_system.h"
 #include "rg_profiler.h"
 
+#ifdef RG_TARGET_HOST
+#include "host/rg_host.h"
+#endif
+
 // Note this profiler might be inaccurate because of:
 // https://gcc.gnu.org/bugzilla/show_bug.cgi?id=28205
 
-// We also need to add multi-core support. Currently it's not an issue
-// because all our profiled code runs on the same core.
+// Each core has its own shadow call stack and its own table of caller/callee edges, the
+// hooks only ever touch the current core's data so they don't need a lock. Time is counted
+// with the CPU cycle counter, which is also per core and much cheaper than esp_timer.
 
 static profile_t *profile;
-static SemaphoreHandle_t lock;
-static bool enabled = false;
-
-#define LOCK_PROFILE()   xSemaphoreTake(lock, pdMS_TO_TICKS(10000)); // {while(lock);lock=true;}
-#define UNLOCK_PROFILE() xSemaphoreGive(lock);                       // {lock = false;}
-
-NO_PROFILE static inline profile_frame_t *find_frame(void *this_fn, void *call_site)
+static volatile bool enabled = false;
+
+// The sampling profiler records the interrupted PC and its caller on each core from a
+// timer interrupt. The samples are folded into the same tables as the instrumented
+// calls, so rg_profiler_print and rg_tool.py work unchanged.
+#define SAMPLE_RING_LENGTH (4096) // Per core, must be a power of two
+
+static struct {
+    uintptr_t (*ring)[2];
+    uint32_t head;
+    uint32_t tail;
+    uint32_t dropped;
+    intr_handle_t intr;
+} sampler[RG_PROFILER_CORES];
+static SemaphoreHandle_t samplerReady;
+// Interrupts being served on each core, _frxt_int_enter counts the sampler's own
+extern unsigned port_interruptNesting[portNUM_PROCESSORS];
+static volatile bool sampling = false;
+static int sampleRate;
+
+NO_PROFILE static inline profile_frame_t *find_frame(profile_core_t *core, void *this_fn, void *caller)
 {
-    for (int i = 0; i < 512; ++i)
+    uint32_t hash = ((uintptr_t)this_fn ^ ((uintptr_t)caller << 5)) * 2654435761u;
+    size_t index = (hash >> 16) & (RG_PROFILER_FRAMES - 1);
+
+    // Open addressing with linear probing, kept at most 3/4 full so that probes stay short
+    while (true)
     {
-        profile_frame_t *frame = &profile->frames[i];
+        profile_frame_t *frame = &core->frames[index];
 
-        if (frame->func_ptr == 0)
-        {
-            profile->total_frames = RG_MAX(profile->total_frames, i + 1);
-            frame->func_ptr = this_fn;
-            // frame->caller_ptr = call_site;
-        }
+        if (frame->func_ptr == this_fn && frame->caller_ptr == caller)
+            return frame;
 
-        if (frame->func_ptr == this_fn) // && frame->caller_ptr == call_site)
+        if (frame->func_ptr == NULL)
         {
+            if (core->total_frames >= RG_PROFILER_FRAMES * 3 / 4)
+                return NULL;
+            core->total_frames++;
+            frame->func_ptr = this_fn;
+            frame->caller_ptr = caller;
             return frame;
         }
+
+        index = (index + 1) & (RG_PROFILER_FRAMES - 1);
+    }
+}
+
+NO_PROFILE static inline profile_core_t *get_core(void)
+{
+    profile_core_t *core = &profile->cores[xPortGetCoreID()];
+
+    // rg_profiler_start can't safely reset another core's stack, it's done here instead
+    if (core->generation != profile->generation)
+    {
+        core->generation = profile->generation;
+        core->depth = 0;
+    }
+
+    return core;
+}
+
+NO_PROFILE static void profile_enter(void *this_fn, void *call_site, bool section)
+{
+    profile_core_t *core = get_core();
+
+    void *caller = core->depth > 0 ? core->stack[core->depth - 1].func_ptr : call_site;
+    profile_frame_t *frame = find_frame(core, this_fn, caller);
+
+    if (!frame || core->depth >= RG_PROFILER_STACK)
+    {
+        core->lost++;
+        return;
+    }
+
+    frame->num_calls++;
+    frame->section = section;
+
+    profile_call_t *call = &core->stack[core->depth++];
+    call->func_ptr = this_fn;
+    call->frame = frame;
+    call->enter_cycles = xthal_get_ccount(); // Last, so that our own overhead isn't counted
+}
+
+NO_PROFILE static void profile_exit(void *this_fn, uint32_t now)
+{
+    profile_core_t *core = get_core();
+    int depth = core->depth - 1;
+
+    // The function may have been entered before the profiler was started, or the entries
+    // above it belong to a task that was preempted on this core. Those are dropped.
+    while (depth >= 0 && core->stack[depth].func_ptr != this_fn)
+        depth--;
+
+    if (depth < 0)
+        return;
+
+    profile_call_t *call = &core->stack[depth];
+    core->depth = depth;
+
+    for (int i = 0; i < depth; ++i)
+    {
+        if (core->stack[i].func_ptr == this_fn)
+            return;
     }
 
-    RG_PANIC("Profile memory exhausted!");
+    call->frame->run_cycles += now - call->enter_cycles;
 }
 
 NO_PROFILE void rg_profiler_init(void)
 {
     profile = rg_alloc(sizeof(profile_t), MEM_SLOW);
-    lock = xSemaphoreCreateMutex();
     RG_LOGI("init done.\n");
 }
 
-NO_PROFILE void rg_profiler_start(void)
+NO_PROFILE static void profile_reset(void)
 {
-    LOCK_PROFILE();
+    uint32_t generation = profile->generation + 1;
+
+    for (int i = 0; i < RG_PROFILER_CORES; ++i)
+    {
+        profile_core_t *core = &profile->cores[i];
+        memset(core->frames, 0, sizeof(core->frames));
+        core->total_frames = 0;
+        core->lost = 0;
+    }
 
-    memset(profile, 0, sizeof(profile_t));
     profile->time_started = get_elapsed_time();
-    enabled = true;
+    profile->generation = generation;
+}
 
-    UNLOCK_PROFILE();
+NO_PROFILE void rg_profiler_start(void)
+{
+    profile_reset();
+    enabled = true;
 }
 
 NO_PROFILE void rg_profiler_stop(void)
 {
     enabled = false;
+    profile->time_stopped = get_elapsed_time();
 }
 
 NO_PROFILE void rg_profiler_print(void)
@@ -69,36 +171,66 @@ NO_PROFILE void rg_profiler_print(void)
     if (!profile)
         return;
 
-    LOCK_PROFILE();
+    uint32_t cycles_per_us = esp_clk_cpu_freq() / 1000000;
+    int total_frames = 0;
+    int lost = 0;
+
+    for (int i = 0; i < RG_PROFILER_CORES; ++i)
+    {
+        total_frames += profile->cores[i].total_frames;
+        lost += profile->cores[i].lost;
+    }
 
-    printf("RGD:PROF:BEGIN %d %lld\n", profile->total_frames, get_elapsed_time_since(profile->time_started));
+    if (lost > 0)
+        RG_LOGW("%d calls were not recorded!\n", lost);
 
-    for (int i = 0; i < profile->total_frames; ++i)
+    printf("RGD:PROF:BEGIN %d %lld\n", total_frames, (long long)(profile->time_stopped - profile->time_started));
+
+    for (int i = 0; i < RG_PROFILER_CORES; ++i)
     {
-        profile_frame_t *frame = &profile->frames[i];
-
-        printf(
-            "RGD:PROF:DATA %p\t%p\t%u\t%u\n",
-            frame->caller_ptr,
-            frame->func_ptr,
-            frame->num_calls,
-            frame->run_time
-        );
+        for (int j = 0; j < RG_PROFILER_FRAMES; ++j)
+        {
+            profile_frame_t *frame = &profile->cores[i].frames[j];
+
+            if (!frame->func_ptr)
+                continue;
+
+            // Sections have no symbol, give rg_tool.py their name
+            if (frame->section)
+                printf("RGD:PROF:NAME %p\t%s\n", frame->func_ptr, (char *)frame->func_ptr);
+
+            printf(
+                "RGD:PROF:DATA %p\t%p\t%u\t%u\n",
+                frame->caller_ptr,
+                frame->func_ptr,
+                frame->num_calls,
+                (uint32_t)(frame->run_cycles / cycles_per_us)
+            );
+        }
     }
 
     printf("RGD:PROF:END\n");
-
-    UNLOCK_PROFILE();
 }
 
 NO_PROFILE void rg_profiler_push(char *section_name)
 {
+    if (!enabled)
+        return;
 
+    profile_enter(section_name, __builtin_return_address(0), true);
 }
 
 NO_PROFILE void rg_profiler_pop(void)
 {
+    uint32_t now = xthal_get_ccount();
 
+    if (!enabled)
+        return;
+
+    profile_core_t *core = get_core();
+
+    if (core->depth > 0 && core->stack[core->depth - 1].frame->section)
+        profile_exit(core->stack[core->depth - 1].func_ptr, now);
 }
 
 NO_PROFILE void __cyg_profile_func_enter(void *this_fn, void *call_site)
@@ -106,38 +238,217 @@ NO_PROFILE void __cyg_profile_func_enter(void *this_fn, void *call_site)
     if (!enabled)
         return;
 
-    int64_t now = get_elapsed_time();
+    profile_enter(this_fn, call_site, false);
+}
 
-    LOCK_PROFILE();
+NO_PROFILE void __cyg_profile_func_exit(void *this_fn, void *call_site)
+{
+    uint32_t now = xthal_get_ccount();
 
-    profile_frame_t *fn = find_frame(this_fn, call_site);
+    if (!enabled)
+        return;
 
-    // Recursion will need a real stack, this is absurd
-    if (fn->enter_time != 0)
-        fn->run_time += now - fn->enter_time;
+    profile_exit(this_fn, now);
+}
 
-    fn->enter_time = get_elapsed_time(); // not now, because we delayed execution
-    fn->num_calls++;
+IRAM_ATTR NO_PROFILE static void sample_push(int core, uintptr_t pc, uintptr_t caller)
+{
+    uint32_t head = sampler[core].head;
 
-    UNLOCK_PROFILE();
+    if (head - __atomic_load_n(&sampler[core].tail, __ATOMIC_ACQUIRE) >= SAMPLE_RING_LENGTH)
+    {
+        sampler[core].dropped++;
+        return;
+    }
+
+    sampler[core].ring[head & (SAMPLE_RING_LENGTH - 1)][0] = pc;
+    sampler[core].ring[head & (SAMPLE_RING_LENGTH - 1)][1] = caller;
+    __atomic_store_n(&sampler[core].head, head + 1, __ATOMIC_RELEASE);
 }
 
-NO_PROFILE void __cyg_profile_func_exit(void *this_fn, void *call_site)
+IRAM_ATTR NO_PROFILE static void sample_isr(void *arg)
 {
-    if (!enabled)
+    int core = (intptr_t)arg;
+
+    TIMERG1.int_clr_timers.val = BIT(core);
+    TIMERG1.hw_timer[core].config.alarm_en = TIMER_ALARM_EN;
+
+    // The TCB starts with pxTopOfStack, where the interrupted task's context was saved on
+    // entry. It's stale if we interrupted another interrupt, those samples are skipped.
+    if (port_interruptNesting[core] > 1)
         return;
 
-    int64_t now = get_elapsed_time();
+    const XtExcFrame *frame = *(XtExcFrame **)xTaskGetCurrentTaskHandle();
+    uintptr_t pc = frame->pc;
+    // The top two bits of a windowed return address hold the caller's window increment
+    uintptr_t caller = (frame->a0 & 0x3FFFFFFF) | 0x40000000;
+
+    sample_push(core, pc, caller);
+}
+
+#ifdef RG_TARGET_HOST
+NO_PROFILE static void sample_host(int core, uintptr_t pc, uintptr_t caller)
+{
+    core = core >= 0 && core < RG_PROFILER_CORES ? core : 0;
+
+    // Same as sample_isr, the signal handler counts itself as an interrupt
+    if (port_interruptNesting[core] > 1)
+        return;
+
+    sample_push(core, pc, caller);
+}
+#endif
+
+NO_PROFILE static void sample_timer_task(void *arg)
+{
+    int core = xPortGetCoreID();
+
+    // Timer interrupts are routed to the core that allocates them, so this runs on each core
+    if (sampling)
+    {
+        timer_config_t config = {
+            .alarm_en = TIMER_ALARM_EN,
+            .counter_en = TIMER_PAUSE,
+            .intr_type = TIMER_INTR_LEVEL,
+            .counter_dir = TIMER_COUNT_UP,
+            .auto_reload = TIMER_AUTORELOAD_EN,
+            .divider = 80, // 1MHz
+        };
+        timer_init(TIMER_GROUP_1, core, &config);
+        timer_set_counter_value(TIMER_GROUP_1, core, 0);
+        timer_set_alarm_value(TIMER_GROUP_1, core, 1000000 / sampleRate);
+        timer_enable_intr(TIMER_GROUP_1, core);
+        timer_isr_register(TIMER_GROUP_1, core, &sample_isr, (void *)(intptr_t)core, 0, &sampler[core].intr);
+        timer_start(TIMER_GROUP_1, core);
+    }
+    else
+    {
+        timer_pause(TIMER_GROUP_1, core);
+        timer_disable_intr(TIMER_GROUP_1, core);
+        esp_intr_free(sampler[core].intr);
+        sampler[core].intr = NULL;
+    }
 
-    LOCK_PROFILE();
+    xSemaphoreGive(samplerReady);
+    vTaskDelete(NULL);
+}
 
-    profile_frame_t *fn = find_frame(this_fn, call_site);
+NO_PROFILE static void sample_timers_update(void)
+{
+#ifdef RG_TARGET_HOST
+    // There are no timer interrupts, host/profiler.c samples the whole process with SIGPROF
+    if (sampling)
+        rg_host_sampler_start(sampleRate, &sample_host);
+    else
+        rg_host_sampler_stop();
+    return;
+#endif
+
+    for (int i = 0; i < RG_PROFILER_CORES; ++i)
+        xTaskCreatePinnedToCore(&sample_timer_task, "sample_timer", 2048, NULL, 20, NULL, i);
+
+    for (int i = 0; i < RG_PROFILER_CORES; ++i)
+        xSemaphoreTake(samplerReady, portMAX_DELAY);
+}
 
-    // Ignore if profiler was disabled when function entered
-    if (fn->enter_time != 0)
-        fn->run_time += now - fn->enter_time;
+NO_PROFILE void rg_profiler_sample_start(int rate)
+{
+    if (enabled)
+    {
+        RG_LOGE("The instrumenting profiler is running!\n");
+        return;
+    }
+
+    if (sampling)
+        rg_profiler_sample_stop();
+
+    if (!profile)
+        profile = rg_alloc(sizeof(profile_t), MEM_SLOW);
+
+    if (!samplerReady)
+        samplerReady = xSemaphoreCreateCounting(RG_PROFILER_CORES, 0);
 
-    fn->enter_time = 0;
+    for (int i = 0; i < RG_PROFILER_CORES; ++i)
+    {
+        if (!sampler[i].ring)
+            sampler[i].ring = rg_alloc(SAMPLE_RING_LENGTH * sizeof(sampler[i].ring[0]), MEM_SLOW);
+        sampler[i].head = sampler[i].tail = 0;
+        sampler[i].dropped = 0;
+    }
 
-    UNLOCK_PROFILE();
+    profile_reset();
+
+    sampleRate = RG_MIN(RG_MAX(rate > 0 ? rate : RG_PROFILER_SAMPLE_RATE, 10), 10000);
+    sampling = true;
+    sample_timers_update();
+
+    RG_LOGI("Sampling at %dHz.\n", sampleRate);
+}
+
+NO_PROFILE void rg_profiler_sample_stop(void)
+{
+    if (!sampling)
+        return;
+
+    sampling = false;
+    sample_timers_update();
+
+    RG_LOGI("Sampling stopped.\n");
+}
+
+NO_PROFILE bool rg_profiler_sample_running(void)
+{
+    return sampling;
+}
+
+NO_PROFILE void rg_profiler_sample_flush(bool print)
+{
+    if (!profile || !sampler[0].ring)
+        return;
+
+    uint32_t cycles_per_sample = esp_clk_cpu_freq() / sampleRate;
+    bool full = false;
+
+    for (int i = 0; i < RG_PROFILER_CORES; ++i)
+    {
+        profile_core_t *core = &profile->cores[i];
+        uint32_t head = __atomic_load_n(&sampler[i].head, __ATOMIC_ACQUIRE);
+        uint32_t tail = sampler[i].tail;
+
+        for (; tail != head; tail++)
+        {
+            uintptr_t *sample = sampler[i].ring[tail & (SAMPLE_RING_LENGTH - 1)];
+            profile_frame_t *frame = find_frame(core, (void *)sample[0], (void *)sample[1]);
+
+            if (!frame)
+            {
+                core->lost++;
+                continue;
+            }
+
+            frame->num_calls++;
+            frame->run_cycles += cycles_per_sample;
+        }
+
+        __atomic_store_n(&sampler[i].tail, tail, __ATOMIC_RELEASE);
+
+        full |= core->total_frames >= RG_PROFILER_FRAMES / 2;
+    }
+
+    // Print early rather than lose samples, every distinct PC takes a slot
+    if (print || full)
+    {
+        uint32_t dropped = 0;
+
+        for (int i = 0; i < RG_PROFILER_CORES; ++i)
+            dropped += sampler[i].dropped;
+
+        profile->time_stopped = get_elapsed_time();
+
+        if (dropped > 0)
+            RG_LOGW("Sample ring overflow: %u samples dropped\n", (unsigned)dropped);
+
+        rg_profiler_print();
+        profile_reset();
+    }
 }
@@ -3,22 +3,43 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+#define RG_PROFILER_CORES 2
+#define RG_PROFILER_FRAMES 1024 // Caller/callee edges per core, must be a power of two
+#define RG_PROFILER_STACK 64    // Shadow call stack depth per core
+#define RG_PROFILER_SAMPLE_RATE 1000 // Default rate of the sampling profiler, per core (Hz)
+
 typedef struct
 {
     void *func_ptr;
     void *caller_ptr;
-    uint32_t enter_time;
     uint32_t num_calls;
-    uint32_t run_time;
+    uint32_t section;       // func_ptr is a section name given to rg_profiler_push
+    uint64_t run_cycles;    // Inclusive, a recursive call only counts its outermost activation
 } profile_frame_t;
 
+typedef struct
+{
+    void *func_ptr;
+    profile_frame_t *frame;
+    uint32_t enter_cycles;
+} profile_call_t;
+
+typedef struct
+{
+    profile_frame_t frames[RG_PROFILER_FRAMES];
+    profile_call_t stack[RG_PROFILER_STACK];
+    int32_t depth;
+    int32_t total_frames;
+    uint32_t generation;    // The stack is stale when it doesn't match profile_t's
+    uint32_t lost;          // Calls not recorded because the table or the stack was full
+} profile_core_t;
+
 typedef struct
 {
     int64_t time_started;
     int64_t time_stopped;
-    int32_t total_frames;
-    int32_t locked;
-    profile_frame_t frames[512];
+    uint32_t generation;
+    profile_core_t cores[RG_PROFILER_CORES];
 } profile_t;
 
 #ifdef __cplusplus
@@ -32,6 +53,10 @@ void rg_profiler_stop(void);
 void rg_profiler_print(void);
 void rg_profiler_push(char *section_name);
 void rg_profiler_pop(void);
+void rg_profiler_sample_start(int rate);
+void rg_profiler_sample_stop(void);
+bool rg_profiler_sample_running(void);
+void rg_profiler_sample_flush(bool print);
 
 void __cyg_profile_func_enter(void *this_fn, void *call_site);
 void __cyg_profile_func_exit(void *this_fn, void *call_site);
@@ -0,0 +1,323 @@
+#include <esp_heap_caps.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "rg_system.h"
+#include "rg_rewind.h"
+
+// Every few frames the game is serialized, like rg_emu_snapshot_take does, and XORed with the
+// previous capture. Only that delta is kept, with the runs of unchanged words left out:
+//   [u16 unchanged words][u16 changed words][changed words XOR previous...] ...
+// The ring holds the deltas, oldest first, and the newest full state is kept beside it. Going
+// back a step is XORing the newest delta into that state, so when the ring is full the oldest
+// deltas can simply be dropped.
+
+static const char *SETTING_BUFFER = "RewindBuffer";
+static const char *SETTING_INTERVAL = "RewindInterval";
+
+typedef struct
+{
+    uint32_t offset;
+    uint32_t size;
+} entry_t;
+
+static rg_state_buffer_t states[2]; // states[current] is the newest capture
+static int current;
+static uint8_t *ring;
+static size_t ringSize;
+static size_t ringHead;
+static uint8_t *scratch;
+static size_t scratchSize;
+static entry_t entries[RG_REWIND_MAX_ENTRIES];
+static int entriesFirst, entriesCount;
+static int budget = 0;
+static int interval = 10;
+static int frameCounter;
+static rg_rewind_stats_t stats;
+static bool enabled;
+
+
+static bool serialize(rg_state_buffer_t *buffer)
+{
+    FILE *fp = rg_state_buffer_open(buffer, true);
+    const rg_emu_proc_t *handlers = &rg_system_get_app()->handlers;
+    bool success = fp && (handlers->saveSnapshot ?: handlers->saveState)(fp);
+    success = fp && fclose(fp) == 0 && success;
+
+    // The deltas work on whole words, the padding must not hold stale bytes
+    size_t padded = (buffer->size + 3) & ~3;
+    if (!success || !rg_state_buffer_reserve(buffer, padded))
+        return false;
+    memset(buffer->data + buffer->size, 0, padded - buffer->size);
+
+    return true;
+}
+
+static size_t delta_encode(const uint32_t *state, const uint32_t *previous, size_t words, uint8_t *out)
+{
+    uint8_t *start = out;
+    size_t i = 0;
+
+    while (i < words)
+    {
+        uint16_t *header = (uint16_t *)out;
+        uint32_t *changes = (uint32_t *)(out + 4);
+        size_t skip = 0, count = 0;
+
+        while (i < words && state[i] == previous[i] && skip < 0xFFFF)
+            skip++, i++;
+
+        while (i < words && state[i] != previous[i] && count < 0xFFFF)
+            changes[count++] = state[i] ^ previous[i], i++;
+
+        header[0] = skip;
+        header[1] = count;
+        out += 4 + count * 4;
+    }
+
+    return out - start;
+}
+
+static void delta_apply(uint32_t *state, size_t words, const uint8_t *delta, size_t size)
+{
+    const uint8_t *end = delta + size;
+    size_t i = 0;
+
+    while (delta < end)
+    {
+        const uint16_t *header = (const uint16_t *)delta;
+        const uint32_t *changes = (const uint32_t *)(delta + 4);
+
+        i += header[0];
+        for (size_t j = 0; j < header[1] && i < words; j++)
+            state[i++] ^= changes[j];
+
+        delta += 4 + header[1] * 4;
+    }
+}
+
+static void ring_clear(void)
+{
+    ringHead = 0;
+    entriesFirst = 0;
+    entriesCount = 0;
+}
+
+static bool ring_push(const uint8_t *data, size_t size)
+{
+    if (size > ringSize)
+        return false;
+
+    if (entriesCount == RG_REWIND_MAX_ENTRIES)
+    {
+        entriesFirst = (entriesFirst + 1) % RG_REWIND_MAX_ENTRIES;
+        entriesCount--;
+    }
+
+    // Entries never wrap, a delta that doesn't fit at the end starts over at the beginning. The
+    // oldest entries are those past ringHead, the ones left at the end go now.
+    if (ringHead + size > ringSize)
+    {
+        while (entriesCount > 0 && entries[entriesFirst].offset >= ringHead)
+        {
+            entriesFirst = (entriesFirst + 1) % RG_REWIND_MAX_ENTRIES;
+            entriesCount--;
+        }
+        ringHead = 0;
+    }
+
+    // From ringHead on, the entries are in the order they were written in, oldest first
+    while (entriesCount > 0)
+    {
+        entry_t *oldest = &entries[entriesFirst];
+        if (oldest->offset >= ringHead + size || oldest->offset + oldest->size <= ringHead)
+            break;
+        entriesFirst = (entriesFirst + 1) % RG_REWIND_MAX_ENTRIES;
+        entriesCount--;
+    }
+
+    memcpy(ring + ringHead, data, size);
+    entries[(entriesFirst + entriesCount) % RG_REWIND_MAX_ENTRIES] = (entry_t){ringHead, size};
+    entriesCount++;
+    ringHead += size;
+
+    return true;
+}
+
+bool rg_rewind_capture(void)
+{
+    if (!enabled)
+        return false;
+
+    int64_t startTime = get_elapsed_time();
+    rg_state_buffer_t *previous = &states[current];
+    rg_state_buffer_t *state = &states[current ^ 1];
+
+    if (!serialize(state))
+    {
+        RG_LOGE("Rewind capture failed!\n");
+        return false;
+    }
+
+    if (state->size != previous->size)
+    {
+        // First capture, or the state's layout changed and the deltas are meaningless
+        size_t words = (state->size + 3) / 4;
+        free(scratch);
+        scratchSize = words * 4 + (words / 0xFFFF + 2) * 4;
+        scratch = heap_caps_malloc(scratchSize, MALLOC_CAP_SPIRAM) ?: malloc(scratchSize);
+        if (!scratch)
+        {
+            RG_LOGE("Out of memory, rewind disabled!\n");
+            rg_rewind_deinit();
+            return false;
+        }
+        ring_clear();
+        stats.stateSize = state->size;
+    }
+    else
+    {
+        size_t words = (state->size + 3) / 4;
+        size_t size = delta_encode((uint32_t *)state->data, (uint32_t *)previous->data, words, scratch);
+        if (!ring_push(scratch, size))
+            ring_clear();
+        stats.lastDelta = size;
+        stats.deltaBytes += size;
+    }
+
+    current ^= 1;
+
+    int64_t elapsed = get_elapsed_time() - startTime;
+    stats.captureTime += elapsed;
+    stats.captureTimeMax = RG_MAX(stats.captureTimeMax, elapsed);
+    stats.captures++;
+
+    return true;
+}
+
+bool rg_rewind_step(void)
+{
+    rg_state_buffer_t *state = &states[current];
+    bool stepped = false;
+
+    if (!enabled || state->size == 0)
+        return false;
+
+    if (entriesCount > 0)
+    {
+        entry_t *newest = &entries[(entriesFirst + entriesCount - 1) % RG_REWIND_MAX_ENTRIES];
+        delta_apply((uint32_t *)state->data, (state->size + 3) / 4, ring + newest->offset, newest->size);
+        ringHead = newest->offset;
+        entriesCount--;
+        stepped = true;
+    }
+
+    // Past the oldest capture the game stays there until the key is released
+    const rg_emu_proc_t *handlers = &rg_system_get_app()->handlers;
+    FILE *fp = rg_state_buffer_open(state, false);
+    bool success = fp && (handlers->loadSnapshot ?: handlers->loadState)(fp);
+
+    if (fp)
+        fclose(fp);
+
+    if (!success)
+    {
+        RG_LOGE("Rewind restore failed!\n");
+        rg_rewind_init();
+        return false;
+    }
+
+    return stepped;
+}
+
+void rg_rewind_tick(void)
+{
+    if (!enabled)
+        return;
+
+    // The game doesn't see the hotkey until it's released, or it would act on it too
+    if ((rg_input_read_gamepad_raw() & RG_REWIND_HOTKEY) == RG_REWIND_HOTKEY)
+    {
+        rg_input_mask_keys(RG_REWIND_HOTKEY);
+        rg_rewind_step();
+        frameCounter = 0;
+    }
+    else if (++frameCounter >= interval)
+    {
+        rg_rewind_capture();
+        frameCounter = 0;
+    }
+}
+
+void rg_rewind_init(void)
+{
+    const rg_app_desc_t *app = rg_system_get_app();
+
+    rg_rewind_deinit();
+
+    budget = rg_settings_get_app_int32(SETTING_BUFFER, 0);
+    interval = RG_MAX(rg_settings_get_app_int32(SETTING_INTERVAL, 10), 1);
+
+    if (budget <= 0 || !app->handlers.saveState || !app->handlers.loadState)
+        return;
+
+    ringSize = budget * 1024;
+    if (!(ring = heap_caps_malloc(ringSize, MALLOC_CAP_SPIRAM)))
+    {
+        RG_LOGE("Unable to allocate %dKB, rewind disabled!\n", budget);
+        return;
+    }
+
+    enabled = true;
+
+    RG_LOGI("Rewind enabled: %dKB, one capture every %d frames.\n", budget, interval);
+}
+
+void rg_rewind_deinit(void)
+{
+    enabled = false;
+    free(ring);
+    free(scratch);
+    ring = scratch = NULL;
+    ringSize = scratchSize = 0;
+    rg_state_buffer_free(&states[0]);
+    rg_state_buffer_free(&states[1]);
+    memset(&stats, 0, sizeof(stats));
+    current = 0;
+    frameCounter = 0;
+    ring_clear();
+}
+
+void rg_rewind_set_budget(int kilobytes)
+{
+    rg_settings_set_app_int32(SETTING_BUFFER, RG_MAX(kilobytes, 0));
+    rg_rewind_init();
+}
+
+int rg_rewind_get_budget(void)
+{
+    return budget;
+}
+
+void rg_rewind_set_interval(int frames)
+{
+    interval = RG_MAX(frames, 1);
+    rg_settings_set_app_int32(SETTING_INTERVAL, interval);
+}
+
+int rg_rewind_get_interval(void)
+{
+    return interval;
+}
+
+rg_rewind_stats_t rg_rewind_get_stats(void)
+{
+    rg_rewind_stats_t out = stats;
+
+    out.entries = entriesCount;
+    out.used = 0;
+    for (int i = 0; i < entriesCount; i++)
+        out.used += entries[(entriesFirst + i) % RG_REWIND_MAX_ENTRIES].size;
+
+    return out;
+}
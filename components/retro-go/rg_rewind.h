@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Held to go back in time, one capture per frame
+#define RG_REWIND_HOTKEY (GAMEPAD_KEY_SELECT | GAMEPAD_KEY_LEFT)
+#define RG_REWIND_MAX_ENTRIES 1024
+
+typedef struct
+{
+    uint32_t captures;      // Since the buffer was (re)allocated
+    uint32_t entries;       // Deltas in the ring
+    uint32_t used;          // Bytes of the ring holding them
+    uint32_t stateSize;
+    uint32_t lastDelta;
+    uint64_t deltaBytes;    // Total, for the average
+    int64_t captureTime;    // Total (serialization and delta), for the average
+    int64_t captureTimeMax;
+} rg_rewind_stats_t;
+
+void rg_rewind_init(void);
+void rg_rewind_deinit(void);
+void rg_rewind_tick(void);
+bool rg_rewind_capture(void);
+bool rg_rewind_step(void);
+void rg_rewind_set_budget(int kilobytes);
+int rg_rewind_get_budget(void);
+void rg_rewind_set_interval(int frames);
+int rg_rewind_get_interval(void);
+rg_rewind_stats_t rg_rewind_get_stats(void);
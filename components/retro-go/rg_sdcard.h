@@ -3,7 +3,9 @@
 #include <stdint.h>
 #include <stdio.h>
 
+#ifndef RG_BASE_PATH
 #define RG_BASE_PATH           "/sd"
+#endif
 #define RG_BASE_PATH_ROMS      RG_BASE_PATH "/roms"
 #define RG_BASE_PATH_SAVES     RG_BASE_PATH "/odroid/data"
 #define RG_BASE_PATH_CACHE     RG_BASE_PATH "/odroid/cache"
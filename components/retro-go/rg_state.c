@@ -0,0 +1,312 @@
+#define _GNU_SOURCE // fopencookie
+#include <esp_heap_caps.h>
+#include <sys/types.h>
+#include <string.h>
+#include <stdlib.h>
+#include <zlib.h>
+
+#include "rg_system.h"
+#include "rg_state.h"
+
+// A save state file is a header, the sections' data and then the section table:
+//   rg_state_header_t | section 0 | section 1 | ... | rg_state_section_t[count]
+// Sections are raw deflate streams, each with the CRC32 of its uncompressed data. The table
+// goes last so that sections can be streamed out before their compressed size is known.
+
+#define CHUNK_SIZE 4096
+#define DEFLATE_LEVEL 3
+#define DEFLATE_WINDOW_BITS 13  // 8KB window, states are mostly large runs of zeros anyway
+#define DEFLATE_MEM_LEVEL 6     // The esp32 build caps it at 6 (MAX_MEM_LEVEL)
+#define BUFFER_STEP (32 * 1024)
+
+
+static void *zalloc_psram(void *opaque, unsigned items, unsigned size)
+{
+    // Keep zlib's window and hash tables out of the internal RAM
+    return heap_caps_calloc(items, size, MALLOC_CAP_SPIRAM) ?: calloc(items, size);
+}
+
+static void zfree_psram(void *opaque, void *ptr)
+{
+    free(ptr);
+}
+
+bool rg_state_buffer_reserve(rg_state_buffer_t *buffer, size_t capacity)
+{
+    if (capacity <= buffer->capacity)
+        return true;
+
+    if (buffer->fixed)
+        return false;
+
+    capacity = (capacity + BUFFER_STEP - 1) / BUFFER_STEP * BUFFER_STEP;
+
+    void *data = heap_caps_realloc(buffer->data, capacity, MALLOC_CAP_SPIRAM) ?: realloc(buffer->data, capacity);
+    if (!data)
+    {
+        RG_LOGE("Unable to grow state buffer to %d bytes!\n", (int)capacity);
+        return false;
+    }
+
+    buffer->data = data;
+    buffer->capacity = capacity;
+    return true;
+}
+
+void rg_state_buffer_free(rg_state_buffer_t *buffer)
+{
+    free(buffer->data);
+    memset(buffer, 0, sizeof(rg_state_buffer_t));
+}
+
+static ssize_t buffer_read(void *cookie, char *buf, size_t size)
+{
+    rg_state_buffer_t *buffer = cookie;
+    if (buffer->position >= buffer->size)
+        return 0;
+    size = RG_MIN(size, buffer->size - buffer->position);
+    memcpy(buf, buffer->data + buffer->position, size);
+    buffer->position += size;
+    return size;
+}
+
+static ssize_t buffer_write(void *cookie, const char *buf, size_t size)
+{
+    rg_state_buffer_t *buffer = cookie;
+    if (!rg_state_buffer_reserve(buffer, buffer->position + size))
+        return -1;
+    memcpy(buffer->data + buffer->position, buf, size);
+    buffer->position += size;
+    buffer->size = RG_MAX(buffer->size, buffer->position);
+    return size;
+}
+
+static int buffer_seek(void *cookie, off_t *offset, int whence)
+{
+    rg_state_buffer_t *buffer = cookie;
+    off_t position = *offset;
+
+    if (whence == SEEK_CUR)
+        position += buffer->position;
+    else if (whence == SEEK_END)
+        position += buffer->size;
+
+    if (position < 0)
+        return -1;
+
+    buffer->position = *offset = position;
+    return 0;
+}
+
+FILE *rg_state_buffer_open(rg_state_buffer_t *buffer, bool write)
+{
+    cookie_io_functions_t functions = {
+        .read = &buffer_read,
+        .write = &buffer_write,
+        .seek = &buffer_seek,
+        .close = NULL,
+    };
+
+    buffer->position = 0;
+    if (write)
+        buffer->size = 0;
+
+    FILE *fp = fopencookie(buffer, write ? "w+" : "r", functions);
+    if (fp)
+        setvbuf(fp, NULL, _IOFBF, 1024);
+    return fp;
+}
+
+bool rg_state_create(rg_state_file_t *file, const char *filename, const char *app)
+{
+    memset(file, 0, sizeof(rg_state_file_t));
+
+    if (!(file->fp = fopen(filename, "wb")))
+        return false;
+
+    file->writing = true;
+    file->header.magic = RG_STATE_MAGIC;
+    file->header.version = RG_STATE_VERSION;
+    strncpy(file->header.app, app ?: "", sizeof(file->header.app) - 1);
+
+    // The header is written again once the table is known
+    return fwrite(&file->header, sizeof(file->header), 1, file->fp) == 1;
+}
+
+bool rg_state_write_section(rg_state_file_t *file, const char *name, const void *data, size_t size)
+{
+    if (!file->fp || !file->writing || file->header.count >= RG_STATE_MAX_SECTIONS)
+        return false;
+
+    rg_state_section_t *section = &file->table[file->header.count];
+    uint8_t *chunk = malloc(CHUNK_SIZE);
+    z_stream stream = {
+        .next_in = (Bytef *)data,
+        .avail_in = size,
+        .zalloc = &zalloc_psram,
+        .zfree = &zfree_psram,
+    };
+    bool success = false;
+    int ret = Z_OK;
+
+    strncpy(section->name, name, sizeof(section->name) - 1);
+    section->flags = RG_STATE_SECTION_DEFLATE;
+    section->offset = ftell(file->fp);
+    section->size = size;
+    section->crc = crc32_le(0, data, size);
+
+    if (!chunk || deflateInit2(&stream, DEFLATE_LEVEL, Z_DEFLATED, -DEFLATE_WINDOW_BITS,
+                               DEFLATE_MEM_LEVEL, Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+        free(chunk);
+        return false;
+    }
+
+    while (ret == Z_OK)
+    {
+        stream.next_out = chunk;
+        stream.avail_out = CHUNK_SIZE;
+        ret = deflate(&stream, Z_FINISH);
+        size_t length = CHUNK_SIZE - stream.avail_out;
+        if ((ret == Z_OK || ret == Z_STREAM_END) && length > 0 && fwrite(chunk, length, 1, file->fp) != 1)
+            ret = Z_ERRNO;
+    }
+
+    if (ret == Z_STREAM_END)
+    {
+        section->stored = stream.total_out;
+        file->header.count++;
+        success = true;
+    }
+    else
+    {
+        RG_LOGE("Section '%s' compression failed (%d)!\n", name, ret);
+    }
+
+    deflateEnd(&stream);
+    free(chunk);
+
+    return success;
+}
+
+bool rg_state_open(rg_state_file_t *file, const char *filename)
+{
+    memset(file, 0, sizeof(rg_state_file_t));
+
+    // On failure the caller can tell a file from before the container (no magic) from a damaged one
+    if (!(file->fp = fopen(filename, "rb")))
+        return false;
+
+    if (fread(&file->header, sizeof(file->header), 1, file->fp) != 1
+        || file->header.magic != RG_STATE_MAGIC)
+    {
+        file->header.magic = 0;
+        goto _fail;
+    }
+
+    if (file->header.version > RG_STATE_VERSION || file->header.count > RG_STATE_MAX_SECTIONS)
+    {
+        RG_LOGE("Unsupported state version %d (%d sections)!\n", file->header.version, file->header.count);
+        goto _fail;
+    }
+
+    size_t tableSize = file->header.count * sizeof(rg_state_section_t);
+
+    if (fseek(file->fp, file->header.tableOffset, SEEK_SET) != 0
+        || (tableSize > 0 && fread(file->table, tableSize, 1, file->fp) != 1)
+        || crc32_le(0, (const uint8_t *)file->table, tableSize) != file->header.tableCRC)
+    {
+        RG_LOGE("State section table is damaged!\n");
+        goto _fail;
+    }
+
+    return true;
+
+_fail:
+    fclose(file->fp);
+    file->fp = NULL;
+    return false;
+}
+
+bool rg_state_read_section(rg_state_file_t *file, const char *name, rg_state_buffer_t *buffer)
+{
+    rg_state_section_t *section = NULL;
+
+    for (int i = 0; i < file->header.count && !section; i++)
+    {
+        if (strncmp(file->table[i].name, name, sizeof(file->table[i].name)) == 0)
+            section = &file->table[i];
+    }
+
+    if (!file->fp || file->writing || !section)
+        return false;
+
+    if (!rg_state_buffer_reserve(buffer, section->size) || fseek(file->fp, section->offset, SEEK_SET) != 0)
+        return false;
+
+    uint8_t *chunk = malloc(CHUNK_SIZE);
+    z_stream stream = {
+        .next_out = buffer->data,
+        .avail_out = section->size,
+        .zalloc = &zalloc_psram,
+        .zfree = &zfree_psram,
+    };
+    size_t remaining = section->stored;
+    int ret = Z_OK;
+
+    if (!chunk || inflateInit2(&stream, -DEFLATE_WINDOW_BITS) != Z_OK)
+    {
+        free(chunk);
+        return false;
+    }
+
+    while (ret == Z_OK && remaining > 0)
+    {
+        stream.next_in = chunk;
+        stream.avail_in = fread(chunk, 1, RG_MIN(remaining, CHUNK_SIZE), file->fp);
+        if (stream.avail_in == 0)
+            break;
+        remaining -= stream.avail_in;
+        ret = inflate(&stream, Z_NO_FLUSH);
+    }
+
+    inflateEnd(&stream);
+    free(chunk);
+
+    buffer->size = stream.total_out;
+    buffer->position = 0;
+
+    if (ret != Z_STREAM_END || buffer->size != section->size
+        || crc32_le(0, buffer->data, buffer->size) != section->crc)
+    {
+        RG_LOGE("Section '%s' is damaged (%d)!\n", name, ret);
+        buffer->size = 0;
+        return false;
+    }
+
+    return true;
+}
+
+bool rg_state_close(rg_state_file_t *file)
+{
+    bool success = true;
+
+    if (!file->fp)
+        return false;
+
+    if (file->writing)
+    {
+        size_t tableSize = file->header.count * sizeof(rg_state_section_t);
+        file->header.tableOffset = ftell(file->fp);
+        file->header.tableCRC = crc32_le(0, (const uint8_t *)file->table, tableSize);
+
+        success = (tableSize == 0 || fwrite(file->table, tableSize, 1, file->fp) == 1)
+            && fseek(file->fp, 0, SEEK_SET) == 0
+            && fwrite(&file->header, sizeof(file->header), 1, file->fp) == 1;
+    }
+
+    success = fclose(file->fp) == 0 && success;
+    file->fp = NULL;
+
+    return success;
+}
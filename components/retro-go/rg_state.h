@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Save state container, see rg_state.c for the layout
+#define RG_STATE_MAGIC 0x54534752 // "RGST"
+#define RG_STATE_VERSION 1
+#define RG_STATE_MAX_SECTIONS 8
+
+#define RG_STATE_SECTION_DEFLATE 0x01
+
+typedef struct
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t count;         // Sections in the table
+    uint32_t tableOffset;
+    uint32_t tableCRC;
+    char app[16];
+} rg_state_header_t;
+
+typedef struct
+{
+    char name[12];
+    uint32_t flags;
+    uint32_t offset;
+    uint32_t size;          // Uncompressed
+    uint32_t stored;        // Bytes in the file
+    uint32_t crc;           // Of the uncompressed data
+} rg_state_section_t;
+
+typedef struct
+{
+    FILE *fp;
+    bool writing;
+    rg_state_header_t header;
+    rg_state_section_t table[RG_STATE_MAX_SECTIONS];
+} rg_state_file_t;
+
+// A PSRAM buffer that cores read and write like a file. It grows as needed unless it is fixed.
+typedef struct
+{
+    uint8_t *data;
+    size_t size;
+    size_t capacity;
+    size_t position;
+    bool fixed;
+} rg_state_buffer_t;
+
+FILE *rg_state_buffer_open(rg_state_buffer_t *buffer, bool write);
+bool rg_state_buffer_reserve(rg_state_buffer_t *buffer, size_t capacity);
+void rg_state_buffer_free(rg_state_buffer_t *buffer);
+
+bool rg_state_create(rg_state_file_t *file, const char *filename, const char *app);
+bool rg_state_write_section(rg_state_file_t *file, const char *name, const void *data, size_t size);
+bool rg_state_open(rg_state_file_t *file, const char *filename);
+bool rg_state_read_section(rg_state_file_t *file, const char *name, rg_state_buffer_t *buffer);
+bool rg_state_close(rg_state_file_t *file);
@@ -0,0 +1,210 @@
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "rg_system.h"
+#include "rg_synth.h"
+
+enum
+{
+    SYNTH_WRITE = 0,
+    SYNTH_FRAME,
+    SYNTH_FRAME_MUTED,  // Rendered to keep the chip state moving, but not submitted
+};
+
+typedef struct
+{
+    uint32_t cycle;
+    uint16_t reg;
+    uint8_t value;
+    uint8_t type;
+} synth_entry_t;
+
+// Must be a power of two. A busy frame is a few hundred writes.
+#define SYNTH_LOG_LENGTH (1024)
+
+// How many frames the emulator may run ahead of the synth task. rg_audio_submit paces the
+// synth task, this in turn paces the emulator.
+#define SYNTH_MAX_FRAMES (2)
+
+// Single producer (the emulator) and single consumer (synth_task), same scheme as the audio ring
+static synth_entry_t *synthLog;
+static uint32_t logHead;
+static uint32_t logTail;
+static uint32_t framesQueued;
+static uint32_t framesDone;
+static SemaphoreHandle_t logReady;
+static SemaphoreHandle_t logSpace;
+static TaskHandle_t synthTask;
+static volatile bool synthTaskRunning;
+static rg_synth_chip_t synthChip;
+static rg_synth_counters_t synthCounters;
+
+
+static void synth_task(void *arg)
+{
+    uint32_t lastCycle = 0;
+
+    while (synthTaskRunning)
+    {
+        uint32_t head = __atomic_load_n(&logHead, __ATOMIC_ACQUIRE);
+        uint32_t tail = logTail;
+
+        if (tail == head)
+        {
+            xSemaphoreTake(logReady, pdMS_TO_TICKS(100));
+            continue;
+        }
+
+        int64_t startTime = get_elapsed_time();
+
+        for (; tail != head; tail++)
+        {
+            const synth_entry_t *entry = &synthLog[tail & (SYNTH_LOG_LENGTH - 1)];
+
+            // Stamps can go back after a state load, just apply the write late
+            if (entry->cycle > lastCycle)
+            {
+                synthChip.render(synthChip.arg, entry->cycle - lastCycle);
+                lastCycle = entry->cycle;
+            }
+
+            if (entry->type == SYNTH_WRITE)
+            {
+                synthChip.write(synthChip.arg, entry->reg, entry->value);
+                synthCounters.writes++;
+                continue;
+            }
+
+            short *buffer = NULL;
+            size_t count = synthChip.flush(synthChip.arg, &buffer);
+            lastCycle = 0;
+
+            // Release the frame before submitting, the emulator can work on the next one meanwhile
+            __atomic_store_n(&logTail, tail + 1, __ATOMIC_RELEASE);
+            __atomic_store_n(&framesDone, framesDone + 1, __ATOMIC_RELEASE);
+            xSemaphoreGive(logSpace);
+
+            synthCounters.busyTime += get_elapsed_time_since(startTime);
+            synthCounters.frames++;
+
+            if (entry->type == SYNTH_FRAME && count > 0)
+                rg_audio_submit(buffer, count);
+
+            startTime = get_elapsed_time();
+        }
+
+        synthCounters.busyTime += get_elapsed_time_since(startTime);
+
+        __atomic_store_n(&logTail, tail, __ATOMIC_RELEASE);
+        xSemaphoreGive(logSpace);
+    }
+
+    synthTask = NULL;
+    vTaskDelete(NULL);
+}
+
+static inline void synth_push(uint32_t cycle, uint16_t reg, uint8_t value, uint8_t type)
+{
+    uint32_t head = logHead;
+    uint32_t used = head - __atomic_load_n(&logTail, __ATOMIC_ACQUIRE);
+
+    if (used >= SYNTH_LOG_LENGTH)
+    {
+        synthCounters.stalls++;
+        do {
+            xSemaphoreGive(logReady);
+            xSemaphoreTake(logSpace, pdMS_TO_TICKS(10));
+            used = head - __atomic_load_n(&logTail, __ATOMIC_ACQUIRE);
+        } while (used >= SYNTH_LOG_LENGTH);
+    }
+
+    if (used >= synthCounters.highWater)
+        synthCounters.highWater = used + 1;
+
+    synthLog[head & (SYNTH_LOG_LENGTH - 1)] = (synth_entry_t){cycle, reg, value, type};
+    __atomic_store_n(&logHead, head + 1, __ATOMIC_RELEASE);
+}
+
+void rg_synth_write(uint32_t cycle, uint16_t reg, uint8_t value)
+{
+    synth_push(cycle, reg, value, SYNTH_WRITE);
+}
+
+void rg_synth_end_frame(uint32_t cycle, bool output)
+{
+    synth_push(cycle, 0, 0, output ? SYNTH_FRAME : SYNTH_FRAME_MUTED);
+    framesQueued++;
+    xSemaphoreGive(logReady);
+
+    while (framesQueued - __atomic_load_n(&framesDone, __ATOMIC_ACQUIRE) > SYNTH_MAX_FRAMES)
+    {
+        xSemaphoreTake(logSpace, pdMS_TO_TICKS(10));
+    }
+}
+
+void rg_synth_sync(void)
+{
+    // Once the log is drained the synth task no longer touches the chip state, until the next write
+    while (synthTask && __atomic_load_n(&logTail, __ATOMIC_ACQUIRE) != logHead)
+    {
+        xSemaphoreGive(logReady);
+        xSemaphoreTake(logSpace, pdMS_TO_TICKS(10));
+    }
+}
+
+void rg_synth_start(const rg_synth_chip_t *chip)
+{
+    RG_ASSERT(chip && chip->write && chip->render && chip->flush, "Bad chip");
+
+    if (synthTask)
+        rg_synth_stop();
+
+    if (!synthLog)
+    {
+        synthLog = rg_alloc(SYNTH_LOG_LENGTH * sizeof(synth_entry_t), MEM_FAST);
+        logReady = xSemaphoreCreateBinary();
+        logSpace = xSemaphoreCreateBinary();
+    }
+
+    synthChip = *chip;
+    logHead = logTail = 0;
+    framesQueued = framesDone = 0;
+    memset(&synthCounters, 0, sizeof(synthCounters));
+
+    // Core 1 only does display, SPI and the DAC, the synth fits between them
+    synthTaskRunning = true;
+    xTaskCreatePinnedToCore(&synth_task, "synth_task", 2048, NULL, 6, &synthTask, 1);
+
+    RG_LOGI("Synth task started.\n");
+}
+
+void rg_synth_stop(void)
+{
+    if (!synthTask)
+        return;
+
+    rg_synth_sync();
+
+    synthTaskRunning = false;
+    while (synthTask)
+    {
+        xSemaphoreGive(logReady);
+        usleep(1000);
+    }
+
+    RG_LOGI("Synth task stopped. frames=%d writes=%d stalls=%d\n",
+        synthCounters.frames, synthCounters.writes, synthCounters.stalls);
+}
+
+bool rg_synth_running(void)
+{
+    return synthTask != NULL;
+}
+
+rg_synth_counters_t rg_synth_get_counters(void)
+{
+    return synthCounters;
+}
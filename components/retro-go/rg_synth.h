@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// A sound chip synthesized on the other core. The emulator logs register writes with the
+// cycle they happened at (relative to the start of the frame), the synth task replays them
+// at the same point of the rendered stream and submits the frame to rg_audio.
+typedef struct
+{
+    void (*write)(void *arg, uint16_t reg, uint8_t value);  // Apply a register write
+    void (*render)(void *arg, uint32_t cycles);             // Run the chip for that many cycles
+    size_t (*flush)(void *arg, short **buffer);             // Return the frame's stereo samples and start a new one
+    void *arg;
+} rg_synth_chip_t;
+
+typedef struct
+{
+    uint32_t writes;        // Register writes replayed
+    uint32_t frames;        // Frames rendered
+    uint32_t stalls;        // Times the emulator waited for room in the log
+    uint32_t highWater;     // Most entries in the log at once
+    uint32_t busyTime;      // Time spent replaying and rendering (us)
+} rg_synth_counters_t;
+
+void rg_synth_start(const rg_synth_chip_t *chip);
+void rg_synth_stop(void);
+bool rg_synth_running(void);
+void rg_synth_write(uint32_t cycle, uint16_t reg, uint8_t value);
+void rg_synth_end_frame(uint32_t cycle, bool output);
+void rg_synth_sync(void);
+rg_synth_counters_t rg_synth_get_counters(void);
@@ -12,9 +12,14 @@
 #include <stdarg.h>
 #include <assert.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "rg_system.h"
 
+#ifdef RG_TARGET_HOST
+#include "host/rg_host.h"
+#endif
+
 #ifdef ENABLE_PROFILING
 #define INPUT_TIMEOUT -1
 #else
@@ -25,6 +30,9 @@
 #define RG_BUILD_USER "ducalex"
 #endif
 
+// How far behind rg_system_frame_sync tolerates being before it restarts its clock (us)
+#define FRAME_CLOCK_MAX_LAG 100000
+
 #define SETTING_ROM_FILE_PATH "RomFilePath"
 #define SETTING_START_ACTION  "StartAction"
 #define SETTING_STARTUP_APP   "StartupApp"
@@ -40,13 +48,40 @@ typedef struct
     log_buffer_t log;
 } panic_trace_t;
 
+typedef struct
+{
+    uint32_t seq;           // Ring position + 1 once the entry is complete, 0 while it is written
+    uint32_t time;          // ms since boot
+    const char *context;
+    const char *format;
+    uint8_t level;
+    uint8_t size;           // Bytes used in args
+    uint8_t args[LOG_ENTRY_ARGS];
+} log_entry_t;
+
 // These will survive a software reset
 static RTC_NOINIT_ATTR panic_trace_t panicTrace;
 static runtime_stats_t statistics;
 static runtime_counters_t counters;
+static rg_frame_time_t frameTimes[RG_FRAME_HISTORY];
+static uint32_t frameTimesCount;
+static uint32_t frameStages[RG_FRAME_STAGE_COUNT];
 static rg_app_desc_t app;
 static long inputTimeout = -1;
 static bool initialized = false;
+static rg_state_buffer_t snapshot;
+static rg_state_buffer_t snapshotCopy;
+static volatile bool snapshotWriting;
+
+// Any task can write, only the system monitor (or a panic) reads. Writers never wait, when the
+// reader falls behind the oldest messages are overwritten.
+static log_entry_t *logRing;
+static uint32_t logHead;
+static uint32_t logTail;
+static uint32_t logLost;
+static bool logFlushing;
+static bool logWakeSent;        // The system monitor was notified and hasn't flushed yet
+static TaskHandle_t logTask;
 
 static SemaphoreHandle_t spiMutex = NULL;
 static spi_lock_res_t spiMutexOwner = -1;
@@ -69,8 +104,259 @@ static inline void logbuf_print(log_buffer_t *buf, const char *str)
     buf->buffer[buf->cursor] = 0;
 }
 
+static size_t log_header(char *buffer, size_t size, int level, const char *context, uint32_t time)
+{
+    static const char *prefix[] = {"", "error", "warn", "info", "debug"};
+    unsigned sec = time / 1000, ms = time % 1000;
+
+    if (level > RG_LOG_DEBUG)
+        return snprintf(buffer, size, "[log:%d %u.%03u] %s: ", level, sec, ms, context);
+    else if (level > RG_LOG_PRINT)
+        return snprintf(buffer, size, "[%s %u.%03u] %s: ", prefix[level], sec, ms, context);
+    return 0;
+}
+
+// Parses the conversion at *format (which points to a '%') and moves past it. Returns the
+// conversion character, the spec is copied to `spec` for formatting. '*' widths are counted in `stars`.
+static char log_parse_spec(const char **format, char spec[16], int *stars, bool *wide)
+{
+    const char *start = *format, *ptr = start + 1;
+    int longs = 0;
+
+    *stars = 0;
+    ptr += strspn(ptr, "-+ #0");
+    if (*ptr == '*')
+        ptr++, (*stars)++;
+    ptr += strspn(ptr, "0123456789");
+    if (*ptr == '.')
+    {
+        if (*++ptr == '*')
+            ptr++, (*stars)++;
+        ptr += strspn(ptr, "0123456789");
+    }
+    for (; *ptr && strchr("hlLqjzt", *ptr); ptr++)
+    {
+        if (*ptr == 'l' || *ptr == 'q' || *ptr == 'L')
+            longs += 1;
+        else if (*ptr == 'j' || ((*ptr == 'z' || *ptr == 't') && sizeof(size_t) > 4))
+            longs += 2;
+    }
+
+    char conv = *ptr ? *ptr++ : 0;
+    size_t len = RG_MIN(ptr - start, 15);
+    memcpy(spec, start, len);
+    spec[len] = 0;
+
+    *wide = (longs >= 2) || (longs == 1 && sizeof(long) > 4);
+    *format = ptr;
+    return conv;
+}
+
+// Copies the arguments in the entry, strings are copied (and truncated if they don't fit) because
+// they are often on the caller's stack.
+static void log_pack(log_entry_t *entry, const char *format, va_list args)
+{
+    uint8_t *dst = entry->args, *end = entry->args + LOG_ENTRY_ARGS;
+    char spec[16];
+    int stars;
+    bool wide;
+
+    #define PACK(type, value) { type _v = (value); if (dst + sizeof(_v) > end) break; \
+                                memcpy(dst, &_v, sizeof(_v)); dst += sizeof(_v); }
+
+    while ((format = strchr(format, '%')))
+    {
+        if (format[1] == '%')
+        {
+            format += 2;
+            continue;
+        }
+
+        char conv = log_parse_spec(&format, spec, &stars, &wide);
+
+        while (stars--)
+            PACK(int, va_arg(args, int));
+
+        if (strchr("diouxXc", conv))
+        {
+            if (wide)
+                PACK(long long, va_arg(args, long long))
+            else
+                PACK(int, va_arg(args, int))
+        }
+        else if (strchr("fFeEgGaA", conv))
+            PACK(double, va_arg(args, double))
+        else if (conv == 'p' || conv == 'n')
+            PACK(void *, va_arg(args, void *))
+        else if (conv == 's')
+        {
+            const char *str = va_arg(args, const char *) ?: "(null)";
+            size_t len = RG_MIN(strlen(str) + 1, (size_t)(end - dst));
+            if (len == 0)
+                break;
+            memcpy(dst, str, len - 1);
+            dst[len - 1] = 0;
+            dst += len;
+        }
+        else
+            break;
+    }
+
+    #undef PACK
+
+    entry->size = dst - entry->args;
+}
+
+static size_t log_unpack(const log_entry_t *entry, char *buffer, size_t size)
+{
+    const uint8_t *src = entry->args, *end = entry->args + entry->size;
+    const char *format = entry->format;
+    size_t len = log_header(buffer, size, entry->level, entry->context, entry->time);
+    char spec[16], resolved[40];
+    int stars;
+    bool wide;
+
+    #define UNPACK(type, var) type var = 0; if (src + sizeof(var) <= end) memcpy(&var, src, sizeof(var)); \
+                              src += sizeof(var);
+    #define APPEND(...) if (len < size) len += snprintf(buffer + len, size - len, __VA_ARGS__);
+
+    while (*format && len < size)
+    {
+        const char *next = strchr(format, '%') ?: format + strlen(format);
+
+        if (next > format)
+        {
+            APPEND("%.*s", (int)(next - format), format);
+            format = next;
+            continue;
+        }
+
+        if (format[1] == '%')
+        {
+            APPEND("%%");
+            format += 2;
+            continue;
+        }
+
+        char conv = log_parse_spec(&format, spec, &stars, &wide);
+
+        // Substitute the '*' with the packed width/precision
+        char *out = resolved;
+        for (char *in = spec; *in && out < resolved + sizeof(resolved) - 12; in++)
+        {
+            if (*in == '*')
+            {
+                UNPACK(int, width);
+                out += sprintf(out, "%d", width);
+            }
+            else
+                *out++ = *in;
+        }
+        *out = 0;
+
+        if (src >= end)
+        {
+            APPEND("?");
+        }
+        else if (strchr("diouxXc", conv))
+        {
+            if (wide)
+            {
+                UNPACK(long long, value);
+                APPEND(resolved, value);
+            }
+            else
+            {
+                UNPACK(int, value);
+                APPEND(resolved, value);
+            }
+        }
+        else if (strchr("fFeEgGaA", conv))
+        {
+            UNPACK(double, value);
+            APPEND(resolved, value);
+        }
+        else if (conv == 'p')
+        {
+            UNPACK(void *, value);
+            APPEND(resolved, value);
+        }
+        else if (conv == 's')
+        {
+            APPEND(resolved, (const char *)src);
+            src += strlen((const char *)src) + 1;
+        }
+        else
+        {
+            src = end;
+        }
+    }
+
+    #undef UNPACK
+    #undef APPEND
+
+    return RG_MIN(len, size - 1);
+}
+
+// Formats the queued messages to stdout and app.log. `force` is for the panic path, it must not
+// be skipped because the system monitor happened to be interrupted mid-flush.
+static void log_flush(bool force)
+{
+    char buffer[256];
+
+    if (!logRing || (__atomic_exchange_n(&logFlushing, true, __ATOMIC_ACQUIRE) && !force))
+        return;
+
+    // Writers that fill the ring past this point may wake us up again
+    __atomic_store_n(&logWakeSent, false, __ATOMIC_RELAXED);
+
+    uint32_t head = __atomic_load_n(&logHead, __ATOMIC_ACQUIRE);
+
+    if (head - logTail > LOG_RING_LENGTH)
+    {
+        logLost += head - logTail - LOG_RING_LENGTH;
+        logTail = head - LOG_RING_LENGTH;
+    }
+
+    for (; logTail != head; logTail++)
+    {
+        const log_entry_t *slot = &logRing[logTail & (LOG_RING_LENGTH - 1)];
+        log_entry_t entry;
+
+        // The writer may still be filling it in, or may have lapped us meanwhile
+        uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        if (seq == 0 || seq - 1 < logTail)
+            break;
+        entry = *slot;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != logTail + 1 || seq != logTail + 1)
+        {
+            logLost++;
+            continue;
+        }
+
+        if (logLost)
+        {
+            size_t len = snprintf(buffer, sizeof(buffer), "[log] %d messages lost\n", logLost);
+            logbuf_print(&app.log, buffer);
+            fwrite(buffer, len, 1, stdout);
+            logLost = 0;
+        }
+
+        size_t len = log_unpack(&entry, buffer, sizeof(buffer));
+        logbuf_print(&app.log, buffer);
+        fwrite(buffer, len, 1, stdout);
+    }
+
+    __atomic_store_n(&logFlushing, false, __ATOMIC_RELEASE);
+}
+
 static inline void begin_panic_trace()
 {
+    // Messages still in the ring are the last thing that happened, they must make it to the trace
+    log_flush(true);
+    logTask = NULL;
+
     panicTrace.magicWord = RG_STRUCT_MAGIC;
     panicTrace.message[0] = 0;
     panicTrace.context[0] = 0;
@@ -86,6 +372,21 @@ IRAM_ATTR void esp_panic_putchar_hook(char c)
     logbuf_print(&panicTrace.log, (char[2]){c, 0});
 }
 
+// Sleeps but wakes up to format the log whenever rg_system_log says the ring is filling up
+static void system_monitor_wait(int timeout_ms)
+{
+    int64_t deadline = get_elapsed_time() + timeout_ms * 1000;
+    int64_t remaining;
+
+    log_flush(false);
+
+    while ((remaining = deadline - get_elapsed_time()) > 0)
+    {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(remaining / 1000) + 1);
+        log_flush(false);
+    }
+}
+
 static void system_monitor_task(void *arg)
 {
     runtime_counters_t current = {0};
@@ -96,8 +397,11 @@ static void system_monitor_task(void *arg)
     memset(&statistics, 0, sizeof(statistics));
     memset(&counters, 0, sizeof(counters));
 
+    // From now on rg_system_log only queues messages, we format them
+    logTask = xTaskGetCurrentTaskHandle();
+
     // Give the app a few seconds to start before monitoring
-    vTaskDelay(pdMS_TO_TICKS(2000));
+    system_monitor_wait(2000);
 
     while (1)
     {
@@ -116,6 +420,11 @@ static void system_monitor_task(void *arg)
         statistics.totalFPS = current.totalFrames / (tickTime / 1000000.f);
         statistics.freeStackMain = uxTaskGetStackHighWaterMark(app.mainTaskHandle);
 
+        rg_audio_counters_t audio = rg_audio_get_counters();
+        statistics.audioLatency = audio.latency;
+        statistics.audioUnderruns = audio.underruns;
+        statistics.audioOverruns = audio.overruns;
+
         heap_caps_get_info(&heap_info, MALLOC_CAP_INTERNAL|MALLOC_CAP_8BIT);
         statistics.freeMemoryInt = heap_info.total_free_bytes;
         statistics.freeBlockInt = heap_info.largest_free_block;
@@ -135,7 +444,7 @@ static void system_monitor_task(void *arg)
             rg_system_set_led(ledState);
         }
 
-        RG_LOGX("STACK:%d, HEAP:%d+%d (%d+%d), BUSY:%.2f, FPS:%.2f (SKIP:%d, PART:%d, FULL:%d), BATT:%d\n",
+        RG_LOGX("STACK:%d, HEAP:%d+%d (%d+%d), BUSY:%.2f, FPS:%.2f (SKIP:%d, PART:%d, FULL:%d), AUDIO:%dms (UND:%d, OVR:%d), BATT:%d\n",
             statistics.freeStackMain,
             statistics.freeMemoryInt / 1024,
             statistics.freeMemoryExt / 1024,
@@ -146,6 +455,9 @@ static void system_monitor_task(void *arg)
             current.skippedFrames,
             current.totalFrames - current.fullFrames - current.skippedFrames,
             current.fullFrames,
+            statistics.audioLatency,
+            statistics.audioUnderruns,
+            statistics.audioOverruns,
             statistics.battery.millivolts);
 
         // if (statistics.freeStackMain < 1024)
@@ -182,30 +494,126 @@ static void system_monitor_task(void *arg)
             }
         #endif
 
-        vTaskDelay(pdMS_TO_TICKS(1000));
+        // Unlike the instrumenting profiler this works on release builds, see rg_gui_debug_menu
+        if (rg_profiler_sample_running())
+        {
+            static long sampleLoops = 0;
+            rg_profiler_sample_flush(((++sampleLoops) % 10) == 0);
+        }
+
+        system_monitor_wait(1000);
     }
 
     vTaskDelete(NULL);
 }
 
+int32_t rg_system_frame_sync(void)
+{
+    static struct {
+        int64_t epoch;      // Deadline of frame 0
+        int64_t frames;     // Frames since epoch
+        int refreshRate;
+    } clock;
+    int64_t now = get_elapsed_time();
+
+    #ifdef RG_TARGET_HOST
+        if (rg_host_unthrottled())
+            return 0;
+    #endif
+
+    // The clock is now in charge of pacing, audio would fight it
+    if (clock.refreshRate == 0)
+        rg_audio_set_pacing(false);
+
+    // Fast forward runs flat out, the clock starts over from wherever it ends
+    if (app.speedupEnabled)
+    {
+        clock.refreshRate = 0;
+        return 0;
+    }
+
+    // Deadlines are computed from the frame count so rounding errors never accumulate
+    if (clock.refreshRate != app.refreshRate)
+    {
+        clock.refreshRate = app.refreshRate;
+        clock.epoch = now;
+        clock.frames = 0;
+    }
+
+    clock.frames++;
+
+    int64_t deadline = clock.epoch + clock.frames * 1000000 / clock.refreshRate;
+    int32_t lateness = now - deadline;
+
+    if (lateness > FRAME_CLOCK_MAX_LAG)
+    {
+        // We were paused (menu, loading) or are too slow, catching up would only cause a burst
+        clock.epoch = now;
+        clock.frames = 0;
+    }
+    else if (lateness < 0)
+    {
+        usleep(-lateness);
+    }
+
+    return lateness;
+}
+
+IRAM_ATTR void rg_system_frame_stage(rg_frame_stage_t stage, uint32_t time_us)
+{
+    __atomic_fetch_add(&frameStages[stage], time_us, __ATOMIC_RELAXED);
+}
+
+IRAM_ATTR static void frame_times_push(int busyTime, bool skipped)
+{
+    static int64_t lastTick = 0;
+    int64_t now = get_elapsed_time();
+    uint32_t stages[RG_FRAME_STAGE_COUNT];
+
+    for (int i = 0; i < RG_FRAME_STAGE_COUNT; i++)
+        stages[i] = __atomic_exchange_n(&frameStages[i], 0, __ATOMIC_RELAXED);
+
+    // The diff and the display queue wait happen inside the emulator's busy time
+    int emulate = busyTime - (int)(stages[RG_FRAME_DIFF] + stages[RG_FRAME_DISPLAY_WAIT]);
+    stages[RG_FRAME_EMULATE] = RG_MAX(emulate, 0);
+
+    rg_frame_time_t *entry = &frameTimes[frameTimesCount % RG_FRAME_HISTORY];
+    entry->period = lastTick ? now - lastTick : 0;
+    entry->skipped = skipped;
+    for (int i = 0; i < RG_FRAME_STAGE_COUNT; i++)
+        entry->stages[i] = RG_MIN(stages[i], 0xFFFF);
+
+    frameTimesCount++;
+    lastTick = now;
+}
+
 IRAM_ATTR void rg_system_tick(int busyTime)
 {
     static uint32_t totalFrames = 0;
     static uint32_t fullFrames = 0;
 
     const rg_display_t *disp = rg_display_get_status();
+    bool skipped = disp->counters.totalFrames == totalFrames;
 
-    if (disp->counters.totalFrames == totalFrames)
+    if (skipped)
         counters.skippedFrames++;
     else if (disp->counters.fullFrames > fullFrames)
         counters.fullFrames++;
 
+    frame_times_push(busyTime, skipped);
+
+    rg_rewind_tick();
+
     totalFrames = disp->counters.totalFrames;
     fullFrames = disp->counters.fullFrames;
 
     counters.totalFrames++;
     counters.busyTime += busyTime;
 
+    #ifdef RG_TARGET_HOST
+        rg_host_frame(busyTime);
+    #endif
+
     // Reduce the inputTimeout once the emulation is running
     if (counters.totalFrames == 1)
     {
@@ -218,6 +626,38 @@ runtime_stats_t rg_system_get_stats()
     return statistics;
 }
 
+size_t rg_system_get_frame_times(rg_frame_time_t *out, size_t count)
+{
+    // Oldest first. Only the emulator writes the history, in rg_system_tick, so this must
+    // be called from the emulator's task (menus are) to get a consistent copy.
+    count = RG_MIN(count, RG_MIN(frameTimesCount, RG_FRAME_HISTORY));
+
+    for (size_t i = 0; i < count; i++)
+        out[i] = frameTimes[(frameTimesCount - count + i) % RG_FRAME_HISTORY];
+
+    return count;
+}
+
+void rg_system_dump_frame_times(void)
+{
+    rg_frame_time_t times[RG_FRAME_HISTORY];
+    size_t count = rg_system_get_frame_times(times, RG_FRAME_HISTORY);
+
+    printf("RGD:FRAME:BEGIN %u\n", (unsigned)count);
+    printf("RGD:FRAME:COLS period,emulate,diff,display_wait,convert,spi_wait,audio_wait,skipped\n");
+
+    for (size_t i = 0; i < count; i++)
+    {
+        const rg_frame_time_t *t = &times[i];
+        printf("RGD:FRAME:DATA %u,%u,%u,%u,%u,%u,%u,%d\n", (unsigned)t->period,
+            t->stages[RG_FRAME_EMULATE], t->stages[RG_FRAME_DIFF], t->stages[RG_FRAME_DISPLAY_WAIT],
+            t->stages[RG_FRAME_CONVERT], t->stages[RG_FRAME_SPI_WAIT], t->stages[RG_FRAME_AUDIO_WAIT],
+            t->skipped);
+    }
+
+    printf("RGD:FRAME:END\n");
+}
+
 #if 0
 static uint8_t bcd2dec(uint8_t val)
 {
@@ -402,6 +842,8 @@ rg_app_desc_t *rg_system_init(int sampleRate, const rg_emu_proc_t *handlers)
             rg_gui_alert("SD Card Error", "Invalid ROM Path.");
             rg_system_switch_app(RG_APP_LAUNCHER);
         }
+
+        rg_rewind_init();
     }
 
     #ifdef ENABLE_PROFILING
@@ -413,7 +855,11 @@ rg_app_desc_t *rg_system_init(int sampleRate, const rg_emu_proc_t *handlers)
     rg_netplay_init(app.netplay_handler);
     #endif
 
-    xTaskCreate(&system_monitor_task, "sysmon", 2048, NULL, 7, NULL);
+    if (!logRing)
+        logRing = rg_alloc(LOG_RING_LENGTH * sizeof(log_entry_t), MEM_SLOW);
+
+    // The stack must fit printf of floats on top of the log's formatting buffer
+    xTaskCreate(&system_monitor_task, "sysmon", 3072, NULL, 7, NULL);
 
     // This is to allow time for app starting
     inputTimeout = INPUT_TIMEOUT * 5;
@@ -447,12 +893,17 @@ char *rg_emu_get_path(rg_path_type_t type, const char *_romPath)
     switch (type)
     {
         case RG_PATH_SAVE_STATE:
+            strcpy(buffer, RG_BASE_PATH_SAVES);
+            strcat(buffer, fileName);
+            strcat(buffer, ".sav");
+            break;
+
         case RG_PATH_SAVE_STATE_1:
         case RG_PATH_SAVE_STATE_2:
         case RG_PATH_SAVE_STATE_3:
             strcpy(buffer, RG_BASE_PATH_SAVES);
             strcat(buffer, fileName);
-            strcat(buffer, ".sav");
+            sprintf(buffer + strlen(buffer), ".sav%d", type - RG_PATH_SAVE_STATE);
             break;
 
         case RG_PATH_SAVE_SRAM:
@@ -479,6 +930,13 @@ char *rg_emu_get_path(rg_path_type_t type, const char *_romPath)
     return strdup(buffer);
 }
 
+// A slot written from a snapshot must be on the SD card before it's read, replaced, or unmounted
+static void wait_for_snapshot_persist(void)
+{
+    while (snapshotWriting)
+        vTaskDelay(1);
+}
+
 bool rg_emu_load_state(int slot)
 {
     if (!app.romPath || !app.handlers.loadState)
@@ -487,17 +945,44 @@ bool rg_emu_load_state(int slot)
         return false;
     }
 
+    if (slot < 0 || slot > RG_PATH_SAVE_STATE_3 - RG_PATH_SAVE_STATE)
+    {
+        RG_LOGE("Invalid save slot %d!\n", slot);
+        return false;
+    }
+
     RG_LOGI("Loading state %d.\n", slot);
 
     rg_gui_draw_hourglass();
+    wait_for_snapshot_persist();
 
     // Increased input timeout, this might take a while
     inputTimeout = INPUT_TIMEOUT * 5;
 
-    char *filename = rg_emu_get_path(RG_PATH_SAVE_STATE, app.romPath);
-    bool success = (*app.handlers.loadState)(filename);
+    char *filename = rg_emu_get_path(RG_PATH_SAVE_STATE + slot, app.romPath);
+    rg_state_buffer_t buffer = {0};
+    rg_state_file_t file;
+    FILE *fp = NULL;
+
+    // The whole state is checked before the core sees any of it, a damaged file leaves the game alone
+    if (rg_state_open(&file, filename))
+    {
+        if (rg_state_read_section(&file, "state", &buffer))
+            fp = rg_state_buffer_open(&buffer, false);
+        rg_state_close(&file);
+    }
+    else if (file.header.magic != RG_STATE_MAGIC)
+    {
+        // Saved before the container existed, the core reads its own format directly
+        fp = fopen(filename, "rb");
+    }
+
+    bool success = fp && (*app.handlers.loadState)(fp);
     // bool success = rg_emu_notify(RG_MSG_LOAD_STATE, filename);
 
+    if (fp)
+        fclose(fp);
+
     inputTimeout = INPUT_TIMEOUT;
 
     if (!success)
@@ -505,11 +990,53 @@ bool rg_emu_load_state(int slot)
         RG_LOGE("Load failed!\n");
     }
 
+    rg_state_buffer_free(&buffer);
     free(filename);
 
     return success;
 }
 
+static bool write_state_file(const char *filename, const rg_state_buffer_t *buffer)
+{
+    char path_buffer[PATH_MAX + 1];
+    rg_state_file_t file;
+    bool success = false;
+
+    if (!rg_mkdir(rg_dirname(filename)))
+    {
+        RG_LOGE("Unable to create dir, save might fail...\n");
+    }
+
+    sprintf(path_buffer, "%s.new", filename);
+    if (rg_state_create(&file, path_buffer, app.name))
+    {
+        bool written = rg_state_write_section(&file, "state", buffer->data, buffer->size);
+        if (rg_state_close(&file) && written)
+        {
+            sprintf(path_buffer, "%s.bak", filename);
+            rename(filename, path_buffer);
+
+            sprintf(path_buffer, "%s.new", filename);
+            if (rename(path_buffer, filename) == 0)
+            {
+                sprintf(path_buffer, "%s.bak", filename);
+                unlink(path_buffer);
+                success = true;
+            }
+        }
+    }
+
+    if (!success)
+    {
+        sprintf(path_buffer, "%s.bak", filename);
+        rename(filename, path_buffer);
+        sprintf(path_buffer, "%s.new", filename);
+        unlink(path_buffer);
+    }
+
+    return success;
+}
+
 bool rg_emu_save_state(int slot)
 {
     if (!app.romPath || !app.handlers.saveState)
@@ -518,54 +1045,54 @@ bool rg_emu_save_state(int slot)
         return false;
     }
 
+    if (slot < 0 || slot > RG_PATH_SAVE_STATE_3 - RG_PATH_SAVE_STATE)
+    {
+        RG_LOGE("Invalid save slot %d!\n", slot);
+        return false;
+    }
+
     RG_LOGI("Saving state %d.\n", slot);
 
     rg_system_set_led(1);
     rg_gui_draw_hourglass();
+    wait_for_snapshot_persist();
 
-    char *filename = rg_emu_get_path(RG_PATH_SAVE_STATE, app.romPath);
-    char path_buffer[PATH_MAX + 1];
+    char *filename = rg_emu_get_path(RG_PATH_SAVE_STATE + slot, app.romPath);
+    rg_state_buffer_t buffer = {0};
     bool success = false;
 
     // Increased input timeout, this might take a while
     inputTimeout = INPUT_TIMEOUT * 5;
 
-    if (!rg_mkdir(rg_dirname(filename)))
-    {
-        RG_LOGE("Unable to create dir, save might fail...\n");
-    }
+    // The core serializes to PSRAM, only the compressed state goes to the SD card
+    int64_t startTime = get_elapsed_time();
+    FILE *fp = rg_state_buffer_open(&buffer, true);
+    bool serialized = fp && (*app.handlers.saveState)(fp);
+    serialized = fp && fclose(fp) == 0 && serialized;
 
-    sprintf(path_buffer, "%s.new", filename);
-    if ((*app.handlers.saveState)(path_buffer))
+    if (serialized && write_state_file(filename, &buffer))
     {
-        sprintf(path_buffer, "%s.bak", filename);
-        rename(filename, path_buffer);
+        RG_LOGI("State is %d bytes, saved in %dms.\n", (int)buffer.size,
+            (int)((get_elapsed_time() - startTime) / 1000));
 
-        sprintf(path_buffer, "%s.new", filename);
-        if (rename(path_buffer, filename) == 0)
-        {
-            sprintf(path_buffer, "%s.bak", filename);
-            unlink(path_buffer);
-
-            success = true;
+        success = true;
 
+        // Resuming a game always starts from the first slot
+        if (slot == 0)
+        {
             rg_settings_set_int32(SETTING_START_ACTION, RG_START_ACTION_RESUME);
             rg_settings_save();
         }
     }
 
+    rg_state_buffer_free(&buffer);
+
     if (!success)
     {
         RG_LOGE("Save failed!\n");
-
-        sprintf(path_buffer, "%s.bak", filename);
-        rename(filename, path_buffer);
-        sprintf(path_buffer, "%s.new", filename);
-        unlink(path_buffer);
-
         rg_gui_alert("Save failed", NULL);
     }
-    else
+    else if (slot == 0)
     {
         // Save succeeded, let's take a pretty screenshot for the launcher!
         char *fileName = rg_emu_get_path(RG_PATH_SCREENSHOT, app.romPath);
@@ -582,6 +1109,102 @@ bool rg_emu_save_state(int slot)
     return success;
 }
 
+bool rg_emu_snapshot_take(void)
+{
+    if (!app.handlers.saveState)
+        return false;
+
+    // The arena keeps its capacity, only the first snapshot allocates
+    FILE *fp = rg_state_buffer_open(&snapshot, true);
+    bool success = fp && (*(app.handlers.saveSnapshot ?: app.handlers.saveState))(fp);
+    success = fp && fclose(fp) == 0 && success;
+
+    if (!success)
+    {
+        RG_LOGE("Snapshot failed!\n");
+        snapshot.size = 0;
+    }
+
+    return success;
+}
+
+bool rg_emu_snapshot_restore(void)
+{
+    if (!app.handlers.loadState || snapshot.size == 0)
+        return false;
+
+    FILE *fp = rg_state_buffer_open(&snapshot, false);
+    bool success = fp && (*(app.handlers.loadSnapshot ?: app.handlers.loadState))(fp);
+
+    if (fp)
+        fclose(fp);
+
+    if (!success)
+        RG_LOGE("Snapshot restore failed!\n");
+
+    return success;
+}
+
+size_t rg_emu_snapshot_size(void)
+{
+    return snapshot.size;
+}
+
+static void snapshot_persist_task(void *arg)
+{
+    int slot = (intptr_t)arg;
+    char *filename = rg_emu_get_path(RG_PATH_SAVE_STATE + slot, app.romPath);
+
+    if (write_state_file(filename, &snapshotCopy))
+    {
+        RG_LOGI("Snapshot saved to slot %d.\n", slot);
+        if (slot == 0)
+        {
+            rg_settings_set_int32(SETTING_START_ACTION, RG_START_ACTION_RESUME);
+            rg_settings_save();
+        }
+    }
+    else
+    {
+        RG_LOGE("Snapshot save to slot %d failed!\n", slot);
+    }
+
+    free(filename);
+    snapshotWriting = false;
+    vTaskDelete(NULL);
+}
+
+bool rg_emu_snapshot_persist(int slot)
+{
+    if (!app.romPath || snapshot.size == 0 || snapshotWriting
+        || slot < 0 || slot > RG_PATH_SAVE_STATE_3 - RG_PATH_SAVE_STATE)
+        return false;
+
+    // A copy lets the game keep taking snapshots while the SD card is busy
+    if (!rg_state_buffer_reserve(&snapshotCopy, snapshot.size))
+        return false;
+
+    memcpy(snapshotCopy.data, snapshot.data, snapshot.size);
+    snapshotCopy.size = snapshot.size;
+    snapshotWriting = true;
+
+    // The launcher's screenshot is of the frame on screen, the one the snapshot was taken at
+    if (slot == 0)
+    {
+        char *fileName = rg_emu_get_path(RG_PATH_SCREENSHOT, app.romPath);
+        rg_emu_screenshot(fileName, 160, 0);
+        free(fileName);
+    }
+
+    if (xTaskCreatePinnedToCore(&snapshot_persist_task, "snapshot", 4096, (void *)(intptr_t)slot, 2, NULL, 1) != pdPASS)
+    {
+        snapshotWriting = false;
+        return false;
+    }
+
+    return true;
+}
+
 bool rg_emu_screenshot(const char *filename, int width, int height)
 {
     if (!app.handlers.screenshot)
@@ -635,6 +1258,7 @@ static void shutdown_cleanup()
     // Prepare the system for a power change (deep sleep, restart, shutdown)
     // Wait for all keys to be released, they could interfer with the restart process
     rg_input_wait_for_key(GAMEPAD_KEY_ALL, false);
+    wait_for_snapshot_persist();
     rg_system_time_save();
     rg_settings_save();
     rg_audio_deinit();
@@ -715,25 +1339,49 @@ void rg_system_panic(const char *message, const char *context)
 
 void rg_system_log(int level, const char *context, const char *format, ...)
 {
-    static const char *prefix[] = {"", "error", "warn", "info", "debug"};
-    char buffer[512]; /*static*/
-    size_t len = 0;
     va_list args;
 
     if (app.logLevel && level > app.logLevel)
         return;
 
-    if (level > RG_LOG_DEBUG)
-        len += sprintf(buffer, "[log:%d] %s: ", level, context);
-    else if (level > RG_LOG_PRINT)
-        len += sprintf(buffer, "[%s] %s: ", prefix[level], context);
+    // Until the system monitor runs (and after a panic) there is nobody to format the ring
+    if (!logTask)
+    {
+        char buffer[512]; /*static*/
+        size_t len = log_header(buffer, sizeof(buffer), level, context, get_elapsed_time() / 1000);
+
+        va_start(args, format);
+        len += vsnprintf(buffer + len, sizeof(buffer) - len, format, args);
+        va_end(args);
+
+        logbuf_print(&app.log, buffer);
+        fwrite(buffer, RG_MIN(len, sizeof(buffer) - 1), 1, stdout);
+        return;
+    }
+
+    uint32_t index = __atomic_fetch_add(&logHead, 1, __ATOMIC_RELAXED);
+    log_entry_t *entry = &logRing[index & (LOG_RING_LENGTH - 1)];
+
+    // Same idea as a seqlock, the reader discards the entry if seq changed while it copied it
+    __atomic_store_n(&entry->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    entry->time = get_elapsed_time() / 1000;
+    entry->context = context;
+    entry->format = format;
+    entry->level = level;
 
     va_start(args, format);
-    len += vsnprintf(buffer + len, sizeof(buffer) - len, format, args);
+    log_pack(entry, format, args);
     va_end(args);
 
-    logbuf_print(&app.log, buffer);
-    fwrite(buffer, len, 1, stdout);
+    __atomic_store_n(&entry->seq, index + 1, __ATOMIC_RELEASE);
+
+    // Don't let a burst of messages overwrite the ones not printed yet. Writers race each other
+    // and the reader, so any depth past half wakes it, but only once until it flushes.
+    if (index - __atomic_load_n(&logTail, __ATOMIC_RELAXED) >= LOG_RING_LENGTH / 2 && !xPortInIsrContext()
+        && !__atomic_exchange_n(&logWakeSent, true, __ATOMIC_RELAXED))
+        xTaskNotifyGive(logTask);
 }
 
 bool rg_system_save_trace(const char *filename, bool panic_trace)
@@ -742,6 +1390,9 @@ bool rg_system_save_trace(const char *filename, bool panic_trace)
     log_buffer_t *log = panic_trace ? &panicTrace.log : &app.log;
     RG_ASSERT(filename, "bad param");
 
+    if (!panic_trace)
+        log_flush(false);
+
     FILE *fp = fopen(filename, "w");
     if (fp)
     {
@@ -846,7 +1497,7 @@ void *rg_alloc(size_t size, uint32_t mem_type)
         size_t availaible = heap_caps_get_largest_free_block(caps);
 
         // Loosen the caps and try again
-        ptr = heap_caps_calloc(1, size, caps & ~(MALLOC_CAP_SPIRAM|MALLOC_CAP_INTERNAL));
+        ptr = heap_caps_calloc(1, size, caps & ~(MALLOC_CAP_SPIRAM|MALLOC_CAP_INTERNAL|MALLOC_CAP_DMA));
         if (!ptr)
         {
             RG_LOGX("[RG_ALLOC] ^-- Allocation failed! (available: %d)\n", availaible);
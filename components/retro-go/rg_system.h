@@ -17,6 +17,7 @@ extern "C" {
 #endif
 
 #include "rg_audio.h"
+#include "rg_synth.h"
 #include "rg_display.h"
 #include "rg_input.h"
 #include "rg_netplay.h"
@@ -27,6 +28,8 @@ extern "C" {
 #include "rg_profiler.h"
 #include "rg_settings.h"
 #include "rg_cheats.h"
+#include "rg_state.h"
+#include "rg_rewind.h"
 
 typedef enum
 {
@@ -81,7 +84,7 @@ enum {
 #define RG_APP_LAUNCHER "launcher"
 #define RG_APP_FACTORY  NULL
 
-typedef bool (*rg_state_handler_t)(const char *filename);
+typedef bool (*rg_state_handler_t)(FILE *fp);
 typedef bool (*rg_reset_handler_t)(bool hard);
 typedef bool (*rg_message_handler_t)(int msg, void *arg);
 typedef bool (*rg_screenshot_handler_t)(const char *filename, int width, int height);
@@ -98,9 +101,16 @@ typedef struct
     rg_screenshot_handler_t screenshot;
     rg_mem_read_handler_t memRead;    // Used by for cheats and debugging
     rg_mem_write_handler_t memWrite;  // Used by for cheats and debugging
+    rg_state_handler_t loadSnapshot;  // Rewind and rg_emu_snapshot_*, many times a second. Optional,
+    rg_state_handler_t saveSnapshot;  // for cores whose load/saveState have messages or side effects
 } rg_emu_proc_t;
 
-// TO DO: Make it an abstract ring buffer implementation?
+// Messages are queued in binary form (format pointer and packed arguments) and formatted later
+// by the system monitor task, see rg_system_log. The format must be a string literal.
+#define LOG_RING_LENGTH 64      // Must be a power of two
+#define LOG_ENTRY_ARGS 110      // Bytes of packed arguments per message, longer strings are truncated
+
+// Formatted output, what rg_system_save_trace writes
 #define LOG_BUFFER_SIZE 2048
 typedef struct
 {
@@ -148,8 +158,33 @@ typedef struct
     uint32_t freeBlockInt;
     uint32_t freeBlockExt;
     uint32_t freeStackMain;
+    uint32_t audioLatency;      // ms
+    uint32_t audioUnderruns;
+    uint32_t audioOverruns;
 } runtime_stats_t;
 
+// Where a frame's time went. Stages are accumulated between two calls to rg_system_tick,
+// whichever task or core they ran on.
+typedef enum
+{
+    RG_FRAME_EMULATE = 0,   // The emulator's busy time, minus the diff and display wait below
+    RG_FRAME_DIFF,          // rg_display_queue_update comparing with the previous frame
+    RG_FRAME_DISPLAY_WAIT,  // rg_display_queue_update waiting for room in the display queue
+    RG_FRAME_CONVERT,       // display_task scaling and converting pixels
+    RG_FRAME_SPI_WAIT,      // display_task waiting for SPI buffers or transactions
+    RG_FRAME_AUDIO_WAIT,    // rg_audio_submit waiting for the DAC
+    RG_FRAME_STAGE_COUNT,
+} rg_frame_stage_t;
+
+#define RG_FRAME_HISTORY 128
+
+typedef struct
+{
+    uint32_t period;                        // Since the previous frame (us)
+    uint16_t stages[RG_FRAME_STAGE_COUNT];  // us, saturated
+    bool skipped;
+} rg_frame_time_t;
+
 rg_app_desc_t *rg_system_init(int sampleRate, const rg_emu_proc_t *handlers);
 void rg_system_panic(const char *reason, const char *context) __attribute__((noreturn));
 void rg_system_shutdown() __attribute__((noreturn));
@@ -161,6 +196,10 @@ bool rg_system_find_app(const char *app);
 void rg_system_set_led(int value);
 int  rg_system_get_led(void);
 void rg_system_tick(int busyTime);
+void rg_system_frame_stage(rg_frame_stage_t stage, uint32_t time_us);
+size_t rg_system_get_frame_times(rg_frame_time_t *out, size_t count);
+void rg_system_dump_frame_times(void);
+int32_t rg_system_frame_sync(void);
 void rg_system_log(int level, const char *context, const char *format, ...);
 bool rg_system_save_trace(const char *filename, bool append);
 rg_app_desc_t *rg_system_get_app();
@@ -172,6 +211,10 @@ void rg_system_time_save();
 char *rg_emu_get_path(rg_path_type_t type, const char *romPath);
 bool rg_emu_save_state(int slot);
 bool rg_emu_load_state(int slot);
+bool rg_emu_snapshot_take(void);
+bool rg_emu_snapshot_restore(void);
+size_t rg_emu_snapshot_size(void);
+bool rg_emu_snapshot_persist(int slot);
 bool rg_emu_reset(int hard);
 bool rg_emu_notify(int msg, void *arg);
 bool rg_emu_screenshot(const char *filename, int width, int height);
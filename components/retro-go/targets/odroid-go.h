@@ -44,6 +44,7 @@
 #define RG_GPIO_LCD_CS              GPIO_NUM_5
 #define RG_GPIO_LCD_DC              GPIO_NUM_21
 #define RG_GPIO_LCD_BCKL            GPIO_NUM_14
+#define RG_GPIO_LCD_TE              GPIO_NUM_NC // Tearing effect output isn't wired on this board
 #define RG_GPIO_SD_MISO             GPIO_NUM_19
 #define RG_GPIO_SD_MOSI             GPIO_NUM_23
 #define RG_GPIO_SD_CLK              GPIO_NUM_18
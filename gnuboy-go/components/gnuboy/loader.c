@@ -432,13 +432,13 @@ _cleanup:
  *
  */
 
-int state_save(const char *file)
+int state_save(FILE *fp)
 {
 	byte *buf = calloc(1, 4096);
 	if (!buf) return -2;
 
-	FILE *fp = fopen(file, "wb");
-	if (!fp) goto _error;
+	/* The channels may still be mixing on the other core */
+	sound_sync();
 
 	sblock_t blocks[] = {
 		{buf, 1},
@@ -487,26 +487,23 @@ int state_save(const char *file)
 		}
 	}
 
-	fclose(fp);
 	free(buf);
 
 	return 0;
 
 _error:
-	if (fp) fclose(fp);
 	if (buf) free(buf);
 
 	return -1;
 }
 
 
-int state_load(const char *file)
+int state_load(FILE *fp)
 {
 	byte* buf = calloc(1, 4096);
 	if (!buf) return -2;
 
-	FILE *fp = fopen(file, "rb");
-	if (!fp) goto _error;
+	sound_sync();
 
 	sblock_t blocks[] = {
 		{buf, 1},
@@ -562,7 +559,6 @@ int state_load(const char *file)
 	memcpy(lcd.oam.mem, buf+oamofs, sizeof lcd.oam);
 	memcpy(snd.wave, buf+wavofs, sizeof snd.wave);
 
-	fclose(fp);
 	free(buf);
 
 	// Disable BIOS. This is a hack to support old saves
@@ -575,7 +571,6 @@ int state_load(const char *file)
 	return 0;
 
 _error:
-	if (fp) fclose(fp);
 	if (buf) free(buf);
 
 	return -1;
@@ -44,6 +44,17 @@ static const int freqtab[8] =
 pcm_t pcm;
 snd_t snd;
 
+/* When synthesis runs on the other core (sound_synth), the CPU only logs register
+   writes and the channels are mixed by the synth task into their own buffer. */
+static bool synth;
+static int synth_cycles;
+static pcm_t synth_pcm;
+
+/* The channels work off snd.regs rather than ram.hi, so that the CPU can read and
+   write the registers while the synth task is mixing. */
+#undef REG
+#define REG(n) snd.regs[(n)]
+
 #define RATE (snd.rate)
 #define WAVE (snd.wave) /* ram.hi+0x30 */
 #define S1 (snd.ch[0])
@@ -88,9 +99,6 @@ static inline void s3_init()
 	if (!S3.on) S3.pos = 0;
 	S3.cnt = 0;
 	S3.on = R_NR30 >> 7;
-	if (!S3.on) return;
-	for (int i = 0; i < 16; i++)
-		ram.hi[i+0x30] = 0x13 ^ ram.hi[i+0x31];
 }
 
 static inline void s4_init()
@@ -105,7 +113,7 @@ static inline void s4_init()
 	S4.encnt = 0;
 }
 
-void sound_dirty()
+static void sound_recalc()
 {
 	S1.swlen = ((R_NR10>>4) & 7) << 14;
 	S1.len = (64-(R_NR11&63)) << 13;
@@ -133,50 +141,73 @@ void sound_dirty()
 	s4_freq();
 }
 
-void sound_off()
+/* Called after the registers were changed behind our back (state load) */
+void sound_dirty()
+{
+	sound_sync();
+	memcpy(snd.regs + RI_NR10, ram.hi + RI_NR10, RI_NR52 - RI_NR10 + 1);
+	snd.status = S1.on | (S2.on<<1) | (S3.on<<2) | (S4.on<<3);
+	sound_recalc();
+}
+
+/* Power-off values, applied to both ram.hi and snd.regs */
+static void sound_off_regs(byte *regs)
+{
+	regs[RI_NR10] = 0x80;
+	regs[RI_NR11] = 0xBF;
+	regs[RI_NR12] = 0xF3;
+	regs[RI_NR14] = 0xBF;
+	regs[RI_NR21] = 0x3F;
+	regs[RI_NR22] = 0x00;
+	regs[RI_NR24] = 0xBF;
+	regs[RI_NR30] = 0x7F;
+	regs[RI_NR31] = 0xFF;
+	regs[RI_NR32] = 0x9F;
+	regs[RI_NR34] = 0xBF;
+	regs[RI_NR41] = 0xFF;
+	regs[RI_NR42] = 0x00;
+	regs[RI_NR43] = 0x00;
+	regs[RI_NR44] = 0xBF;
+	regs[RI_NR50] = 0x77;
+	regs[RI_NR51] = 0xF3;
+	regs[RI_NR52] = 0x70;
+}
+
+static void sound_off_channels()
 {
 	memset(&S1, 0, sizeof S1);
 	memset(&S2, 0, sizeof S2);
 	memset(&S3, 0, sizeof S3);
 	memset(&S4, 0, sizeof S4);
-	R_NR10 = 0x80;
-	R_NR11 = 0xBF;
-	R_NR12 = 0xF3;
-	R_NR14 = 0xBF;
-	R_NR21 = 0x3F;
-	R_NR22 = 0x00;
-	R_NR24 = 0xBF;
-	R_NR30 = 0x7F;
-	R_NR31 = 0xFF;
-	R_NR32 = 0x9F;
-	R_NR34 = 0xBF;
-	R_NR41 = 0xFF;
-	R_NR42 = 0x00;
-	R_NR43 = 0x00;
-	R_NR44 = 0xBF;
-	R_NR50 = 0x77;
-	R_NR51 = 0xF3;
-	R_NR52 = 0x70;
-	sound_dirty();
+	sound_off_regs(snd.regs);
+	sound_recalc();
+}
+
+void sound_off()
+{
+	sound_sync();
+	sound_off_channels();
+	sound_off_regs(ram.hi);
 }
 
 void sound_reset(bool hard)
 {
+	sound_sync();
 	memset(&snd, 0, sizeof snd);
 	memcpy(WAVE, hw.cgb ? cgbwave : dmgwave, 16);
 	memcpy(ram.hi + 0x30, WAVE, 16);
 	snd.rate = pcm.hz ? (int)(((1<<21) / (double)pcm.hz) + 0.5) : 0;
 	pcm.pos = 0;
 	sound_off();
-	R_NR52 = 0xF1;
+	R_NR52 = ram.hi[RI_NR52] = 0xF1;
 }
 
-void sound_mix()
+static void sound_render(int *cycles, pcm_t *out)
 {
-	if (!RATE || snd.cycles < RATE)
+	if (!RATE || *cycles < RATE)
 		return;
 
-	for (; snd.cycles >= RATE; snd.cycles -= RATE)
+	for (; *cycles >= RATE; *cycles -= RATE)
 	{
 		int l = 0;
 		int r = 0;
@@ -308,46 +339,41 @@ void sound_mix()
 		// if (r > 127) r = 127;
 		// else if (r < -128) r = -128;
 
-		if (pcm.buf)
+		if (out->buf)
 		{
-			if (pcm.pos >= pcm.len)
+			if (out->pos >= out->len)
 			{
 				//pcm_submit();
-				MESSAGE_ERROR("buffer overflow. (pcm.len=%d)\n", pcm.len);
+				MESSAGE_ERROR("buffer overflow. (pcm.len=%d)\n", out->len);
 				//abort();
 			}
-			else if (pcm.stereo)
+			else if (out->stereo)
 			{
-				pcm.buf[pcm.pos++] = (n16)l; //+128;
-				pcm.buf[pcm.pos++] = (n16)r; //+128;
+				out->buf[out->pos++] = (n16)l; //+128;
+				out->buf[out->pos++] = (n16)r; //+128;
 			}
-			else pcm.buf[pcm.pos++] = (n16)((l+r)>>1); //+128;
+			else out->buf[out->pos++] = (n16)((l+r)>>1); //+128;
 		}
 	}
-	R_NR52 = (R_NR52&0xf0) | S1.on | (S2.on<<1) | (S3.on<<2) | (S4.on<<3);
+	snd.status = S1.on | (S2.on<<1) | (S3.on<<2) | (S4.on<<3);
+	R_NR52 = (R_NR52&0xf0) | snd.status;
 }
 
-byte sound_read(byte r)
+void sound_mix()
 {
-	sound_mix();
-	return REG(r);
+	if (!synth)
+		sound_render(&snd.cycles, &pcm);
 }
 
-void sound_write(byte r, byte b)
+static void sound_apply(byte r, byte b)
 {
-	if (!(R_NR52 & 128) && r != RI_NR52)
-		return;
-
 	if ((r & 0xF0) == 0x30)
 	{
-		if (S3.on) sound_mix();
 		if (!S3.on)
-			WAVE[r-0x30] = ram.hi[r] = b;
+			WAVE[r-0x30] = b;
 		return;
 	}
 
-	sound_mix();
-
 	switch (r)
 	{
 	case RI_NR10:
@@ -443,9 +469,126 @@ void sound_write(byte r, byte b)
 	case RI_NR52:
 		R_NR52 = b;
 		if (!(R_NR52 & 128))
-			sound_off();
+			sound_off_channels();
 		break;
 	default:
 		return;
 	}
 }
+
+byte sound_read(byte r)
+{
+	sound_mix();
+	if (r == RI_NR52)
+		return (ram.hi[r] & 0xf0) | snd.status;
+	return ram.hi[r];
+}
+
+void sound_write(byte r, byte b)
+{
+	if (!(ram.hi[RI_NR52] & 128) && r != RI_NR52)
+		return;
+
+	/* Unused registers, nothing to log */
+	if (r == 0x15 || r == 0x1F || (r > RI_NR52 && r < 0x30))
+		return;
+
+	if (synth)
+	{
+		rg_synth_write(snd.cycles, r, b);
+	}
+	else
+	{
+		sound_mix();
+		sound_apply(r, b);
+	}
+
+	/* What the CPU reads back. With the synth running, channel 3's state
+	   is the one of the last mixed frame. */
+	if ((r & 0xF0) == 0x30)
+	{
+		if (!(synth ? (snd.status & 4) : S3.on))
+			ram.hi[r] = b;
+		return;
+	}
+
+	ram.hi[r] = b;
+
+	if (r == RI_NR34 && (b & 128) && (ram.hi[RI_NR30] & 128))
+	{
+		for (int i = 0; i < 16; i++)
+			ram.hi[i+0x30] = 0x13 ^ ram.hi[i+0x31];
+	}
+	else if (r == RI_NR52 && !(b & 128))
+	{
+		sound_off_regs(ram.hi);
+	}
+}
+
+static void synth_write(void *arg, uint16_t reg, uint8_t value)
+{
+	sound_apply(reg, value);
+}
+
+static void synth_render(void *arg, uint32_t cycles)
+{
+	synth_cycles += cycles;
+	sound_render(&synth_cycles, &synth_pcm);
+}
+
+static size_t synth_flush(void *arg, short **buffer)
+{
+	size_t count = synth_pcm.stereo ? synth_pcm.pos >> 1 : synth_pcm.pos;
+	*buffer = synth_pcm.buf;
+	synth_pcm.pos = 0;
+	return count;
+}
+
+/* Moves mixing to a task on the other core. pcm must be set up first,
+   samples are then submitted from there and pcm.buf is left alone. */
+void sound_synth(bool enable)
+{
+	if (enable == synth)
+		return;
+
+	if (enable)
+	{
+		n16 *buf = synth_pcm.buf;
+		synth_pcm = pcm;
+		synth_pcm.buf = buf ? buf : rg_alloc(pcm.len * sizeof(n16), MEM_FAST);
+		synth_pcm.pos = 0;
+		synth_cycles = snd.cycles;
+		snd.cycles = 0;
+		rg_synth_start(&(rg_synth_chip_t){
+			.write = &synth_write,
+			.render = &synth_render,
+			.flush = &synth_flush,
+		});
+		synth = true;
+	}
+	else
+	{
+		rg_synth_stop();
+		synth = false;
+	}
+}
+
+/* Wait until the synth task is done with the channels, before touching snd */
+void sound_sync()
+{
+	if (synth)
+		rg_synth_sync();
+}
+
+void sound_end_frame(bool output)
+{
+	if (synth)
+	{
+		rg_synth_end_frame(snd.cycles, output);
+		snd.cycles = 0;
+	}
+	else if (output)
+	{
+		rg_audio_submit(pcm.buf, pcm.pos >> 1);
+	}
+}
@@ -19,6 +19,8 @@ typedef struct
 	int rate;
 	sndchan_t ch[4];
 	byte wave[16];
+	byte regs[0x30]; /* The channels' copy of NR10-NR52, see sound_synth() */
+	byte status;     /* NR52 channel bits as of the last mix */
 	int cycles;
 } snd_t;
 
@@ -38,5 +40,8 @@ byte sound_read(byte r);
 void sound_dirty();
 void sound_reset(bool hard);
 void sound_mix();
+void sound_end_frame(bool output);
+void sound_synth(bool enable);
+void sound_sync();
 
 #endif
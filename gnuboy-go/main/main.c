@@ -1,4 +1,5 @@
 #include <rg_system.h>
+#include <soc/soc_memory_layout.h>
 #include <sys/time.h>
 #include <string.h>
 
@@ -13,11 +14,13 @@
 #include "../components/gnuboy/emu.h"
 
 #define AUDIO_SAMPLE_RATE   (32000)
+// The channels are mixed at a whole number of cycles per sample (96), rg_audio resamples
+#define AUDIO_SOURCE_RATE   ((1 << 21) / 96)
 #define AUDIO_BUFFER_LENGTH (AUDIO_SAMPLE_RATE / 16 + 1)
 
 static short audioBuffer[AUDIO_BUFFER_LENGTH * 2];
 
-static rg_video_frame_t frames[2];
+static rg_video_frame_t frames[3];
 static rg_video_frame_t *currentUpdate = &frames[0];
 
 static rg_app_desc_t *app;
@@ -43,14 +46,14 @@ static bool screenshot_handler(const char *filename, int width, int height)
     return rg_display_save_frame(filename, currentUpdate, width, height);
 }
 
-static bool save_state_handler(const char *filename)
+static bool save_state_handler(FILE *fp)
 {
-    return state_save(filename) == 0;
+    return state_save(fp) == 0;
 }
 
-static bool load_state_handler(const char *filename)
+static bool load_state_handler(FILE *fp)
 {
-    if (state_load(filename) != 0)
+    if (state_load(fp) != 0)
     {
         // If a state fails to load then we should behave as we do on boot
         // which is a hard reset and load sram if present
@@ -200,12 +203,13 @@ static dialog_return_t advanced_settings_cb(dialog_option_t *option, dialog_even
 
 static void screen_blit(void)
 {
-    rg_video_frame_t *previousUpdate = &frames[currentUpdate == &frames[0]];
+    static rg_video_frame_t *previousUpdate = NULL;
 
     fullFrame = rg_display_queue_update(currentUpdate, previousUpdate) == RG_UPDATE_FULL;
 
-    // swap buffers
-    currentUpdate = previousUpdate;
+    // Triple buffering: the display can have two frames in flight while we draw the third
+    previousUpdate = currentUpdate;
+    currentUpdate = rg_display_acquire_frame(frames, 3, -1);
     fb.buffer = currentUpdate->buffer;
 }
 
@@ -236,14 +240,27 @@ void app_main(void)
 
     app = rg_system_init(AUDIO_SAMPLE_RATE, &handlers);
 
-    frames[0].flags = RG_PIXEL_565|RG_PIXEL_BE;
+    frames[0].flags = RG_PIXEL_565|RG_PIXEL_BE|RG_PIXEL_DMA;
     frames[0].width = GB_WIDTH;
     frames[0].height = GB_HEIGHT;
     frames[0].stride = GB_WIDTH * 2;
     frames[1] = frames[0];
+    frames[2] = frames[0];
 
-    frames[0].buffer = rg_alloc(GB_WIDTH * GB_HEIGHT * 2, MEM_ANY);
-    frames[1].buffer = rg_alloc(GB_WIDTH * GB_HEIGHT * 2, MEM_ANY);
+    // Internal RAM budget: two frames of 45KB the panel can DMA straight from, while the emulator
+    // draws into the other. The third frame, only needed for the queue depth, lives in PSRAM and
+    // gets copied through the SPI buffers instead.
+    frames[0].buffer = rg_alloc(GB_WIDTH * GB_HEIGHT * 2, MEM_FAST|MEM_DMA);
+    frames[1].buffer = rg_alloc(GB_WIDTH * GB_HEIGHT * 2, MEM_FAST|MEM_DMA);
+    frames[2].buffer = rg_alloc(GB_WIDTH * GB_HEIGHT * 2, MEM_SLOW);
+
+    for (int i = 0; i < 2; i++)
+    {
+        if (!esp_ptr_dma_capable(frames[i].buffer))
+            RG_LOGW("Frame %d fell back to memory the DMA can't reach, it will be copied.\n", i);
+    }
+
+    rg_display_set_queue_depth(2);
 
     autoSaveSRAM = rg_settings_get_app_int32(SETTING_SAVESRAM, 0);
     sramFile = rg_emu_get_path(RG_PATH_SAVE_SRAM, 0);
@@ -273,7 +290,7 @@ void app_main(void)
 
     // Audio
     pcm = (pcm_t) {
-        .hz = AUDIO_SAMPLE_RATE,
+        .hz = AUDIO_SOURCE_RATE,
         .stereo = 1,
         .len = AUDIO_BUFFER_LENGTH * 2, // count of 16bit samples (x2 for stereo)
         .buf = (n16 *)&audioBuffer,
@@ -282,6 +299,12 @@ void app_main(void)
 
     emu_init();
 
+    // What the channels really produce, snd.rate is rounded to whole cycles
+    rg_audio_set_source_rate((1 << 21) / snd.rate);
+
+    // Mix audio on the other core
+    sound_synth(true);
+
     if (app->startAction == RG_START_ACTION_RESUME)
     {
         rg_emu_load_state(0);
@@ -310,7 +333,7 @@ void app_main(void)
         }
 
         int64_t startTime = get_elapsed_time();
-        bool drawFrame = !skipFrames;
+        bool drawFrame = rg_display_should_render(!skipFrames);
 
         pad_set(PAD_UP, joystick & GAMEPAD_KEY_UP);
         pad_set(PAD_RIGHT, joystick & GAMEPAD_KEY_RIGHT);
@@ -356,9 +379,7 @@ void app_main(void)
         // Tick before submitting audio/syncing
         rg_system_tick(elapsed);
 
-        if (!app->speedupEnabled)
-        {
-            rg_audio_submit(pcm.buf, pcm.pos >> 1);
-        }
+        // Muted frames still run the channels when the synth task does the mixing
+        sound_end_frame(!app->speedupEnabled);
     }
 }
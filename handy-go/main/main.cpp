@@ -114,30 +114,14 @@ static bool screenshot_handler(const char *filename, int width, int height)
     return rg_display_save_frame(filename, currentUpdate, width, height);
 }
 
-static bool save_state_handler(const char *filename)
+static bool save_state_handler(FILE *fp)
 {
-    bool ret = false;
-    FILE *fp;
-
-    if ((fp = fopen(filename, "wb")))
-    {
-        ret = lynx->ContextSave(fp);
-        fclose(fp);
-    }
-
-    return ret;
+    return lynx->ContextSave(fp);
 }
 
-static bool load_state_handler(const char *filename)
+static bool load_state_handler(FILE *fp)
 {
-    bool ret = false;
-    FILE *fp;
-
-    if ((fp = fopen(filename, "rb")))
-    {
-        ret = lynx->ContextLoad(fp);
-        fclose(fp);
-    }
+    bool ret = lynx->ContextLoad(fp);
 
     if (!ret) lynx->Reset();
 
@@ -164,15 +148,15 @@ extern "C" void app_main(void)
 
     app = rg_system_init(AUDIO_SAMPLE_RATE, &handlers);
 
-    frames[0].flags = RG_PIXEL_565|RG_PIXEL_BE;
+    frames[0].flags = RG_PIXEL_565|RG_PIXEL_BE|RG_PIXEL_DMA;
     frames[0].width = HANDY_SCREEN_WIDTH;
     frames[0].height = HANDY_SCREEN_WIDTH;
     frames[0].stride = HANDY_SCREEN_WIDTH * 2;
     frames[1] = frames[0];
 
     // the HANDY_SCREEN_WIDTH * HANDY_SCREEN_WIDTH is deliberate because of rotation
-    frames[0].buffer = (void*)rg_alloc(HANDY_SCREEN_WIDTH * HANDY_SCREEN_WIDTH * 2, MEM_FAST);
-    frames[1].buffer = (void*)rg_alloc(HANDY_SCREEN_WIDTH * HANDY_SCREEN_WIDTH * 2, MEM_FAST);
+    frames[0].buffer = (void*)rg_alloc(HANDY_SCREEN_WIDTH * HANDY_SCREEN_WIDTH * 2, MEM_FAST|MEM_DMA);
+    frames[1].buffer = (void*)rg_alloc(HANDY_SCREEN_WIDTH * HANDY_SCREEN_WIDTH * 2, MEM_FAST|MEM_DMA);
 
     // The Lynx has a variable framerate but 60 is typical
     app->refreshRate = 60;
@@ -217,7 +201,7 @@ extern "C" void app_main(void)
         }
 
         int64_t startTime = get_elapsed_time();
-        bool drawFrame = !skipFrames;
+        bool drawFrame = rg_display_should_render(!skipFrames);
 
         ULONG buttons = 0;
 
@@ -242,6 +226,9 @@ extern "C" void app_main(void)
 
             currentUpdate = previousUpdate;
             gPrimaryFrameBuffer = (UBYTE*)currentUpdate->buffer;
+
+            // The display might still be reading the buffer we're about to draw into
+            rg_display_wait_frame_release(currentUpdate);
         }
 
         long elapsed = get_elapsed_time_since(startTime);
@@ -624,7 +624,12 @@ void emulator_show_file_menu(retro_emulator_file_t *file, bool advanced)
     case 2:
         if (has_save && rg_gui_confirm("Delete save state?", 0, 0))
         {
-            unlink(save_path);
+            for (int slot = RG_PATH_SAVE_STATE; slot <= RG_PATH_SAVE_STATE_3; slot++)
+            {
+                char *path = rg_emu_get_path(slot, emulator_get_file_path(file));
+                unlink(path);
+                free(path);
+            }
             unlink(scrn_path);
         }
         if (has_sram && rg_gui_confirm("Delete sram file?", 0, 0))
@@ -34,6 +34,24 @@
 /* active APU */
 static apu_t apu;
 
+/* When the channels are mixed on the other core (apu_synth), the CPU only logs their register
+** writes. The DMC stays here: it reads the CPU bus, steals cycles and raises IRQs. Its output
+** is handed to the synth task a frame at a time, along with the external chip's if any.
+*/
+#define APU_SYNTH_SAMPLES  (APU_SAMPLES_PER_FRAME / 2)
+#define APU_SYNTH_FRAMES   4       /* DMC frames in flight, more than rg_synth lets the CPU queue */
+#define APU_SYNTH_DMC      0x4018  /* Not a register, the write that hands a DMC frame over */
+
+static bool synth;
+static uint32 synth_frame_start;    /* CPU cycle the current frame started at */
+static uint8 synth_dmc_frame;       /* DMC frame being filled by the CPU */
+static int16 *synth_dmc;            /* APU_SYNTH_FRAMES frames of DMC output */
+static const int16 *synth_dmc_mix;  /* DMC frame of the frame being mixed */
+static int32 *synth_mix;            /* The other channels of the frame being mixed */
+static float synth_cycles;
+static uint32 synth_pos;
+static uint8 synth_status;          /* $4015 channel bits as of the last mixed frame */
+
 /* vblank length table used for rectangles, triangle, noise */
 static const uint8 vbl_length[32] =
 {
@@ -105,12 +123,14 @@ IRAM_ATTR void apu_fc_advance(int cycles)
 void apu_setcontext(apu_t *src_apu)
 {
    ASSERT(src_apu);
+   apu_sync();
    apu = *src_apu;
 }
 
 void apu_getcontext(apu_t *dest_apu)
 {
    ASSERT(dest_apu);
+   apu_sync();
    *dest_apu = apu;
 }
 
@@ -430,7 +450,8 @@ INLINE int32 apu_dmc(void)
 }
 
 
-IRAM_ATTR void apu_write(uint32 address, uint8 value)
+/* Channel register writes, replayed by the synth task when it runs */
+IRAM_ATTR static void apu_regwrite(uint32 address, uint8 value)
 {
    int chan;
 
@@ -534,47 +555,7 @@ IRAM_ATTR void apu_write(uint32 address, uint8 value)
       apu.noise.env_vol = 0; /* reset envelope */
       break;
 
-   /* DMC */
-   case APU_WRE0:
-      apu.dmc.regs[0] = value;
-      apu.dmc.freq = dmc_clocks[value & 0x0F];
-      apu.dmc.looping = (value >> 6) & 1;
-
-      if (value & 0x80)
-      {
-         apu.dmc.irq_gen = true;
-      }
-      else
-      {
-         apu.dmc.irq_gen = false;
-         apu.dmc.irq_occurred = false;
-      }
-      break;
-
-   case APU_WRE1: /* 7-bit DAC */
-      /* add the _delta_ between written value and
-      ** current output level of the volume reg
-      */
-      value &= 0x7F; /* bit 7 ignored */
-      apu.dmc.output_vol += ((value - apu.dmc.regs[1]) << 8);
-      apu.dmc.regs[1] = value;
-      break;
-
-   case APU_WRE2:
-      apu.dmc.regs[2] = value;
-      apu.dmc.cached_addr = 0xC000 + (uint16) (value << 6);
-      break;
-
-   case APU_WRE3:
-      apu.dmc.regs[3] = value;
-      apu.dmc.cached_dmalength = ((value << 4) + 1) << 3;
-      break;
-
    case APU_SMASK:
-      /* bodge for timestamp queue */
-      apu.dmc.enabled = (value >> 4) & 1;
-      apu.control_reg = value;
-
       for (chan = 0; chan < 2; chan++)
       {
          if (value & (1 << chan))
@@ -610,6 +591,57 @@ IRAM_ATTR void apu_write(uint32 address, uint8 value)
          apu.noise.enabled = false;
          apu.noise.vbl_length = 0;
       }
+      break;
+
+   default:
+      break;
+   }
+}
+
+IRAM_ATTR void apu_write(uint32 address, uint8 value)
+{
+   switch (address)
+   {
+   /* DMC, it always runs on this core */
+   case APU_WRE0:
+      apu.dmc.regs[0] = value;
+      apu.dmc.freq = dmc_clocks[value & 0x0F];
+      apu.dmc.looping = (value >> 6) & 1;
+
+      if (value & 0x80)
+      {
+         apu.dmc.irq_gen = true;
+      }
+      else
+      {
+         apu.dmc.irq_gen = false;
+         apu.dmc.irq_occurred = false;
+      }
+      return;
+
+   case APU_WRE1: /* 7-bit DAC */
+      /* add the _delta_ between written value and
+      ** current output level of the volume reg
+      */
+      value &= 0x7F; /* bit 7 ignored */
+      apu.dmc.output_vol += ((value - apu.dmc.regs[1]) << 8);
+      apu.dmc.regs[1] = value;
+      return;
+
+   case APU_WRE2:
+      apu.dmc.regs[2] = value;
+      apu.dmc.cached_addr = 0xC000 + (uint16) (value << 6);
+      return;
+
+   case APU_WRE3:
+      apu.dmc.regs[3] = value;
+      apu.dmc.cached_dmalength = ((value << 4) + 1) << 3;
+      return;
+
+   case APU_SMASK:
+      /* bodge for timestamp queue */
+      apu.dmc.enabled = (value >> 4) & 1;
+      apu.control_reg = value;
 
       if (value & 0x10)
       {
@@ -628,16 +660,41 @@ IRAM_ATTR void apu_write(uint32 address, uint8 value)
       apu.fc.state = value;
       apu.fc.cycles = 0; // 3-4 cpu cycles before reset
       apu.fc.irq_occurred = false;
-      break;
+      return;
 
       /* unused, but they get hit in some mem-clear loops */
    case 0x4009:
    case 0x400D:
-      break;
+      return;
 
    default:
+      if (address > APU_WRD3)
+         return;
       break;
    }
+
+   /* The rest is the channels' */
+   if (synth)
+      rg_synth_write(nes6502_getcycles() - synth_frame_start, address, value);
+   else
+      apu_regwrite(address, value);
+}
+
+/* Length counter bits of $4015 */
+INLINE uint8 apu_status(void)
+{
+   uint8 value = 0;
+
+   if (apu.rectangle[0].enabled && apu.rectangle[0].vbl_length)
+      value |= 0x01;
+   if (apu.rectangle[1].enabled && apu.rectangle[1].vbl_length)
+      value |= 0x02;
+   if (apu.triangle.enabled && apu.triangle.vbl_length)
+      value |= 0x04;
+   if (apu.noise.enabled && apu.noise.vbl_length)
+      value |= 0x08;
+
+   return value;
 }
 
 /* Read from $4000-$4017 */
@@ -648,16 +705,11 @@ IRAM_ATTR uint8 apu_read(uint32 address)
    switch (address)
    {
    case APU_SMASK:
-      value = 0;
       /* Return 1 in 0-5 bit pos if a channel is playing */
-      if (apu.rectangle[0].enabled && apu.rectangle[0].vbl_length)
-         value |= 0x01;
-      if (apu.rectangle[1].enabled && apu.rectangle[1].vbl_length)
-         value |= 0x02;
-      if (apu.triangle.enabled && apu.triangle.vbl_length)
-         value |= 0x04;
-      if (apu.noise.enabled && apu.noise.vbl_length)
-         value |= 0x08;
+      if (synth)
+         value = synth_status & apu.control_reg; /* as of the last mixed frame */
+      else
+         value = apu_status();
 
       /* bodge for timestamp queue */
       if (apu.dmc.enabled)
@@ -681,6 +733,31 @@ IRAM_ATTR uint8 apu_read(uint32 address)
    return value;
 }
 
+/* Filter and clip one sample of the mix */
+INLINE int16 apu_output(int accum, int *prev_sample)
+{
+   /* do any filtering */
+   if (OPT(APU_FILTER_TYPE) == APU_FILTER_WEIGHTED)
+   {
+      accum = (accum + accum + accum + *prev_sample) >> 2;
+   }
+   else if (OPT(APU_FILTER_TYPE) == APU_FILTER_LOWPASS)
+   {
+      accum += *prev_sample;
+      accum >>= 1;
+   }
+   *prev_sample = accum;
+
+   /* do clipping */
+   if (accum > 0x7FFF)
+      accum = 0x7FFF;
+   else if (accum < -0x8000)
+      accum = -0x8000;
+
+   /* signed 16-bit output */
+   return (int16) accum;
+}
+
 void apu_process(int16 *buffer, size_t num_samples, bool stereo)
 {
    int prev_sample = apu.prev_sample;
@@ -705,29 +782,12 @@ void apu_process(int16 *buffer, size_t num_samples, bool stereo)
       if (apu.ext) // && OPT(APU_CHANNEL6_EN))
          accum += apu.ext->process();
 
-      /* do any filtering */
-      if (OPT(APU_FILTER_TYPE) == APU_FILTER_WEIGHTED)
-      {
-         accum = (accum + accum + accum + prev_sample) >> 2;
-      }
-      else if (OPT(APU_FILTER_TYPE) == APU_FILTER_LOWPASS)
-      {
-         accum += prev_sample;
-         accum >>= 1;
-      }
-      prev_sample = accum;
+      int16 sample = apu_output(accum, &prev_sample);
 
-      /* do clipping */
-      if (accum > 0x7FFF)
-         accum = 0x7FFF;
-      else if (accum < -0x8000)
-         accum = -0x8000;
-
-      /* signed 16-bit output */
-      *buffer++ = (int16) accum;
+      *buffer++ = sample;
 
       if (stereo)
-         *buffer++ = (int16) accum;
+         *buffer++ = sample;
 
       // Advance frame counter
       // apu_fc_advance(apu.cycle_rate);
@@ -736,10 +796,135 @@ void apu_process(int16 *buffer, size_t num_samples, bool stereo)
    apu.prev_sample = prev_sample;
 }
 
+/* The CPU's share of a frame when the synth task mixes the other channels */
+static void apu_process_dmc(int16 *buffer, size_t num_samples)
+{
+   while (num_samples--)
+   {
+      int accum = apu_dmc();
+
+      if (apu.ext)
+         accum += apu.ext->process();
+
+      *buffer++ = MAX(MIN(accum, 0x7FFF), -0x8000);
+   }
+}
+
 void apu_emulate(void)
 {
    // Run for one frame
-   apu_process(apu.buffer, apu.samples_per_frame, apu.stereo);
+   if (synth)
+      apu_process_dmc(&synth_dmc[synth_dmc_frame * APU_SYNTH_SAMPLES], apu.samples_per_frame);
+   else
+      apu_process(apu.buffer, apu.samples_per_frame, apu.stereo);
+}
+
+/* Submits the frame, or hands it to the synth task along with its DMC output */
+void apu_end_frame(bool output)
+{
+   if (synth)
+   {
+      uint32 cycle = nes6502_getcycles() - synth_frame_start;
+
+      rg_synth_write(cycle, APU_SYNTH_DMC, synth_dmc_frame);
+      rg_synth_end_frame(cycle, output);
+
+      synth_frame_start += cycle;
+      synth_dmc_frame = (synth_dmc_frame + 1) % APU_SYNTH_FRAMES;
+   }
+   else if (output)
+   {
+      rg_audio_submit(apu.buffer, apu.samples_per_frame);
+   }
+}
+
+static void synth_write(void *arg, uint16_t reg, uint8_t value)
+{
+   if (reg == APU_SYNTH_DMC)
+      synth_dmc_mix = &synth_dmc[value * APU_SYNTH_SAMPLES];
+   else
+      apu_regwrite(reg, value);
+}
+
+static void synth_render_to(uint32 samples)
+{
+   for (; synth_pos < samples; synth_pos++)
+      synth_mix[synth_pos] = apu_rectangle_0() + apu_rectangle_1() + apu_triangle() + apu_noise();
+}
+
+static void synth_render(void *arg, uint32_t cycles)
+{
+   /* A write lands on the sample its cycle falls in, instead of the start of the frame */
+   synth_cycles += cycles;
+   synth_render_to(MIN(apu.samples_per_frame, (uint32) (synth_cycles / apu.cycle_rate)));
+}
+
+static size_t synth_flush(void *arg, short **buffer)
+{
+   int prev_sample = apu.prev_sample;
+   int16 *out = apu.buffer;
+
+   synth_render_to(apu.samples_per_frame);
+
+   for (uint32 i = 0; i < apu.samples_per_frame; i++)
+   {
+      int16 sample = apu_output(synth_mix[i] + synth_dmc_mix[i], &prev_sample);
+
+      *out++ = sample;
+
+      if (apu.stereo)
+         *out++ = sample;
+   }
+
+   apu.prev_sample = prev_sample;
+   synth_status = apu_status();
+   synth_cycles = 0;
+   synth_pos = 0;
+
+   *buffer = apu.buffer;
+   return apu.samples_per_frame;
+}
+
+/* Moves the pulse, triangle and noise channels to a task on the other core. The samples are
+** then submitted from there, apu_end_frame only hands the frame over.
+*/
+void apu_synth(bool enable)
+{
+   if (enable == synth)
+      return;
+
+   if (enable)
+   {
+      if (!synth_dmc)
+      {
+         synth_dmc = rg_alloc(APU_SYNTH_FRAMES * APU_SYNTH_SAMPLES * sizeof(int16), MEM_FAST);
+         synth_mix = rg_alloc(APU_SYNTH_SAMPLES * sizeof(int32), MEM_FAST);
+      }
+      synth_dmc_mix = synth_dmc;
+      synth_dmc_frame = 0;
+      synth_frame_start = nes6502_getcycles();
+      synth_status = apu_status();
+      synth_cycles = 0;
+      synth_pos = 0;
+      rg_synth_start(&(rg_synth_chip_t){
+         .write = &synth_write,
+         .render = &synth_render,
+         .flush = &synth_flush,
+      });
+      synth = true;
+   }
+   else
+   {
+      rg_synth_stop();
+      synth = false;
+   }
+}
+
+/* Wait until the synth task is done with the channels, before touching them */
+void apu_sync(void)
+{
+   if (synth)
+      rg_synth_sync();
 }
 
 void apu_setopt(apu_option_t n, int val)
@@ -761,6 +946,8 @@ int apu_getopt(apu_option_t n)
 
 void apu_reset(void)
 {
+   apu_sync();
+
    /* Update region if needed */
    apu.samples_per_frame = apu.sample_rate / NES_REFRESH_RATE;
    apu.cycle_rate = (float)NES_CPU_CLOCK / apu.sample_rate;
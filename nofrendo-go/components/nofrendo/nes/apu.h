@@ -231,6 +231,9 @@ extern void apu_shutdown(void);
 extern void apu_setext(apuext_t *ext);
 
 extern void apu_emulate(void);
+extern void apu_end_frame(bool output);
+extern void apu_synth(bool enable);
+extern void apu_sync(void);
 
 extern void apu_setopt(apu_option_t n, int val);
 extern int  apu_getopt(apu_option_t n);
@@ -90,14 +90,14 @@ static bool screenshot_handler(const char *filename, int width, int height)
 	return rg_display_save_frame(filename, currentUpdate, width, height);
 }
 
-static bool save_state_handler(const char *filename)
+static bool save_state_handler(FILE *fp)
 {
-    return state_save(filename) == 0;
+    return state_save(fp) == 0;
 }
 
-static bool load_state_handler(const char *filename)
+static bool load_state_handler(FILE *fp)
 {
-    if (state_load(filename) != 0)
+    if (state_load(fp) != 0)
     {
         nes_reset(true);
         return false;
@@ -280,13 +280,10 @@ void osd_vsync()
     // Tick before submitting audio/syncing
     rg_system_tick(elapsed);
 
-    nes->drawframe = (skipFrames == 0);
+    nes->drawframe = rg_display_should_render(skipFrames == 0);
 
-    // Use audio to throttle emulation
-    if (!app->speedupEnabled)
-    {
-        rg_audio_submit(nes->apu->buffer, nes->apu->samples_per_frame);
-    }
+    // Muted frames still run the channels when the synth task does the mixing
+    apu_end_frame(!app->speedupEnabled);
 
     lastSyncTime = get_elapsed_time();
 }
@@ -405,6 +402,9 @@ void app_main(void)
         RG_PANIC("Unsupported ROM.");
     }
 
+    // Mix audio on the other core
+    apu_synth(true);
+
     nes_emulate();
 
     RG_PANIC("Nofrendo died!");
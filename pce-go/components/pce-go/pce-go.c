@@ -310,28 +310,21 @@ RunPCE(void)
  * Load saved state
  */
 int
-LoadState(const char *name)
+LoadState(FILE *fp)
 {
-	MESSAGE_INFO("Loading state from %s...\n", name);
+	MESSAGE_DEBUG("Loading state...\n");
 
 	char buffer[512];
 
-	FILE *fp = fopen(name, "rb");
-	if (fp == NULL)
-		return -1;
-
-	fread(&buffer, 8, 1, fp);
-
-	if (memcmp(&buffer, SAVESTATE_HEADER, 8) != 0)
+	if (fread(&buffer, 8, 1, fp) != 1 || memcmp(&buffer, SAVESTATE_HEADER, 8) != 0)
 	{
 		MESSAGE_ERROR("Loading state failed: Header mismatch\n");
-		fclose(fp);
 		return -1;
 	}
 
 	for (int i = 0; SaveStateVars[i].len > 0; i++)
 	{
-		MESSAGE_INFO("Loading %s (%d)\n", SaveStateVars[i].key, SaveStateVars[i].len);
+		MESSAGE_DEBUG("Loading %s (%d)\n", SaveStateVars[i].key, SaveStateVars[i].len);
 		fread(SaveStateVars[i].ptr, SaveStateVars[i].len, 1, fp);
 	}
 
@@ -344,8 +337,6 @@ LoadState(const char *name)
 
 	osd_gfx_set_mode(IO_VDC_SCREEN_WIDTH, IO_VDC_SCREEN_HEIGHT);
 
-	fclose(fp);
-
 	return 0;
 }
 
@@ -354,25 +345,19 @@ LoadState(const char *name)
  * Save current state
  */
 int
-SaveState(const char *name)
+SaveState(FILE *fp)
 {
-	MESSAGE_INFO("Saving state to %s...\n", name);
-
-	FILE *fp = fopen(name, "wb");
-	if (fp == NULL)
-		return -1;
+	MESSAGE_DEBUG("Saving state...\n");
 
 	fwrite(SAVESTATE_HEADER, sizeof(SAVESTATE_HEADER), 1, fp);
 
 	for (int i = 0; SaveStateVars[i].len > 0; i++)
 	{
-		MESSAGE_INFO("Saving %s (%d)\n", SaveStateVars[i].key, SaveStateVars[i].len);
+		MESSAGE_DEBUG("Saving %s (%d)\n", SaveStateVars[i].key, SaveStateVars[i].len);
 		fwrite(SaveStateVars[i].ptr, SaveStateVars[i].len, 1, fp);
 	}
 
-	fclose(fp);
-
-	return 0;
+	return ferror(fp) ? -1 : 0;
 }
 
 
@@ -12,8 +12,8 @@
 
 #include <rg_system.h>
 
-int LoadState(const char *name);
-int SaveState(const char *name);
+int LoadState(FILE *fp);
+int SaveState(FILE *fp);
 void ResetPCE(bool);
 void RunPCE(void);
 void ShutdownPCE();
@@ -44,7 +44,7 @@ static const char *SETTING_OVERSCAN  = "overscan";
 
 uint8_t *osd_gfx_framebuffer(void)
 {
-    if (skipFrames > 0)
+    if (!rg_display_should_render(skipFrames == 0))
         return NULL;
     return (uint8_t *)currentUpdate->my_arg;
 }
@@ -74,11 +74,13 @@ void osd_gfx_set_mode(int width, int height)
     int offset_center = (((XBUF_HEIGHT - height) / 2 + 16) * XBUF_WIDTH + (XBUF_WIDTH - width) / 2);
     int offset_cropping = (crop_v / 2) * XBUF_WIDTH + (crop_h / 2);
 
+    // Every state load sets the mode, rewind does it each frame
+    if (width != current_width || height != current_height)
+        RG_LOGI("Resolution: %dx%d / Cropping: H: %d V: %d\n", width, height, crop_h, crop_v);
+
     current_width = width;
     current_height = height;
 
-    RG_LOGI("Resolution: %dx%d / Cropping: H: %d V: %d\n", width, height, crop_h, crop_v);
-
     frames[0].flags = RG_PIXEL_PAL|RG_PIXEL_565|RG_PIXEL_BE;
     frames[0].width = width - crop_h;
     frames[0].height = height - crop_v;
@@ -98,7 +100,7 @@ void osd_gfx_set_mode(int width, int height)
 
 void osd_gfx_blit(void)
 {
-    bool drawFrame = !skipFrames;
+    bool drawFrame = rg_display_should_render(!skipFrames);
 
     if (drawFrame)
     {
@@ -238,32 +240,15 @@ void osd_log(int type, const char *format, ...)
 
 void osd_vsync(void)
 {
-    const int32_t frametime = get_frame_time(60);
-    static int64_t lasttime, prevtime;
+    static int64_t prevtime;
 
-    int64_t curtime = get_elapsed_time();
-    int32_t sleep = frametime - (curtime - lasttime);
+    rg_system_tick(get_elapsed_time() - prevtime);
 
-    if (sleep > frametime)
-    {
-        RG_LOGE("Our vsync timer seems to have overflowed! (%dus)\n", sleep);
-    }
-    else if (sleep > 0)
-    {
-        usleep(sleep);
-    }
-    else if (sleep < -(frametime / 2))
-    {
+    // More than half a frame late, the next frame won't be drawn
+    if (rg_system_frame_sync() > get_frame_time(60) / 2)
         skipFrames++;
-    }
-
-    rg_system_tick(curtime - prevtime);
 
     prevtime = get_elapsed_time();
-    lasttime += frametime;
-
-    if ((lasttime + frametime) < prevtime)
-        lasttime = prevtime;
 }
 
 void *osd_alloc(size_t size)
@@ -278,14 +263,14 @@ static bool screenshot_handler(const char *filename, int width, int height)
     return rg_display_save_frame(filename, previousUpdate, width, height);
 }
 
-static bool save_state_handler(const char *filename)
+static bool save_state_handler(FILE *fp)
 {
-    return SaveState(filename) == 0;
+    return SaveState(fp) == 0;
 }
 
-static bool load_state_handler(const char *filename)
+static bool load_state_handler(FILE *fp)
 {
-    if (LoadState(filename) != 0)
+    if (LoadState(fp) != 0)
     {
         ResetPCE(false);
         return false;
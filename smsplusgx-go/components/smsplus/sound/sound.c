@@ -77,6 +77,9 @@ int sound_init(void)
 
   /* Calculate number of samples generated per frame */
   snd.sample_count = (snd.sample_rate / snd.fps) + 1;
+
+  /* Run the chips at the rate the frames really consume, or every tone is sharp */
+  snd.sample_rate = snd.sample_count * snd.fps;
   printf("%s: sample_count=%d fps=%d (actual=%f)\n", __func__, snd.sample_count, snd.fps, (float)snd.sample_rate / (float)snd.fps);
 
   /* Calculate size of sample buffer */
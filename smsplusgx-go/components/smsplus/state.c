@@ -43,11 +43,6 @@ int system_save_state(void *mem)
 {
   int i;
 
-  printf("%s: sizeof sms=%d\n", __func__, sizeof(sms));
-  printf("%s: sizeof vdp=%d\n", __func__, sizeof(vdp));
-  printf("%s: sizeof Z80=%d\n", __func__, sizeof(Z80));
-  printf("%s: sizeof SN76489_Context=%d\n", __func__, sizeof(SN76489_Context));
-
   /*** Save SMS Context ***/
   fwrite(&sms, sizeof(sms), 1, mem);
 
@@ -79,26 +74,21 @@ int system_save_state(void *mem)
 }
 
 
-void system_load_state(void *mem)
+int system_load_state(void *mem)
 {
   int i;
 
-  printf("%s: sizeof sms=%d\n", __func__, sizeof(sms));
-  printf("%s: sizeof vdp=%d\n", __func__, sizeof(vdp));
-  printf("%s: sizeof Z80=%d\n", __func__, sizeof(Z80));
-  printf("%s: sizeof SN76489_Context=%d\n", __func__, sizeof(SN76489_Context));
-
   /* Initialize everything */
   system_reset();
 
   /*** Set SMS Context ***/
   int current_console = sms.console;
-  fread(&sms, sizeof(sms), 1, mem);
-  if(sms.console != current_console)
+  int current_display = sms.display;
+  if(fread(&sms, sizeof(sms), 1, mem) != 1 || sms.console != current_console)
   {
       system_reset();
       printf("%s: Bad save data\n", __func__);
-      return;
+      return -1;
   }
 
   /*** Set vdp state ***/
@@ -106,7 +96,10 @@ void system_load_state(void *mem)
 
   /** restore video & audio settings (needed if timing changed) ***/
   vdp_init();
-  sound_init();
+
+  /* sound_init reallocates the buffers, rewind loads states every frame */
+  if (sms.display != current_display)
+    sound_init();
 
   /*** Set cart info ***/
   for (i = 0; i < 4; i++)
@@ -143,6 +136,13 @@ void system_load_state(void *mem)
   psg->Clock = psg_Clock;
   psg->dClock = psg_dClock;
 
+  /* A short read leaves a half loaded machine, the caller has to reset it */
+  if (ferror(mem) || feof(mem))
+  {
+    printf("%s: Truncated save data\n", __func__);
+    return -1;
+  }
+
 
   if ((sms.console != CONSOLE_COLECO) && (sms.console != CONSOLE_SG1000))
   {
@@ -182,4 +182,6 @@ void system_load_state(void *mem)
   /* Restore palette */
   for(i = 0; i < PALETTE_SIZE; i++)
     palette_sync(i);
+
+  return 0;
 }
@@ -31,6 +31,6 @@
 
 /* Function prototypes */
 extern int system_save_state(void *mem);
-extern void system_load_state(void *mem);
+extern int system_load_state(void *mem);
 
 #endif /* _STATE_H_ */
@@ -3,6 +3,8 @@
 #include "../components/smsplus/shared.h"
 
 #define AUDIO_SAMPLE_RATE   (32000)
+// The PSG is mixed at this rate, rg_audio resamples
+#define AUDIO_SOURCE_RATE   (22050)
 #define AUDIO_BUFFER_LENGTH (AUDIO_SAMPLE_RATE / 50 + 1)
 
 #define SMS_WIDTH 256
@@ -75,29 +77,20 @@ static bool screenshot_handler(const char *filename, int width, int height)
 	return rg_display_save_frame(filename, currentUpdate, width, height);
 }
 
-static bool save_state_handler(const char *filename)
+static bool save_state_handler(FILE *fp)
 {
-    FILE* f = fopen(filename, "w");
-    if (f)
-    {
-        system_save_state(f);
-        fclose(f);
-        return true;
-    }
-    return false;
+    system_save_state(fp);
+    return !ferror(fp);
 }
 
-static bool load_state_handler(const char *filename)
+static bool load_state_handler(FILE *fp)
 {
-    FILE* f = fopen(filename, "r");
-    if (f)
+    if (system_load_state(fp) != 0)
     {
-        system_load_state(f);
-        fclose(f);
-        return true;
+        system_reset();
+        return false;
     }
-    system_reset();
-    return false;
+    return true;
 }
 
 static bool reset_handler(bool hard)
@@ -146,7 +139,7 @@ void app_main(void)
     bitmap.pitch = bitmap.width;
     bitmap.data = currentUpdate->buffer;
 
-    option.sndrate = AUDIO_SAMPLE_RATE;
+    option.sndrate = AUDIO_SOURCE_RATE;
     option.overscan = 0;
     option.extra_gg = 0;
 
@@ -155,6 +148,9 @@ void app_main(void)
 
     app->refreshRate = (sms.display == DISPLAY_NTSC) ? 60 : 50;
 
+    // sound_init rounds the rate up to whole samples per frame
+    rg_audio_set_source_rate(snd.sample_rate);
+
     frames[0].width  = frames[1].width  = bitmap.viewport.w;
     frames[0].height = frames[1].height = bitmap.viewport.h;
     frames[0].stride  = frames[1].stride  = bitmap.pitch;
@@ -168,6 +164,7 @@ void app_main(void)
 
     long frameTime = get_frame_time(app->refreshRate);
     long skipFrames = 0;
+    bool colecoReset = false;
 
     while (true)
     {
@@ -181,7 +178,7 @@ void app_main(void)
         }
 
         int64_t startTime = get_elapsed_time();
-        bool drawFrame = !skipFrames;
+        bool drawFrame = rg_display_should_render(!skipFrames);
         bool fullFrame = true;
 
         input.pad[0] = 0x00;
@@ -238,10 +235,17 @@ void app_main(void)
             coleco.keypad[0] = 0xff;
             coleco.keypad[1] = 0xff;
 
+            // SELECT resets once released. A SELECT that went away while still down was masked
+            // by the rewind hotkey, it isn't a reset.
             if (joystick & GAMEPAD_KEY_SELECT)
             {
-                rg_input_wait_for_key(GAMEPAD_KEY_SELECT, false);
-                system_reset();
+                colecoReset = true;
+            }
+            else if (colecoReset)
+            {
+                colecoReset = false;
+                if (!(rg_input_read_gamepad_raw() & GAMEPAD_KEY_SELECT))
+                    system_reset();
             }
 
             // 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, *, #
@@ -337,5 +341,7 @@ void app_main(void)
             }
             rg_audio_submit(audioBuffer, length);
         }
+
+        rg_system_frame_sync();
     }
 }
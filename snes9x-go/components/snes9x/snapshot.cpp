@@ -559,21 +559,24 @@ static void FreezeStruct (FILE *, const char *, void *, const FreezeData *, int)
 static bool CheckBlockName(FILE *, const char *, int *);
 static void SkipBlockWithName(FILE *, const char *);
 
+// Quiet saves happen every few frames, clearing the tile cache each time would be too slow
+static uint8 *QuietSoundSnapshot = NULL;
+
 // QuickSave
 
-int S9xFreezeGame (const char *filename)
+int S9xFreezeGame (FILE *stream, bool8 quiet)
 {
-	FILE *stream = fopen(filename, "wb");
-
-	if (!stream)
-	{
-		return (FILE_NOT_FOUND);
-	}
+	if (quiet && !QuietSoundSnapshot)
+		QuietSoundSnapshot = (uint8 *)malloc(SPC_SAVE_STATE_BLOCK_SIZE);
 
 	// We don't have enough RAM to fit the sound snapshot at the moment
 	// So we're naughty and used the tile cache data which is about 256K.
-	uint8 *soundsnapshot = (uint8 *)IPPU.TileCacheData; // new uint8[SPC_SAVE_STATE_BLOCK_SIZE];
-	memset(IPPU.TileCache, 0, sizeof(IPPU.TileCache));
+	uint8 *soundsnapshot = quiet ? QuietSoundSnapshot : NULL;
+	if (!soundsnapshot)
+	{
+		soundsnapshot = (uint8 *)IPPU.TileCacheData; // new uint8[SPC_SAVE_STATE_BLOCK_SIZE];
+		memset(IPPU.TileCache, 0, sizeof(IPPU.TileCache));
+	}
 
 	sprintf(String, "%s:%04d\n", SNAPSHOT_MAGIC, SNAPSHOT_VERSION);
 	fwrite(String, strlen(String), 1, stream);
@@ -611,27 +614,22 @@ int S9xFreezeGame (const char *filename)
 	if (Settings.DSP == 2)
 		FreezeStruct(stream, "DP2", &DSP2, SnapDSP2, COUNT(SnapDSP2));
 
-	fclose(stream);
+	if (ferror(stream))
+		return (FILE_NOT_FOUND);
 
-	sprintf(String, SAVE_INFO_SNAPSHOT " %s", S9xBasename(filename));
-	S9xMessage(S9X_INFO, S9X_FREEZE_FILE_INFO, String);
+	if (!quiet)
+	{
+		sprintf(String, SAVE_INFO_SNAPSHOT " %s", Memory.ROMName);
+		S9xMessage(S9X_INFO, S9X_FREEZE_FILE_INFO, String);
+	}
 
 	return (SUCCESS);
 }
 
 // QuickLoad
 
-int S9xUnfreezeGame (const char *filename)
+int S9xUnfreezeGame (FILE *stream, bool8 quiet)
 {
-	FILE *stream = fopen(filename, "rb");
-
-	if (!stream)
-	{
-		sprintf(String, SAVE_ERR_SAVE_NOT_FOUND, S9xBasename(filename));
-		S9xMessage(S9X_INFO, S9X_FREEZE_FILE_INFO, String);
-		return (FILE_NOT_FOUND);
-	}
-
 	int		result = SUCCESS;
 	int		version, len;
 	char	buffer[PATH_MAX + 1];
@@ -739,8 +737,6 @@ int S9xUnfreezeGame (const char *filename)
 		S9xGraphicsScreenResize();
 	}
 
-	fclose(stream);
-
 	if (result != SUCCESS)
 	{
 		switch (result)
@@ -755,7 +751,7 @@ int S9xUnfreezeGame (const char *filename)
 
 			case FILE_NOT_FOUND:
 			default:
-				sprintf(String, SAVE_ERR_ROM_NOT_FOUND, S9xBasename(filename));
+				sprintf(String, SAVE_ERR_ROM_NOT_FOUND, Memory.ROMName);
 				S9xMessage(S9X_ERROR, S9X_ROM_NOT_FOUND, String);
 				break;
 		}
@@ -763,8 +759,11 @@ int S9xUnfreezeGame (const char *filename)
 		return (FALSE);
 	}
 
-	sprintf(String, SAVE_INFO_LOAD " %s", S9xBasename(filename));
-	S9xMessage(S9X_INFO, S9X_FREEZE_FILE_INFO, String);
+	if (!quiet)
+	{
+		sprintf(String, SAVE_INFO_LOAD " %s", Memory.ROMName);
+		S9xMessage(S9X_INFO, S9X_FREEZE_FILE_INFO, String);
+	}
 
 	return (SUCCESS);
 }
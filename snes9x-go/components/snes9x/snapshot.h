@@ -17,7 +17,8 @@ enum
 	FILE_NOT_FOUND = -3,
 };
 
-int S9xFreezeGame (const char *);
-int S9xUnfreezeGame (const char *);
+// quiet is for rewind and in-memory snapshots: no message, and the tile cache is left alone
+int S9xFreezeGame (FILE *, bool8 quiet);
+int S9xUnfreezeGame (FILE *, bool8 quiet);
 
 #endif
@@ -153,25 +153,37 @@ static bool screenshot_handler(const char *filename, int width, int height)
 	return rg_display_save_frame(filename, currentUpdate, width, height);
 }
 
-static bool save_state_handler(const char *filename)
+static bool save_state_handler(FILE *fp)
 {
-	return S9xFreezeGame(filename) == SUCCESS;
+	return S9xFreezeGame(fp, FALSE) == SUCCESS;
 }
 
-static bool load_state_handler(const char *filename)
+static bool load_state_handler(FILE *fp)
 {
-	bool ret = false;
-
-	if (access(filename, F_OK) == 0)
+	if (S9xUnfreezeGame(fp, FALSE) != SUCCESS)
 	{
-		ret = S9xUnfreezeGame(filename) == SUCCESS;
+		S9xReset();
+		return false;
 	}
-	else
+
+	return true;
+}
+
+// Rewind and snapshots, without the on-screen message and the tile cache flush of a save
+static bool save_snapshot_handler(FILE *fp)
+{
+	return S9xFreezeGame(fp, TRUE) == SUCCESS;
+}
+
+static bool load_snapshot_handler(FILE *fp)
+{
+	if (S9xUnfreezeGame(fp, TRUE) != SUCCESS)
 	{
 		S9xReset();
+		return false;
 	}
 
-	return ret;
+	return true;
 }
 
 static bool reset_handler(bool hard)
@@ -274,7 +286,7 @@ static void snes9x_task(void *arg)
 
 		rg_system_tick(elapsed);
 
-		IPPU.RenderThisFrame = (((++frames_counter) & 3) == 3);
+		IPPU.RenderThisFrame = rg_display_should_render(((++frames_counter) & 3) == 3);
 		GFX.Screen = (uint16*)currentUpdate->buffer;
 	}
 
@@ -289,6 +301,8 @@ extern "C" void app_main(void)
 		.reset = &reset_handler,
 		.netplay = NULL,
 		.screenshot = &screenshot_handler,
+		.loadSnapshot = &load_snapshot_handler,
+		.saveSnapshot = &save_snapshot_handler,
 	};
 
 	app = rg_system_init(AUDIO_SAMPLE_RATE, &handlers);
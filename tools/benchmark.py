@@ -0,0 +1,200 @@
+#!/usr/bin/env python
+# Runs the benchmark suite on the host build (see components/retro-go/README.md) and collects
+# the results as JSON and CSV. Every test runs from a fresh sd folder with the same input, so
+# two runs of the same commit on the same machine should only differ by timing noise.
+import argparse
+import subprocess
+import tempfile
+import hashlib
+import json
+import csv
+import sys
+import os
+
+PRJ_PATH = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+HOST_PATH = os.path.join(PRJ_PATH, "components", "retro-go", "host")
+SUITE_PATH = os.path.join(PRJ_PATH, "tools", "benchmark")
+
+sys.path.insert(0, SUITE_PATH)
+import make_roms
+
+CSV_COLUMNS = [
+    "commit", "name", "app", "render", "frames", "fps", "frame_us", "cpu_us", "video_us", "audio_us",
+    "busy_us", "skipped_frames", "heap_peak", "rss_peak_kb", "spi_bytes", "panel_crc", "snapshot_bytes",
+    "snapshot_us", "restore_us", "rewind_kb", "rewind_state_bytes", "rewind_delta_bytes", "rewind_capture_us",
+    "rewind_capture_max_us", "rom_sha1",
+]
+
+
+def shell_exec(cmd):
+    return subprocess.check_output(cmd, shell=True, cwd=PRJ_PATH).decode().rstrip()
+
+def sha1_file(filepath):
+    with open(filepath, "rb") as f: return hashlib.sha1(f.read()).hexdigest()
+
+
+def build_host(build_dir, apps):
+    subprocess.run(["cmake", "-S", HOST_PATH, "-B", build_dir, "-DCMAKE_BUILD_TYPE=Release",
+                    "-DRG_HOST_CXX_APPS=ON"], check=True)
+    subprocess.run(["cmake", "--build", build_dir, "-j", str(os.cpu_count() or 1), "--target"] + apps, check=True)
+
+
+def run_test(test, render, args, suite, rewind=0):
+    rom = os.path.join(args.roms, test["rom"])
+    if not os.path.exists(rom):
+        print("  failed, '%s' not found" % rom)
+        return None
+
+    if test.get("sha1") and sha1_file(rom) != test["sha1"]:
+        print("  failed, '%s' isn't the ROM the suite was written for" % rom)
+        return None
+
+    with tempfile.TemporaryDirectory(prefix="rg-bench-") as root:
+        report = os.path.join(root, "report.json")
+        cmd = [
+            os.path.join(args.build_dir, test["app"]),
+            "--rom", rom,
+            "--root", root,
+            "--render", render,
+            "--frames", str(args.frames or test.get("frames", suite["frames"])),
+            "--warmup", str(test.get("warmup", suite["warmup"])),
+            "--report", report,
+            "--snapshots", str(test.get("snapshots", suite.get("snapshots", 0))),
+            "--rewind", str(rewind),
+        ]
+        if test.get("input"):
+            cmd += ["--input", os.path.join(SUITE_PATH, test["input"])]
+
+        proc = subprocess.run(cmd, stdout=subprocess.PIPE, stderr=subprocess.STDOUT)
+        if proc.returncode != 0 or not os.path.exists(report):
+            print("  failed (exit code %d):\n%s" % (proc.returncode, proc.stdout.decode(errors="ignore")[-2000:]))
+            return None
+
+        with open(report) as f:
+            result = json.load(f)
+
+    result["name"] = test["name"]
+    result["rom_sha1"] = sha1_file(rom)
+    if rewind:
+        result["render"] = "rewind"
+    return result
+
+
+def compare(results, baseline_file, threshold):
+    with open(baseline_file) as f:
+        baseline = {(r["name"], r["render"]): r for r in json.load(f)["results"]}
+
+    regressions = 0
+    for result in results:
+        base = baseline.get((result["name"], result["render"]))
+        if not base:
+            continue
+        if base["rom_sha1"] != result["rom_sha1"]:
+            print("%-24s %-5s different ROM, not compared" % (result["name"], result["render"]))
+            continue
+        change = (result["frame_us"] - base["frame_us"]) / base["frame_us"] * 100
+        status = ""
+        if change > threshold:
+            status = "REGRESSION"
+            regressions += 1
+        if base["panel_crc"] != result["panel_crc"] and result["render"] == "all":
+            status += " OUTPUT CHANGED"
+        print("%-24s %-5s %9.1fus -> %9.1fus %+6.1f%% %s" % (result["name"], result["render"],
+              base["frame_us"], result["frame_us"], change, status))
+    return regressions
+
+
+parser = argparse.ArgumentParser(description="Retro-Go benchmark runner")
+parser.add_argument(
+    "--roms", default=os.path.join(PRJ_PATH, "roms"), help="Directory holding the suite's ROMs"
+)
+parser.add_argument(
+    "--suite", default=os.path.join(SUITE_PATH, "suite.json"), help="Suite definition"
+)
+parser.add_argument(
+    "--build-dir", default=os.path.join(PRJ_PATH, "build-host"), help="Host build directory"
+)
+parser.add_argument(
+    "--no-build", action="store_const", const=True, help="Use the existing host build as is"
+)
+parser.add_argument(
+    "--render", default="all,none", help="Rendering modes to run each test with (auto, all, none)"
+)
+parser.add_argument(
+    "--frames", type=int, default=0, help="Override the number of measured frames"
+)
+parser.add_argument(
+    "--rewind", type=int, default=None, help="Rewind buffer (in KB) of the extra rewind run, 0 to skip it"
+)
+parser.add_argument(
+    "--only", default=None, help="Only run the tests whose name contains this"
+)
+parser.add_argument(
+    "--output", default="benchmark.json", help="JSON results"
+)
+parser.add_argument(
+    "--csv", default=None, help="Also write the results as CSV"
+)
+parser.add_argument(
+    "--compare", default=None, help="Previous JSON results to compare frame times with"
+)
+parser.add_argument(
+    "--threshold", type=float, default=5.0, help="Slowdown (in %%) reported as a regression"
+)
+args = parser.parse_args()
+
+with open(args.suite) as f:
+    suite = json.load(f)
+
+tests = [t for t in suite["tests"] if not args.only or args.only in t["name"]]
+commit = shell_exec("git describe --tags --abbrev=5 --dirty --always")
+
+if not args.no_build:
+    build_host(args.build_dir, sorted(set(t["app"] for t in tests)))
+
+# The suite's ROMs come from make_roms.py, a stale one fails its sha1 check rather than being replaced
+make_roms.write_roms(args.roms, only_missing=True)
+
+rewind = suite.get("rewind", 0) if args.rewind is None else args.rewind
+runs = [(render, 0) for render in args.render.split(",")]
+if rewind > 0:
+    # Rewind captures add to the frame time, they get their own run (reported as render=rewind)
+    runs.append(("auto", rewind))
+
+results = []
+for test in tests:
+    for render, rewind_kb in runs:
+        print("%s (%s, render=%s%s)" % (test["name"], test["app"], render,
+              ", rewind=%dKB" % rewind_kb if rewind_kb else ""))
+        result = run_test(test, render, args, suite, rewind_kb)
+        if result:
+            result["commit"] = commit
+            results.append(result)
+            print("  %.1f fps, %.1fus/frame (cpu %.1f, video %.1f, audio %.1f), heap %dKB" % (
+                result["fps"], result["frame_us"], result["cpu_us"], result["video_us"],
+                result["audio_us"], result["heap_peak"] / 1024))
+            if rewind_kb:
+                print("  rewind: %d bytes state, %.1f bytes/capture, capture %.1fus (max %dus)" % (
+                    result["rewind_state_bytes"], result["rewind_delta_bytes"],
+                    result["rewind_capture_us"], result["rewind_capture_max_us"]))
+            else:
+                print("  snapshot: %d bytes, take %.1fus, restore %.1fus" % (
+                    result["snapshot_bytes"], result["snapshot_us"], result["restore_us"]))
+
+with open(args.output, "w") as f:
+    json.dump({"commit": commit, "suite": os.path.basename(args.suite), "results": results}, f, indent=2)
+
+if args.csv:
+    with open(args.csv, "w", newline="") as f:
+        writer = csv.DictWriter(f, fieldnames=CSV_COLUMNS, extrasaction="ignore")
+        writer.writeheader()
+        writer.writerows(results)
+
+regressions = compare(results, args.compare, args.threshold) if args.compare else 0
+
+if len(results) < len(tests) * len(runs):
+    print("Some tests didn't run!")
+    sys.exit(1)
+
+if regressions > 0:
+    sys.exit(1)
@@ -0,0 +1,470 @@
+#!/usr/bin/env python
+# Builds the benchmark suite's ROMs. They're tiny homebrew programs that fill the screen with
+# tiles, scroll it by a pixel every frame (backwards while A is held) and sweep the pitch of a
+# square wave, so the scaler, the display diff and the audio path get the same work on every run.
+# They're generated rather than downloaded so that the sha1 pinned in suite.json can be checked by
+# anyone, offline.
+import hashlib
+import sys
+import os
+
+PRJ_ROMS_PATH = os.path.join(os.path.dirname(os.path.dirname(os.path.dirname(os.path.abspath(__file__)))), "roms")
+ROMS = {}
+
+
+def rom(path):
+    def register(func):
+        ROMS[path] = func
+        return func
+    return register
+
+
+def w(value):
+    return (value & 0xFF, (value >> 8) & 0xFF)
+
+
+class Asm:
+    """Just enough of an assembler for the programs below: bytes, labels, 16bit addresses and
+    8bit relative branches (all four CPUs are little endian)."""
+
+    def __init__(self, origin):
+        self.origin = origin
+        self.code = bytearray()
+        self.labels = {}
+        self.fixups = []
+
+    def __call__(self, *data):
+        for value in data:
+            if isinstance(value, str):
+                self.fixups.append((len(self.code), value, 2))
+                self.code += b"\0\0"
+            else:
+                self.code.append(value & 0xFF)
+
+    def label(self, name):
+        self.labels[name] = self.origin + len(self.code)
+
+    def branch(self, opcode, name):
+        self.code.append(opcode)
+        self.fixups.append((len(self.code), name, 1))
+        self.code.append(0)
+
+    def build(self):
+        for pos, name, size in self.fixups:
+            target = self.labels[name]
+            if size == 1:
+                offset = target - (self.origin + pos + 1)
+                assert -128 <= offset < 128, "branch to '%s' is too far" % name
+                self.code[pos] = offset & 0xFF
+            else:
+                self.code[pos:pos + 2] = bytes(w(target))
+        return bytes(self.code)
+
+
+def place(image, offset, code):
+    assert len(set(image[offset:offset + len(code)])) == 1, "code overlaps at 0x%X" % offset
+    image[offset:offset + len(code)] = code
+
+
+@rom("gb/scroll.gb")
+def make_gb():
+    a = Asm(0x150)
+    a(0xF3)                                 # di
+    a(0x31, *w(0xFFFE))                     # ld sp,$FFFE
+    a.label("vblank")                       # The LCD can only be turned off in vblank
+    a(0xF0, 0x44, 0xFE, 144)                # ldh a,(LY); cp 144
+    a.branch(0x20, "vblank")                # jr nz
+    a(0xAF, 0xE0, 0x40)                     # xor a; ldh (LCDC),a
+    a(0x21, *w(0x8000))                     # ld hl,$8000
+    a.label("fill")                         # Tiles and both maps get L^H
+    a(0x7D, 0xAC, 0x22)                     # ld a,l; xor h; ld (hl+),a
+    a(0x7C, 0xFE, 0xA0)                     # ld a,h; cp $A0
+    a.branch(0x20, "fill")                  # jr nz
+    a(0x3E, 0xE4, 0xE0, 0x47)               # BGP = $E4
+    a(0x3E, 0x80, 0xE0, 0x26)               # NR52: sound on
+    a(0x3E, 0x77, 0xE0, 0x24)               # NR50: full volume
+    a(0x3E, 0x11, 0xE0, 0x25)               # NR51: channel 1 on both sides
+    a(0x3E, 0x80, 0xE0, 0x11)               # NR11: 50% duty
+    a(0x3E, 0xF0, 0xE0, 0x12)               # NR12: volume 15, no envelope
+    a(0x3E, 0x86, 0xE0, 0x14)               # NR14: trigger
+    a(0x3E, 0x91, 0xE0, 0x40)               # LCDC: on, BG on, tiles at $8000
+    a.label("frame")
+    a(0xF0, 0x44, 0xFE, 144)                # ldh a,(LY); cp 144
+    a.branch(0x20, "frame")                 # jr nz
+    a(0x3E, 0x10, 0xE0, 0x00)               # P1: select the buttons
+    a(0xF0, 0x00, 0xE6, 0x01)               # ldh a,(P1); and 1: 0 while A is down
+    a(0x87, 0x3D, 0x47)                     # add a,a; dec a; ld b,a: +1 or -1
+    a(0xF0, 0x43, 0x80, 0xE0, 0x43)         # SCX += B
+    a(0xF0, 0x42, 0x90, 0xE0, 0x42)         # SCY -= B
+    a(0xE0, 0x13)                           # NR13 = SCY
+    a.label("wait")
+    a(0xF0, 0x44, 0xFE, 144)                # ldh a,(LY); cp 144
+    a.branch(0x28, "wait")                  # jr z
+    a.branch(0x18, "frame")                 # jr
+
+    image = bytearray(0x8000)
+    place(image, 0x100, bytes([0x00, 0xC3, *w(0x150)]))  # nop; jp $150
+    place(image, 0x104, bytes.fromhex(
+        "CEED6666CC0D000B03730083000C000D0008111F8889000E"
+        "DCCC6EE6DDDDD999BBBB67636E0EECCCDDDC999FBBB9333E"))
+    place(image, 0x134, b"RG BENCH")
+    place(image, 0x150, a.build())
+    image[0x14A] = 0x01  # Not Japanese
+    image[0x14D] = -sum(image[0x134:0x14D]) - 0x19 & 0xFF
+    image[0x14E:0x150] = (sum(image) & 0xFFFF).to_bytes(2, "big")
+    return image
+
+
+@rom("nes/scroll.nes")
+def make_nes():
+    a = Asm(0xC000)
+    a.label("reset")
+    a(0x78, 0xD8, 0xA2, 0xFF, 0x9A)         # sei; cld; ldx #$FF; txs
+    a(0xA9, 0x00, 0x8D, *w(0x2000))         # PPUCTRL = 0
+    a(0x8D, *w(0x2001))                     # PPUMASK = 0
+    for n in range(2):                      # The PPU needs two frames to warm up
+        a.label("warmup%d" % n)
+        a(0x2C, *w(0x2002))                 # bit PPUSTATUS
+        a.branch(0x10, "warmup%d" % n)      # bpl
+    a(0xA9, 0x3F, 0x8D, *w(0x2006))         # PPUADDR = $3F00
+    a(0xA9, 0x00, 0x8D, *w(0x2006))
+    a(0xA2, 0x00)                           # ldx #0
+    a.label("palette")
+    a(0x8A, 0x8D, *w(0x2007))               # txa; sta PPUDATA
+    a(0xE8, 0xE0, 32)                       # inx; cpx #32
+    a.branch(0xD0, "palette")               # bne
+    a(0xA9, 0x20, 0x8D, *w(0x2006))         # PPUADDR = $2000
+    a(0xA9, 0x00, 0x8D, *w(0x2006))
+    a(0xA9, 0x08, 0x85, 0x01)               # Both nametables and their attributes get X^page
+    a(0xA2, 0x00)                           # ldx #0
+    a.label("nametables")
+    a(0x8A, 0x45, 0x01, 0x8D, *w(0x2007))   # txa; eor $01; sta PPUDATA
+    a(0xE8)                                 # inx
+    a.branch(0xD0, "nametables")            # bne
+    a(0xC6, 0x01)                           # dec $01
+    a.branch(0xD0, "nametables")            # bne
+    a(0xA9, 0x01, 0x8D, *w(0x4015))         # APU: pulse 1 on
+    a(0xA9, 0xBF, 0x8D, *w(0x4000))         # 50% duty, constant volume 15
+    a(0xA9, 0x08, 0x8D, *w(0x4001))         # No sweep
+    a(0xA9, 0x00, 0x8D, *w(0x4002))
+    a(0xA9, 0x01, 0x8D, *w(0x4003))         # Period $100
+    a(0xA9, 0x80, 0x8D, *w(0x2000))         # PPUCTRL: NMI on
+    a(0xA9, 0x0A, 0x8D, *w(0x2001))         # PPUMASK: background on
+    a.label("main")
+    a(0x4C, "main")                         # jmp main
+    a.label("nmi")
+    a(0x48, 0xAD, *w(0x2002))               # pha; lda PPUSTATUS
+    a(0xA9, 0x01, 0x8D, *w(0x4016))         # Latch the pad, A comes first
+    a(0xA9, 0x00, 0x8D, *w(0x4016))
+    a(0xAD, *w(0x4016), 0x29, 0x01)         # lda JOY1; and #1
+    a.branch(0xD0, "backwards")             # bne
+    a(0xE6, 0x00, 0xE6, 0x00)               # inc $00; inc $00
+    a.label("backwards")
+    a(0xC6, 0x00, 0xA5, 0x00)               # dec $00; lda $00
+    a(0x8D, *w(0x2005))                     # X scroll
+    a(0x4A, 0x8D, *w(0x2005))               # lsr; Y scroll
+    a(0xA5, 0x00, 0x8D, *w(0x4002))         # Pitch
+    a(0x68)                                 # pla
+    a.label("irq")
+    a(0x40)                                 # rti
+
+    prg = bytearray(0x4000)
+    code = a.build()
+    place(prg, 0, code)
+    place(prg, 0x3FFA, bytes([*w(a.labels["nmi"]), *w(a.labels["reset"]), *w(a.labels["irq"])]))
+    chr = bytes((i * 37 ^ i >> 4) & 0xFF for i in range(0x2000))
+    header = b"NES\x1A" + bytes([1, 1, 0x01]) + bytes(9)  # 16K PRG, 8K CHR, vertical mirroring
+    return header + prg + chr
+
+
+@rom("sms/scroll.sms")
+def make_sms():
+    boot = Asm(0x0000)
+    boot(0xF3, 0xED, 0x56)                  # di; im 1
+    boot(0x31, *w(0xDFF0))                  # ld sp,$DFF0
+    boot(0xC3, *w(0x0080))                  # jp $0080
+
+    nmi = Asm(0x0066)
+    nmi(0xED, 0x45)                         # retn
+
+    a = Asm(0x0080)
+    a(0x21, "registers")                    # ld hl,registers
+    a(0x06, 22, 0x0E, 0xBF, 0xED, 0xB3)     # ld b,22; ld c,$BF; otir
+    a(0xAF, 0xD3, 0xBF, 0x3E, 0x40, 0xD3, 0xBF) # VRAM address 0
+    a(0x21, *w(0x0000), 0x11, *w(0x0001))   # ld hl,0; ld de,1
+    a.label("vram")                         # Tiles, name table and sprites come from a 16bit LFSR
+    a(0xCB, 0x3A, 0xCB, 0x1B)               # srl d; rr e
+    a.branch(0x30, "vram_out")              # jr nc
+    a(0x7A, 0xEE, 0xB4, 0x57)               # ld a,d; xor $B4; ld d,a
+    a.label("vram_out")
+    a(0x7B, 0xD3, 0xBE)                     # ld a,e; out ($BE),a
+    a(0x23, 0x7C, 0xFE, 0x40)               # inc hl; ld a,h; cp $40
+    a.branch(0x20, "vram")                  # jr nz
+    a(0xAF, 0xD3, 0xBF, 0x3E, 0xC0, 0xD3, 0xBF) # CRAM address 0
+    a(0x06, 32)                             # ld b,32
+    a.label("cram")
+    a(0x78, 0xD3, 0xBE)                     # ld a,b; out ($BE),a
+    a.branch(0x10, "cram")                  # djnz
+    a(0x3E, 0x8F, 0xD3, 0x7F)               # Tone 0
+    a(0x3E, 0x10, 0xD3, 0x7F)
+    a(0x3E, 0x90, 0xD3, 0x7F)               # Volume 0 (loudest)
+    a(0x3E, 0xE0, 0xD3, 0xBF, 0x3E, 0x81, 0xD3, 0xBF) # R1: display and frame interrupt on
+    a(0xFB)                                 # ei
+    a.label("main")
+    a(0x76)                                 # halt
+    a.branch(0x18, "main")                  # jr
+    a.label("frame")
+    a(0xF5, 0xDB, 0xBF)                     # push af; in a,($BF) to acknowledge
+    a(0xDB, 0xDC, 0xE6, 0x20)               # in a,($DC); and $20: 0 while button 2 is down
+    a(0x3A, *w(0xC000))                     # ld a,($C000)
+    a.branch(0x28, "backwards")             # jr z
+    a(0x3C, 0x3C)                           # inc a; inc a
+    a.label("backwards")
+    a(0x3D, 0x32, *w(0xC000))               # dec a; ld ($C000),a
+    a(0xD3, 0xBF, 0x3E, 0x88, 0xD3, 0xBF)   # R8 = horizontal scroll
+    a(0x3A, *w(0xC000), 0xE6, 0x7F)         # ld a,($C000); and $7F
+    a(0xD3, 0xBF, 0x3E, 0x89, 0xD3, 0xBF)   # R9 = vertical scroll
+    a(0x3A, *w(0xC000), 0xE6, 0x0F)         # ld a,($C000); and $0F
+    a(0xF6, 0x80, 0xD3, 0x7F)               # or $80; out ($7F),a: pitch
+    a(0xF1, 0xFB, 0xC9)                     # pop af; ei; ret
+    a.label("registers")                    # Mode 4, name table at $3800, sprites at $3F00
+    for reg, value in enumerate([0x04, 0x80, 0xFF, 0xFF, 0xFF, 0xFF, 0xFB, 0x00, 0x00, 0x00, 0xFF]):
+        a(value, 0x80 | reg)
+
+    image = bytearray(0x8000)
+    place(image, 0x0000, boot.build())
+    place(image, 0x0038, bytes([0xC3, *w(a.labels["frame"])]))  # jp frame
+    place(image, 0x0066, nmi.build())
+    place(image, 0x0080, a.build())
+    place(image, 0x7FF0, b"TMR SEGA")
+    image[0x7FFA:0x7FFC] = w(sum(image[:0x7FF0]))
+    image[0x7FFF] = 0x4C  # SMS export, 32K
+    return image
+
+
+@rom("pce/scroll.pce")
+def make_pce():
+    a = Asm(0xE000)
+    a.label("reset")
+    a(0x78, 0xD4, 0xD8)                     # sei; csh; cld
+    a(0xA2, 0xFF, 0x9A)                     # ldx #$FF; txs
+    a(0xA9, 0xFF, 0x53, 0x01)               # MPR0 = I/O
+    a(0xA9, 0xF8, 0x53, 0x02)               # MPR1 = RAM, zero page at $2000
+    a(0xA9, 0x07, 0x8D, *w(0x1402))         # Interrupts off
+    for reg, value in [(0x05, 0x0000), (0x09, 0x0000), (0x0A, 0x0202), (0x0B, 0x031F),
+                       (0x0C, 0x0F02), (0x0D, 0x00EF), (0x0E, 0x0003), (0x07, 0), (0x08, 0)]:
+        a(0x03, reg, 0x13, value & 0xFF, 0x23, value >> 8) # st0, st1, st2: 256x240, 32x32 BAT
+    a(0x9C, *w(0x0400))                     # VCE: 5MHz dot clock
+    a(0x9C, *w(0x0402), 0x9C, *w(0x0403))   # Palette address 0
+    a(0xA0, 0x02, 0xA2, 0x00)               # ldy #2; ldx #0
+    a.label("palette")
+    a(0x8E, *w(0x0404), 0x8C, *w(0x0405))   # stx VCE data low; sty high
+    a(0xE8)                                 # inx
+    a.branch(0xD0, "palette")               # bne
+    a(0x88)                                 # dey
+    a.branch(0xD0, "palette")               # bne
+    a(0x03, 0x00, 0x13, 0x00, 0x23, 0x00)   # MAWR = 0
+    a(0x03, 0x02)                           # VRAM data
+    a(0xA0, 0x80, 0xA2, 0x00)               # ldy #$80; ldx #0
+    a.label("vram")                         # Every word gets (X^Y, X)
+    a(0x84, 0x00)                           # sty $00
+    a.label("vram_page")
+    a(0x8A, 0x45, 0x00, 0x8D, *w(0x0002))   # txa; eor $00; sta VDC data low
+    a(0x8E, *w(0x0003))                     # stx VDC data high
+    a(0xE8)                                 # inx
+    a.branch(0xD0, "vram_page")             # bne
+    a(0x88)                                 # dey
+    a.branch(0xD0, "vram")                  # bne
+    a(0x03, 0x00, 0x13, 0x00, 0x23, 0x00)   # MAWR = 0
+    a(0x03, 0x02)                           # BAT: tiles $100-$1FF, palette from the tile number
+    a(0xA0, 0x04, 0xA2, 0x00)               # ldy #4; ldx #0
+    a.label("bat")
+    a(0x8E, *w(0x0002))                     # stx VDC data low
+    a(0x8A, 0x29, 0xF0, 0x09, 0x01)         # txa; and #$F0; ora #$01
+    a(0x8D, *w(0x0003), 0xE8)               # sta VDC data high; inx
+    a.branch(0xD0, "bat")                   # bne
+    a(0x88)                                 # dey
+    a.branch(0xD0, "bat")                   # bne
+    a(0x03, 0x05, 0x13, 0x88, 0x23, 0x00)   # CR: background and vblank interrupt on
+    a(0x9C, *w(0x0800))                     # PSG channel 0
+    a(0xA9, 0xFF, 0x8D, *w(0x0801))         # Main volume
+    a(0x9C, *w(0x0804))                     # Channel off, waveform index reset
+    a(0xA2, 0x20)                           # ldx #32
+    a.label("waveform")                     # Square wave
+    a(0x8A, 0x29, 0x10, 0x8D, *w(0x0806))   # txa; and #$10; sta waveform
+    a(0xCA)                                 # dex
+    a.branch(0xD0, "waveform")              # bne
+    a(0x9C, *w(0x0802))                     # Frequency $200
+    a(0xA9, 0x02, 0x8D, *w(0x0803))
+    a(0xA9, 0xFF, 0x8D, *w(0x0805))         # Balance
+    a(0xA9, 0x9F, 0x8D, *w(0x0804))         # Channel on, volume 31
+    a(0xA9, 0x05, 0x8D, *w(0x1402))         # Only the VDC interrupt
+    a(0x58)                                 # cli
+    a.label("main")
+    a.branch(0x80, "main")                  # bra main
+    a.label("vdc")
+    a(0x48, 0xAD, *w(0x0000))               # pha; lda VDC status to acknowledge
+    a(0xA9, 0x03, 0x8D, *w(0x1000))         # Back to the first pad
+    a(0xA9, 0x00, 0x8D, *w(0x1000))         # Its buttons
+    a(0xAD, *w(0x1000), 0x29, 0x01)         # lda joypad; and #1: 0 while I is down
+    a.branch(0xF0, "backwards")             # beq
+    a(0xE6, 0x10, 0xE6, 0x10)               # inc $10; inc $10
+    a.label("backwards")
+    a(0xC6, 0x10, 0xA5, 0x10)               # dec $10; lda $10
+    a(0x03, 0x07, 0x8D, *w(0x0002))         # BXR
+    a(0x9C, *w(0x0003))
+    a(0x03, 0x08, 0x8D, *w(0x0002))         # BYR
+    a(0x9C, *w(0x0003))
+    a(0x8D, *w(0x0802))                     # Pitch
+    a(0x68)                                 # pla
+    a.label("rti")
+    a(0x40)                                 # rti
+
+    image = bytearray(0x8000)
+    place(image, 0, a.build())
+    place(image, 0x1FF6, bytes([*w(a.labels["rti"]), *w(a.labels["vdc"]), *w(a.labels["rti"]),
+                                *w(a.labels["rti"]), *w(a.labels["reset"])]))
+    return image
+
+
+@rom("lnx/scroll.o")
+def make_lynx():
+    load = 0x0200
+    a = Asm(load)
+    a(0x78, 0xD8, 0xA2, 0xFF, 0x9A)         # sei; cld; ldx #$FF; txs
+    a(0xA2, 0x0F)                           # ldx #15
+    a.label("palette")
+    a(0x8A, 0x9D, *w(0xFDA0))               # txa; sta GREEN0,x
+    a(0x0A, 0x0A, 0x0A, 0x0A, 0x85, 0x00)   # asl x4; sta $00
+    a(0x8A, 0x49, 0x0F, 0x05, 0x00)         # txa; eor #$0F; ora $00
+    a(0x9D, *w(0xFDB0))                     # sta BLUERED0,x
+    a(0xCA)                                 # dex
+    a.branch(0x10, "palette")               # bpl
+    a(0xA9, 0x00, 0x85, 0x02)               # $02 = $2000
+    a(0xA9, 0x20, 0x85, 0x03)
+    a(0xA0, 0x00)                           # ldy #0
+    a.label("fill")                         # $2000-$BFFF get Y^page, the display moves through it
+    a(0x98, 0x45, 0x03, 0x91, 0x02)         # tya; eor $03; sta ($02),y
+    a(0xC8)                                 # iny
+    a.branch(0xD0, "fill")                  # bne
+    a(0xE6, 0x03, 0xA5, 0x03, 0xC9, 0xC0)   # inc $03; lda $03; cmp #$C0
+    a.branch(0xD0, "fill")                  # bne
+    a(0xA9, 0x00, 0x85, 0x04)               # $04 = $2000
+    a(0xA9, 0x20, 0x85, 0x05)
+    a(0xA9, 0x7F, 0x8D, *w(0xFD20))         # AUD0VOL
+    a(0xA9, 0x01, 0x8D, *w(0xFD21))         # AUD0SHFTFB
+    a(0xA9, 0x01, 0x8D, *w(0xFD23))         # AUD0L8SHFT
+    a(0xA9, 0x40, 0x8D, *w(0xFD24))         # AUD0TBACK
+    a(0xA9, 0x19, 0x8D, *w(0xFD25))         # AUD0CTL: reload, count, 2us clock
+    a(0x9C, *w(0xFD50))                     # MSTEREO: all on
+    a.label("frame")
+    a.label("vblank")                       # Timer 2 counts the lines down
+    a(0xAD, *w(0xFD0A))                     # lda TIM2CNT
+    a.branch(0xD0, "vblank")                # bne
+    a(0xAD, *w(0xFCB0), 0x29, 0x01)         # lda JOYSTICK; and #1: A
+    a.branch(0xD0, "backwards")             # bne
+    a(0x18, 0xA5, 0x04, 0x69, 80, 0x85, 0x04) # clc; $04 += 80, one line
+    a(0xA5, 0x05, 0x69, 0x00)               # lda $05; adc #0
+    a(0xC9, 0xA0)                           # cmp #$A0
+    a.branch(0x90, "display")               # bcc
+    a(0xA9, 0x20)                           # lda #$20
+    a.branch(0x80, "display")               # bra
+    a.label("backwards")
+    a(0x38, 0xA5, 0x04, 0xE9, 80, 0x85, 0x04) # sec; $04 -= 80
+    a(0xA5, 0x05, 0xE9, 0x00)               # lda $05; sbc #0
+    a(0xC9, 0x20)                           # cmp #$20
+    a.branch(0xB0, "display")               # bcs
+    a(0xA9, 0x9F)                           # lda #$9F
+    a.label("display")
+    a(0x85, 0x05, 0x8D, *w(0xFD95))         # sta $05; sta DISPADRH
+    a(0xA5, 0x04, 0x8D, *w(0xFD94))         # lda $04; sta DISPADRL
+    a(0x8D, *w(0xFD24))                     # sta AUD0TBACK: pitch
+    a.label("line")
+    a(0xAD, *w(0xFD0A))                     # lda TIM2CNT
+    a.branch(0xF0, "line")                  # beq
+    a(0x4C, "frame")                        # jmp frame
+
+    code = a.build()
+    size = 10 + len(code)
+    # The header is loaded 10 bytes before the code and starts with a branch over itself
+    return bytes([0x80, 0x08, load >> 8, load & 0xFF, size >> 8, size & 0xFF]) + b"BS93" + code
+
+
+@rom("snes/scroll.smc")
+def make_snes():
+    a = Asm(0x8000)
+    a.label("reset")
+    a(0x78, 0x18, 0xFB)                     # sei; clc; xce: native mode
+    a(0xC2, 0x10, 0xE2, 0x20)               # rep #$10; sep #$20: 16bit X/Y, 8bit A
+    a(0xA2, *w(0x1FFF), 0x9A)               # ldx #$1FFF; txs
+    a(0xA9, 0x80, 0x8D, *w(0x2100))         # INIDISP: forced blank
+    a(0x9C, *w(0x4200))                     # NMITIMEN = 0
+    a(0xA9, 0x01, 0x8D, *w(0x2105))         # BGMODE 1
+    a(0x9C, *w(0x2107))                     # BG1 map at 0, 32x32
+    a(0xA9, 0x01, 0x8D, *w(0x210B))         # BG1 tiles at $1000
+    a(0xA9, 0x80, 0x8D, *w(0x2115))         # VMAIN: increment after the high byte
+    a(0x9C, *w(0x2116), 0x9C, *w(0x2117))   # VRAM address 0
+    a(0xA2, *w(0x0000))                     # ldx #0
+    a.label("vram")                         # Every word gets (X low, X high ^ X low)
+    a(0x86, 0x00)                           # stx $00
+    a(0xA5, 0x00, 0x8D, *w(0x2118))         # lda $00; sta VMDATAL
+    a(0xA5, 0x01, 0x45, 0x00)               # lda $01; eor $00
+    a(0x8D, *w(0x2119), 0xE8)               # sta VMDATAH; inx
+    a(0xE0, *w(0x8000))                     # cpx #$8000
+    a.branch(0xD0, "vram")                  # bne
+    a(0x9C, *w(0x2121))                     # CGRAM address 0
+    a(0xA2, *w(0x0000))                     # ldx #0
+    a.label("cgram")
+    a(0x8A, 0x8D, *w(0x2122), 0xE8)         # txa; sta CGDATA; inx
+    a(0xE0, *w(0x0200))                     # cpx #$200
+    a.branch(0xD0, "cgram")                 # bne
+    a(0xA9, 0x01, 0x8D, *w(0x212C))         # TM: BG1
+    a(0xA9, 0x81, 0x8D, *w(0x4200))         # NMITIMEN: NMI and joypad
+    a(0xA9, 0x0F, 0x8D, *w(0x2100))         # INIDISP: full brightness
+    a.label("main")
+    a(0xCB)                                 # wai
+    a.branch(0x80, "main")                  # bra
+    a.label("nmi")
+    a(0x48, 0xAD, *w(0x4210))               # pha; lda RDNMI to acknowledge
+    a(0xAD, *w(0x4218), 0x29, 0x80)         # lda JOY1L; and #$80: the last frame's A
+    a.branch(0xD0, "backwards")             # bne
+    a(0xE6, 0x10, 0xE6, 0x10)               # inc $10; inc $10
+    a.label("backwards")
+    a(0xC6, 0x10, 0xA5, 0x10)               # dec $10; lda $10
+    a(0x8D, *w(0x210D), 0x9C, *w(0x210D))   # BG1HOFS
+    a(0x8D, *w(0x210E), 0x9C, *w(0x210E))   # BG1VOFS
+    a(0x68)                                 # pla
+    a.label("rti")
+    a(0x40)                                 # rti
+
+    # snes9x takes an image with mostly zeros at the start for a copier header, and reads a HiROM
+    # header past the end of anything under 64K. A 32K cart shows up twice in 64K on the bus anyway.
+    image = bytearray(b"\xFF" * 0x8000)
+    place(image, 0, a.build())
+    place(image, 0x7FC0, b"RETRO-GO BENCHMARK   ")
+    image[0x7FD5:0x7FE0] = bytes([0x20, 0x00, 0x06, 0x00, 0x01, 0x00, 0x00])  # LoROM, 64K, North America
+    image[0x7FDC:0x7FE0] = bytes([0xFF, 0xFF, 0x00, 0x00])
+    vectors = {0x7FEA: "nmi", 0x7FEE: "rti", 0x7FFC: "reset", 0x7FFE: "rti"}
+    for offset, label in vectors.items():
+        image[offset:offset + 2] = w(a.labels[label])
+    checksum = sum(image) * 2 & 0xFFFF
+    image[0x7FDC:0x7FE0] = bytes([*w(checksum ^ 0xFFFF), *w(checksum)])
+    return image * 2
+
+
+def write_roms(roms_dir, only_missing=False):
+    for path, make in ROMS.items():
+        filepath = os.path.join(roms_dir, path)
+        if only_missing and os.path.exists(filepath):
+            continue
+        os.makedirs(os.path.dirname(filepath), exist_ok=True)
+        with open(filepath, "wb") as f:
+            f.write(make())
+
+
+if __name__ == "__main__":
+    # Prints the sha1 of each ROM, the ones suite.json must have
+    roms_dir = sys.argv[1] if len(sys.argv) > 1 else PRJ_ROMS_PATH
+    write_roms(roms_dir)
+    for path, make in ROMS.items():
+        print("%s  %s" % (hashlib.sha1(make()).hexdigest(), path))